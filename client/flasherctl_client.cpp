@@ -0,0 +1,442 @@
+#include "flasherctl_client.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+// Events taken per epoll_wait
+#define FLASHERCTL_EVENTS 64
+
+static const uint64_t no_deadline = UINT64_MAX;
+
+struct flasherctl_device {
+  int fd;                    // UDP socket connected to the device
+  uint8_t sequence;          // High byte of the next request ID; never 0, so IDs never are
+
+  // Requests waiting for room in the window
+  struct flasherctl_request *head;
+  struct flasherctl_request *tail;
+
+  // Window: the request in flight in each slot and its ID, and the free slots
+  std::vector<struct flasherctl_request *> slots;
+  std::vector<uint16_t> ids;
+  std::vector<uint8_t> free_slots;
+
+  uint64_t next_deadline_ns;  // Earliest deadline in flight, or no_deadline
+};
+
+struct flasherctl_client {
+  int epfd;
+  uint8_t window;
+  uint32_t timeout_us;
+  uint8_t max_retries;
+
+  std::vector<struct flasherctl_device> devices;
+  uint32_t outstanding;
+  uint64_t next_deadline_ns;  // Earliest over all devices, or no_deadline
+
+  struct flasherctl_client_stats stats;
+};
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+uint16_t flasherctl_pack(uint8_t *buf, uint16_t buf_size, uint16_t id,
+                         uint8_t subsystem_id, uint16_t code,
+                         const void *payload, uint16_t size)
+{
+  if (size > iostack_max_payload_size || iostack_header_size + size > buf_size)
+    return 0;
+
+  struct iostack_header header = {.id = id, .subsystem_id = subsystem_id, .code = code};
+  memcpy(buf, &header, sizeof(header));
+  if (size)
+    memcpy(buf + sizeof(header), payload, size);
+
+  return sizeof(header) + size;
+}
+
+
+const uint8_t *flasherctl_unpack(const uint8_t *buf, uint16_t buf_size,
+                                 struct iostack_header *header, uint16_t *size)
+{
+  if (buf_size < iostack_header_size || buf_size > FLASHERCTL_MAX_DATAGRAM)
+    return NULL;
+
+  memcpy(header, buf, sizeof(*header));
+  *size = buf_size - sizeof(*header);
+  return buf + sizeof(*header);
+}
+
+
+/* The iostack reports errors with IOSTACK_REPORT_ERR, the other subsystems
+   with SUBSYSTEM_REPORT_ERR; both carry a uint16_t */
+uint8_t flasherctl_response_error(const struct flasherctl_request *request,
+                                  uint16_t *error)
+{
+  if (request->status != FLASHERCTL_OK)
+    return 0;
+  if (request->response.code != SUBSYSTEM_REPORT_ERR &&
+      !(request->response.subsystem_id == SYS_IOSTACK &&
+        request->response.code == IOSTACK_REPORT_ERR))
+    return 0;
+
+  *error = 0;
+  if (request->response_size == sizeof(*error))
+    memcpy(error, request->response_payload, sizeof(*error));
+  return 1;
+}
+
+
+struct flasherctl_client *flasherctl_client_create(uint8_t window, uint32_t timeout_us,
+                                                   uint8_t max_retries)
+{
+  if (window < 1 || timeout_us == 0 || max_retries == FLASHERCTL_DEFAULT_RETRIES) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0)
+    return NULL;
+
+  struct flasherctl_client *client = new flasherctl_client();
+  client->epfd = epfd;
+  client->window = window;
+  client->timeout_us = timeout_us;
+  client->max_retries = max_retries;
+  client->outstanding = 0;
+  client->next_deadline_ns = no_deadline;
+  client->stats = {};
+
+  return client;
+}
+
+
+void flasherctl_client_destroy(struct flasherctl_client *client)
+{
+  for (auto &device : client->devices)
+    close(device.fd);
+  close(client->epfd);
+  delete client;
+}
+
+
+int flasherctl_client_add_device(struct flasherctl_client *client, const char *ip,
+                                 uint16_t port)
+{
+  if (client->devices.size() > UINT16_MAX) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  // Connected, so that the kernel drops datagrams from anyone else and a
+  // response needs no address lookup
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u32 = client->devices.size();
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      epoll_ctl(client->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  client->devices.emplace_back();
+  struct flasherctl_device &device = client->devices.back();
+  device.fd = fd;
+  device.sequence = 1;
+  device.head = device.tail = NULL;
+  device.slots.assign(client->window, NULL);
+  device.ids.assign(client->window, 0);
+  for (int slot = client->window - 1; slot >= 0; slot--)
+    device.free_slots.push_back(slot);
+  device.next_deadline_ns = no_deadline;
+
+  return client->devices.size() - 1;
+}
+
+
+/* Sends the request in a slot and arms its deadline; a failed send is left
+   to the timeout like a lost datagram */
+static void flasherctl_send(struct flasherctl_client *client, struct flasherctl_device *device,
+                            uint8_t slot, uint64_t now)
+{
+  struct flasherctl_request *request = device->slots[slot];
+
+  struct iostack_header header = {.id = device->ids[slot], .subsystem_id = request->subsystem_id,
+                                  .code = request->code};
+  struct iovec iov[2] = {{&header, sizeof(header)}, {request->payload, request->size}};
+  struct msghdr msg = {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+
+  client->stats.sent++;
+  if (sendmsg(device->fd, &msg, MSG_DONTWAIT) < 0)
+    client->stats.send_errors++;
+
+  uint32_t timeout_us = request->timeout_us ? request->timeout_us : client->timeout_us;
+  request->deadline_ns = now + (uint64_t) timeout_us * 1000;
+  if (request->deadline_ns < device->next_deadline_ns)
+    device->next_deadline_ns = request->deadline_ns;
+  if (request->deadline_ns < client->next_deadline_ns)
+    client->next_deadline_ns = request->deadline_ns;
+}
+
+
+/* Moves queued requests into free slots of the window */
+static void flasherctl_fill(struct flasherctl_client *client, struct flasherctl_device *device,
+                            uint64_t now)
+{
+  while (device->head && !device->free_slots.empty()) {
+    struct flasherctl_request *request = device->head;
+    device->head = request->next;
+    if (!device->head)
+      device->tail = NULL;
+
+    uint8_t slot = device->free_slots.back();
+    device->free_slots.pop_back();
+
+    device->slots[slot] = request;
+    device->ids[slot] = (uint16_t) device->sequence << 8 | slot;
+    if (++device->sequence == 0)
+      device->sequence = 1;
+
+    request->attempts = 1;
+    request->sent_ns = now;
+    flasherctl_send(client, device, slot, now);
+  }
+}
+
+
+/* Frees the slot and hands the request back. The callback may submit
+   requests and so change client->devices; take the device by index. */
+static void flasherctl_complete(struct flasherctl_client *client, uint16_t index,
+                                uint8_t slot, enum flasherctl_status status, uint64_t now)
+{
+  struct flasherctl_device *device = &client->devices[index];
+  struct flasherctl_request *request = device->slots[slot];
+  device->slots[slot] = NULL;
+  device->free_slots.push_back(slot);
+  client->outstanding--;
+
+  request->status = status;
+  request->latency_ns = now - request->sent_ns;
+  client->stats.completed++;
+  if (status == FLASHERCTL_TIMEOUT)
+    client->stats.timeouts++;
+
+  if (request->done)
+    request->done(request, request->context);
+
+  flasherctl_fill(client, &client->devices[index], now);
+}
+
+
+int flasherctl_client_submit(struct flasherctl_client *client, int index,
+                             struct flasherctl_request *request)
+{
+  if (index < 0 || (size_t) index >= client->devices.size() ||
+      request->size > iostack_max_payload_size) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct flasherctl_device *device = &client->devices[index];
+  request->status = FLASHERCTL_PENDING;
+  request->device = index;
+  request->attempts = 0;
+  request->next = NULL;
+  if (device->tail)
+    device->tail->next = request;
+  else
+    device->head = request;
+  device->tail = request;
+  client->outstanding++;
+
+  flasherctl_fill(client, device, now_ns());
+  return 0;
+}
+
+
+/* Reads every datagram waiting on a device's socket */
+static int flasherctl_receive(struct flasherctl_client *client, uint16_t index)
+{
+  uint8_t buf[FLASHERCTL_MAX_DATAGRAM + 1];  // One more to recognise oversized datagrams
+  int completed = 0;
+
+  for (;;) {
+    ssize_t n = recv(client->devices[index].fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      // ICMP port unreachable from an earlier send; its request times out
+      if (errno == ECONNREFUSED || errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    struct iostack_header header;
+    uint16_t size;
+    const uint8_t *payload = flasherctl_unpack(buf, n, &header, &size);
+
+    struct flasherctl_device *device = &client->devices[index];
+    uint8_t slot = header.id & 0xff;
+    if (!payload || slot >= client->window || !device->slots[slot] ||
+        device->ids[slot] != header.id) {
+      client->stats.stale++;
+      continue;
+    }
+
+    struct flasherctl_request *request = device->slots[slot];
+    request->response = header;
+    memcpy(request->response_payload, payload, size);
+    request->response_size = size;
+
+    flasherctl_complete(client, index, slot, FLASHERCTL_OK, now_ns());
+    completed++;
+  }
+
+  return completed;
+}
+
+
+/* Resends or times out the requests whose deadline has passed. Only devices
+   with an expired deadline are scanned, and a deadline that was met leaves
+   one idle scan behind, so this costs little while responses arrive. */
+static int flasherctl_expire(struct flasherctl_client *client, uint64_t now)
+{
+  if (now < client->next_deadline_ns)
+    return 0;
+
+  int completed = 0;
+  for (size_t index = 0; index < client->devices.size(); index++) {
+    if (now < client->devices[index].next_deadline_ns)
+      continue;
+
+    for (uint8_t slot = 0; slot < client->window; slot++) {
+      struct flasherctl_device *device = &client->devices[index];
+      struct flasherctl_request *request = device->slots[slot];
+      if (!request || now < request->deadline_ns)
+        continue;
+
+      uint8_t max_retries = request->max_retries == FLASHERCTL_DEFAULT_RETRIES ?
+                            client->max_retries : request->max_retries;
+      if (request->attempts <= max_retries) {
+        request->attempts++;
+        client->stats.retries++;
+        flasherctl_send(client, device, slot, now);
+      } else {
+        flasherctl_complete(client, index, slot, FLASHERCTL_TIMEOUT, now);
+        completed++;
+      }
+    }
+
+    struct flasherctl_device *device = &client->devices[index];
+    device->next_deadline_ns = no_deadline;
+    for (auto request : device->slots)
+      if (request && request->deadline_ns < device->next_deadline_ns)
+        device->next_deadline_ns = request->deadline_ns;
+  }
+
+  // Callbacks may have sent to devices scanned before
+  client->next_deadline_ns = no_deadline;
+  for (auto &device : client->devices)
+    if (device.next_deadline_ns < client->next_deadline_ns)
+      client->next_deadline_ns = device.next_deadline_ns;
+
+  return completed;
+}
+
+
+int flasherctl_client_next_timeout(const struct flasherctl_client *client)
+{
+  if (client->next_deadline_ns == no_deadline)
+    return -1;
+
+  uint64_t now = now_ns();
+  if (now >= client->next_deadline_ns)
+    return 0;
+  return (client->next_deadline_ns - now + 999999) / 1000000;
+}
+
+
+int flasherctl_client_poll(struct flasherctl_client *client, int timeout_ms)
+{
+  int completed = flasherctl_expire(client, now_ns());
+
+  int wait = completed ? 0 : timeout_ms;
+  int deadline = flasherctl_client_next_timeout(client);
+  if (deadline >= 0 && (wait < 0 || deadline < wait))
+    wait = deadline;
+  if (wait < 0 && !client->outstanding)
+    wait = 0;  // Nothing would ever arrive
+
+  struct epoll_event events[FLASHERCTL_EVENTS];
+  int n = epoll_wait(client->epfd, events, FLASHERCTL_EVENTS, wait);
+  if (n < 0)
+    return errno == EINTR ? completed : -1;
+
+  for (int i = 0; i < n; i++) {
+    int received = flasherctl_receive(client, events[i].data.u32);
+    if (received < 0)
+      return -1;
+    completed += received;
+  }
+
+  return completed + flasherctl_expire(client, now_ns());
+}
+
+
+int flasherctl_client_run(struct flasherctl_client *client)
+{
+  while (client->outstanding)
+    if (flasherctl_client_poll(client, -1) < 0)
+      return -1;
+  return 0;
+}
+
+
+uint32_t flasherctl_client_outstanding(const struct flasherctl_client *client)
+{
+  return client->outstanding;
+}
+
+
+int flasherctl_client_fd(const struct flasherctl_client *client)
+{
+  return client->epfd;
+}
+
+
+const struct flasherctl_client_stats *flasherctl_client_stats(const struct flasherctl_client *client)
+{
+  return &client->stats;
+}
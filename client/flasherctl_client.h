@@ -0,0 +1,128 @@
+#ifndef __FLASHERCTL_CLIENT_H__
+#define __FLASHERCTL_CLIENT_H__
+
+// Host client for the flasher iostack protocol, for DAQ software that talks
+// to many controllers at once. Requests are caller-owned structures that the
+// client links into its queues, so that nothing is allocated once the
+// devices are added. The client keeps up to a window of requests in flight
+// per device, resends a request that got no response within its timeout,
+// and completes it through a callback from flasherctl_client_poll.
+//
+// The client is not thread-safe; drive each one from a single thread.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Largest datagram of the protocol
+#define FLASHERCTL_MAX_DATAGRAM (iostack_header_size + iostack_max_payload_size)
+
+// Largest window; request IDs carry the window slot in their low byte
+#define FLASHERCTL_MAX_WINDOW 255
+
+// flasherctl_request.max_retries: use the client's default
+#define FLASHERCTL_DEFAULT_RETRIES 0xff
+
+enum flasherctl_status {
+  FLASHERCTL_OK = 0,        // Got a response; it may report an error, see flasherctl_response_error
+  FLASHERCTL_TIMEOUT,       // No response to the last attempt
+  FLASHERCTL_PENDING,       // Queued or in flight
+};
+
+struct flasherctl_client;
+struct flasherctl_request;
+
+typedef void flasherctl_done(struct flasherctl_request *request, void *context);
+
+struct flasherctl_request {
+  // Set by the caller before flasherctl_client_submit
+  uint8_t subsystem_id;
+  uint16_t code;
+  uint8_t payload[iostack_max_payload_size];
+  uint16_t size;
+  uint32_t timeout_us;   // Per attempt; 0 for the client's default
+  uint8_t max_retries;   // Attempts after the first; FLASHERCTL_DEFAULT_RETRIES for the client's
+  flasherctl_done *done; // May be NULL; may submit requests, this one included
+  void *context;
+
+  // Set by the client on completion
+  enum flasherctl_status status;
+  struct iostack_header response;           // code is the response code
+  uint8_t response_payload[iostack_max_payload_size];
+  uint16_t response_size;
+  uint8_t attempts;
+  uint64_t latency_ns;   // From the first attempt to completion
+
+  // Private to the client
+  struct flasherctl_request *next;
+  uint64_t sent_ns;      // First attempt
+  uint64_t deadline_ns;
+  uint16_t device;
+};
+
+struct flasherctl_client_stats {
+  uint64_t sent;        // Datagrams, retries included
+  uint64_t retries;
+  uint64_t timeouts;    // Requests completed with FLASHERCTL_TIMEOUT
+  uint64_t completed;
+  uint64_t stale;       // Datagrams that matched no request in flight: late duplicates, pushes
+  uint64_t send_errors;
+};
+
+// Packs a request datagram into buf without allocating. Returns its size,
+// or 0 if it does not fit into buf or exceeds the protocol's limit.
+uint16_t flasherctl_pack(uint8_t *buf, uint16_t buf_size, uint16_t id,
+                         uint8_t subsystem_id, uint16_t code,
+                         const void *payload, uint16_t size);
+
+// Reads the header of a response datagram; returns a pointer to its payload
+// and its size in *size, or NULL if the datagram is too short or too long
+const uint8_t *flasherctl_unpack(const uint8_t *buf, uint16_t buf_size,
+                                 struct iostack_header *header, uint16_t *size);
+
+// Returns 1 and the reported code in *error if the response of a completed
+// request is an error report: an enum iostack_error_code for
+// IOSTACK_REPORT_ERR, the FLASHER_E* bits for CMD_REPORT_FLASHERCTL_ERR
+uint8_t flasherctl_response_error(const struct flasherctl_request *request,
+                                  uint16_t *error);
+
+// window: requests in flight per device (1 to FLASHERCTL_MAX_WINDOW);
+// timeout_us and max_retries: defaults for requests that set none
+struct flasherctl_client *flasherctl_client_create(uint8_t window, uint32_t timeout_us,
+                                                   uint8_t max_retries);
+
+// Outstanding requests are dropped without their callbacks
+void flasherctl_client_destroy(struct flasherctl_client *client);
+
+// Adds the device at ip:port (one of its channel ports); returns its index
+// for flasherctl_client_submit, or -1 with errno set
+int flasherctl_client_add_device(struct flasherctl_client *client, const char *ip,
+                                 uint16_t port);
+
+// Queues a request; it is sent once the device's window has room. Returns 0,
+// or -1 if the device or the payload size is invalid. The request must stay
+// valid and untouched until it completes.
+int flasherctl_client_submit(struct flasherctl_client *client, int device,
+                             struct flasherctl_request *request);
+
+// Receives responses, resends timed-out requests and completes requests,
+// waiting at most timeout_ms (-1: until a response arrives or a deadline
+// passes). Returns the number of requests completed, or -1 with errno set.
+int flasherctl_client_poll(struct flasherctl_client *client, int timeout_ms);
+
+// Polls until no request is outstanding; returns 0, or -1 with errno set
+int flasherctl_client_run(struct flasherctl_client *client);
+
+uint32_t flasherctl_client_outstanding(const struct flasherctl_client *client);
+
+// The client's epoll descriptor, readable when flasherctl_client_poll has
+// responses to process, for use in another event loop. Deadlines do not
+// make it readable; call flasherctl_client_poll(client, 0) at least every
+// flasherctl_client_next_timeout() ms.
+int flasherctl_client_fd(const struct flasherctl_client *client);
+int flasherctl_client_next_timeout(const struct flasherctl_client *client);
+
+const struct flasherctl_client_stats *flasherctl_client_stats(const struct flasherctl_client *client);
+
+#endif
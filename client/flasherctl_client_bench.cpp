@@ -0,0 +1,368 @@
+// Throughput and latency of the host client against simulated devices on
+// the loopback interface.
+//
+// Each simulated device serves one request at a time, like the firmware:
+// a request arrives after the one-way latency, waits for the requests ahead
+// of it, takes the service time and its response returns after the latency
+// again. PING is echoed; anything else gets an iostack error report.
+// Requests may be dropped at random to exercise the retries.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <queue>
+#include <vector>
+
+#include "flasherctl_client.h"
+
+struct sim_config {
+  unsigned devices;
+  uint32_t service_us;
+  uint32_t latency_us;  // One way
+  double loss;          // Probability that a request is dropped
+};
+
+struct sim_device {
+  int fd;
+  uint16_t port;
+  uint64_t busy_until_ns;
+};
+
+struct sim_reply {
+  uint64_t due_ns;
+  int fd;
+  struct sockaddr_in addr;
+  uint16_t size;
+  uint8_t data[FLASHERCTL_MAX_DATAGRAM];
+
+  bool operator<(const struct sim_reply &other) const { return due_ns > other.due_ns; }
+};
+
+struct sim {
+  struct sim_config config;
+  std::vector<struct sim_device> devices;
+  int epfd;
+  std::atomic<bool> stop;
+  pthread_t thread;
+  unsigned seed;
+};
+
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Answers one request datagram, or drops it */
+static void sim_serve(struct sim *sim, struct sim_device *device, const uint8_t *buf, uint16_t n,
+                      const struct sockaddr_in *addr, std::priority_queue<struct sim_reply> *replies)
+{
+  struct iostack_header header;
+  uint16_t size;
+  const uint8_t *payload = flasherctl_unpack(buf, n, &header, &size);
+  if (!payload || rand_r(&sim->seed) < sim->config.loss * RAND_MAX)
+    return;
+
+  uint64_t arrival = now_ns() + sim->config.latency_us * 1000ull;
+  uint64_t start = std::max(arrival, device->busy_until_ns);
+  device->busy_until_ns = start + sim->config.service_us * 1000ull;
+
+  struct sim_reply reply;
+  reply.due_ns = device->busy_until_ns + sim->config.latency_us * 1000ull;
+  reply.fd = device->fd;
+  reply.addr = *addr;
+  if (header.subsystem_id == SYS_IOSTACK && header.code == CMD_PING) {
+    reply.size = flasherctl_pack(reply.data, sizeof(reply.data), header.id, SYS_IOSTACK,
+                                 CMD_PING, payload, size);
+  } else {
+    uint16_t error = IOSTACK_ERR_UNKNOWN_COMMAND;
+    reply.size = flasherctl_pack(reply.data, sizeof(reply.data), header.id, SYS_IOSTACK,
+                                 IOSTACK_REPORT_ERR, &error, sizeof(error));
+  }
+  replies->push(reply);
+}
+
+
+static void *sim_run(void *arg)
+{
+  struct sim *sim = (struct sim *) arg;
+  std::priority_queue<struct sim_reply> replies;
+
+  while (!sim->stop.load(std::memory_order_relaxed)) {
+    uint64_t now = now_ns();
+    while (!replies.empty() && replies.top().due_ns <= now) {
+      const struct sim_reply &reply = replies.top();
+      sendto(reply.fd, reply.data, reply.size, 0, (struct sockaddr *) &reply.addr,
+             sizeof(reply.addr));
+      replies.pop();
+    }
+
+    // Wake up for the next reply with sub-millisecond resolution; poll
+    // the stop flag every 10 ms
+    uint64_t wait_ns = replies.empty() ? 10000000 : replies.top().due_ns - now;
+    wait_ns = std::min(wait_ns, (uint64_t) 10000000);
+    struct timespec timeout = {0, (long) wait_ns};
+
+    struct epoll_event events[16];
+    int nevents = epoll_pwait2(sim->epfd, events, 16, &timeout, NULL);
+    for (int i = 0; i < nevents; i++) {
+      struct sim_device *device = &sim->devices[events[i].data.u32];
+      for (;;) {
+        uint8_t buf[FLASHERCTL_MAX_DATAGRAM + 1];
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        ssize_t n = recvfrom(device->fd, buf, sizeof(buf), MSG_DONTWAIT,
+                             (struct sockaddr *) &addr, &addrlen);
+        if (n < 0)
+          break;
+        sim_serve(sim, device, buf, n, &addr, &replies);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+static struct sim *sim_start(const struct sim_config *config)
+{
+  struct sim *sim = new struct sim();
+  sim->config = *config;
+  sim->epfd = epoll_create1(0);
+  sim->stop = false;
+  sim->seed = 1;
+
+  for (unsigned i = 0; i < config->devices; i++) {
+    struct sim_device device = {};
+    device.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    if (device.fd < 0 || bind(device.fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        getsockname(device.fd, (struct sockaddr *) &addr, &addrlen) < 0) {
+      perror("sim socket");
+      exit(1);
+    }
+    device.port = ntohs(addr.sin_port);
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u32 = i;
+    epoll_ctl(sim->epfd, EPOLL_CTL_ADD, device.fd, &event);
+    sim->devices.push_back(device);
+  }
+
+  pthread_create(&sim->thread, NULL, sim_run, sim);
+  return sim;
+}
+
+
+static void sim_stop(struct sim *sim)
+{
+  sim->stop = true;
+  pthread_join(sim->thread, NULL);
+  for (auto &device : sim->devices)
+    close(device.fd);
+  close(sim->epfd);
+  delete sim;
+}
+
+
+struct bench {
+  struct flasherctl_client *client;
+  uint32_t total;       // Requests to complete
+  uint32_t submitted;
+  uint32_t mismatches;  // Responses that do not echo their request
+  std::vector<uint64_t> latency_ns;
+};
+
+
+static void bench_submit(struct bench *bench, struct flasherctl_request *request, int device)
+{
+  uint32_t sequence = bench->submitted++;
+  request->subsystem_id = SYS_IOSTACK;
+  request->code = CMD_PING;
+  memcpy(request->payload, &sequence, sizeof(sequence));
+  request->size = sizeof(sequence);
+  flasherctl_client_submit(bench->client, device, request);
+}
+
+
+/* Checks the echo and keeps the window full until all requests are in */
+static void bench_done(struct flasherctl_request *request, void *context)
+{
+  struct bench *bench = (struct bench *) context;
+
+  if (request->status == FLASHERCTL_OK) {
+    if (request->response.code != CMD_PING || request->response_size != request->size ||
+        memcmp(request->response_payload, request->payload, request->size))
+      bench->mismatches++;
+    bench->latency_ns.push_back(request->latency_ns);
+  }
+
+  if (bench->submitted < bench->total)
+    bench_submit(bench, request, request->device);
+}
+
+
+/* Returns the number of failures: mismatched responses, and timeouts where
+   no request was lost */
+static int run_bench(const char *name, const struct sim_config *config, uint8_t window,
+                     uint32_t total, uint32_t timeout_us)
+{
+  struct sim *sim = sim_start(config);
+  struct bench bench = {};
+  bench.client = flasherctl_client_create(window, timeout_us, 3);
+  bench.total = total;
+  bench.latency_ns.reserve(total);
+
+  for (auto &device : sim->devices)
+    flasherctl_client_add_device(bench.client, "127.0.0.1", device.port);
+
+  std::vector<struct flasherctl_request> requests(config->devices * window);
+  for (size_t i = 0; i < requests.size(); i++) {
+    requests[i].timeout_us = 0;
+    requests[i].max_retries = FLASHERCTL_DEFAULT_RETRIES;
+    requests[i].done = bench_done;
+    requests[i].context = &bench;
+  }
+
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < requests.size() && bench.submitted < total; i++)
+    bench_submit(&bench, &requests[i], i % config->devices);
+  if (flasherctl_client_run(bench.client) < 0)
+    perror("flasherctl_client_run");
+  double elapsed = (now_ns() - start) * 1e-9;
+
+  sim_stop(sim);
+
+  const struct flasherctl_client_stats *stats = flasherctl_client_stats(bench.client);
+  std::vector<uint64_t> &latency = bench.latency_ns;
+  std::sort(latency.begin(), latency.end());
+  auto percentile = [&](double p) {
+    return latency.empty() ? 0.0 : latency[(size_t) (p * (latency.size() - 1))] * 1e-3;
+  };
+
+  printf("%-28s %4u %4u %9.0f %8.0f %8.0f %8.0f %7lu %7lu\n", name, config->devices, window,
+         stats->completed / elapsed, percentile(0.5), percentile(0.99), percentile(1.0),
+         (unsigned long) stats->retries, (unsigned long) stats->timeouts);
+
+  int failures = bench.mismatches;
+  if (config->loss == 0)
+    failures += stats->timeouts;
+  if (stats->completed != total)
+    failures++;
+  if (failures)
+    printf("  FAILED: %u mismatched responses, %lu timeouts, %lu of %u completed\n",
+           bench.mismatches, (unsigned long) stats->timeouts,
+           (unsigned long) stats->completed, total);
+
+  flasherctl_client_destroy(bench.client);
+  return failures;
+}
+
+
+/* Packing, error reports and timeouts against a device that never answers */
+static int run_client_check(void)
+{
+  int failures = 0;
+
+  uint8_t buf[FLASHERCTL_MAX_DATAGRAM];
+  uint8_t payload[iostack_max_payload_size + 1] = {0x5a};
+  uint16_t n = flasherctl_pack(buf, sizeof(buf), 0x1234, SYS_FLASHER, CMD_SET_LED_CURRENT,
+                               payload, 1);
+  struct iostack_header header;
+  uint16_t size;
+  const uint8_t *unpacked = flasherctl_unpack(buf, n, &header, &size);
+  if (n != 6 || !unpacked || header.id != 0x1234 || header.subsystem_id != SYS_FLASHER ||
+      header.code != CMD_SET_LED_CURRENT || size != 1 || unpacked[0] != 0x5a) {
+    printf("FAILED: pack/unpack\n");
+    failures++;
+  }
+  if (flasherctl_pack(buf, sizeof(buf), 1, SYS_IOSTACK, CMD_PING, payload, sizeof(payload)) ||
+      flasherctl_pack(buf, 4, 1, SYS_IOSTACK, CMD_PING, NULL, 0)) {
+    printf("FAILED: oversized datagrams packed\n");
+    failures++;
+  }
+
+  struct sim_config config = {.devices = 1, .service_us = 0, .latency_us = 0, .loss = 0};
+  struct sim *sim = sim_start(&config);
+  struct flasherctl_client *client = flasherctl_client_create(4, 20000, 1);
+  int device = flasherctl_client_add_device(client, "127.0.0.1", sim->devices[0].port);
+
+  // A dead port: nothing is bound to the device's port after closing it
+  int dead_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrlen = sizeof(addr);
+  bind(dead_fd, (struct sockaddr *) &addr, sizeof(addr));
+  getsockname(dead_fd, (struct sockaddr *) &addr, &addrlen);
+  close(dead_fd);
+  int dead = flasherctl_client_add_device(client, "127.0.0.1", ntohs(addr.sin_port));
+
+  struct flasherctl_request unknown = {}, lost = {};
+  unknown.subsystem_id = SYS_FLASHER;
+  unknown.code = CMD_FIRE_STATUS;
+  unknown.max_retries = FLASHERCTL_DEFAULT_RETRIES;
+  lost.subsystem_id = SYS_IOSTACK;
+  lost.code = CMD_PING;
+  lost.timeout_us = 5000;
+  lost.max_retries = 2;
+
+  flasherctl_client_submit(client, device, &unknown);
+  flasherctl_client_submit(client, dead, &lost);
+  flasherctl_client_run(client);
+
+  uint16_t error;
+  if (!flasherctl_response_error(&unknown, &error) || error != IOSTACK_ERR_UNKNOWN_COMMAND) {
+    printf("FAILED: error report not recognised\n");
+    failures++;
+  }
+  if (lost.status != FLASHERCTL_TIMEOUT || lost.attempts != 3 || lost.latency_ns < 15000000) {
+    printf("FAILED: timeout after %u attempts, %.1f ms\n", lost.attempts, lost.latency_ns * 1e-6);
+    failures++;
+  }
+
+  flasherctl_client_destroy(client);
+  sim_stop(sim);
+  return failures;
+}
+
+
+int main(void)
+{
+  int failures = run_client_check();
+
+  printf("%-28s %4s %4s %9s %8s %8s %8s %7s %7s\n", "", "devs", "win", "req/s",
+         "p50 us", "p99 us", "max us", "retries", "timeouts");
+
+  struct sim_config one = {.devices = 1, .service_us = 50, .latency_us = 100, .loss = 0};
+  failures += run_bench("one device, stop-and-wait", &one, 1, 2000, 200000);
+  failures += run_bench("one device, pipelined", &one, 8, 10000, 200000);
+
+  struct sim_config fleet = {.devices = 64, .service_us = 50, .latency_us = 100, .loss = 0};
+  failures += run_bench("64 devices, pipelined", &fleet, 8, 50000, 200000);
+
+  struct sim_config lossy = fleet;
+  lossy.loss = 0.02;
+  failures += run_bench("64 devices, 2% loss", &lossy, 8, 50000, 5000);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#include "dmac.h"
+
+#if defined(ARDUINO_ARCH_SAMD)
+DmacDescriptor dmac_base[DMAC_NUM_CHANNELS] __attribute__((aligned(16)));
+DmacDescriptor dmac_writeback[DMAC_NUM_CHANNELS] __attribute__((aligned(16)));
+
+
+// Enables the DMAC with the shared descriptor tables; safe to call again
+void dmac_init(void)
+{
+  static uint8_t initialised = 0;
+
+  if (initialised)
+    return;
+
+  PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+  PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+  DMAC->CTRL.reg &= ~DMAC_CTRL_DMAENABLE;
+  DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+  while (DMAC->CTRL.reg & DMAC_CTRL_SWRST)
+    ;
+
+  DMAC->BASEADDR.reg = (uint32_t) dmac_base;
+  DMAC->WRBADDR.reg = (uint32_t) dmac_writeback;
+  DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+
+  initialised = 1;
+}
+
+
+// Resets a channel and sets its trigger (one beat per trigger) and priority
+void dmac_channel_init(uint8_t channel, uint8_t trigger, uint8_t level)
+{
+  DMAC->CHID.reg = DMAC_CHID_ID(channel);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(level) | DMAC_CHCTRLB_TRIGSRC(trigger) |
+                      DMAC_CHCTRLB_TRIGACT_BEAT;
+}
+#endif
@@ -0,0 +1,24 @@
+#ifndef __DMAC_H__
+#define __DMAC_H__
+
+// DMAC channel allocation and the descriptor tables shared by its users
+
+#include <Arduino.h>
+
+// Channels; the descriptor tables only have entries for these
+#define DMAC_CH_W55_TX    0  // SERCOM4 (SPI_2) bursts, see w5500.cpp
+#define DMAC_CH_W55_RX    1
+#define DMAC_CH_PULSE_SET 2  // Pulse train edges on PIN_LED2, see flasher.cpp
+#define DMAC_CH_PULSE_CLR 3
+#define DMAC_NUM_CHANNELS 4
+
+// The host build simulates these (see host/sim.cpp)
+#if defined(ARDUINO_ARCH_SAMD) || defined(FLASHERCTL_HOST)
+extern DmacDescriptor dmac_base[DMAC_NUM_CHANNELS];
+extern DmacDescriptor dmac_writeback[DMAC_NUM_CHANNELS];
+
+void dmac_init(void);
+void dmac_channel_init(uint8_t channel, uint8_t trigger, uint8_t level);
+#endif
+
+#endif
@@ -1,10 +1,96 @@
 #include <Arduino.h>
 
+#include "dmac.h"
 #include "flasher.h"
+#include "gpio.h"
+#include "timesync.h"
 
 extern SPIClass SPI_1;
 extern SPIClass SPI_2;
 
+// LED current photorelays: bit 0 of the current on LED_A0, ..., bit 3 on LED_A3
+typedef gpio_bus<LED_A0, LED_A1, LED_A2, LED_A3> led_current_bus;
+
+// Settings preloaded by flasher_STAGE_SETTINGS
+// While staged, the width sits in the DS1023 shift register with LE held
+// high; the DS1023 only transfers it to the delay latch on the falling LE.
+static uint8_t staged = 0;
+static uint8_t staged_current;
+static uint8_t staged_width;
+
+// Settings last applied, for telemetry
+static uint8_t led_current = 0;
+static uint8_t pulse_width = 0;
+
+// Pulse timer: TCC0 and two DMAC channels on the SAMD21, modelled by the
+// host simulator (see end of file). period, width and delay (to the first
+// rising edge, less than period - width) are in timer ticks.
+void pulse_timer_start(uint16_t count, uint8_t prescaler, uint32_t period, uint32_t width,
+                       uint32_t delay);
+uint16_t pulse_timer_remaining(void);
+uint8_t pulse_timer_busy(void);
+void pulse_timer_stop(void);
+
+// Timestamps the first rising edge after pulse_timer_start, which it must
+// follow; pulse_timer_edge_us returns 1 until the edge has come, then 0 and
+// its micros() in *us
+void pulse_timer_stamp_edge(void);
+uint8_t pulse_timer_edge_us(uint32_t *us);
+
+// DS1023 shift register on SERCOM5 (see DS1023_SPI), at the end of the file
+// on the SAMD21 and modelled by the host simulator
+#if DS1023_SPI
+void ds1023_spi_init(void);
+void ds1023_spi_write(uint8_t data);
+#endif
+
+// TCC_CTRLA_PRESCALER settings and the 24-bit TCC0 counter
+static const uint16_t pulse_timer_dividers[] = {1, 2, 4, 8, 16, 64, 256, 1024};
+#define PULSE_TIMER_MAX_PERIOD (1ul << 24)
+
+// Last pulse train started by flasher_PULSE_TRAIN
+static uint8_t pulse_train_running = 0;
+static uint16_t pulse_train_count = 0;
+static uint16_t pulse_train_emitted = 0;
+
+// Pulse scheduled by flasher_FIRE_AT
+static uint8_t fire_state = FLASHER_FIRE_IDLE;
+static uint64_t fire_target_us;  // Client time base
+static uint64_t fire_fired_us;   // Client time base, from the timestamped edge
+
+// While a pulse is scheduled, TCC0 and TEST_PULSE are reserved for it
+#define FIRE_PENDING() (fire_state == FLASHER_FIRE_PENDING || fire_state == FLASHER_FIRE_ARMED)
+
+// Calibration sequence, executed by flasher_tick
+enum sequence_phase {SEQ_APPLY, SEQ_PULSING, SEQ_DWELL};
+
+static struct flasher_sequence_step sequence_steps[SEQUENCE_MAX_STEPS];
+static uint16_t sequence_nsteps = 0;
+static uint16_t sequence_step = 0;
+static uint8_t sequence_state = FLASHER_SEQ_IDLE;
+static uint8_t sequence_phase;
+static uint32_t sequence_dwell_started;
+
+// While a sequence runs, it owns the LED settings and TEST_PULSE
+#define SEQUENCE_RUNNING() (sequence_state == FLASHER_SEQ_RUNNING)
+
+static void ds1023_shift(uint8_t width);
+static void apply_settings(uint8_t current, uint8_t width);
+
+// DS28CM00 serial number, read once by flasher_init_serial_no
+static uint8_t serial_no_cache[6];
+static uint16_t serial_no_error = FLASHER_ESERIALNO;
+
+// Background temperature sampler
+// One conversion is started every temperature_period_ms and read back
+// TEMPERATURE_CONVERSION_MS later into the history ring.
+static uint16_t temperature_period_ms = TEMPERATURE_PERIOD_MS;
+static uint8_t temperature_converting = 0;
+static uint32_t temperature_started; // millis() at the start of the last conversion
+static struct flasher_temperature_sample temperature_history[TEMPERATURE_HISTORY];
+static uint8_t temperature_next = 0; // Slot of the next sample
+static uint8_t temperature_count = 0;
+
 /* Sets LED_BUILTIN high or low */
 uint16_t flasher_LED_BUILTIN(uint8_t on_off)
 {
@@ -19,11 +105,30 @@ uint16_t flasher_LED_BUILTIN(uint8_t on_off)
   return error;
 }
 
+/* Returns 1 while a pulse train drives PIN_LED2; stops the timer once the
+   last pulse has ended */
+static uint8_t pulse_train_busy(void)
+{
+  if (pulse_train_running && !pulse_timer_busy()) {
+    pulse_timer_stop();
+    pulse_train_running = 0;
+    pulse_train_emitted = pulse_train_count;
+  }
+
+  return pulse_train_running;
+}
+
 /* Sets TEST_PULSE / PIN_LED2 high or low. If on_off is 2, PIN_LED2 is pulsed high then low*/
 uint16_t flasher_TEST_PULSE(uint8_t on_off)
 {
   uint16_t error = 0;
 
+  if (SEQUENCE_RUNNING() || pulse_train_busy() || FIRE_PENDING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
   if (on_off == 0)
   {
     digitalWrite(PIN_LED2, LOW);
@@ -34,12 +139,9 @@ uint16_t flasher_TEST_PULSE(uint8_t on_off)
   }
   else if (on_off == 2)
   {
-    digitalWrite(PIN_LED2, HIGH);
-    digitalWrite(PIN_LED2, HIGH); // NOP
-    digitalWrite(PIN_LED2, HIGH); // NOP
-    digitalWrite(PIN_LED2, HIGH); // NOP
-    digitalWrite(PIN_LED2, HIGH); // NOP
-    digitalWrite(PIN_LED2, LOW);
+    gpio<PIN_LED2>::high();
+    gpio_delay_ns<TEST_PULSE_WIDTH_NS>();
+    gpio<PIN_LED2>::low();
   }
   else
   {
@@ -49,39 +151,463 @@ uint16_t flasher_TEST_PULSE(uint8_t on_off)
   return error;
 }
 
-/* Starts the ADT7310 temperature measurement (16-bit mode) */
+/* Starts an ADT7310 temperature measurement (16-bit mode) now; the sampler
+   reads it into the history once the conversion is done */
 uint16_t flasher_START_TEMPERATURE()
 {
   uint16_t error = 0;
 
-  start_temperature(SPI_1, ADT7310_CS);
+  start_temperature<ADT7310_CS>(SPI_1);
+  temperature_started = millis();
+  temperature_converting = 1;
 
   return error;
 }
 
-/* Reads the ADT7310 temperature (16-bit mode) */
+/* Returns the latest sampled temperature, or reads the ADT7310 if there is
+   no sample yet */
 float flasher_READ_TEMPERATURE(uint16_t *error)
 {
-  float temperature;
+  int16_t value;
 
-  temperature = read_temperature(SPI_1, ADT7310_CS);
+  if (flasher_latest_temperature(&value))
+    value = read_temperature<ADT7310_CS>(SPI_1);
   *error = 0;
 
-  return temperature;
+  return value / TEMPERATURE_LSB_PER_C;
+}
+
+/* Copies the sample history, oldest first, and summarises it. Returns the
+   number of samples copied */
+uint8_t flasher_READ_TEMPERATURE_HISTORY(struct flasher_temperature_summary *summary,
+                                         struct flasher_temperature_sample *samples)
+{
+  uint8_t first = (temperature_next + TEMPERATURE_HISTORY - temperature_count) % TEMPERATURE_HISTORY;
+  int16_t min = INT16_MAX;
+  int16_t max = INT16_MIN;
+  int32_t sum = 0;
+
+  for (uint8_t i = 0; i < temperature_count; i++) {
+    samples[i] = temperature_history[(first + i) % TEMPERATURE_HISTORY];
+    int16_t value = samples[i].value;
+    if (value < min)
+      min = value;
+    if (value > max)
+      max = value;
+    sum += value;
+  }
+
+  summary->millis = millis();
+  summary->period_ms = temperature_period_ms;
+  summary->count = temperature_count;
+  if (temperature_count) {
+    summary->min = min / TEMPERATURE_LSB_PER_C;
+    summary->max = max / TEMPERATURE_LSB_PER_C;
+    summary->mean = sum / TEMPERATURE_LSB_PER_C / temperature_count;
+  } else {
+    summary->min = summary->max = summary->mean = NAN;
+  }
+
+  return temperature_count;
+}
+
+/* Sets the time between background conversions; 0 stops the sampler */
+uint16_t flasher_SET_TEMPERATURE_PERIOD(uint16_t period_ms)
+{
+  uint16_t error = 0;
+
+  if (period_ms != 0 && period_ms < TEMPERATURE_CONVERSION_MS) {
+    error = FLASHER_EBVALUE;
+    return error;
+  }
+
+  temperature_period_ms = period_ms;
+
+  return error;
+}
+
+/* Rounds a period and width to ticks of the finest timer clock that fits the
+   period into the counter, and returns that clock in Hz */
+static uint32_t pulse_train_ticks(uint32_t period_ns, uint32_t width_ns, uint8_t *prescaler,
+                                  uint32_t *period, uint32_t *width)
+{
+  uint32_t timer_hz = 0;
+  for (*prescaler = 0; *prescaler < sizeof(pulse_timer_dividers) / sizeof(*pulse_timer_dividers); (*prescaler)++)
+  {
+    timer_hz = F_CPU / pulse_timer_dividers[*prescaler];
+    *period = ((uint64_t) period_ns * timer_hz + 500000000) / 1000000000;
+    if (*period <= PULSE_TIMER_MAX_PERIOD)
+      break;
+  }
+
+  *width = ((uint64_t) width_ns * timer_hz + 500000000) / 1000000000;
+  if (*width == 0)
+    *width = 1;
+
+  return timer_hz;
+}
+
+/* Returns FLASHER_EBVALUE unless the timer can produce the period and width.
+   Any 32-bit period in ns fits the counter with the largest prescaler. */
+static uint16_t pulse_train_check(uint32_t period_ns, uint32_t width_ns)
+{
+  if (width_ns < PULSE_TRAIN_MIN_EDGE_NS ||
+      period_ns < width_ns || period_ns - width_ns < PULSE_TRAIN_MIN_EDGE_NS)
+    return FLASHER_EBVALUE;
+
+  // With coarse ticks, rounding can take the low time below the minimum
+  uint8_t prescaler;
+  uint32_t period, width;
+  uint32_t timer_hz = pulse_train_ticks(period_ns, width_ns, &prescaler, &period, &width);
+  uint32_t min_edge = ((uint64_t) PULSE_TRAIN_MIN_EDGE_NS * timer_hz + 999999999) / 1000000000;
+  if (width < min_edge || period < width || period - width < min_edge)
+    return FLASHER_EBVALUE;
+
+  return 0;
+}
+
+/* Starts a checked pulse train and rounds its period and width to timer ticks */
+static void pulse_train_start(struct flasher_pulse_train *train)
+{
+  uint8_t prescaler;
+  uint32_t period, width;
+  uint32_t timer_hz = pulse_train_ticks(train->period_ns, train->width_ns, &prescaler,
+                                        &period, &width);
+
+  train->period_ns = (uint64_t) period * 1000000000 / timer_hz;
+  train->width_ns = (uint64_t) width * 1000000000 / timer_hz;
+
+  pulse_timer_start(train->count, prescaler, period, width, 1);
+  pulse_train_running = 1;
+  pulse_train_count = train->count;
+  pulse_train_emitted = 0;
+}
+
+/* Stops a running pulse train and keeps the number of pulses it started */
+static void pulse_train_stop(void)
+{
+  if (pulse_train_busy())
+  {
+    pulse_train_emitted = pulse_train_count - pulse_timer_remaining();
+    pulse_timer_stop();
+    pulse_train_running = 0;
+  }
+}
+
+/* Starts count pulses on PIN_LED2, timed by TCC0 without CPU involvement,
+   and returns the period and width actually used (rounded to timer ticks).
+   A count of 0 stops a running train. */
+uint16_t flasher_PULSE_TRAIN(struct flasher_pulse_train *train)
+{
+  uint16_t error = 0;
+
+  if (SEQUENCE_RUNNING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
+  if (train->count == 0)
+  {
+    pulse_train_stop();
+    return error;
+  }
+
+  if (pulse_train_busy() || FIRE_PENDING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
+  error = pulse_train_check(train->period_ns, train->width_ns);
+  if (error)
+    return error;
+
+  pulse_train_start(train);
+
+  return error;
+}
+
+/* Reports whether the last pulse train is still running and how many of
+   its pulses have started */
+void flasher_PULSE_TRAIN_STATUS(struct flasher_pulse_train_status *status)
+{
+  status->running = pulse_train_busy();
+  status->count = pulse_train_count;
+  status->emitted = status->running ? pulse_train_count - pulse_timer_remaining()
+                                    : pulse_train_emitted;
+}
+
+/* Stores nsteps calibration steps from step offset on; the table then ends
+   after them. Load from offset 0 up, in chunks that fit a request. */
+uint16_t flasher_SEQUENCE_LOAD(uint16_t offset, const struct flasher_sequence_step *steps,
+                               uint8_t nsteps)
+{
+  uint16_t error = 0;
+
+  if (SEQUENCE_RUNNING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
+  if (offset > sequence_nsteps || offset + nsteps > SEQUENCE_MAX_STEPS)
+  {
+    error = FLASHER_EBVALUE;
+    return error;
+  }
+
+  for (uint8_t i = 0; i < nsteps; i++)
+  {
+    if (steps[i].current > 0x0F ||
+        (steps[i].pulses && pulse_train_check(steps[i].period_ns, SEQUENCE_TRIGGER_WIDTH_NS)))
+    {
+      error = FLASHER_EBVALUE;
+      return error;
+    }
+  }
+
+  memcpy(&sequence_steps[offset], steps, nsteps * sizeof(*steps));
+  sequence_nsteps = offset + nsteps;
+
+  return error;
+}
+
+/* Starts executing the loaded steps from the first one */
+uint16_t flasher_SEQUENCE_START()
+{
+  uint16_t error = 0;
+
+  if (SEQUENCE_RUNNING() || pulse_train_busy() || FIRE_PENDING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
+  if (sequence_nsteps == 0)
+  {
+    error = FLASHER_EBVALUE;
+    return error;
+  }
+
+  sequence_step = 0;
+  sequence_phase = SEQ_APPLY;
+  sequence_state = FLASHER_SEQ_RUNNING;
+
+  return error;
+}
+
+/* Stops a running sequence, including its pulse train; the settings of the
+   current step stay applied */
+void flasher_SEQUENCE_ABORT()
+{
+  if (!SEQUENCE_RUNNING())
+    return;
+
+  pulse_train_stop();
+  sequence_state = FLASHER_SEQ_ABORTED;
+}
+
+void flasher_SEQUENCE_STATUS(struct flasher_sequence_status *status)
+{
+  status->state = sequence_state;
+  status->step = sequence_step;
+  status->nsteps = sequence_nsteps;
+
+  if (sequence_state == FLASHER_SEQ_IDLE || sequence_phase == SEQ_APPLY)
+    status->pulses = 0;
+  else if (sequence_phase == SEQ_PULSING && pulse_train_busy())
+    status->pulses = pulse_train_count - pulse_timer_remaining();
+  else
+    status->pulses = pulse_train_emitted;
+}
+
+/* Advances the calibration sequence as far as it can without waiting */
+static void sequence_tick(uint32_t now)
+{
+  while (SEQUENCE_RUNNING())
+  {
+    const struct flasher_sequence_step *step = &sequence_steps[sequence_step];
+
+    if (sequence_phase == SEQ_APPLY)
+    {
+      apply_settings(step->current, step->width);
+
+      pulse_train_emitted = 0;
+      if (step->pulses)
+      {
+        struct flasher_pulse_train train = {step->pulses, step->period_ns, SEQUENCE_TRIGGER_WIDTH_NS};
+        pulse_train_start(&train);
+      }
+      sequence_phase = SEQ_PULSING;
+    }
+
+    if (sequence_phase == SEQ_PULSING)
+    {
+      if (pulse_train_busy())
+        return;
+
+      sequence_dwell_started = now;
+      sequence_phase = SEQ_DWELL;
+    }
+
+    if (now - sequence_dwell_started < step->dwell_ms)
+      return;
+
+    sequence_phase = SEQ_APPLY;
+    if (++sequence_step == sequence_nsteps)
+      sequence_state = FLASHER_SEQ_DONE;
+  }
+}
+
+/* Schedules one TEST_PULSE_WIDTH_NS pulse on PIN_LED2 at time_us in the
+   client's time base (see timesync.h); 0 cancels a scheduled pulse. The pulse
+   is timed by TCC0, armed by flasher_tick shortly before. */
+uint16_t flasher_FIRE_AT(uint64_t time_us)
+{
+  uint16_t error = 0;
+
+  if (time_us == 0)
+  {
+    if (fire_state == FLASHER_FIRE_ARMED)
+      pulse_timer_stop();
+    if (FIRE_PENDING())
+      fire_state = FLASHER_FIRE_CANCELLED;
+    return error;
+  }
+
+  if (SEQUENCE_RUNNING() || pulse_train_busy() || FIRE_PENDING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
+  if (!timesync_synced())
+  {
+    error = FLASHER_ENOTSYNCED;
+    return error;
+  }
+
+  if ((int64_t) (timesync_to_local(time_us) - timesync_local_us()) <= 0)
+  {
+    error = FLASHER_EBVALUE;
+    return error;
+  }
+
+  fire_target_us = time_us;
+  fire_fired_us = 0;
+  fire_state = FLASHER_FIRE_PENDING;
+
+  return error;
+}
+
+void flasher_FIRE_STATUS(struct flasher_fire_status *status)
+{
+  status->state = fire_state;
+  status->target_us = fire_target_us;
+  status->fired_us = fire_fired_us;
+}
+
+/* Arms TCC0 once the scheduled pulse is less than FIRE_ARM_WINDOW_US away,
+   and releases it after the pulse. The target is converted to local time only
+   now, with the latest clock corrections. */
+static void fire_tick(void)
+{
+  if (fire_state == FLASHER_FIRE_ARMED && !pulse_timer_busy())
+  {
+    // Converted with the latest clock corrections, like the target was
+    uint32_t edge_us;
+    if (!pulse_timer_edge_us(&edge_us))
+      fire_fired_us = timesync_to_client(timesync_extend(edge_us));
+
+    pulse_timer_stop();
+    fire_state = FLASHER_FIRE_FIRED;
+    return;
+  }
+
+  if (fire_state != FLASHER_FIRE_PENDING)
+    return;
+
+  uint64_t now = timesync_local_us();
+  int64_t remaining = (int64_t) (timesync_to_local(fire_target_us) - now);
+  if (remaining > FIRE_ARM_WINDOW_US)
+    return;
+
+  if (remaining <= 0)
+  {
+    fire_state = FLASHER_FIRE_MISSED;
+    return;
+  }
+
+  // One pulse, delay ticks of the undivided timer clock from now
+  uint32_t ticks_per_us = F_CPU / 1000000;
+  uint32_t width = ((uint64_t) TEST_PULSE_WIDTH_NS * F_CPU + 500000000) / 1000000000;
+  pulse_timer_start(1, 0, PULSE_TIMER_MAX_PERIOD, width, remaining * ticks_per_us);
+  pulse_timer_stamp_edge();
+  fire_state = FLASHER_FIRE_ARMED;
+}
+
+/* Gets the latest sampled temperature (1/128 C); returns 1 if there is none */
+uint8_t flasher_latest_temperature(int16_t *value)
+{
+  if (!temperature_count)
+    return 1;
+
+  *value = temperature_history[(temperature_next + TEMPERATURE_HISTORY - 1) % TEMPERATURE_HISTORY].value;
+  return 0;
 }
 
-void start_temperature(SPIClass this_spi, int this_cs)
+/* Gets the LED current and pulse width last applied */
+void flasher_settings(uint8_t *current, uint8_t *width)
+{
+  *current = led_current;
+  *width = pulse_width;
+}
+
+/* Runs the calibration sequence and the background temperature sampler, arms
+   scheduled pulses, and retires finished pulse trains; call from the main loop */
+void flasher_tick()
+{
+  uint32_t now = millis();
+
+  // Release TCC0 once a pulse train is done
+  pulse_train_busy();
+
+  sequence_tick(now);
+  fire_tick();
+
+  if (temperature_converting) {
+    if (now - temperature_started < TEMPERATURE_CONVERSION_MS)
+      return;
+
+    struct flasher_temperature_sample *sample = &temperature_history[temperature_next];
+    sample->millis = now;
+    sample->value = read_temperature<ADT7310_CS>(SPI_1);
+
+    temperature_next = (temperature_next + 1) % TEMPERATURE_HISTORY;
+    if (temperature_count < TEMPERATURE_HISTORY)
+      temperature_count++;
+    temperature_converting = 0;
+  }
+
+  if (temperature_period_ms && now - temperature_started >= temperature_period_ms)
+    flasher_START_TEMPERATURE();
+}
+
+template <uint32_t cs>
+void start_temperature(SPIClass &this_spi)
 {
   // Start a new 16-bit single shot conversion to avoid blocking code (otherwise we need to wait 240ms for conversion to complete)
   this_spi.beginTransaction(SPISettings(SPI_SPEED, MSBFIRST, SPI_MODE3)); // ADT7310 needs SPI Mode 3
-  digitalWrite(this_cs,LOW); // Pull CS low
+  gpio<cs>::low(); // Pull CS low
   this_spi.transfer(0x08); // Send command byte: Write, Register 1 (configuration register)
   this_spi.transfer(0xA0); // Send data byte: 16-bit mode (1), one shot (01), interrupt mode (0), INT active low (0), CT active low (0), 1 fault (00)
-  digitalWrite(this_cs,HIGH); // Pull CS high
+  gpio<cs>::high(); // Pull CS high
   this_spi.endTransaction();
 }
 
-float read_temperature(SPIClass this_spi, int this_cs)
+template <uint32_t cs>
+int16_t read_temperature(SPIClass &this_spi)
 {
   struct {
     union {
@@ -92,22 +618,17 @@ float read_temperature(SPIClass this_spi, int this_cs)
       } bytes;
     };
   } temp_reg;
-  float temperature;
 
   // Read temperature from this SPI using this CS
   this_spi.beginTransaction(SPISettings(SPI_SPEED, MSBFIRST, SPI_MODE3)); // ADT7310 needs SPI Mode 3
-  digitalWrite(this_cs,LOW); // Pull CS low
+  gpio<cs>::low(); // Pull CS low
   this_spi.transfer(0x50); // Send command byte: Read, Register 2 (temperature value register (16-bit))
   temp_reg.bytes.hi_byte = this_spi.transfer(0xff); // Read MSB
   temp_reg.bytes.lo_byte = this_spi.transfer(0xff); // Read LSB
-  digitalWrite(this_cs,HIGH); // Pull CS high
+  gpio<cs>::high(); // Pull CS high
   this_spi.endTransaction();
 
-  // Convert the temperature to float
-  temperature = (float)temp_reg.temperature;
-  temperature = temperature / 128.0;
-
-  return temperature;
+  return temp_reg.temperature; // 1/128 C
 }
 
 uint16_t flasher_SET_LED_CURRENT(uint8_t current)
@@ -115,81 +636,409 @@ uint16_t flasher_SET_LED_CURRENT(uint8_t current)
 {
   uint16_t error = 0;
 
+  if (SEQUENCE_RUNNING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
   if (current > 0x0F)
   {
     error = FLASHER_EBVALUE;
     return error;
   }
 
-  digitalWrite(LED_A0, ((current >> 0) & 0x01));
-  digitalWrite(LED_A1, ((current >> 1) & 0x01));
-  digitalWrite(LED_A2, ((current >> 2) & 0x01));
-  digitalWrite(LED_A3, ((current >> 3) & 0x01));
+  led_current_bus::write(current); // All four photorelays switch together
+  led_current = current;
 
   return error;
 }
 
-uint16_t flasher_SET_PULSE_WIDTH(uint8_t width)
-// Configures the pulse width (DS1023 delay)
+void flasher_init_ds1023()
+// Hands D and CLK to SERCOM5 where DS1023_SPI is set; call once the pins are outputs
 {
-  uint16_t error = 0;
+#if DS1023_SPI
+  ds1023_spi_init();
+#endif
+}
 
-  digitalWrite(DS1023_LE, LOW); // Make sure the LE is low
-  digitalWrite(DS1023_CLK, LOW); // Make sure the CLK is low
+static void ds1023_shift(uint8_t width)
+// Shifts the width into the DS1023 and leaves LE high; lowering LE latches it
+{
+  if (!staged)
+  {
+    gpio<DS1023_LE>::low(); // Make sure the LE is low
+#if !DS1023_SPI
+    gpio<DS1023_CLK>::low(); // Make sure the CLK is low (SERCOM5 idles it low)
+#endif
 
-  digitalWrite(DS1023_LE, HIGH); // Raise the LE
+    gpio<DS1023_LE>::high(); // Raise the LE
+  }
 
+#if DS1023_SPI
+  ds1023_spi_write(width); // MS bit first; returns after the last CLK cycle
+#else
   for (int i = 7; i >= 0; i--) // Clock the width bits out MS bit first
   {
-    digitalWrite(DS1023_D, ((width >> i) & 0x01)); // Set the data bit
-    digitalWrite(DS1023_D, ((width >> i) & 0x01)); // NOP
-    digitalWrite(DS1023_CLK, HIGH); // Raise the CLK
-    digitalWrite(DS1023_CLK, HIGH); // NOP
-    digitalWrite(DS1023_CLK, LOW); // Lower the CLK
-    digitalWrite(DS1023_CLK, LOW); // NOP
+    gpio<DS1023_D>::write((width >> i) & 0x01); // Set the data bit
+    gpio_delay_ns<DS1023_T_CLK_NS>(); // Data setup
+    gpio<DS1023_CLK>::high(); // Raise the CLK
+    gpio_delay_ns<DS1023_T_CLK_NS>();
+    gpio<DS1023_CLK>::low(); // Lower the CLK
+    gpio_delay_ns<DS1023_T_CLK_NS>();
   }
+#endif
+}
 
-  digitalWrite(DS1023_LE, LOW); // Make sure the LE is low
+uint16_t flasher_SET_PULSE_WIDTH(uint8_t width)
+// Configures the pulse width (DS1023 delay); discards staged settings
+{
+  uint16_t error = 0;
+
+  if (SEQUENCE_RUNNING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
+
+  ds1023_shift(width); // Overwrites a staged width without latching it
+
+  gpio<DS1023_LE>::low(); // Make sure the LE is low
+  staged = 0;
+  pulse_width = width;
 
   return error;
 }
 
-uint16_t flasher_READ_SERIAL_NO(uint8_t *serial_no)
-// Read the DS28CM00 serial number via Wire
-// The six serial number bytes are copied to serial_no LSB first (little endian)
-// TO DO: implement the X^8 + X^5 + X^4 + 1 CRC
+uint16_t flasher_STAGE_SETTINGS(uint8_t current, uint8_t width)
+// Preloads the LED current and pulse width without applying them
 {
   uint16_t error = 0;
 
-  Wire.beginTransmission(0x50); // Start communication with the DS28CM00
-  Wire.write(0x00); // Point to address 0 (family code)
-  Wire.endTransmission(false); // Restart
-
-  Wire.requestFrom(0x50, 8); // Request 8 bytes
+  if (SEQUENCE_RUNNING())
+  {
+    error = FLASHER_EBUSY;
+    return error;
+  }
 
-  if (Wire.available() < 8)
+  if (current > 0x0F)
   {
-    error = FLASHER_ESERIALNO;
+    error = FLASHER_EBVALUE;
     return error;
   }
 
-  char c = Wire.read(); // Read the first byte (family code)
+  ds1023_shift(width);
+  staged_current = current;
+  staged_width = width;
+  staged = 1;
 
-  if (c != 0x70) // Check that the family code is correct
+  return error;
+}
+
+uint16_t flasher_COMMIT_SETTINGS()
+// Applies the staged LED current and pulse width in two consecutive stores
+{
+  uint16_t error = 0;
+
+  if (SEQUENCE_RUNNING())
   {
-    error = FLASHER_ESERIALNO;
+    error = FLASHER_EBUSY;
     return error;
   }
 
-  for (int i = 0; i < 6; i++) // Read the six serial number bytes (LSB is read first)
+  if (!staged)
   {
-    c = Wire.read(); // Read the byte
-    *(serial_no + i) = c; // Store the byte
-    // TO DO: implement the X^8 + X^5 + X^4 + 1 CRC
+    error = FLASHER_ENOTSTAGED;
+    return error;
   }
 
-  c = Wire.read(); // Read the CRC byte
-  // TO DO: implement the X^8 + X^5 + X^4 + 1 CRC
+  gpio<DS1023_LE>::low(); // Latch the staged width
+  led_current_bus::write(staged_current);
+  staged = 0;
+  led_current = staged_current;
+  pulse_width = staged_width;
 
   return error;
 }
+
+static void apply_settings(uint8_t current, uint8_t width)
+// Applies an LED current and pulse width together, as STAGE then COMMIT do
+{
+  ds1023_shift(width);
+  gpio<DS1023_LE>::low(); // Latch the width
+  led_current_bus::write(current);
+  staged = 0;
+  led_current = current;
+  pulse_width = width;
+}
+
+// Dallas/Maxim CRC-8 (X^8 + X^5 + X^4 + 1, reflected), as appended by the
+// DS28CM00; the lookup table is generated by the compiler
+constexpr uint8_t crc8_maxim_entry(uint8_t crc, uint8_t bits = 8)
+{
+  return bits == 0 ? crc : crc8_maxim_entry((crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1, bits - 1);
+}
+
+template <uint16_t n, uint8_t... entries>
+struct crc8_maxim_table : crc8_maxim_table<n - 1, crc8_maxim_entry(n - 1), entries...> {};
+
+template <uint8_t... entries>
+struct crc8_maxim_table<0, entries...> {
+  static constexpr uint8_t table[sizeof...(entries)] = {entries...};
+};
+
+template <uint8_t... entries>
+constexpr uint8_t crc8_maxim_table<0, entries...>::table[sizeof...(entries)];
+
+typedef crc8_maxim_table<256> crc8_maxim_lut;
+static_assert(crc8_maxim_lut::table[1] == 0x5e && crc8_maxim_lut::table[255] == 0x35,
+              "CRC-8 table does not match the Dallas/Maxim polynomial");
+
+static uint8_t crc8_maxim(const uint8_t *data, uint8_t size)
+{
+  uint8_t crc = 0;
+  while (size--)
+    crc = crc8_maxim_lut::table[crc ^ *data++];
+
+  return crc;
+}
+
+static uint16_t ds28cm00_read(uint8_t *serial_no)
+// One read of the DS28CM00 ROM (family code, six serial bytes, CRC) via Wire
+{
+  uint8_t rom[8];
+
+  Wire.beginTransmission(0x50); // Start communication with the DS28CM00
+  Wire.write(0x00); // Point to address 0 (family code)
+  Wire.endTransmission(false); // Restart
+
+  Wire.requestFrom(0x50, 8); // Request 8 bytes
+
+  if (Wire.available() < 8)
+    return FLASHER_ESERIALNO;
+
+  for (int i = 0; i < 8; i++)
+    rom[i] = Wire.read();
+
+  if (crc8_maxim(rom, 7) != rom[7])
+    return FLASHER_ERXCHECKSUM;
+
+  if (rom[0] != 0x70) // Check that the family code is correct
+    return FLASHER_ESERIALNO;
+
+  memcpy(serial_no, &rom[1], 6); // LSB is read first
+  return 0;
+}
+
+uint16_t flasher_init_serial_no()
+// Reads the serial number into RAM, retrying reads that fail the CRC or are
+// not acknowledged; returns the error of the last attempt
+{
+  for (uint8_t attempt = 0; attempt < SERIAL_NO_ATTEMPTS; attempt++)
+  {
+    serial_no_error = ds28cm00_read(serial_no_cache);
+    if (!serial_no_error)
+      break;
+  }
+
+  return serial_no_error;
+}
+
+uint16_t flasher_READ_SERIAL_NO(uint8_t *serial_no)
+// Copies the serial number read at boot to serial_no LSB first (little endian)
+{
+  if (serial_no_error)
+    return serial_no_error;
+
+  memcpy(serial_no, serial_no_cache, sizeof(serial_no_cache));
+  return 0;
+}
+
+#if defined(ARDUINO_ARCH_SAMD)
+// PIN_LED2 is not on a timer output, so TCC0 only paces the edges: its
+// overflow and CC0 match events trigger DMAC beats that write the pin mask to
+// PORT OUTSET and OUTCLR (the DMAC cannot reach the IOBUS). The edges follow
+// the timer clock within the DMAC's trigger latency, and the pulse train runs
+// without the CPU.
+static const uint32_t pulse_pin_mask = gpio<PIN_LED2>::mask;
+
+static void pulse_descriptor(uint8_t channel, volatile uint32_t *dst, uint16_t count)
+{
+  DmacDescriptor *desc = &dmac_base[channel];
+
+  desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_WORD;
+  desc->BTCNT.reg = count;
+  desc->SRCADDR.reg = (uint32_t) &pulse_pin_mask;
+  desc->DSTADDR.reg = (uint32_t) dst;
+  desc->DESCADDR.reg = 0;
+
+  // The DMAC only writes back after the first beat
+  dmac_writeback[channel].BTCNT.reg = count;
+}
+
+void pulse_timer_start(uint16_t count, uint8_t prescaler, uint32_t period, uint32_t width,
+                       uint32_t delay)
+{
+  dmac_init();
+
+  PM->APBCMASK.reg |= PM_APBCMASK_TCC0;
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID_TCC0_TCC1;
+  while (GCLK->STATUS.bit.SYNCBUSY)
+    ;
+
+  TCC0->CTRLA.reg &= ~TCC_CTRLA_ENABLE;
+  while (TCC0->SYNCBUSY.bit.ENABLE)
+    ;
+  TCC0->CTRLA.reg = TCC_CTRLA_SWRST;
+  while (TCC0->SYNCBUSY.bit.SWRST)
+    ;
+
+  // Start delay ticks below the top so the first overflow (rising edge) comes
+  // delay ticks after enabling and no CC0 match precedes it
+  TCC0->CTRLA.reg = TCC_CTRLA_PRESCALER(prescaler) | TCC_CTRLA_PRESCSYNC_PRESC;
+  TCC0->WAVE.reg = TCC_WAVE_WAVEGEN_NFRQ;
+  TCC0->PER.reg = period - 1;
+  TCC0->CC[0].reg = width;
+  TCC0->COUNT.reg = period - delay;
+  while (TCC0->SYNCBUSY.reg)
+    ;
+
+  pulse_descriptor(DMAC_CH_PULSE_SET, &PORT->Group[gpio<PIN_LED2>::port].OUTSET.reg, count);
+  pulse_descriptor(DMAC_CH_PULSE_CLR, &PORT->Group[gpio<PIN_LED2>::port].OUTCLR.reg, count);
+
+  // Highest priority: a W5500 burst must not delay an edge
+  dmac_channel_init(DMAC_CH_PULSE_SET, TCC0_DMAC_ID_OVF, 3);
+  dmac_channel_init(DMAC_CH_PULSE_CLR, TCC0_DMAC_ID_MC_0, 3);
+  DMAC->CHID.reg = DMAC_CHID_ID(DMAC_CH_PULSE_CLR);
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+  DMAC->CHID.reg = DMAC_CHID_ID(DMAC_CH_PULSE_SET);
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+
+  TCC0->CTRLA.reg |= TCC_CTRLA_ENABLE;
+  while (TCC0->SYNCBUSY.bit.ENABLE)
+    ;
+}
+
+// Pulses whose rising edge is still to come
+uint16_t pulse_timer_remaining(void)
+{
+  return dmac_writeback[DMAC_CH_PULSE_SET].BTCNT.reg;
+}
+
+// 1 until the falling edge of the last pulse; the channel disables itself then
+uint8_t pulse_timer_busy(void)
+{
+  DMAC->CHID.reg = DMAC_CHID_ID(DMAC_CH_PULSE_CLR);
+  return (DMAC->CHCTRLA.reg & DMAC_CHCTRLA_ENABLE) != 0;
+}
+
+void pulse_timer_stop(void)
+{
+  TCC0->INTENCLR.reg = TCC_INTENCLR_OVF;
+  TCC0->CTRLA.reg &= ~TCC_CTRLA_ENABLE;
+  while (TCC0->SYNCBUSY.bit.ENABLE)
+    ;
+
+  DMAC->CHID.reg = DMAC_CHID_ID(DMAC_CH_PULSE_SET);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+  DMAC->CHID.reg = DMAC_CHID_ID(DMAC_CH_PULSE_CLR);
+  DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+
+  gpio<PIN_LED2>::low(); // A train stopped early may end high
+}
+
+static volatile uint8_t pulse_edge_stamped;
+static volatile uint32_t pulse_edge_us;
+
+// The overflow that triggers the rising edge; the ticks TCC0 counted since
+// take the interrupt latency out of the timestamp
+void TCC0_Handler(void)
+{
+  uint32_t now = micros();
+  TCC0->CTRLBSET.reg = TCC_CTRLBSET_CMD_READSYNC;
+  while (TCC0->SYNCBUSY.bit.CTRLB || TCC0->SYNCBUSY.bit.COUNT)
+    ;
+  uint32_t ticks = TCC0->COUNT.reg * pulse_timer_dividers[TCC0->CTRLA.bit.PRESCALER];
+
+  TCC0->INTENCLR.reg = TCC_INTENCLR_OVF;
+  TCC0->INTFLAG.reg = TCC_INTFLAG_OVF;
+  pulse_edge_us = now - ticks / (F_CPU / 1000000);
+  pulse_edge_stamped = 1;
+}
+
+void pulse_timer_stamp_edge(void)
+{
+  pulse_edge_stamped = 0;
+
+  // An overflow that came already is still flagged and taken at once
+  NVIC_SetPriority(TCC0_IRQn, 0);
+  NVIC_EnableIRQ(TCC0_IRQn);
+  TCC0->INTENSET.reg = TCC_INTENSET_OVF;
+}
+
+uint8_t pulse_timer_edge_us(uint32_t *us)
+{
+  if (!pulse_edge_stamped)
+    return 1;
+
+  *us = pulse_edge_us;
+  return 0;
+}
+#endif
+
+#if DS1023_SPI && defined(ARDUINO_ARCH_SAMD)
+// SERCOM5 as a transmit-only SPI master in mode 0 (data sampled on the rising
+// CLK, as the DS1023 does), MS bit first. DOPO 1 puts DO on PAD2 (D) and SCK
+// on PAD3 (CLK). The DS1023 serial output is not routed back to the MCU, so
+// the latched value cannot be read back.
+static_assert(1e9 * (DS1023_SPI_BAUD + 1) / F_CPU >= DS1023_T_CLK_NS,
+              "DS1023 CLK half period below DS1023_T_CLK_NS");
+
+// Switches a pin from the PORT to peripheral function C (SERCOM)
+template <uint32_t pin>
+static void ds1023_pin_sercom(void)
+{
+  constexpr uint8_t port = gpio<pin>::port;
+  constexpr uint8_t bit = gpio_pins[gpio_index(pin)].bit;
+
+  if (bit & 1)
+    PORT->Group[port].PMUX[bit >> 1].bit.PMUXO = PORT_PMUX_PMUXO_C_Val;
+  else
+    PORT->Group[port].PMUX[bit >> 1].bit.PMUXE = PORT_PMUX_PMUXE_C_Val;
+  PORT->Group[port].PINCFG[bit].reg |= PORT_PINCFG_PMUXEN;
+}
+
+void ds1023_spi_init(void)
+{
+  PM->APBCMASK.reg |= PM_APBCMASK_SERCOM5;
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID_SERCOM5_CORE;
+  while (GCLK->STATUS.bit.SYNCBUSY)
+    ;
+
+  SERCOM5->SPI.CTRLA.reg = SERCOM_SPI_CTRLA_SWRST;
+  while (SERCOM5->SPI.SYNCBUSY.bit.SWRST)
+    ;
+
+  SERCOM5->SPI.CTRLA.reg = SERCOM_SPI_CTRLA_MODE_SPI_MASTER | SERCOM_SPI_CTRLA_DOPO(1);
+  SERCOM5->SPI.CTRLB.reg = SERCOM_SPI_CTRLB_CHSIZE(0); // 8 bits, receiver off
+  SERCOM5->SPI.BAUD.reg = DS1023_SPI_BAUD;
+  SERCOM5->SPI.CTRLA.reg |= SERCOM_SPI_CTRLA_ENABLE;
+  while (SERCOM5->SPI.SYNCBUSY.bit.ENABLE)
+    ;
+
+  // CLK idles low from here on; the PORT keeps driving LE
+  ds1023_pin_sercom<DS1023_D>();
+  ds1023_pin_sercom<DS1023_CLK>();
+}
+
+// Returns once the last bit has been clocked out, so LE may fall right after
+void ds1023_spi_write(uint8_t data)
+{
+  SERCOM5->SPI.INTFLAG.reg = SERCOM_SPI_INTFLAG_TXC;
+  SERCOM5->SPI.DATA.reg = data;
+  while (!SERCOM5->SPI.INTFLAG.bit.TXC)
+    ;
+}
+#endif
@@ -6,19 +6,8 @@
 #include <SPI.h>
 #include <Wire.h>
 
-// Subsystem ID for the flashers
-// The iostack is "0"
-// The Dynamixel servos are "1"
-#define SYS_FLASHER 2
-
-// Error codes
-#define FLASHER_EBVALUE       1
-#define FLASHER_ESERIALNO     2
-#define FLASHER_ETIMEDOUT     128
-#define FLASHER_ERXCHECKSUM   256
-#define FLASHER_EMISMATCH     512
-#define FLASHER_ERDONLY       1024
-#define FLASHER_ERXFSM        32768
+// Subsystem ID (SYS_FLASHER) and error codes (FLASHER_E*)
+#include "protocol.h"
 
 // WIZnet W5500 Ethernet (SPI_2 : SERCOM4)
 // CS for the W5500 is "SS"
@@ -36,6 +25,38 @@
 #define DS1023_LE 8   // PA22
 #define DS1023_CLK 16 // PA21
 #define DS1023_D 15   // PA20
+#define DS1023_T_CLK_NS 50 // Minimum CLK pulse width, also used for data setup
+
+// Width byte shifted out by SERCOM5 in SPI mode (D on PA20/PAD2, CLK on
+// PA21/PAD3, both peripheral function C); 0 = bit-banged through gpio<>.
+// LE is a GPIO in both cases.
+#ifndef DS1023_SPI
+#if defined(ARDUINO_ARCH_SAMD) || defined(FLASHERCTL_HOST)
+#define DS1023_SPI 1
+#else
+#define DS1023_SPI 0
+#endif
+#endif
+
+// SERCOM BAUD for a CLK half period of at least DS1023_T_CLK_NS (62.5 ns at 48 MHz)
+#define DS1023_SPI_BAUD ((DS1023_T_CLK_NS * (F_CPU / 1000000) + 999) / 1000 - 1)
+
+// DS28CM00 reads at boot before the serial number is reported as missing
+#define SERIAL_NO_ATTEMPTS 3
+
+// Width of the TEST_PULSE produced by flasher_TEST_PULSE(2)
+#define TEST_PULSE_WIDTH_NS 1000
+
+// Pulse trains on TEST_PULSE (see flasher_PULSE_TRAIN)
+#define PULSE_TRAIN_MIN_EDGE_NS 500 // Minimum high and low time
+
+// Calibration sequences (see flasher_SEQUENCE_LOAD)
+#define SEQUENCE_MAX_STEPS 256
+#define SEQUENCE_TRIGGER_WIDTH_NS TEST_PULSE_WIDTH_NS // Width of the pulses on TEST_PULSE
+
+// Pulse at an absolute time (see flasher_FIRE_AT): TCC0 is armed this long
+// before the target, which keeps the delay within its 24-bit counter
+#define FIRE_ARM_WINDOW_US 100000
 
 // LED Current
 #define LED_A0 21 // PA14
@@ -45,6 +66,76 @@
 
 #define SPI_SPEED 1000000 // Default to 1MHz SPI transfers
 
+// Background temperature sampling (see flasher_tick)
+#define TEMPERATURE_CONVERSION_MS 240 // ADT7310 one-shot conversion time
+#define TEMPERATURE_PERIOD_MS 1000    // Default time between conversions; 0 = off
+#define TEMPERATURE_HISTORY 32        // Samples kept in the history ring
+#define TEMPERATURE_LSB_PER_C 128.0   // ADT7310 16-bit mode resolution
+
+struct __attribute__((packed)) flasher_temperature_sample {
+  uint32_t millis;  // millis() when the conversion was read
+  int16_t value;    // Temperature (1/128 C)
+};
+
+// Header of a CMD_READ_TEMPERATURE_HISTORY reply, followed by count samples
+struct __attribute__((packed)) flasher_temperature_summary {
+  uint32_t millis;     // millis() when the reply was assembled
+  uint16_t period_ms;
+  uint8_t count;       // Number of samples, oldest first
+  float min;           // C over the samples; NAN if there are none
+  float max;
+  float mean;
+};
+
+struct __attribute__((packed)) flasher_pulse_train {
+  uint16_t count;      // Number of pulses; 0 stops a running train
+  uint32_t period_ns;  // Rising edge to rising edge
+  uint32_t width_ns;
+};
+
+struct __attribute__((packed)) flasher_pulse_train_status {
+  uint8_t running;
+  uint16_t count;      // Pulses requested
+  uint16_t emitted;    // Pulses started so far
+};
+
+enum flasher_sequence_state {
+  FLASHER_SEQ_IDLE = 0,  // Nothing started since boot
+  FLASHER_SEQ_RUNNING,
+  FLASHER_SEQ_DONE,
+  FLASHER_SEQ_ABORTED,
+};
+
+struct __attribute__((packed)) flasher_sequence_step {
+  uint8_t current;     // LED current (0 to 15)
+  uint8_t width;       // Pulse width (DS1023 delay)
+  uint16_t pulses;     // Pulses on TEST_PULSE; 0 for none
+  uint32_t period_ns;  // Time between pulses
+  uint16_t dwell_ms;   // Wait after the last pulse before the next step
+};
+
+struct __attribute__((packed)) flasher_sequence_status {
+  uint8_t state;       // enum flasher_sequence_state
+  uint16_t step;       // Step being executed; nsteps once done
+  uint16_t nsteps;
+  uint16_t pulses;     // Pulses started in the current step
+};
+
+enum flasher_fire_state {
+  FLASHER_FIRE_IDLE = 0,   // Nothing scheduled since boot
+  FLASHER_FIRE_PENDING,    // Waiting to arm TCC0
+  FLASHER_FIRE_ARMED,      // TCC0 counting down to the pulse
+  FLASHER_FIRE_FIRED,
+  FLASHER_FIRE_MISSED,     // The main loop came too late to arm TCC0
+  FLASHER_FIRE_CANCELLED,
+};
+
+struct __attribute__((packed)) flasher_fire_status {
+  uint8_t state;       // enum flasher_fire_state
+  uint64_t target_us;  // Requested time (client time base)
+  uint64_t fired_us;   // Rising edge, timestamped by the disciplined clock; 0 until fired
+};
+
 uint16_t flasher_LED_BUILTIN(uint8_t on_off);
 uint16_t flasher_START_TEMPERATURE();
 float flasher_READ_TEMPERATURE(uint16_t *error);
@@ -52,8 +143,28 @@ uint16_t flasher_READ_SERIAL_NO(uint8_t *serial_no);
 uint16_t flasher_SET_LED_CURRENT(uint8_t current);
 uint16_t flasher_SET_PULSE_WIDTH(uint8_t width);
 uint16_t flasher_TEST_PULSE(uint8_t on_off);
+uint16_t flasher_STAGE_SETTINGS(uint8_t current, uint8_t width);
+uint16_t flasher_COMMIT_SETTINGS();
+uint8_t flasher_READ_TEMPERATURE_HISTORY(struct flasher_temperature_summary *summary,
+                                         struct flasher_temperature_sample *samples);
+uint16_t flasher_SET_TEMPERATURE_PERIOD(uint16_t period_ms);
+uint16_t flasher_PULSE_TRAIN(struct flasher_pulse_train *train);
+void flasher_PULSE_TRAIN_STATUS(struct flasher_pulse_train_status *status);
+uint16_t flasher_SEQUENCE_LOAD(uint16_t offset, const struct flasher_sequence_step *steps,
+                               uint8_t nsteps);
+uint16_t flasher_SEQUENCE_START();
+void flasher_SEQUENCE_ABORT();
+void flasher_SEQUENCE_STATUS(struct flasher_sequence_status *status);
+uint16_t flasher_FIRE_AT(uint64_t time_us);
+void flasher_FIRE_STATUS(struct flasher_fire_status *status);
+
+void flasher_init_ds1023();
+uint16_t flasher_init_serial_no();
+uint8_t flasher_latest_temperature(int16_t *value);
+void flasher_settings(uint8_t *current, uint8_t *width);
+void flasher_tick();
 
-void start_temperature(SPIClass this_spi, int this_cs);
-float read_temperature(SPIClass this_spi, int this_cs);
+template <uint32_t cs> void start_temperature(SPIClass &this_spi);
+template <uint32_t cs> int16_t read_temperature(SPIClass &this_spi);
 
 #endif
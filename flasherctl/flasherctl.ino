@@ -1,5 +1,9 @@
 #include "flasher.h"
+#include "gpio.h"
 #include "iostack.h"
+#include "log.h"
+#include "telemetry.h"
+#include "timesync.h"
 
 #include <SPI.h>
 // Define the SPIClass for the I2C/SPI Header using SERCOM0
@@ -15,15 +19,7 @@ SPIClass SPI_2 (&PERIPH_SPI2, PIN_SPI2_MISO, PIN_SPI2_SCK, PIN_SPI2_MOSI, PAD_SP
 static const uint16_t udp_listen_port = 512;
 static uint8_t udp_socket = 0xff;
 
-// Command codes (to match class FlasherCommand in flasherctl.py)
-enum flasherctl_cmd_code {CMD_LED_BUILTIN = 0x0000,
-                          CMD_START_TEMPERATURE,
-                          CMD_READ_TEMPERATURE,
-                          CMD_READ_SERIAL_NO,
-                          CMD_SET_LED_CURRENT,
-                          CMD_SET_PULSE_WIDTH,
-                          CMD_TEST_PULSE,
-                          CMD_REPORT_FLASHERCTL_ERR=0xffff};
+// Command codes: enum flasherctl_cmd_code in protocol.h
 
 // Command handlers
 enum iostack_error_code flasherctl_LED_BUILTIN(struct iostack_request *request);
@@ -33,17 +29,68 @@ enum iostack_error_code flasherctl_READ_SERIAL_NO(struct iostack_request *reques
 enum iostack_error_code flasherctl_SET_LED_CURRENT(struct iostack_request *request);
 enum iostack_error_code flasherctl_SET_PULSE_WIDTH(struct iostack_request *request);
 enum iostack_error_code flasherctl_TEST_PULSE(struct iostack_request *request);
-
-// Command definitions
-static struct iostack_cmd flasher_cmds[] = {{CMD_LED_BUILTIN, flasherctl_LED_BUILTIN},
-                                            {CMD_START_TEMPERATURE, flasherctl_START_TEMPERATURE},
-                                            {CMD_READ_TEMPERATURE, flasherctl_READ_TEMPERATURE},
-                                            {CMD_READ_SERIAL_NO, flasherctl_READ_SERIAL_NO},
-                                            {CMD_SET_LED_CURRENT, flasherctl_SET_LED_CURRENT},
-                                            {CMD_SET_PULSE_WIDTH, flasherctl_SET_PULSE_WIDTH},
-                                            {CMD_TEST_PULSE, flasherctl_TEST_PULSE}};
-
-static struct iostack_subsystem flasher_subsystem = {.id = SYS_FLASHER, .cmds = flasher_cmds};
+enum iostack_error_code flasherctl_STAGE_SETTINGS(struct iostack_request *request);
+enum iostack_error_code flasherctl_COMMIT_SETTINGS(struct iostack_request *request);
+enum iostack_error_code flasherctl_READ_TEMPERATURE_HISTORY(struct iostack_request *request);
+enum iostack_error_code flasherctl_SET_TEMPERATURE_PERIOD(struct iostack_request *request);
+enum iostack_error_code flasherctl_PULSE_TRAIN(struct iostack_request *request);
+enum iostack_error_code flasherctl_PULSE_TRAIN_STATUS(struct iostack_request *request);
+enum iostack_error_code flasherctl_SEQUENCE_LOAD(struct iostack_request *request);
+enum iostack_error_code flasherctl_SEQUENCE_START(struct iostack_request *request);
+enum iostack_error_code flasherctl_SEQUENCE_ABORT(struct iostack_request *request);
+enum iostack_error_code flasherctl_SEQUENCE_STATUS(struct iostack_request *request);
+enum iostack_error_code flasherctl_FIRE_AT(struct iostack_request *request);
+enum iostack_error_code flasherctl_FIRE_STATUS(struct iostack_request *request);
+
+// Command definitions: code, min and max payload size, handler
+static constexpr struct iostack_cmd flasher_cmds[] = {{CMD_LED_BUILTIN, 1, 1, flasherctl_LED_BUILTIN},
+                                                     {CMD_START_TEMPERATURE, 0, 0, flasherctl_START_TEMPERATURE},
+                                                     {CMD_READ_TEMPERATURE, 0, 0, flasherctl_READ_TEMPERATURE},
+                                                     {CMD_READ_SERIAL_NO, 0, 0, flasherctl_READ_SERIAL_NO},
+                                                     {CMD_SET_LED_CURRENT, 1, 1, flasherctl_SET_LED_CURRENT},
+                                                     {CMD_SET_PULSE_WIDTH, 1, 1, flasherctl_SET_PULSE_WIDTH},
+                                                     {CMD_TEST_PULSE, 1, 1, flasherctl_TEST_PULSE},
+                                                     {CMD_STAGE_SETTINGS, 2, 2, flasherctl_STAGE_SETTINGS},
+                                                     {CMD_COMMIT_SETTINGS, 0, 0, flasherctl_COMMIT_SETTINGS},
+                                                     {CMD_READ_TEMPERATURE_HISTORY, 0, 0, flasherctl_READ_TEMPERATURE_HISTORY},
+                                                     {CMD_SET_TEMPERATURE_PERIOD, 2, 2, flasherctl_SET_TEMPERATURE_PERIOD},
+                                                     {CMD_PULSE_TRAIN, sizeof(struct flasher_pulse_train), sizeof(struct flasher_pulse_train), flasherctl_PULSE_TRAIN},
+                                                     {CMD_PULSE_TRAIN_STATUS, 0, 0, flasherctl_PULSE_TRAIN_STATUS},
+                                                     {CMD_SEQUENCE_LOAD, 2, iostack_max_payload_size, flasherctl_SEQUENCE_LOAD},
+                                                     {CMD_SEQUENCE_START, 1, 1, flasherctl_SEQUENCE_START},
+                                                     {CMD_SEQUENCE_ABORT, 0, 0, flasherctl_SEQUENCE_ABORT},
+                                                     {CMD_SEQUENCE_STATUS, 0, 0, flasherctl_SEQUENCE_STATUS},
+                                                     {CMD_FIRE_AT, 8, 8, flasherctl_FIRE_AT},
+                                                     {CMD_FIRE_STATUS, 0, 0, flasherctl_FIRE_STATUS}};
+
+static_assert(iostack_cmds_indexed(flasher_cmds, sizeof(flasher_cmds) / sizeof(*flasher_cmds)),
+              "flasher_cmds must be ordered by command code");
+
+static_assert(sizeof(struct flasher_temperature_summary) +
+              TEMPERATURE_HISTORY * sizeof(struct flasher_temperature_sample) <= iostack_max_payload_size,
+              "temperature history does not fit in one response");
+
+static struct iostack_subsystem flasher_subsystem = {.id = SYS_FLASHER};
+
+// CMD_SEQUENCE_START flags
+#define SEQUENCE_PUSH_PROGRESS 0x01  // Push the status to the client at every step
+
+// Client to push sequence progress to, the socket it asked on, and what it
+// was last sent
+static struct w5500_udp_header sequence_client;
+static uint8_t sequence_socket;
+static uint8_t sequence_push = 0;
+static struct flasher_sequence_status sequence_pushed;
+
+// A pushed status: iostack header with ID 0 and the CMD_SEQUENCE_STATUS reply
+struct __attribute__((packed)) flasherctl_sequence_datagram {
+  uint16_t id;
+  uint8_t subsystem_id;
+  uint16_t response_code;
+  struct flasher_sequence_status status;
+};
+
+void flasherctl_sequence_push(void);
 
 void setup()
 {
@@ -69,6 +116,19 @@ void setup()
   pinMode(DS1023_D, OUTPUT); // Serial data input for the DS1023
   digitalWrite(DS1023_D, LOW);
 
+  // Serial communication via USB; up before the first gpio<> access, which
+  // relies on the GPIO table matching the board variant
+  Serial.begin(115200);
+  delay(10);
+  Serial.println("Flasher");
+  if (gpio_verify()) {
+    Serial.println(F("GPIO table does not match the board variant; cannot continue"));
+    while (1)
+      ;
+  }
+
+  flasher_init_ds1023(); // D and CLK move to SERCOM5 with DS1023_SPI
+
   // LED Current: default to minimum brightness (A0-A3 LOW)
   pinMode(LED_A0, OUTPUT);
   digitalWrite(LED_A0, LOW);
@@ -92,14 +152,24 @@ void setup()
   // Start I2C for the DS28CM00 serial number
   Wire.begin();
 
+  // Read the serial number once; CMD_READ_SERIAL_NO and discovery replies
+  // answer from RAM
+  uint16_t serial_no_error = flasher_init_serial_no();
+  if (!serial_no_error) {
+    uint8_t serial_no[6];
+    flasher_READ_SERIAL_NO(serial_no);
+    iostack_set_serial_no(serial_no);
+  }
+
   // Initialise the temperature sensor - to stop the continuous conversions
+  // and take the first sample
   flasher_START_TEMPERATURE();
 
   // Initialise subsystems
-  // - serial communication via USB
-  Serial.begin(115200);
-  delay(10);
-  Serial.println("Flasher");
+  if (serial_no_error) {
+    Serial.print(F("Could not read the serial number, error "));
+    Serial.println(serial_no_error);
+  }
   // - w5500 & I/O stack
   Serial.println("Initialising I/O stack...");
   udp_socket = iostack_init(udp_listen_port);
@@ -115,12 +185,61 @@ void setup()
                             sizeof(flasher_cmds) / sizeof(*flasher_cmds));
   iostack_register_subsystem(&flasher_subsystem);
 
+  Serial.println(F("  registering telemetry subsystem..."));
+  telemetry_register();
+
+  Serial.println(F("  registering time sync subsystem..."));
+  timesync_register();
+
 }
 
 
 void loop()
 {
-  iostack_tick(udp_socket);
+  iostack_tick();
+
+  // Keep the 64-bit clock behind scheduled pulses running
+  timesync_tick();
+
+  // Start or read back the background temperature conversion when due
+  flasher_tick();
+  flasherctl_sequence_push();
+
+  // Push telemetry to the subscribers that are due
+  telemetry_tick(iostack_socket(IOSTACK_CHANNEL_TELEMETRY));
+
+  // Print log records while nothing else is waiting
+  log_flush();
+
+  // Sleep until the W5500 raises INTn unless datagrams are left over (no-op
+  // when polling)
+  if (!iostack_pending())
+    w55_irq_sleep();
+}
+
+
+// Sends the sequence status to the client that asked for it when a step
+// starts and when the sequence ends
+void flasherctl_sequence_push(void)
+{
+  if (!sequence_push)
+    return;
+
+  struct flasherctl_sequence_datagram datagram = {0, SYS_FLASHER, CMD_SEQUENCE_STATUS};
+  flasher_SEQUENCE_STATUS(&datagram.status);
+
+  if (datagram.status.state == sequence_pushed.state &&
+      datagram.status.step == sequence_pushed.step)
+    return;
+
+  sequence_pushed = datagram.status;
+  if (datagram.status.state != FLASHER_SEQ_RUNNING)
+    sequence_push = 0;
+
+  if (w55_udp_begin(sequence_socket, &sequence_client) ||
+      w55_udp_write(sequence_socket, (uint8_t *) &datagram, sizeof(datagram)) != sizeof(datagram))
+    return;
+  w55_udp_end(sequence_socket);
 }
 
 
@@ -142,9 +261,6 @@ void flasherctl_send_acknowledge(struct iostack_request *request)
 // Turns the controller LED pin on or off
 enum iostack_error_code flasherctl_LED_BUILTIN(struct iostack_request *request)
 {
-  if (request->size != 1)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint8_t *on_off = (uint8_t *) request->payload;
   uint16_t error = flasher_LED_BUILTIN(*on_off);
 
@@ -159,9 +275,6 @@ enum iostack_error_code flasherctl_LED_BUILTIN(struct iostack_request *request)
 
 enum iostack_error_code flasherctl_START_TEMPERATURE(struct iostack_request *request)
 {
-  if (request->size != 0)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint16_t error = flasher_START_TEMPERATURE();
 
   if (error == 0) {
@@ -175,9 +288,6 @@ enum iostack_error_code flasherctl_START_TEMPERATURE(struct iostack_request *req
 
 enum iostack_error_code flasherctl_READ_TEMPERATURE(struct iostack_request *request)
 {
-  if (request->size != 0)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint16_t error = 0;
   float val = flasher_READ_TEMPERATURE(&error);
 
@@ -194,9 +304,6 @@ enum iostack_error_code flasherctl_READ_TEMPERATURE(struct iostack_request *requ
 
 enum iostack_error_code flasherctl_READ_SERIAL_NO(struct iostack_request *request)
 {
-  if (request->size != 0)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint8_t serial_no[6];
   uint8_t *serial_ptr = serial_no;
   uint16_t error = flasher_READ_SERIAL_NO(serial_ptr);
@@ -214,9 +321,6 @@ enum iostack_error_code flasherctl_READ_SERIAL_NO(struct iostack_request *reques
 
 enum iostack_error_code flasherctl_SET_LED_CURRENT(struct iostack_request *request)
 {
-  if (request->size != 1)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint8_t *current = (uint8_t *) request->payload;
   uint16_t error = flasher_SET_LED_CURRENT((uint8_t) *current);
 
@@ -231,9 +335,6 @@ enum iostack_error_code flasherctl_SET_LED_CURRENT(struct iostack_request *reque
 
 enum iostack_error_code flasherctl_SET_PULSE_WIDTH(struct iostack_request *request)
 {
-  if (request->size != 1)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint8_t *width = (uint8_t *) request->payload;
   uint16_t error = flasher_SET_PULSE_WIDTH((uint8_t) *width);
 
@@ -248,9 +349,6 @@ enum iostack_error_code flasherctl_SET_PULSE_WIDTH(struct iostack_request *reque
 
 enum iostack_error_code flasherctl_TEST_PULSE(struct iostack_request *request)
 {
-  if (request->size != 1)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint8_t *on_off = (uint8_t *) request->payload;
   uint16_t error = flasher_TEST_PULSE((uint8_t) *on_off);
 
@@ -262,3 +360,177 @@ enum iostack_error_code flasherctl_TEST_PULSE(struct iostack_request *request)
 
   return IOSTACK_ERR_OKAY;
 }
+
+enum iostack_error_code flasherctl_STAGE_SETTINGS(struct iostack_request *request)
+{
+  uint8_t current = request->payload[0];
+  uint8_t width = request->payload[1];
+  uint16_t error = flasher_STAGE_SETTINGS(current, width);
+
+  if (error == 0) {
+    flasherctl_send_acknowledge(request);
+  } else {
+    flasherctl_send_error(request, error);
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_COMMIT_SETTINGS(struct iostack_request *request)
+{
+  uint16_t error = flasher_COMMIT_SETTINGS();
+
+  if (error == 0) {
+    flasherctl_send_acknowledge(request);
+  } else {
+    flasherctl_send_error(request, error);
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_READ_TEMPERATURE_HISTORY(struct iostack_request *request)
+{
+  struct flasher_temperature_summary summary;
+  struct flasher_temperature_sample samples[TEMPERATURE_HISTORY];
+  uint8_t count = flasher_READ_TEMPERATURE_HISTORY(&summary, samples);
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, &summary, sizeof(summary));
+  iostack_response_write(request, samples, count * sizeof(*samples));
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_SET_TEMPERATURE_PERIOD(struct iostack_request *request)
+{
+  uint16_t *period_ms = (uint16_t *) request->payload;
+  uint16_t error = flasher_SET_TEMPERATURE_PERIOD(*period_ms);
+
+  if (error == 0) {
+    flasherctl_send_acknowledge(request);
+  } else {
+    flasherctl_send_error(request, error);
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_PULSE_TRAIN(struct iostack_request *request)
+{
+  struct flasher_pulse_train train;
+  memcpy(&train, request->payload, sizeof(train));
+  uint16_t error = flasher_PULSE_TRAIN(&train);
+
+  if (error) {
+    flasherctl_send_error(request, error);
+  } else {
+    iostack_response_begin(request, request->request_code);
+    iostack_response_write(request, &train, sizeof(train));
+    iostack_response_end(request);
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_PULSE_TRAIN_STATUS(struct iostack_request *request)
+{
+  struct flasher_pulse_train_status status;
+  flasher_PULSE_TRAIN_STATUS(&status);
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, &status, sizeof(status));
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+// Payload: uint16 offset of the first step, then the steps
+enum iostack_error_code flasherctl_SEQUENCE_LOAD(struct iostack_request *request)
+{
+  uint16_t offset;
+  uint16_t size = request->size - sizeof(offset);
+
+  if (size % sizeof(struct flasher_sequence_step))
+    return IOSTACK_ERR_INVALID_SIZE;
+
+  memcpy(&offset, request->payload, sizeof(offset));
+  uint16_t error = flasher_SEQUENCE_LOAD(offset,
+                                         (struct flasher_sequence_step *) &request->payload[sizeof(offset)],
+                                         size / sizeof(struct flasher_sequence_step));
+
+  if (error == 0) {
+    flasherctl_send_acknowledge(request);
+  } else {
+    flasherctl_send_error(request, error);
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_SEQUENCE_START(struct iostack_request *request)
+{
+  uint8_t flags = request->payload[0];
+  uint16_t error = flasher_SEQUENCE_START();
+
+  if (error == 0) {
+    sequence_push = flags & SEQUENCE_PUSH_PROGRESS;
+    sequence_client = request->udp_header;
+    sequence_socket = request->socket;
+    sequence_pushed.state = FLASHER_SEQ_IDLE;
+    flasherctl_send_acknowledge(request);
+  } else {
+    flasherctl_send_error(request, error);
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_SEQUENCE_ABORT(struct iostack_request *request)
+{
+  flasher_SEQUENCE_ABORT();
+  flasherctl_send_acknowledge(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_SEQUENCE_STATUS(struct iostack_request *request)
+{
+  struct flasher_sequence_status status;
+  flasher_SEQUENCE_STATUS(&status);
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, &status, sizeof(status));
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+// Payload: uint64 time of the pulse in the client's time base (us); 0 cancels
+enum iostack_error_code flasherctl_FIRE_AT(struct iostack_request *request)
+{
+  uint64_t time_us;
+  memcpy(&time_us, request->payload, sizeof(time_us));
+  uint16_t error = flasher_FIRE_AT(time_us);
+
+  if (error == 0) {
+    flasherctl_send_acknowledge(request);
+  } else {
+    flasherctl_send_error(request, error);
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+enum iostack_error_code flasherctl_FIRE_STATUS(struct iostack_request *request)
+{
+  struct flasher_fire_status status;
+  flasher_FIRE_STATUS(&status);
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, &status, sizeof(status));
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
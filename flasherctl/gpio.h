@@ -0,0 +1,149 @@
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
+// Compile-time GPIO access for the pins in flasher.h
+//
+// gpio<pin>::high()/low() compile to a single store to the pin's PORT
+// OUTSET/OUTCLR register, without the g_APinDescription lookup that
+// digitalWrite() does on every call. Timing between edges comes from
+// gpio_delay_ns<>(), not from the duration of the calls themselves.
+
+#include <Arduino.h>
+
+#include "flasher.h"
+
+// Use the single-cycle I/O bus where the core exposes it
+#ifdef PORT_IOBUS
+#define GPIO_PORT PORT_IOBUS
+#else
+#define GPIO_PORT PORT
+#endif
+
+// Minimum number of CPU cycles covering ns nanoseconds
+#define GPIO_NS_TO_CYCLES(ns) (((ns) * (F_CPU / 1000000) + 999) / 1000)
+
+struct gpio_pin_desc {
+  uint8_t pin;
+  uint8_t port;
+  uint8_t bit;
+};
+
+// Port and bit of each pin, as in the controller board's variant.cpp
+// (checked against g_APinDescription at boot by gpio_verify())
+static constexpr struct gpio_pin_desc gpio_pins[] = {
+  {SS, PORTA, 18},          // W5500 CS
+  {PIN_LED2, PORTB, 3},     // TEST_PULSE
+  {ADT7310_CS, PORTA, 16},
+  {DS1023_LE, PORTA, 22},
+  {DS1023_CLK, PORTA, 21},
+  {DS1023_D, PORTA, 20},
+  {LED_A0, PORTA, 14},
+  {LED_A1, PORTA, 13},
+  {LED_A2, PORTA, 12},
+  {LED_A3, PORTA, 15},
+};
+
+static constexpr uint8_t gpio_npins = sizeof(gpio_pins) / sizeof(*gpio_pins);
+
+constexpr uint8_t gpio_index(uint32_t pin, uint8_t i = 0)
+{
+  return i == gpio_npins ? i : gpio_pins[i].pin == pin ? i : gpio_index(pin, i + 1);
+}
+
+template <uint32_t pin>
+struct gpio {
+  static_assert(gpio_index(pin) < gpio_npins, "pin is missing from gpio_pins");
+
+  static constexpr uint8_t port = gpio_pins[gpio_index(pin)].port;
+  static constexpr uint32_t mask = 1ul << gpio_pins[gpio_index(pin)].bit;
+
+  __attribute__((always_inline)) static inline void high(void)
+  {
+    GPIO_PORT->Group[port].OUTSET.reg = mask;
+  }
+
+  __attribute__((always_inline)) static inline void low(void)
+  {
+    GPIO_PORT->Group[port].OUTCLR.reg = mask;
+  }
+
+  __attribute__((always_inline)) static inline void write(uint8_t value)
+  {
+    if (value)
+      high();
+    else
+      low();
+  }
+};
+
+// Spreads bit i of a value onto the i-th pin of a list
+template <uint32_t... pins>
+struct gpio_spread;
+
+template <>
+struct gpio_spread<> {
+  static constexpr uint32_t mask = 0;
+  static constexpr uint32_t bits(uint32_t) { return 0; }
+  static constexpr bool same_port(uint8_t) { return true; }
+};
+
+template <uint32_t pin, uint32_t... rest>
+struct gpio_spread<pin, rest...> {
+  static constexpr uint32_t mask = gpio<pin>::mask | gpio_spread<rest...>::mask;
+
+  static constexpr uint32_t bits(uint32_t value)
+  {
+    return ((value & 1) ? gpio<pin>::mask : 0) | gpio_spread<rest...>::bits(value >> 1);
+  }
+
+  static constexpr bool same_port(uint8_t port)
+  {
+    return gpio<pin>::port == port && gpio_spread<rest...>::same_port(port);
+  }
+};
+
+// Pins on one port that are written together, e.g. a binary-coded setting.
+// write() changes all of them in the same cycle with a single OUTTGL store,
+// so no intermediate value ever appears on the pins.
+template <uint32_t first, uint32_t... rest>
+struct gpio_bus {
+  typedef gpio_spread<first, rest...> spread;
+
+  static constexpr uint8_t port = gpio<first>::port;
+  static constexpr uint32_t mask = spread::mask;
+  static_assert(spread::same_port(port), "gpio_bus pins must share a port");
+
+  __attribute__((always_inline)) static inline void write(uint32_t value)
+  {
+    uint32_t out = GPIO_PORT->Group[port].OUT.reg;
+    GPIO_PORT->Group[port].OUTTGL.reg = (out ^ spread::bits(value)) & mask;
+  }
+};
+
+// Busy-waits for at least the given number of CPU cycles
+template <uint32_t cycles>
+__attribute__((always_inline)) inline void gpio_delay_cycles(void)
+{
+  __asm__ __volatile__(".rept %c0\n\tnop\n\t.endr" : : "i" (cycles));
+}
+
+template <uint32_t ns>
+__attribute__((always_inline)) inline void gpio_delay_ns(void)
+{
+  gpio_delay_cycles<GPIO_NS_TO_CYCLES(ns)>();
+}
+
+// Returns 0 if gpio_pins matches the core's pin table
+inline uint8_t gpio_verify(void)
+{
+  for (uint8_t i = 0; i < gpio_npins; i++) {
+    const PinDescription *desc = &g_APinDescription[gpio_pins[i].pin];
+    if ((uint8_t) desc->ulPort != gpio_pins[i].port ||
+        desc->ulPin != gpio_pins[i].bit)
+      return 1;
+  }
+
+  return 0;
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "iostack.h"
+#include "log.h"
 
 // Updated to use https://github.com/FrankBoesing/FastCRC
 #include <FastCRC.h>
@@ -11,10 +12,14 @@ FastCRC16 CRC16;
 enum iostack_error_code iostack_handle_register_read(struct iostack_request *request);
 enum iostack_error_code iostack_handle_register_write(struct iostack_request *request);
 enum iostack_error_code iostack_handle_ping(struct iostack_request *request);
+enum iostack_error_code iostack_handle_batch(struct iostack_request *request);
+enum iostack_error_code iostack_handle_reset_stats(struct iostack_request *request);
+enum iostack_error_code iostack_handle_group(struct iostack_request *request);
 
 // Special handlers
 enum iostack_error_code iostack_handle_ethernet_configuration_read(struct iostack_request *request);
 enum iostack_error_code iostack_handle_ethernet_configuration_write(struct iostack_request *request, uint8_t *payload, uint16_t size);
+static void iostack_send_acknowledge(struct iostack_request *request, uint16_t code);
 
 // Random Locally Administered Unicast MAC Addresses:
 // https://www.hellion.org.uk/cgi-bin/randmac.pl?scope=local&type=unicast
@@ -26,50 +31,123 @@ enum iostack_error_code iostack_handle_ethernet_configuration_write(struct iosta
 // Configuration
 struct iostack_config iostack_default_config = {
   .magic = iostack_eeprom_magic,
-  .version = 0,
+  .version = IOSTACK_CONFIG_VERSION,
   .checksum = 0,  // requires update
   .static_ethernet_config = {
     .gateway_addr = {192, 168, 0, 1},
     .subnet_mask = {255, 255, 252, 0},
     .mac_address = {0, 0, 0, 0, 0, 0},  // requires update
     .ip_address = {192, 168, 0, 200}
-  }
+  },
+  .groups = {IOSTACK_GROUP_NONE}
 };
 
 struct iostack_config iostack_config;
 
-// Commands
-enum iostack_cmd_code {CMD_READ_REG=0x0000, CMD_WRITE_REG, CMD_PING, CMD_REPORT_ERR=0xffff};
-
-enum iostack_reg {REG_ETH_CFG=0x0000};
+// Commands (enum iostack_cmd_code) and registers (enum iostack_reg) are in
+// protocol.h
+static constexpr struct iostack_cmd iostack_cmds[] =
+  {{CMD_READ_REG, 2, 3, iostack_handle_register_read},  // REG_CMD_STATS takes a page number
+   {CMD_WRITE_REG, 3, iostack_max_payload_size, iostack_handle_register_write},
+   {CMD_PING, 0, iostack_max_payload_size, iostack_handle_ping},
+   {CMD_BATCH, 0, iostack_max_payload_size, iostack_handle_batch},
+   {CMD_RESET_STATS, 0, 0, iostack_handle_reset_stats},
+   {CMD_GROUP, sizeof(struct iostack_group_request), iostack_max_payload_size, iostack_handle_group}};
 
-static struct iostack_cmd iostack_cmds[] =
-  {{CMD_READ_REG, iostack_handle_register_read},
-   {CMD_WRITE_REG, iostack_handle_register_write},
-   {CMD_PING, iostack_handle_ping}};
+static_assert(iostack_cmds_indexed(iostack_cmds, sizeof(iostack_cmds) / sizeof(*iostack_cmds)),
+              "iostack_cmds must be ordered by command code");
 
 // Subsystems
 static struct iostack_subsystem iostack_subsystem = {
   .id = SYS_IOSTACK,
   .cmds = iostack_cmds,
-  .prev = NULL,
-  .next = NULL
+  .ncmds = sizeof(iostack_cmds) / sizeof(*iostack_cmds)
 };
 
-struct iostack_subsystem *iostack_subsystems = &iostack_subsystem;
+// Dispatch table, indexed by subsystem ID
+static struct iostack_subsystem *iostack_subsystems[IOSTACK_MAX_SUBSYSTEMS] =
+  {&iostack_subsystem};
+
+// W5500 buffer memory (KB) of each channel, and the datagrams it may serve
+// in a tick once the channels before it are empty (0: all queued)
+static const struct {
+  uint8_t rx_kb;
+  uint8_t tx_kb;
+  uint8_t budget;
+} channel_config[IOSTACK_CHANNELS] = {
+  {4, 4, 0},  // Control
+  {2, 8, 4},  // Telemetry: small requests, pushes to every subscriber
+  {8, 2, 1},  // Bulk: full-size requests that keep the handler busy
+};
 
+static uint8_t channel_sockets[IOSTACK_CHANNELS];
 
-uint16_t iostack_calculate_checksum(struct iostack_config *cfg)
+// Sockets with datagrams that may be waiting; left set for channels whose
+// budget ran out
+static uint8_t ready_sockets = 0;
+
+// Requests that were too small or answered with an iostack error
+static uint32_t request_errors = 0;
+
+// Per-command statistics (see struct iostack_cmd_stats)
+static struct iostack_cmd_stats cmd_stats[IOSTACK_STATS_SLOTS];
+static uint8_t cmd_stats_used = 0;
+static uint32_t cmd_stats_untracked = 0;
+static uint32_t cmd_stats_rejected = 0;
+static uint32_t cmd_stats_reset_ms = 0;
+
+// micros() when the request being served was read off the W5500
+static uint32_t request_received_us;
+
+// Set once the request being served was found a handler; others only count
+// as rejected, so that bogus codes cannot take up the statistics slots
+static uint8_t request_dispatched;
+
+// Outcome of the last response, for the statistics
+static uint8_t response_sent;
+static uint8_t response_suppressed;  // No reply was asked for
+static uint8_t response_error;
+static uint32_t response_sent_us;
+
+static_assert(IOSTACK_STATS_PER_PAGE > 0, "REG_CMD_STATS page holds no entries");
+
+// Response being assembled; iostack_response_end() writes it to the W5500 in
+// one burst instead of a transfer per iostack_response_write()
+static uint8_t response[iostack_header_size + iostack_max_payload_size];
+static uint16_t response_size;
+static uint16_t response_limit;  // Lowered to response_size when a write fails
+
+// Appended to REG_ETH_CFG replies once set
+static uint8_t serial_no[IOSTACK_SERIAL_NO_SIZE];
+static uint8_t serial_no_valid = 0;
+
+struct iostack_batch {
+  uint8_t data[iostack_max_payload_size];
+  uint16_t size;
+  uint16_t record;   // Offset of the open response record
+  uint8_t overflow;  // A reply in the open record was truncated
+};
+
+// Replies of CMD_BATCH and CMD_GROUP, which do not nest
+static struct iostack_batch batch;
+
+
+// Checksum of the configuration after the checksum field, up to end
+static uint16_t iostack_checksum(struct iostack_config *cfg, uint16_t end)
 {
   uint8_t *data = (uint8_t *) &cfg->checksum + 2;
-  uint16_t size = sizeof(struct iostack_config) -
-                  ((uint8_t *) &cfg->checksum + 2 - (uint8_t *) cfg);
+  uint16_t size = end - ((uint8_t *) &cfg->checksum + 2 - (uint8_t *) cfg);
 
   uint16_t crc = CRC16.x25(data, size);
 
   return crc;
 }
 
+uint16_t iostack_calculate_checksum(struct iostack_config *cfg)
+{
+  return iostack_checksum(cfg, sizeof(struct iostack_config));
+}
+
 void eeprom_update_block(struct iostack_config *cfg, uint16_t base, size_t size_of)
 {
   uint8_t value;
@@ -173,7 +251,7 @@ void iostack_query_mac_address(uint8_t mac[6])
 
 
 void iostack_register_commands(struct iostack_subsystem *subsystem,
-                               struct iostack_cmd *cmds, uint8_t ncmds)
+                               const struct iostack_cmd *cmds, uint8_t ncmds)
 {
   if (!subsystem)
     return;
@@ -183,18 +261,24 @@ void iostack_register_commands(struct iostack_subsystem *subsystem,
     ncmds = 0;
   }
 
-  subsystem->cmds = cmds;
-
+  // Dispatch indexes the table by code; stop at the first entry out of place
   for (uint8_t i = 0; i < ncmds; ++i) {
-    cmds[i].prev = i > 0 ? &cmds[i - 1] : NULL;
-    cmds[i].next = i < ncmds ? &cmds[i + 1] : NULL;
+    if (cmds[i].code != i) {
+      Serial.print(F("  command table not ordered by code, ignoring codes from "));
+      Serial.println(i);
+      ncmds = i;
+      break;
+    }
   }
+
+  subsystem->cmds = cmds;
+  subsystem->ncmds = ncmds;
 }
 
 
 int8_t iostack_init(uint16_t udp_listen_port)
 {
-  // Initialise the commands linked list
+  // Validate the command table
   iostack_register_commands(&iostack_subsystem, iostack_cmds,
                             sizeof(iostack_cmds) / sizeof(*iostack_cmds));
 
@@ -203,9 +287,22 @@ int8_t iostack_init(uint16_t udp_listen_port)
   eeprom_read_block(&iostack_config, iostack_eeprom_base,
                     sizeof(struct iostack_config));
 
+  uint8_t valid = iostack_config.magic == iostack_eeprom_magic &&
+                  iostack_calculate_checksum(&iostack_config) == iostack_config.checksum;
+
+  // Keep the network configuration of version 0, which had no groups
+  if (!valid && iostack_config.magic == iostack_eeprom_magic && iostack_config.version == 0 &&
+      iostack_checksum(&iostack_config, offsetof(struct iostack_config, groups)) ==
+          iostack_config.checksum) {
+    Serial.print(F("upgrading... "));
+    iostack_config.version = IOSTACK_CONFIG_VERSION;
+    memset(iostack_config.groups, IOSTACK_GROUP_NONE, sizeof(iostack_config.groups));
+    iostack_update_eeprom();
+    valid = 1;
+  }
+
   // Validate content
-  if (iostack_config.magic != iostack_eeprom_magic ||
-      iostack_calculate_checksum(&iostack_config) != iostack_config.checksum) {
+  if (!valid) {
     Serial.println(F("invalid"));
 
     // Generate default configuration
@@ -246,9 +343,22 @@ int8_t iostack_init(uint16_t udp_listen_port)
       ;
   }
 
-  // Open UDP socket
-  Serial.println(F("  opening UDP socket..."));
-  uint8_t udp_socket = w55_udp_open(udp_listen_port);
+  // Open one UDP socket per channel
+  Serial.println(F("  opening UDP sockets..."));
+  uint8_t polling = 0;
+  for (uint8_t c = 0; c < IOSTACK_CHANNELS; c++) {
+    channel_sockets[c] = w55_udp_open(udp_listen_port + c, channel_config[c].rx_kb,
+                                      channel_config[c].tx_kb);
+    if (channel_sockets[c] >= W5500_NUM_SOCKETS)
+      return W5500_NUM_SOCKETS;
+
+    polling |= w55_irq_enable(channel_sockets[c]);
+  }
+
+  if (!polling)
+    Serial.println(F("  receiving on INTn interrupts"));
+  else
+    Serial.println(F("  polling for received packets"));
 
   Serial.print(F("  listening on "));
   Serial.print(iostack_config.static_ethernet_config.ip_address[0]);
@@ -259,10 +369,12 @@ int8_t iostack_init(uint16_t udp_listen_port)
   Serial.print(F("."));
   Serial.print(iostack_config.static_ethernet_config.ip_address[3]);
   Serial.print(F(":"));
-  Serial.println(udp_listen_port);
+  Serial.print(udp_listen_port);
+  Serial.print(F("-"));
+  Serial.println(udp_listen_port + IOSTACK_CHANNELS - 1);
 
   // TODO: Propagate errors
-  return udp_socket;
+  return channel_sockets[IOSTACK_CHANNEL_CONTROL];
 }
 
 
@@ -274,10 +386,29 @@ uint8_t iostack_response_begin(struct iostack_request *request,
 
   request->response_code = response_code;
 
-  if (w55_udp_begin(request->socket, &request->udp_header) ||
-      w55_udp_write(request->socket, (uint8_t *) request,
-                    iostack_header_size) != iostack_header_size)
-    return 1;
+  if (request->batch) {
+    // Open a record in the combined response; iostack_batch_close completes it
+    struct iostack_batch *batch = request->batch;
+    if (batch->size + sizeof(struct iostack_batch_response) > sizeof(batch->data))
+      return 1;
+
+    struct iostack_batch_response *record =
+        (struct iostack_batch_response *) &batch->data[batch->size];
+    record->subsystem_id = request->subsystem_id;
+    record->response_code = response_code;
+    record->status = IOSTACK_ERR_OKAY;
+    record->size = 0;
+
+    batch->record = batch->size;
+    batch->size += sizeof(struct iostack_batch_response);
+    batch->overflow = 0;
+  } else {
+    response_error = response_code == SUBSYSTEM_REPORT_ERR ||
+                     (request->subsystem_id == SYS_IOSTACK && response_code == IOSTACK_REPORT_ERR);
+    memcpy(response, request, iostack_header_size);
+    response_size = iostack_header_size;
+    response_limit = sizeof(response);
+  }
 
   request->response_state = 1;
   return 0;
@@ -290,7 +421,33 @@ uint16_t iostack_response_write(struct iostack_request *request, void *src,
   if (request->response_state != 1)
     return 0;
 
-  return w55_udp_write(request->socket, (uint8_t *) src, size);
+  if (request->batch) {
+    struct iostack_batch *batch = request->batch;
+    struct iostack_batch_response *record =
+        (struct iostack_batch_response *) &batch->data[batch->record];
+
+    if (size > sizeof(batch->data) - batch->size) {
+      size = sizeof(batch->data) - batch->size;
+      batch->overflow = 1;
+    }
+
+    memcpy(&batch->data[batch->size], src, size);
+    batch->size += size;
+    record->size += size;
+
+    return size;
+  }
+
+  // Stop writing if one part did not fit, as w55_udp_write() does
+  if (size == 0 || size > response_limit - response_size) {
+    response_limit = response_size;
+    return 0;
+  }
+
+  memcpy(&response[response_size], src, size);
+  response_size += size;
+
+  return size;
 }
 
 
@@ -300,13 +457,25 @@ uint8_t iostack_response_end(struct iostack_request *request)
     return 1;
 
   request->response_state = 2;
-  return w55_udp_end(request->socket);
+
+  if (request->batch)
+    return 0;
+
+  if (w55_udp_begin(request->socket, &request->udp_header) ||
+      w55_udp_write(request->socket, response, response_size) != response_size ||
+      w55_udp_end(request->socket))
+    return 1;
+
+  response_sent = 1;
+  response_sent_us = micros();
+
+  return 0;
 }
 
 
 enum iostack_error_code iostack_handle_ping(struct iostack_request *request)
 {
-  Serial.println(F("ping request received"));
+  LOG_DEBUG("ping request received");
 
   iostack_response_begin(request, request->request_code);
   iostack_response_write(request, request->payload, request->size);
@@ -317,45 +486,152 @@ enum iostack_error_code iostack_handle_ping(struct iostack_request *request)
 }
 
 
+// Replies with the page-th group of IOSTACK_STATS_PER_PAGE statistics entries
+static enum iostack_error_code iostack_handle_stats_read(struct iostack_request *request,
+                                                         uint8_t page)
+{
+  struct iostack_stats_header header;
+  header.uptime_ms = millis();
+  header.reset_ms = cmd_stats_reset_ms;
+  header.untracked = cmd_stats_untracked;
+  header.rejected = cmd_stats_rejected;
+  header.nentries = cmd_stats_used;
+  header.first = page * IOSTACK_STATS_PER_PAGE;
+
+  uint8_t n = 0;
+  if (header.first < cmd_stats_used)
+    n = cmd_stats_used - header.first;
+  if (n > IOSTACK_STATS_PER_PAGE)
+    n = IOSTACK_STATS_PER_PAGE;
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, &header, sizeof(header));
+  if (n)
+    iostack_response_write(request, &cmd_stats[header.first], n * sizeof(*cmd_stats));
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+enum iostack_error_code iostack_handle_reset_stats(struct iostack_request *request)
+{
+  memset(cmd_stats, 0, sizeof(cmd_stats));
+  cmd_stats_used = 0;
+  cmd_stats_untracked = 0;
+  cmd_stats_rejected = 0;
+  cmd_stats_reset_ms = millis();
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
 enum iostack_error_code iostack_handle_register_read(
     struct iostack_request *request)
 {
-  if (request->size != 2)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint16_t reg = (uint16_t)(request->payload[0] << 8) + (uint16_t) request->payload[1];
 
-  Serial.print(F("register read request received for register "));
-  Serial.println(reg);
+  LOG_DEBUG("register read request received for register", reg);
 
   switch (reg) {
     case REG_ETH_CFG:
       return iostack_handle_ethernet_configuration_read(request);
 
+    case REG_FAILED_SENDS: {
+      uint32_t failed_sends = w55_udp_failed_sends();
+      iostack_response_begin(request, request->request_code);
+      iostack_response_write(request, &failed_sends, sizeof(failed_sends));
+      iostack_response_end(request);
+      return IOSTACK_ERR_OKAY;
+    }
+
+    case REG_DROPPED_PACKETS: {
+      uint32_t dropped = w55_udp_dropped();
+      iostack_response_begin(request, request->request_code);
+      iostack_response_write(request, &dropped, sizeof(dropped));
+      iostack_response_end(request);
+      return IOSTACK_ERR_OKAY;
+    }
+
+    case REG_REQUEST_ERRORS: {
+      uint32_t errors = iostack_request_errors();
+      iostack_response_begin(request, request->request_code);
+      iostack_response_write(request, &errors, sizeof(errors));
+      iostack_response_end(request);
+      return IOSTACK_ERR_OKAY;
+    }
+
+    case REG_CMD_STATS:
+      return iostack_handle_stats_read(request, request->size > 2 ? request->payload[2] : 0);
+
+    case REG_GROUPS:
+      iostack_response_begin(request, request->request_code);
+      iostack_response_write(request, iostack_config.groups, sizeof(iostack_config.groups));
+      iostack_response_end(request);
+      return IOSTACK_ERR_OKAY;
+
+    case REG_LOG_DROPPED: {
+      uint32_t dropped = log_dropped();
+      iostack_response_begin(request, request->request_code);
+      iostack_response_write(request, &dropped, sizeof(dropped));
+      iostack_response_end(request);
+      return IOSTACK_ERR_OKAY;
+    }
+
     default:
       return IOSTACK_ERR_INVALID_REGISTER;
   }
 }
 
 
+uint32_t iostack_request_errors(void)
+{
+  return request_errors;
+}
+
+
+/* Returns micros() when the request being served was read off the W5500,
+   before any time went into dispatching it */
+uint32_t iostack_received_us(void)
+{
+  return request_received_us;
+}
+
+
+/* Sets the serial number reported with the Ethernet configuration */
+void iostack_set_serial_no(const uint8_t serial[IOSTACK_SERIAL_NO_SIZE])
+{
+  memcpy(serial_no, serial, sizeof(serial_no));
+  serial_no_valid = 1;
+}
+
+
 enum iostack_error_code iostack_handle_register_write(
     struct iostack_request *request)
 {
-  if (request->size < 3)
-    return IOSTACK_ERR_INVALID_SIZE;
-
   uint16_t reg = (uint16_t)(request->payload[0] << 8) + (uint16_t) request->payload[1];
   uint8_t *payload = &request->payload[2];
   uint16_t size = request->size - 2;
 
-  Serial.print(F("register write request received for register "));
-  Serial.println(reg);
+  LOG_DEBUG("register write request received for register", reg);
 
   switch (reg) {
     case REG_ETH_CFG:
       return iostack_handle_ethernet_configuration_write(request, payload,
                                                          size);
 
+    case REG_GROUPS:
+      if (size != sizeof(iostack_config.groups))
+        return IOSTACK_ERR_INVALID_SIZE;
+
+      memcpy(iostack_config.groups, payload, sizeof(iostack_config.groups));
+      iostack_update_eeprom();
+      iostack_send_acknowledge(request, IOSTACK_ERR_OKAY);
+      return IOSTACK_ERR_OKAY;
+
     default:
       return IOSTACK_ERR_INVALID_REGISTER;
   }
@@ -389,6 +665,8 @@ enum iostack_error_code iostack_handle_ethernet_configuration_read(
   iostack_response_begin(request, request->request_code);
   iostack_response_write(request, &iostack_config.static_ethernet_config,
                          sizeof(struct w5500_config));
+  if (serial_no_valid)
+    iostack_response_write(request, serial_no, sizeof(serial_no));
   iostack_response_end(request);
 
   // Restore previous subnet mask
@@ -414,7 +692,7 @@ static void iostack_send_error(struct iostack_request *request,
                                uint16_t error_code)
 {
   request->subsystem_id = 0;
-  iostack_response_begin(request, 0xff);
+  iostack_response_begin(request, IOSTACK_REPORT_ERR);
   iostack_response_write(request, &error_code, sizeof(error_code));
   iostack_response_end(request);
 }
@@ -454,70 +732,358 @@ enum iostack_error_code iostack_handle_ethernet_configuration_write(
 }
 
 
-/* Assumptions which simplify the code:
-    - no duplicate ids
-*/
 void iostack_register_subsystem(struct iostack_subsystem *subsystem)
 {
-  if (!subsystem || !iostack_subsystems)
+  if (!subsystem)
     return;
 
-  struct iostack_subsystem *cur = iostack_subsystems;
-  while (cur->next)
-    cur = cur->next;
+  if (subsystem->id >= IOSTACK_MAX_SUBSYSTEMS ||
+      iostack_subsystems[subsystem->id]) {
+    Serial.print(F("  cannot register subsystem "));
+    Serial.println(subsystem->id);
+    return;
+  }
 
-  cur->next = subsystem;
-  subsystem->prev = cur;
-  subsystem->next = NULL;
+  iostack_subsystems[subsystem->id] = subsystem;
 }
 
 
-void iostack_tick(uint8_t udp_socket)
+// Finds the handler of a request and runs it
+static enum iostack_error_code iostack_dispatch(struct iostack_request *request)
 {
-  static struct iostack_request request;
-  request.response_state = 0;
+  // Find subsystem
+  struct iostack_subsystem *subsystem = NULL;
+  if (request->subsystem_id < IOSTACK_MAX_SUBSYSTEMS)
+    subsystem = iostack_subsystems[request->subsystem_id];
 
-  uint16_t nbytes =
-      w55_udp_read(udp_socket, &request.udp_header, (uint8_t *) &request,
-                   iostack_header_size + iostack_max_payload_size);
+  if (!subsystem) {
+    LOG_INFO("received request for unknown subsystem", request->subsystem_id);
+    return IOSTACK_ERR_UNKNOWN_SUBSYSTEM;
+  }
 
-  if (nbytes == 0)
-    return;
+  // Find command
+  if (request->request_code >= subsystem->ncmds) {
+    LOG_INFO("received request with unknown command", request->request_code);
+    return IOSTACK_ERR_UNKNOWN_COMMAND;
+  }
 
-  if (nbytes < iostack_header_size) {
-    Serial.println("request too small");
-    return;
+  const struct iostack_cmd *cmd = &subsystem->cmds[request->request_code];
+
+  if (request->size < cmd->min_size || request->size > cmd->max_size) {
+    LOG_INFO("received request with invalid size", request->size);
+    return IOSTACK_ERR_INVALID_SIZE;
   }
 
-  request.size = nbytes - iostack_header_size;
+  // Execute command
+  request_dispatched = 1;
+  enum iostack_error_code rc = cmd->handler(request);
+  if (rc != IOSTACK_ERR_OKAY) {
+    LOG_ERROR("command handler returned error code", rc);
+  }
 
-  // Find subsystem
-  struct iostack_subsystem *subsystem = iostack_subsystems;
-  while (subsystem && subsystem->id != request.subsystem_id)
-    subsystem = subsystem->next;
+  return rc;
+}
 
-  if (!subsystem) {
-    Serial.println("received request for unknown subsystem");
-    iostack_send_error(&request, IOSTACK_ERR_UNKNOWN_SUBSYSTEM);
+
+// Completes the response record of a request in a batch
+static void iostack_batch_close(struct iostack_request *request,
+                                enum iostack_error_code rc)
+{
+  struct iostack_batch *batch = request->batch;
+
+  // Requests that failed or did not reply still get an (empty) record
+  if (request->response_state == 0 &&
+      iostack_response_begin(request, request->request_code))
     return;
+
+  iostack_response_end(request);
+
+  struct iostack_batch_response *record =
+      (struct iostack_batch_response *) &batch->data[batch->record];
+  if (rc == IOSTACK_ERR_OKAY && batch->overflow)
+    rc = IOSTACK_ERR_BATCH_FULL;
+  record->status = rc;
+}
+
+
+// Executes the iostack_batch_request records in payload, collecting their
+// replies in batch. A request is only started while its record header still
+// fits in the reply; the rest are not executed and have no record.
+static enum iostack_error_code iostack_batch_run(struct iostack_request *request,
+                                                 uint8_t *payload, uint16_t size)
+{
+  static struct iostack_request record;
+
+  // Batches do not nest
+  if (request->batch)
+    return IOSTACK_ERR_UNKNOWN_COMMAND;
+
+  // Validate the framing before executing anything
+  uint16_t offset = 0;
+  while (offset < size) {
+    if (offset + sizeof(struct iostack_batch_request) > size)
+      return IOSTACK_ERR_INVALID_SIZE;
+
+    struct iostack_batch_request *header =
+        (struct iostack_batch_request *) &payload[offset];
+    offset += sizeof(struct iostack_batch_request) + header->size;
   }
 
-  // Find command
-  struct iostack_cmd *cmd = subsystem->cmds;
-  while (cmd && cmd->code != request.request_code)
-    cmd = cmd->next;
+  if (offset != size)
+    return IOSTACK_ERR_INVALID_SIZE;
 
-  if (!cmd) {
-    Serial.println("received request with unknown command");
-    iostack_send_error(&request, IOSTACK_ERR_UNKNOWN_COMMAND);
-    return;
+  batch.size = 0;
+
+  offset = 0;
+  while (offset < size &&
+         batch.size + sizeof(struct iostack_batch_response) <= sizeof(batch.data)) {
+    struct iostack_batch_request *header =
+        (struct iostack_batch_request *) &payload[offset];
+    offset += sizeof(struct iostack_batch_request);
+
+    record.id = request->id;
+    record.subsystem_id = header->subsystem_id;
+    record.request_code = header->request_code;
+    record.size = header->size;
+    memcpy(record.payload, &payload[offset], header->size);
+    offset += header->size;
+
+    record.response_state = 0;
+    record.socket = request->socket;
+    record.udp_header = request->udp_header;
+    record.batch = &batch;
+
+    iostack_batch_close(&record, iostack_dispatch(&record));
   }
 
-  // Execute command and handle return code
-  enum iostack_error_code rc = cmd->handler(&request);
-  if (rc != IOSTACK_ERR_OKAY) {
-    Serial.print("command handler returned error code ");
-    Serial.println(rc);
-    iostack_send_error(&request, rc);
+  return IOSTACK_ERR_OKAY;
+}
+
+
+// Whether a request in the batch failed or was answered with an error report
+static uint8_t iostack_batch_failed(void)
+{
+  uint16_t offset = 0;
+  while (offset < batch.size) {
+    struct iostack_batch_response *record =
+        (struct iostack_batch_response *) &batch.data[offset];
+    if (record->status != IOSTACK_ERR_OKAY || record->response_code == SUBSYSTEM_REPORT_ERR)
+      return 1;
+    offset += sizeof(struct iostack_batch_response) + record->size;
   }
+
+  return 0;
+}
+
+
+/* Executes a sequence of requests, each an iostack_batch_request header
+   followed by its payload, in order, and replies with one
+   iostack_batch_response record per executed request (see
+   iostack_batch_run)
+*/
+enum iostack_error_code iostack_handle_batch(struct iostack_request *request)
+{
+  enum iostack_error_code rc = iostack_batch_run(request, request->payload, request->size);
+  if (rc != IOSTACK_ERR_OKAY)
+    return rc;
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, batch.data, batch.size);
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+static uint8_t iostack_group_member(uint8_t group)
+{
+  if (group == IOSTACK_GROUP_ALL)
+    return 1;
+  if (group == IOSTACK_GROUP_NONE)
+    return 0;
+
+  for (uint8_t i = 0; i < IOSTACK_MAX_GROUPS; i++)
+    if (iostack_config.groups[i] == group)
+      return 1;
+
+  return 0;
+}
+
+
+/* Executes the batch after an iostack_group_request header if this device is
+   a member of the group. Sent as a broadcast, one datagram configures every
+   member; replies are as for CMD_BATCH, from the members the header asks
+   for. Devices outside the group ignore the request.
+*/
+enum iostack_error_code iostack_handle_group(struct iostack_request *request)
+{
+  struct iostack_group_request *header = (struct iostack_group_request *) request->payload;
+
+  if (!iostack_group_member(header->group)) {
+    response_suppressed = 1;
+    return IOSTACK_ERR_OKAY;
+  }
+
+  enum iostack_error_code rc =
+      iostack_batch_run(request, &request->payload[sizeof(*header)],
+                        request->size - sizeof(*header));
+  if (rc != IOSTACK_ERR_OKAY)
+    return rc;
+
+  if (header->reply == IOSTACK_GROUP_REPLY_ALL ||
+      (header->reply == IOSTACK_GROUP_REPLY_ERRORS && iostack_batch_failed())) {
+    iostack_response_begin(request, request->request_code);
+    iostack_response_write(request, batch.data, batch.size);
+    iostack_response_end(request);
+  } else {
+    response_suppressed = 1;
+  }
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+// Counts a served request in the entry of its subsystem and command
+static void iostack_stats_add(uint8_t subsystem_id, uint16_t request_code,
+                              uint32_t received, uint32_t handler_us)
+{
+  struct iostack_cmd_stats *entry = NULL;
+
+  for (uint8_t i = 0; i < cmd_stats_used; i++) {
+    if (cmd_stats[i].subsystem_id == subsystem_id &&
+        cmd_stats[i].request_code == request_code) {
+      entry = &cmd_stats[i];
+      break;
+    }
+  }
+
+  if (!entry) {
+    if (cmd_stats_used == IOSTACK_STATS_SLOTS) {
+      cmd_stats_untracked++;
+      return;
+    }
+
+    entry = &cmd_stats[cmd_stats_used++];
+    entry->subsystem_id = subsystem_id;
+    entry->request_code = request_code;
+  }
+
+  entry->count++;
+  entry->handler_us += handler_us;
+  if ((!response_sent && !response_suppressed) || response_error)
+    entry->errors++;
+
+  // A request that was not answered counts until now
+  uint32_t latency = (response_sent ? response_sent_us : micros()) - received;
+  uint8_t bucket = 0;
+  while (latency > 1 && bucket < IOSTACK_STATS_BUCKETS - 1) {
+    latency >>= 1;
+    bucket++;
+  }
+
+  if (entry->latency[bucket] != UINT16_MAX)
+    entry->latency[bucket]++;
+}
+
+
+/* Serves up to max datagrams (0: all) queued in a socket; returns the number
+   served */
+static uint8_t iostack_serve(uint8_t socket, uint8_t max)
+{
+  static struct iostack_request request;
+
+  if (!w55_udp_rx_begin(socket)) {
+    ready_sockets &= ~(1 << socket);
+    return 0;
+  }
+
+  uint8_t served = 0;
+  uint16_t nbytes;
+  while ((max == 0 || served < max) &&
+         (nbytes = w55_udp_rx_next(socket, &request.udp_header, (uint8_t *) &request,
+                                   iostack_header_size + iostack_max_payload_size))) {
+    served++;
+    request_received_us = micros();
+    request.response_state = 0;
+    request.socket = socket;
+    request.batch = NULL;
+
+    if (nbytes < iostack_header_size) {
+      LOG_INFO("request too small", nbytes);
+      request_errors++;
+      cmd_stats_rejected++;
+      continue;
+    }
+
+    request.size = nbytes - iostack_header_size;
+
+    // Error replies overwrite the subsystem ID and the request code
+    uint8_t subsystem_id = request.subsystem_id;
+    uint16_t request_code = request.request_code;
+
+    // Execute command and handle return code
+    request_dispatched = 0;
+    response_sent = 0;
+    response_suppressed = 0;
+    response_error = 0;
+    uint32_t dispatched = micros();
+    enum iostack_error_code rc = iostack_dispatch(&request);
+    uint32_t handled = micros();
+    if (rc != IOSTACK_ERR_OKAY) {
+      iostack_send_error(&request, rc);
+      request_errors++;
+    }
+
+    if (request_dispatched)
+      iostack_stats_add(subsystem_id, request_code, request_received_us,
+                        handled - dispatched);
+    else
+      cmd_stats_rejected++;
+  }
+
+  if (!w55_udp_rx_end(socket))
+    ready_sockets &= ~(1 << socket);
+
+  return served;
+}
+
+
+/* Serves the channels in order of priority: every queued command, then the
+   budget of the first other channel with datagrams waiting. A command thus
+   waits for at most one such budget behind telemetry or bulk traffic. */
+void iostack_tick(void)
+{
+  // Complete the previous responses' SENDs while the W5500 was transmitting
+  for (uint8_t c = 0; c < IOSTACK_CHANNELS; c++)
+    w55_udp_poll(channel_sockets[c]);
+
+  // Without an interrupt from INTn nothing has arrived (all set if polling)
+  ready_sockets |= w55_irq_take();
+
+  for (uint8_t c = 0; c < IOSTACK_CHANNELS; c++) {
+    uint8_t socket = channel_sockets[c];
+    if (!(ready_sockets & (1 << socket)))
+      continue;
+
+    if (iostack_serve(socket, channel_config[c].budget) && c != IOSTACK_CHANNEL_CONTROL)
+      break;
+  }
+}
+
+
+/* Returns 1 while channels have datagrams left over from iostack_tick; the
+   main loop must not sleep on INTn then */
+uint8_t iostack_pending(void)
+{
+  for (uint8_t c = 0; c < IOSTACK_CHANNELS; c++)
+    if (ready_sockets & (1 << channel_sockets[c]))
+      return 1;
+
+  return 0;
+}
+
+
+uint8_t iostack_socket(enum iostack_channel channel)
+{
+  return channel < IOSTACK_CHANNELS ? channel_sockets[channel] : W5500_NUM_SOCKETS;
 }
@@ -10,20 +10,38 @@
 
 #include <Arduino.h>
 
+#include "protocol.h"
 #include "w5500.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Subsystem ID for the iostack
-#define SYS_IOSTACK 0x00
-
-static const uint16_t iostack_header_size = 5;
-static const uint16_t iostack_max_payload_size = 256 - iostack_header_size;
 static const uint32_t iostack_eeprom_magic = 0x10574c6b;
 static const uint16_t iostack_eeprom_base = 0x0000;
 
+// Size of the device serial number appended to REG_ETH_CFG replies, so that
+// one discovery broadcast also inventories the devices (see
+// iostack_set_serial_no)
+#define IOSTACK_SERIAL_NO_SIZE 6
+
+// Version 0 ended after static_ethernet_config; iostack_init() upgrades it
+#define IOSTACK_CONFIG_VERSION 1
+
+// Groups a device can be a member of, see CMD_GROUP
+#define IOSTACK_MAX_GROUPS 4
+#define IOSTACK_GROUP_NONE 0x00  // Unused slot in iostack_config.groups
+#define IOSTACK_GROUP_ALL  0xff  // Every device is a member
+
+// UDP channels, each a W5500 socket on its own port counted from the listen
+// port. iostack_tick serves them in this order of priority.
+enum iostack_channel {
+  IOSTACK_CHANNEL_CONTROL = 0,  // Listen port: commands
+  IOSTACK_CHANNEL_TELEMETRY,    // Listen port + 1: subscriptions and pushes
+  IOSTACK_CHANNEL_BULK,         // Listen port + 2: sequence uploads, batches
+  IOSTACK_CHANNELS
+};
+
 struct __attribute__((packed)) iostack_config {
   // Header
   uint32_t magic;
@@ -32,37 +50,71 @@ struct __attribute__((packed)) iostack_config {
 
   // Configuration structures
   struct w5500_config static_ethernet_config;
+  uint8_t groups[IOSTACK_MAX_GROUPS];
 };
 
-enum iostack_error_code {
-  IOSTACK_ERR_OKAY = 0x0000,
-  IOSTACK_ERR_UNKNOWN_SUBSYSTEM,
-  IOSTACK_ERR_UNKNOWN_COMMAND,
-  IOSTACK_ERR_INVALID_SIZE,
-  IOSTACK_ERR_INVALID_REGISTER,
-  IOSTACK_ERR_INVALID_MAC,
-  IOSTACK_ERR_UNHANDLED_ERROR,
+// Replies to CMD_GROUP; members that stay silent do not count as errors
+enum iostack_group_reply {
+  IOSTACK_GROUP_REPLY_NONE = 0,
+  IOSTACK_GROUP_REPLY_ERRORS,  // Only members where a request failed
+  IOSTACK_GROUP_REPLY_ALL,
+};
+
+// Per-command statistics, kept by iostack_tick for every (subsystem, command)
+// dispatched since the last CMD_RESET_STATS and read page by page from
+// REG_CMD_STATS. Latency runs from reading the request off the W5500 to
+// issuing the SEND of its response; the W5500 transmits it after that.
+#define IOSTACK_STATS_SLOTS 24
+#define IOSTACK_STATS_BUCKETS 12  // Bucket k: [2^k, 2^(k+1)) us (0 from 0 us, the last open)
+
+struct __attribute__((packed)) iostack_cmd_stats {
+  uint8_t subsystem_id;
+  uint16_t request_code;
+  uint32_t count;
+  uint32_t errors;      // Answered with an error report, or not at all
+  uint32_t handler_us;  // Sum of the time spent in the handler
+  uint16_t latency[IOSTACK_STATS_BUCKETS];  // Saturate at 65535
 };
 
+// REG_CMD_STATS reply: this header, then the entries from index first on
+struct __attribute__((packed)) iostack_stats_header {
+  uint32_t uptime_ms;
+  uint32_t reset_ms;   // millis() of the last CMD_RESET_STATS (0: boot)
+  uint32_t untracked;  // Requests not counted because all slots were taken
+  uint32_t rejected;   // Requests not dispatched: too small, unknown subsystem
+                       // or command, invalid size
+  uint8_t nentries;    // Entries in use
+  uint8_t first;
+};
+
+#define IOSTACK_STATS_PER_PAGE \
+  ((iostack_max_payload_size - sizeof(struct iostack_stats_header)) / sizeof(struct iostack_cmd_stats))
+
+// Replies of the requests in a batch, collected for one combined response
+struct iostack_batch;
+
 typedef enum iostack_error_code iostack_handler(
     struct iostack_request *request);
 
+// Subsystem IDs (see protocol.h) are indices into the dispatch table, so keep them small
+#define IOSTACK_MAX_SUBSYSTEMS 8
+
+// Command tables are indexed by command code: entry i must have code i
 struct __attribute__((packed)) iostack_cmd {
   uint8_t code;
+  uint8_t min_size;  // Payload size limits, checked before the handler runs
+  uint8_t max_size;
   iostack_handler *handler;
-
-  struct iostack_cmd *prev;
-  struct iostack_cmd *next;
 };
 
 struct __attribute__((packed)) iostack_subsystem {
   uint8_t id;
-  struct iostack_cmd *cmds;
-
-  struct iostack_subsystem *prev;
-  struct iostack_subsystem *next;
+  const struct iostack_cmd *cmds;
+  uint8_t ncmds;
 };
 
+// Starts with the fields of struct iostack_header, so that a datagram is read
+// into it as is
 struct __attribute__((packed)) iostack_request {
   uint16_t id;
   uint8_t subsystem_id;
@@ -77,13 +129,46 @@ struct __attribute__((packed)) iostack_request {
 
   uint8_t socket;
   struct w5500_udp_header udp_header;
+  struct iostack_batch *batch;  // NULL unless the request is part of a batch
+};
+
+static_assert(offsetof(struct iostack_request, subsystem_id) == offsetof(struct iostack_header, subsystem_id) &&
+              offsetof(struct iostack_request, request_code) == offsetof(struct iostack_header, code) &&
+              offsetof(struct iostack_request, payload) == sizeof(struct iostack_header),
+              "iostack_request must start with the layout of iostack_header");
+
+// Record headers of CMD_BATCH requests and responses; each header is
+// followed by size bytes of payload
+struct __attribute__((packed)) iostack_batch_request {
+  uint8_t subsystem_id;
+  uint16_t request_code;
+  uint8_t size;
+};
+
+struct __attribute__((packed)) iostack_batch_response {
+  uint8_t subsystem_id;
+  uint16_t response_code;
+  uint16_t status;  // enum iostack_error_code of the request
+  uint8_t size;
+};
+
+// Header of CMD_GROUP requests, followed by the requests to execute as in
+// CMD_BATCH; the reply is that of CMD_BATCH
+struct __attribute__((packed)) iostack_group_request {
+  uint8_t group;
+  uint8_t reply;  // enum iostack_group_reply
 };
 
 int8_t iostack_init(uint16_t udp_listen_port);
 void iostack_register_commands(struct iostack_subsystem *subsystem,
-                               struct iostack_cmd *cmds, uint8_t ncmds);
+                               const struct iostack_cmd *cmds, uint8_t ncmds);
 void iostack_register_subsystem(struct iostack_subsystem *subsystem);
-void iostack_tick(uint8_t udp_socket);
+void iostack_tick(void);
+uint8_t iostack_pending(void);
+uint8_t iostack_socket(enum iostack_channel channel);
+uint32_t iostack_request_errors(void);
+uint32_t iostack_received_us(void);
+void iostack_set_serial_no(const uint8_t serial_no[IOSTACK_SERIAL_NO_SIZE]);
 
 uint8_t iostack_response_begin(struct iostack_request *request,
                                uint16_t response_code);
@@ -96,6 +181,14 @@ void eeprom_read_block(struct iostack_config *cfg, uint16_t base, size_t size_of
 
 #ifdef __cplusplus
 }
+
+// For static_assert on command tables: true if entry i has code i
+constexpr bool iostack_cmds_indexed(const struct iostack_cmd *cmds,
+                                    uint8_t ncmds, uint8_t i = 0)
+{
+  return i == ncmds || (cmds[i].code == i &&
+                        iostack_cmds_indexed(cmds, ncmds, i + 1));
+}
 #endif
 
 #endif
@@ -0,0 +1,102 @@
+#include "log.h"
+
+#include <stdio.h>
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+struct log_record {
+  uint32_t millis;
+  const char *message;
+  int32_t value;
+  uint8_t level;
+  uint8_t has_value;
+};
+
+static struct log_record ring[LOG_RING_SIZE];
+static uint8_t head = 0;  // Next record to print
+static uint8_t count = 0;
+static uint32_t dropped = 0;
+
+static const char *const level_names[] = {"", "E", "I", "D"};
+
+
+static void log_store(uint8_t level, const char *message, int32_t value, uint8_t has_value)
+{
+  if (count == LOG_RING_SIZE) {
+    dropped++;
+    return;
+  }
+
+  struct log_record *r = &ring[(head + count) & (LOG_RING_SIZE - 1)];
+  r->millis = millis();
+  r->message = message;
+  r->value = value;
+  r->level = level;
+  r->has_value = has_value;
+  count++;
+}
+
+
+void log_write(uint8_t level, const char *message)
+{
+  log_store(level, message, 0, 0);
+}
+
+
+void log_write(uint8_t level, const char *message, int32_t value)
+{
+  log_store(level, message, value, 1);
+}
+
+
+// Line being printed; it may take several log_flush() calls
+static char line[80];
+static uint8_t line_len = 0;
+static uint8_t line_pos = 0;
+
+
+static void log_format(const struct log_record *r)
+{
+  int n;
+  if (r->has_value)
+    n = snprintf(line, sizeof(line), "%lu %s %s %ld\r\n", (unsigned long) r->millis,
+                 level_names[r->level], r->message, (long) r->value);
+  else
+    n = snprintf(line, sizeof(line), "%lu %s %s\r\n", (unsigned long) r->millis,
+                 level_names[r->level], r->message);
+
+  line_len = n < (int) sizeof(line) ? n : sizeof(line) - 1;
+  line_pos = 0;
+}
+
+
+/* Prints as much of the stored records as the Serial transmit buffer takes
+   without blocking; call when there is nothing else to do */
+void log_flush(void)
+{
+  while (line_pos < line_len || count) {
+    if (line_pos == line_len) {
+      log_format(&ring[head]);
+      head = (head + 1) & (LOG_RING_SIZE - 1);
+      count--;
+    }
+
+    int room = Serial.availableForWrite();
+    if (room <= 0)
+      return;
+
+    uint8_t n = line_len - line_pos < room ? line_len - line_pos : room;
+    Serial.write((const uint8_t *) &line[line_pos], n);
+    line_pos += n;
+  }
+}
+
+
+uint32_t log_dropped(void)
+{
+  return dropped;
+}
+
+#endif
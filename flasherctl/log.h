@@ -0,0 +1,58 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+// Deferred logging
+//
+// LOG_ERROR/LOG_INFO/LOG_DEBUG only store a fixed-size record (time, level,
+// message, optional value) in a RAM ring; log_flush() formats the records
+// and prints them to Serial from the idle part of the loop, and only as far
+// as the port takes them without blocking. A stalled USB CDC port therefore
+// never delays a request: the ring fills up and further records are counted
+// as dropped (REG_LOG_DROPPED).
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+// Records above this level compile to nothing; LOG_LEVEL_NONE also removes
+// the ring
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Ring size in records (a power of two)
+#define LOG_RING_SIZE 32
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+void log_write(uint8_t level, const char *message);
+void log_write(uint8_t level, const char *message, int32_t value);
+void log_flush(void);
+uint32_t log_dropped(void);
+#else
+static inline void log_flush(void) {}
+static inline uint32_t log_dropped(void) { return 0; }
+#endif
+
+// message must be a string literal (only its address is stored)
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#endif
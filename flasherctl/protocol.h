@@ -0,0 +1,92 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+// Wire protocol shared by the firmware and the C++ host client in client/:
+// datagram header, subsystem IDs, command codes and error codes. Keep this
+// free of Arduino headers so that it builds on any host.
+
+#include <stdint.h>
+
+// Subsystem IDs
+// The iostack is "0", the Dynamixel servos were "1"
+#define SYS_IOSTACK 0x00
+#define SYS_FLASHER 2
+#define SYS_TELEMETRY 3
+#define SYS_TIMESYNC 4
+
+static const uint16_t iostack_header_size = 5;
+static const uint16_t iostack_max_payload_size = 256 - iostack_header_size;
+
+// Header of every request and response datagram, followed by the payload;
+// struct iostack_request starts with the same fields
+struct __attribute__((packed)) iostack_header {
+  uint16_t id;            // Echoed in the response; 0 in pushes
+  uint8_t subsystem_id;
+  uint16_t code;          // Request code, or response code
+};
+
+static_assert(sizeof(struct iostack_header) == iostack_header_size,
+              "iostack_header does not match iostack_header_size");
+
+// iostack command codes
+enum iostack_cmd_code {CMD_READ_REG=0x0000, CMD_WRITE_REG, CMD_PING, CMD_BATCH, CMD_RESET_STATS,
+                       CMD_GROUP};
+
+// Registers; READ_REG and WRITE_REG carry the number big-endian
+enum iostack_reg {REG_ETH_CFG=0x0000, REG_FAILED_SENDS, REG_DROPPED_PACKETS, REG_REQUEST_ERRORS,
+                  REG_LOG_DROPPED, REG_CMD_STATS, REG_GROUPS};
+
+// Response code of iostack error reports (subsystem SYS_IOSTACK)
+#define IOSTACK_REPORT_ERR 0xff
+
+// Response code of the other subsystems' error reports
+// (CMD_REPORT_FLASHERCTL_ERR, ...)
+#define SUBSYSTEM_REPORT_ERR 0xffff
+
+// Payload of iostack error reports (uint16_t)
+enum iostack_error_code {
+  IOSTACK_ERR_OKAY = 0x0000,
+  IOSTACK_ERR_UNKNOWN_SUBSYSTEM,
+  IOSTACK_ERR_UNKNOWN_COMMAND,
+  IOSTACK_ERR_INVALID_SIZE,
+  IOSTACK_ERR_INVALID_REGISTER,
+  IOSTACK_ERR_INVALID_MAC,
+  IOSTACK_ERR_UNHANDLED_ERROR,
+  IOSTACK_ERR_BATCH_FULL,
+};
+
+// Flasher command codes (to match class FlasherCommand in flasherctl.py)
+enum flasherctl_cmd_code {CMD_LED_BUILTIN = 0x0000,
+                          CMD_START_TEMPERATURE,
+                          CMD_READ_TEMPERATURE,
+                          CMD_READ_SERIAL_NO,
+                          CMD_SET_LED_CURRENT,
+                          CMD_SET_PULSE_WIDTH,
+                          CMD_TEST_PULSE,
+                          CMD_STAGE_SETTINGS,
+                          CMD_COMMIT_SETTINGS,
+                          CMD_READ_TEMPERATURE_HISTORY,
+                          CMD_SET_TEMPERATURE_PERIOD,
+                          CMD_PULSE_TRAIN,
+                          CMD_PULSE_TRAIN_STATUS,
+                          CMD_SEQUENCE_LOAD,
+                          CMD_SEQUENCE_START,
+                          CMD_SEQUENCE_ABORT,
+                          CMD_SEQUENCE_STATUS,
+                          CMD_FIRE_AT,
+                          CMD_FIRE_STATUS,
+                          CMD_REPORT_FLASHERCTL_ERR=SUBSYSTEM_REPORT_ERR};
+
+// Flasher error bits, the payload of CMD_REPORT_FLASHERCTL_ERR (uint16_t)
+#define FLASHER_EBVALUE       1
+#define FLASHER_ESERIALNO     2
+#define FLASHER_ENOTSTAGED    4
+#define FLASHER_EBUSY         8
+#define FLASHER_ENOTSYNCED    16
+#define FLASHER_ETIMEDOUT     128
+#define FLASHER_ERXCHECKSUM   256
+#define FLASHER_EMISMATCH     512
+#define FLASHER_ERDONLY       1024
+#define FLASHER_ERXFSM        32768
+
+#endif
@@ -0,0 +1,233 @@
+#include "telemetry.h"
+
+#include "flasher.h"
+
+// Command codes (to match class TelemetryCommand in flasherctl_telemetry.py)
+enum telemetry_cmd_code {CMD_SUBSCRIBE = 0x0000,
+                         CMD_UNSUBSCRIBE,
+                         CMD_READ_TELEMETRY,
+                         CMD_REPORT_TELEMETRY_ERR=SUBSYSTEM_REPORT_ERR};
+
+// Handlers
+enum iostack_error_code telemetry_handle_subscribe(struct iostack_request *request);
+enum iostack_error_code telemetry_handle_unsubscribe(struct iostack_request *request);
+enum iostack_error_code telemetry_handle_read(struct iostack_request *request);
+
+static constexpr struct iostack_cmd telemetry_cmds[] =
+  {{CMD_SUBSCRIBE, 2, 2, telemetry_handle_subscribe},
+   {CMD_UNSUBSCRIBE, 0, 0, telemetry_handle_unsubscribe},
+   {CMD_READ_TELEMETRY, 0, 0, telemetry_handle_read}};
+
+static_assert(iostack_cmds_indexed(telemetry_cmds, sizeof(telemetry_cmds) / sizeof(*telemetry_cmds)),
+              "telemetry_cmds must be ordered by command code");
+
+static struct iostack_subsystem telemetry_subsystem = {.id = SYS_TELEMETRY};
+
+struct telemetry_subscriber {
+  struct w5500_udp_header udp_header;  // Where to push to
+  uint16_t period_ms;                  // 0 = free slot
+  uint32_t renewed;                    // millis() of the last CMD_SUBSCRIBE
+  uint32_t pushed;                     // millis() the last push was due
+  uint32_t sequence;
+  uint8_t failed_pushes;               // In a row, see telemetry_settle()
+};
+
+static struct telemetry_subscriber subscribers[TELEMETRY_MAX_SUBSCRIBERS];
+
+// The subscriber of the last push and the socket's failed SENDs before it
+static struct telemetry_subscriber *pushed_to;
+static uint32_t pushed_failed_sends;
+
+// A pushed datagram: iostack header and frame, written in one piece
+struct __attribute__((packed)) telemetry_datagram {
+  uint16_t id;
+  uint8_t subsystem_id;
+  uint16_t response_code;
+  struct telemetry_frame frame;
+};
+
+
+void telemetry_register(void)
+{
+  iostack_register_commands(&telemetry_subsystem, telemetry_cmds,
+                            sizeof(telemetry_cmds) / sizeof(*telemetry_cmds));
+  iostack_register_subsystem(&telemetry_subsystem);
+}
+
+
+static void telemetry_fill(struct telemetry_frame *frame, uint32_t sequence)
+{
+  frame->version = TELEMETRY_VERSION;
+  frame->sequence = sequence;
+  frame->uptime_ms = millis();
+
+  int16_t temperature;
+  frame->temperature = flasher_latest_temperature(&temperature) ? INT16_MIN : temperature;
+
+  uint8_t current, width;
+  flasher_settings(&current, &width);
+  frame->led_current = current;
+  frame->pulse_width = width;
+
+  frame->failed_sends = w55_udp_failed_sends();
+  frame->dropped_packets = w55_udp_dropped();
+  frame->request_errors = iostack_request_errors();
+}
+
+
+// Finds the subscriber with the request's source address
+static struct telemetry_subscriber *telemetry_find(struct iostack_request *request)
+{
+  for (uint8_t i = 0; i < TELEMETRY_MAX_SUBSCRIBERS; i++) {
+    struct telemetry_subscriber *s = &subscribers[i];
+    if (s->period_ms && s->udp_header.port == request->udp_header.port &&
+        !memcmp(s->udp_header.ip_address, request->udp_header.ip_address,
+                sizeof(s->udp_header.ip_address)))
+      return s;
+  }
+
+  return NULL;
+}
+
+
+static void telemetry_send_error(struct iostack_request *request, uint16_t error)
+{
+  iostack_response_begin(request, CMD_REPORT_TELEMETRY_ERR);
+  iostack_response_write(request, &error, sizeof(error));
+  iostack_response_end(request);
+}
+
+
+/* Subscribes the sender to a push every period_ms (uint16), or changes the
+   period and renews the lease of an existing subscription */
+enum iostack_error_code telemetry_handle_subscribe(struct iostack_request *request)
+{
+  uint16_t period_ms = *(uint16_t *) request->payload;
+
+  if (period_ms < TELEMETRY_MIN_PERIOD_MS) {
+    telemetry_send_error(request, TELEMETRY_EBVALUE);
+    return IOSTACK_ERR_OKAY;
+  }
+
+  uint32_t now = millis();
+  struct telemetry_subscriber *s = telemetry_find(request);
+
+  // Take a free or expired slot
+  for (uint8_t i = 0; !s && i < TELEMETRY_MAX_SUBSCRIBERS; i++) {
+    if (!subscribers[i].period_ms || now - subscribers[i].renewed >= TELEMETRY_LEASE_MS) {
+      s = &subscribers[i];
+      s->udp_header = request->udp_header;
+      s->pushed = now - period_ms;  // First push in the next tick
+      s->sequence = 0;
+      s->failed_pushes = 0;
+      if (pushed_to == s)
+        pushed_to = NULL;
+    }
+  }
+
+  if (!s) {
+    telemetry_send_error(request, TELEMETRY_EFULL);
+    return IOSTACK_ERR_OKAY;
+  }
+
+  s->period_ms = period_ms;
+  s->renewed = now;
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+/* Ends the sender's subscription, if any */
+enum iostack_error_code telemetry_handle_unsubscribe(struct iostack_request *request)
+{
+  struct telemetry_subscriber *s = telemetry_find(request);
+  if (s)
+    s->period_ms = 0;
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+/* Replies with a telemetry frame; sequence is 0 */
+enum iostack_error_code telemetry_handle_read(struct iostack_request *request)
+{
+  struct telemetry_frame frame;
+  telemetry_fill(&frame, 0);
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, &frame, sizeof(frame));
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+/* Charges the last push's outcome to its subscriber once its SEND completed.
+   Each push to a host that does not answer ARP keeps the socket busy for
+   W55_SEND_TIMEOUT_US, during which no one else is pushed to, so such a
+   subscriber is dropped after TELEMETRY_MAX_FAILED_PUSHES in a row. */
+static void telemetry_settle(uint8_t udp_socket)
+{
+  if (!pushed_to)
+    return;
+
+  uint32_t failed_sends = w55_udp_socket_failed_sends(udp_socket);
+  if (failed_sends == pushed_failed_sends)
+    pushed_to->failed_pushes = 0;
+  else if (++pushed_to->failed_pushes >= TELEMETRY_MAX_FAILED_PUSHES)
+    pushed_to->period_ms = 0;
+
+  pushed_to = NULL;
+}
+
+
+/* Pushes a frame to every subscriber that is due; call from the main loop */
+void telemetry_tick(uint8_t udp_socket)
+{
+  uint32_t now = millis();
+
+  for (uint8_t i = 0; i < TELEMETRY_MAX_SUBSCRIBERS; i++) {
+    struct telemetry_subscriber *s = &subscribers[i];
+    if (!s->period_ms || now - s->pushed < s->period_ms)
+      continue;
+
+    if (now - s->renewed >= TELEMETRY_LEASE_MS) {
+      s->period_ms = 0;
+      continue;
+    }
+
+    // w55_udp_begin would wait for the previous push's SEND, for up to
+    // W55_SEND_TIMEOUT_US while the subscriber's host does not answer ARP;
+    // leave the subscriber due and push on a later tick instead
+    if (w55_udp_poll(udp_socket) == W55_SEND_PENDING)
+      return;
+
+    telemetry_settle(udp_socket);
+    if (!s->period_ms)
+      continue;
+
+    // Keep the schedule, but do not catch up on pushes missed by a slow loop
+    s->pushed += s->period_ms;
+    if (now - s->pushed >= s->period_ms)
+      s->pushed = now;
+
+    struct telemetry_datagram datagram;
+    datagram.id = 0;
+    datagram.subsystem_id = SYS_TELEMETRY;
+    datagram.response_code = CMD_READ_TELEMETRY;
+    telemetry_fill(&datagram.frame, s->sequence++);
+
+    if (w55_udp_begin(udp_socket, &s->udp_header) ||
+        w55_udp_write(udp_socket, (uint8_t *) &datagram, sizeof(datagram)) != sizeof(datagram))
+      continue;
+    pushed_to = s;
+    pushed_failed_sends = w55_udp_socket_failed_sends(udp_socket);
+    w55_udp_end(udp_socket);
+  }
+}
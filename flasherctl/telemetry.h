@@ -0,0 +1,40 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+// Telemetry subsystem: pushes a fixed-layout status datagram to subscribed
+// clients instead of having them poll every quantity
+
+#include <Arduino.h>
+
+#include "iostack.h"
+
+// Subscriber table size and limits
+#define TELEMETRY_MAX_SUBSCRIBERS 4
+#define TELEMETRY_MIN_PERIOD_MS 10
+#define TELEMETRY_LEASE_MS 60000ul  // A subscription ends unless renewed within this time
+#define TELEMETRY_MAX_FAILED_PUSHES 2  // A subscription ends after this many in a row
+
+// Error codes
+#define TELEMETRY_EBVALUE 1  // Period below TELEMETRY_MIN_PERIOD_MS
+#define TELEMETRY_EFULL   2  // No free subscriber slot
+
+#define TELEMETRY_VERSION 1
+
+// Payload of a pushed datagram and of the CMD_READ_TELEMETRY reply. Pushed
+// datagrams carry the usual iostack header with ID 0.
+struct __attribute__((packed)) telemetry_frame {
+  uint8_t version;           // TELEMETRY_VERSION
+  uint32_t sequence;         // Pushes to this subscriber since it subscribed
+  uint32_t uptime_ms;        // millis()
+  int16_t temperature;       // Latest sample (1/128 C); INT16_MIN if none yet
+  uint8_t led_current;
+  uint8_t pulse_width;
+  uint32_t failed_sends;     // As in the iostack registers
+  uint32_t dropped_packets;
+  uint32_t request_errors;
+};
+
+void telemetry_register(void);
+void telemetry_tick(uint8_t udp_socket);
+
+#endif
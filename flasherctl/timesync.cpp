@@ -0,0 +1,254 @@
+#include "timesync.h"
+
+// Command codes (to match class TimesyncCommand in flasherctl_timesync.py)
+enum timesync_cmd_code {CMD_SYNC = 0x0000,
+                        CMD_SYNC_STATUS};
+
+// Handlers
+enum iostack_error_code timesync_handle_sync(struct iostack_request *request);
+enum iostack_error_code timesync_handle_status(struct iostack_request *request);
+
+static constexpr struct iostack_cmd timesync_cmds[] =
+  {{CMD_SYNC, sizeof(struct timesync_request), sizeof(struct timesync_request), timesync_handle_sync},
+   {CMD_SYNC_STATUS, 0, 0, timesync_handle_status}};
+
+static_assert(iostack_cmds_indexed(timesync_cmds, sizeof(timesync_cmds) / sizeof(*timesync_cmds)),
+              "timesync_cmds must be ordered by command code");
+
+static struct iostack_subsystem timesync_subsystem = {.id = SYS_TIMESYNC};
+
+// micros() extended to 64 bits; timesync_tick() must run more often than
+// every 71 minutes
+static uint32_t local_last = 0;
+static uint32_t local_high = 0;
+
+// Clock model: client time = ref_client + d + d * rate_ppb / 10^9, with
+// d = local time - ref_local
+static uint8_t synced = 0;
+static uint64_t ref_local;
+static uint64_t ref_client;
+static int32_t rate_ppb = 0;
+
+// Least-squares fit of the clock offset against local time over the accepted
+// exchanges of a window: x in ms since its first exchange, y the change of
+// client - local time in us since then. The sums stay within int64_t for
+// TIMESYNC_RATE_MAX_SAMPLES exchanges over TIMESYNC_RATE_BASELINE_US at up to
+// TIMESYNC_MAX_RATE_PPB.
+static uint64_t anchor_local;
+static uint64_t anchor_client;
+static uint32_t fit_n;
+static int64_t fit_sx, fit_sy, fit_sxx, fit_sxy;
+
+// Frequency fitted over the previous window, and the spread of its x (n times
+// the variance) that weighs it against the current one
+static double prev_rate_ppb;
+static double prev_sxx;
+
+// Exchange waiting for its t4
+static uint32_t pending_sequence;
+static uint64_t pending_t1, pending_t2, pending_t3;
+static uint8_t pending = 0;
+
+static uint32_t min_delay_us;
+static struct timesync_status status;
+
+
+void timesync_register(void)
+{
+  iostack_register_commands(&timesync_subsystem, timesync_cmds,
+                            sizeof(timesync_cmds) / sizeof(*timesync_cmds));
+  iostack_register_subsystem(&timesync_subsystem);
+}
+
+
+uint64_t timesync_local_us(void)
+{
+  uint32_t now = micros();
+  if (now < local_last)
+    local_high++;
+  local_last = now;
+
+  return ((uint64_t) local_high << 32) | now;
+}
+
+
+// Extends a recent micros() reading to 64 bits
+uint64_t timesync_extend(uint32_t us)
+{
+  uint64_t now = timesync_local_us();
+  return now - (uint32_t) ((uint32_t) now - us);
+}
+
+
+uint8_t timesync_synced(void)
+{
+  return synced;
+}
+
+
+uint64_t timesync_to_client(uint64_t local_us)
+{
+  int64_t d = (int64_t) (local_us - ref_local);
+  return ref_client + d + d * rate_ppb / 1000000000;
+}
+
+
+uint64_t timesync_to_local(uint64_t client_us)
+{
+  int64_t d = (int64_t) (client_us - ref_client);
+  return ref_local + d - d * rate_ppb / 1000000000;
+}
+
+
+/* Adds an exchange to the frequency fit and returns the frequency of the
+   previous and current windows combined, each weighted by the inverse
+   variance of its slope. A single exchange yields none; rate_ppb is kept. */
+static int32_t timesync_fit(uint64_t local, uint64_t client)
+{
+  int64_t x = (int64_t) (local - anchor_local) / 1000;
+  int64_t y = (int64_t) (client - anchor_client) - (int64_t) (local - anchor_local);
+
+  fit_n++;
+  fit_sx += x;
+  fit_sy += y;
+  fit_sxx += x * x;
+  fit_sxy += x * y;
+
+  int64_t den = fit_n * fit_sxx - fit_sx * fit_sx;
+  double rate = rate_ppb;
+  double slope = 0;
+  double sxx = 0;
+  if (den > 0) {
+    slope = (double) (fit_n * fit_sxy - fit_sx * fit_sy) * 1e6 / den;  // us/ms to ppb
+    sxx = (double) den / fit_n;
+    rate = (prev_rate_ppb * prev_sxx + slope * sxx) / (prev_sxx + sxx);
+  }
+
+  if (rate > TIMESYNC_MAX_RATE_PPB)
+    rate = TIMESYNC_MAX_RATE_PPB;
+  if (rate < -TIMESYNC_MAX_RATE_PPB)
+    rate = -TIMESYNC_MAX_RATE_PPB;
+
+  // Start over from this exchange, keeping the window for the next one
+  if ((int64_t) (local - anchor_local) >= TIMESYNC_RATE_BASELINE_US ||
+      fit_n >= TIMESYNC_RATE_MAX_SAMPLES) {
+    if (den > 0) {
+      prev_rate_ppb = slope;
+      prev_sxx = sxx;
+    }
+    anchor_local = local;
+    anchor_client = client;
+    fit_n = 1;
+    fit_sx = fit_sy = fit_sxx = fit_sxy = 0;
+  }
+
+  return (int32_t) rate;
+}
+
+
+/* Corrects the clock model with a completed exchange. The first one sets the
+   clock; later ones correct half the phase error they show. The frequency is
+   fitted to all exchanges of the last one or two windows (see
+   timesync_fit), so that the timestamp noise of single exchanges averages
+   out. */
+static void timesync_sample(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+{
+  int64_t delay = (int64_t) (t4 - t1) - (int64_t) (t3 - t2);
+  if (delay < 0 || delay > INT32_MAX) {
+    status.rejected++;
+    return;
+  }
+
+  // Keep to exchanges close to the fastest recent one; the limit relaxes
+  // with every rejection so that a slower path is taken up eventually
+  if (synced && delay > 2 * (int64_t) min_delay_us + TIMESYNC_DELAY_SLACK_US) {
+    min_delay_us += 1 + min_delay_us / 16;
+    status.rejected++;
+    return;
+  }
+  if (!synced || delay < min_delay_us)
+    min_delay_us = delay;
+
+  // Both clocks at the middle of the exchange
+  uint64_t local = t2 + (t3 - t2) / 2;
+  uint64_t client = t1 + (t4 - t1) / 2;
+
+  if (!synced) {
+    ref_local = local;
+    ref_client = client;
+    anchor_local = local;
+    anchor_client = client;
+    fit_n = 1;
+    fit_sx = fit_sy = fit_sxx = fit_sxy = 0;
+    prev_rate_ppb = 0;
+    prev_sxx = 0;
+    rate_ppb = 0;
+    synced = 1;
+    status.offset_us = 0;
+  } else {
+    uint64_t predicted = timesync_to_client(local);
+    int64_t error = (int64_t) (client - predicted);
+
+    rate_ppb = timesync_fit(local, client);
+
+    ref_local = local;
+    ref_client = predicted + error / 2;
+    status.offset_us = error > INT32_MAX ? INT32_MAX : error < INT32_MIN ? INT32_MIN : error;
+  }
+
+  status.delay_us = delay;
+  status.samples++;
+}
+
+
+/* Completes the previous exchange if the request carries its t4, and replies
+   with the timestamps of this one */
+enum iostack_error_code timesync_handle_sync(struct iostack_request *request)
+{
+  struct timesync_request sync;
+  memcpy(&sync, request->payload, sizeof(sync));
+
+  uint64_t t2 = timesync_extend(iostack_received_us());
+
+  if (pending && sync.prev_t4 && sync.prev_sequence == pending_sequence)
+    timesync_sample(pending_t1, pending_t2, pending_t3, sync.prev_t4);
+
+  struct timesync_reply reply;
+  reply.sequence = sync.sequence;
+  reply.t1 = sync.t1;
+  reply.t2 = t2;
+
+  iostack_response_begin(request, request->request_code);
+  reply.t3 = timesync_local_us();
+  iostack_response_write(request, &reply, sizeof(reply));
+  iostack_response_end(request);
+
+  pending_sequence = sync.sequence;
+  pending_t1 = sync.t1;
+  pending_t2 = reply.t2;
+  pending_t3 = reply.t3;
+  pending = 1;
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+enum iostack_error_code timesync_handle_status(struct iostack_request *request)
+{
+  status.synced = synced;
+  status.rate_ppb = rate_ppb;
+  status.now_us = synced ? timesync_to_client(timesync_local_us()) : 0;
+
+  iostack_response_begin(request, request->request_code);
+  iostack_response_write(request, &status, sizeof(status));
+  iostack_response_end(request);
+
+  return IOSTACK_ERR_OKAY;
+}
+
+
+/* Keeps the 64-bit clock running; call from the main loop */
+void timesync_tick(void)
+{
+  timesync_local_us();
+}
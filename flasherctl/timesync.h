@@ -0,0 +1,62 @@
+#ifndef __TIMESYNC_H__
+#define __TIMESYNC_H__
+
+// Time sync subsystem: disciplines a microsecond clock to the client's time
+// base with NTP-style four-timestamp exchanges, so that devices can act at
+// the same absolute time (see flasher_FIRE_AT)
+
+#include <Arduino.h>
+
+#include "iostack.h"
+
+// Exchanges whose round trip exceeds twice the smallest recent one plus this
+// are discarded as delayed by queueing
+#define TIMESYNC_DELAY_SLACK_US 50
+
+// The frequency is fitted to the exchanges of a window, which starts over
+// after this long or this many exchanges to follow slow drift (temperature)
+#define TIMESYNC_RATE_BASELINE_US 64000000
+#define TIMESYNC_RATE_MAX_SAMPLES 1024
+
+// Limit of the frequency correction
+#define TIMESYNC_MAX_RATE_PPB 500000
+
+// CMD_SYNC payload. t1 is the client's time when it sent the request; the
+// previous exchange is completed by the client's time when its reply
+// arrived (t4), so the device holds all four timestamps of it.
+struct __attribute__((packed)) timesync_request {
+  uint32_t sequence;
+  uint64_t t1;             // Client time (us)
+  uint32_t prev_sequence;  // Exchange completed by prev_t4; ignored if prev_t4 is 0
+  uint64_t prev_t4;
+};
+
+// CMD_SYNC reply
+struct __attribute__((packed)) timesync_reply {
+  uint32_t sequence;
+  uint64_t t1;  // As received
+  uint64_t t2;  // Device time the request was read off the W5500 (local us)
+  uint64_t t3;  // Device time the reply was assembled (local us)
+};
+
+// CMD_SYNC_STATUS reply
+struct __attribute__((packed)) timesync_status {
+  uint8_t synced;      // At least one exchange accepted
+  int32_t offset_us;   // Error of the clock at the last accepted exchange
+  int32_t rate_ppb;    // Frequency correction applied to the local clock
+  uint32_t delay_us;   // Round trip of the last accepted exchange
+  uint16_t samples;    // Exchanges accepted
+  uint16_t rejected;   // Exchanges discarded for their round trip
+  uint64_t now_us;     // Current time in the client's time base
+};
+
+void timesync_register(void);
+void timesync_tick(void);
+
+uint64_t timesync_local_us(void);
+uint64_t timesync_extend(uint32_t us);  // A recent micros() reading as local us
+uint8_t timesync_synced(void);
+uint64_t timesync_to_client(uint64_t local_us);
+uint64_t timesync_to_local(uint64_t client_us);
+
+#endif
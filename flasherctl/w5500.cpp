@@ -1,6 +1,8 @@
 #include <SPI.h>
 extern SPIClass SPI_2;
 
+#include "dmac.h"
+#include "gpio.h"
 #include "w5500.h"
 
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
@@ -13,6 +15,27 @@ void w55_transmit(uint8_t x) __attribute__((always_inline));
 void w55_enable(void) __attribute__((always_inline));
 void w55_disable(void) __attribute__((always_inline));
 
+#if W55_SPI_DMA
+// Bulk transfer of a 3-byte frame header plus payload in one DMA burst; src or
+// dest is NULL for reads or writes, respectively (see end of file)
+void w55_dma_init(void);
+void w55_dma_burst(uint8_t *header, uint8_t *src, uint8_t *dest, uint16_t size);
+#endif
+
+#if W55_SPI_STATS
+static struct w5500_spi_stats spi_stats;
+
+#define W55_SPI_STATS_START(t) uint32_t t = micros()
+#define W55_SPI_STATS_ADD(path, nbytes, t) \
+  do { \
+    spi_stats.path##_bytes += (nbytes); \
+    spi_stats.path##_micros += micros() - (t); \
+  } while (0)
+#else
+#define W55_SPI_STATS_START(t)
+#define W55_SPI_STATS_ADD(path, nbytes, t)
+#endif
+
 
 void w55_write(uint16_t addr, uint8_t block, uint8_t data)
 {
@@ -39,15 +62,31 @@ void w55_write16(uint16_t addr, uint8_t block, uint16_t data)
 
 void w55_writen(uint16_t addr, uint8_t block, uint8_t *src, uint16_t size)
 {
+  W55_SPI_STATS_START(start);
+
+#if W55_SPI_DMA
+  if (size >= W55_SPI_DMA_MIN_SIZE) {
+    uint8_t header[3] = {(uint8_t) (addr >> 8), (uint8_t) addr,
+                         (uint8_t) ((block << 3) | W5500_RWB)};
+    w55_enable();
+    w55_dma_burst(header, src, NULL, size);
+    w55_disable();
+
+    W55_SPI_STATS_ADD(dma, size + 3, start);
+    return;
+  }
+#endif
+
   w55_enable();
   w55_transmit(addr >> 8);
   w55_transmit(addr);
   w55_transmit((block << 3) | W5500_RWB);
 
-  while (size-- != 0)
-    w55_transmit(*src++);
+  for (uint16_t i = 0; i < size; i++)
+    w55_transmit(src[i]);
 
   w55_disable();
+  W55_SPI_STATS_ADD(polled, size + 3, start);
 }
 
 
@@ -93,17 +132,37 @@ uint16_t w55_read16(uint16_t addr, uint8_t block)
 
 void w55_readn(uint16_t addr, uint8_t block, uint8_t *dest, uint16_t size)
 {
+  W55_SPI_STATS_START(start);
+
+#if W55_SPI_DMA
+  if (size >= W55_SPI_DMA_MIN_SIZE) {
+    uint8_t header[3] = {(uint8_t) (addr >> 8), (uint8_t) addr,
+                         (uint8_t) (block << 3)};
+    w55_enable();
+    w55_dma_burst(header, NULL, dest, size);
+    w55_disable();
+
+    W55_SPI_STATS_ADD(dma, size + 3, start);
+    return;
+  }
+#endif
+
   w55_enable();
   w55_transmit(addr >> 8);
   w55_transmit(addr);
   w55_transmit(block << 3);
-  while (size-- != 0) {
-    *dest++ = w55_exchange(0x00);
-  }
+  for (uint16_t i = 0; i < size; i++)
+    dest[i] = w55_exchange(0x00);
   w55_disable();
+  W55_SPI_STATS_ADD(polled, size + 3, start);
 }
 
 
+// Buffer memory handed out by w55_udp_open() since w55_init()
+static uint8_t rx_allocated_kb = 0;
+static uint8_t tx_allocated_kb = 0;
+
+
 void w55_init(void)
 {
   // Initialise SPI
@@ -112,11 +171,28 @@ void w55_init(void)
 //  SPCR = (1 << SPE) | (1 << MSTR);  // SPI master mode 0
 //  SPSR |= (1 << SPI2X);             // SPI clock rate clock / 2 = 8 MHz
 
+#if W55_SPI_DMA
+  w55_dma_init();
+#endif
+
   w55_write(W5500_MR, W5500_BLB_COM, W5500_MR_SOFTRST | (1 << 1));
 
   // TODO: Add timeout
   while (w55_read(W5500_MR, W5500_BLB_COM) & W5500_MR_SOFTRST)
     ;
+
+  // Bound the time a SEND can stay pending (e.g. ARP for an absent peer)
+  w55_write16(W5500_RTR, W5500_BLB_COM, W55_RTR);
+  w55_write(W5500_RCR, W5500_BLB_COM, W55_RCR);
+
+  // The reset gives every socket 2 KB each way; leave all memory to the
+  // sockets w55_udp_open() allocates it to
+  for (uint8_t socket = 0; socket < W5500_NUM_SOCKETS; socket++) {
+    w55_write(W5500_RXBUF_SIZE_OFFSET, W5500_BLB_SKT_REG(socket), 0);
+    w55_write(W5500_TXBUF_SIZE_OFFSET, W5500_BLB_SKT_REG(socket), 0);
+  }
+  rx_allocated_kb = 0;
+  tx_allocated_kb = 0;
 }
 
 
@@ -138,6 +214,16 @@ uint8_t w55_config(struct w5500_config *cfg)
 }
 
 
+void w55_spi_stats(struct w5500_spi_stats *stats)
+{
+#if W55_SPI_STATS
+  *stats = spi_stats;
+#else
+  memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+
 uint8_t w55_next_free_socket(void)
 {
   uint8_t socket = 0;
@@ -169,8 +255,64 @@ void w55_command(uint8_t socket, uint8_t cmd)
 }
 
 
-uint8_t w55_udp_open(uint16_t port)
+// Receive state of each socket (see w55_udp_rx_begin)
+static uint16_t rxrd[W5500_NUM_SOCKETS] = {
+    0,
+};
+static uint16_t rx_mask[W5500_NUM_SOCKETS] = {
+    0,
+};
+static uint16_t rx_left[W5500_NUM_SOCKETS] = {
+    0,
+};
+static uint8_t rx_consumed[W5500_NUM_SOCKETS] = {
+    0,
+};
+static uint32_t rx_dropped = 0;
+
+// Transmit state of each socket (see w55_udp_begin)
+static uint16_t get_free_size[W5500_NUM_SOCKETS] = {
+    0,
+};
+static uint16_t txwr[W5500_NUM_SOCKETS] = {
+    0,
+};
+
+// Kept between datagrams: a UDP SEND
+// empties the TX buffer, so once it completed TX_FSR is the buffer size and
+// TX_WR is where w55_udp_end() left it. Only a failed SEND makes the next
+// datagrams read them back from the chip, until the buffer has drained.
+static uint16_t tx_size[W5500_NUM_SOCKETS] = {
+    0,
+};
+static uint8_t tx_synced[W5500_NUM_SOCKETS] = {
+    0,
+};
+
+// Destination last written to DIPR/DPORT
+static uint8_t tx_peer_ip[W5500_NUM_SOCKETS][4];
+static uint16_t tx_peer_port[W5500_NUM_SOCKETS];
+static uint8_t tx_peer_valid[W5500_NUM_SOCKETS] = {
+    0,
+};
+
+
+// Sn_RXBUF_SIZE/Sn_TXBUF_SIZE values the W5500 accepts
+static uint8_t w55_buf_size_valid(uint8_t kb)
+{
+  return kb == 1 || kb == 2 || kb == 4 || kb == 8 || kb == 16;
+}
+
+
+// Opens a UDP socket with rx_kb and tx_kb of the W5500's buffer memory;
+// returns W5500_NUM_SOCKETS if there is no free socket or memory
+uint8_t w55_udp_open(uint16_t port, uint8_t rx_kb, uint8_t tx_kb)
 {
+  if (!w55_buf_size_valid(rx_kb) || !w55_buf_size_valid(tx_kb) ||
+      rx_allocated_kb + rx_kb > W5500_BUF_MEMORY_KB ||
+      tx_allocated_kb + tx_kb > W5500_BUF_MEMORY_KB)
+    return W5500_NUM_SOCKETS;
+
   uint8_t socket = w55_next_free_socket();
   if (socket >= W5500_NUM_SOCKETS)
     return W5500_NUM_SOCKETS;
@@ -182,8 +324,10 @@ uint8_t w55_udp_open(uint16_t port)
   uint8_t block = W5500_BLB_SKT_REG(socket);
   w55_write(W5500_MR_OFFSET, block, W5500_SKT_SR_UDP);
 
-  // Set port
+  // Set port and buffer sizes (read back below)
   w55_write16(W5500_PORT_OFFSET, block, port);
+  w55_write(W5500_RXBUF_SIZE_OFFSET, block, rx_kb);
+  w55_write(W5500_TXBUF_SIZE_OFFSET, block, tx_kb);
 
   // Open and check
   w55_command(socket, W5500_SKT_CR_OPEN);
@@ -192,74 +336,240 @@ uint8_t w55_udp_open(uint16_t port)
     return W5500_NUM_SOCKETS;
   }
 
+  // Only the receive code moves RX_RD from now on, so keep a copy
+  rx_mask[socket] = (w55_read(W5500_RXBUF_SIZE_OFFSET, block) << 10) - 1;
+  rxrd[socket] = w55_read16(W5500_RX_RD_OFFSET, block);
+  rx_left[socket] = 0;
+
+  // Likewise TX_WR for the transmit code; the TX buffer is empty
+  tx_size[socket] = w55_read(W5500_TXBUF_SIZE_OFFSET, block) << 10;
+  txwr[socket] = w55_read16(W5500_TX_WR_OFFSET, block);
+  tx_synced[socket] = 1;
+  tx_peer_valid[socket] = 0;
+
+  rx_allocated_kb += rx_kb;
+  tx_allocated_kb += tx_kb;
+
   return socket;
 }
 
 
-uint16_t w55_udp_read(uint16_t socket, struct w5500_udp_header *header,
-                      uint8_t *dst, uint16_t size)
+// Reads from the RX ring buffer, splitting the burst where it wraps
+static void w55_rx_readn(uint8_t socket, uint16_t ptr, uint8_t *dst,
+                         uint16_t size)
+{
+  const uint8_t rx_block = W5500_BLB_SKT_RX(socket);
+  uint16_t offset = ptr & rx_mask[socket];
+  uint16_t first = MIN(size, (uint16_t) (rx_mask[socket] + 1 - offset));
+
+  w55_readn(offset, rx_block, dst, first);
+  if (first < size)
+    w55_readn(0, rx_block, dst + first, size - first);
+}
+
+
+// Starts draining a socket; returns the number of bytes received
+uint16_t w55_udp_rx_begin(uint8_t socket)
 {
   if (socket >= W5500_NUM_SOCKETS)
     return 0;
 
-  if (!dst)
-    size = 0;
+  rx_left[socket] = w55_read16(W5500_RX_RSR_OFFSET, W5500_BLB_SKT_REG(socket));
+  rx_consumed[socket] = 0;
 
-  const uint8_t block = W5500_BLB_SKT_REG(socket);
-  const uint8_t rx_block = W5500_BLB_SKT_RX(socket);
+  return rx_left[socket];
+}
+
+
+// Returns the next datagram of those counted by w55_udp_rx_begin(), or 0
+// if there is none. Empty datagrams and those longer than size are skipped
+// and counted as dropped. The W5500 only adds complete datagrams to RX_RSR, so a header or
+// payload that runs past it means the buffer is corrupt: the rest is dropped.
+uint16_t w55_udp_rx_next(uint8_t socket, struct w5500_udp_header *header,
+                         uint8_t *dst, uint16_t size)
+{
   const uint8_t header_size = 8;
 
-  uint16_t get_size = w55_read16(W5500_RX_RSR_OFFSET, block);
-  if (get_size == 0 || get_size < header_size)
-    // FIXME: Handle size < 8 differently: skip incomplete packet
+  if (socket >= W5500_NUM_SOCKETS)
     return 0;
 
-  get_size -= header_size;
+  if (!dst)
+    size = 0;
+
+  while (rx_left[socket]) {
+    if (rx_left[socket] < header_size) {
+      rxrd[socket] += rx_left[socket];
+      rx_left[socket] = 0;
+      rx_consumed[socket] = 1;
+      rx_dropped++;
+      break;
+    }
+
+    // Read header
+    w55_rx_readn(socket, rxrd[socket], (uint8_t *) header, header_size);
+
+    // Swap endianess of port and size
+    header->port = swap16(header->port);
+    header->size = swap16(header->size);
 
-  uint16_t rxrd = w55_read16(W5500_RX_RD_OFFSET, block);
+    if (header->size > rx_left[socket] - header_size) {
+      rxrd[socket] += rx_left[socket];
+      rx_left[socket] = 0;
+      rx_consumed[socket] = 1;
+      rx_dropped++;
+      break;
+    }
+
+    uint16_t data = rxrd[socket] + header_size;
+    rxrd[socket] += header_size + header->size;
+    rx_left[socket] -= header_size + header->size;
+    rx_consumed[socket] = 1;
+
+    if (header->size == 0 || header->size > size) {
+      rx_dropped++;
+      continue;
+    }
+
+    w55_rx_readn(socket, data, dst, header->size);
+    return header->size;
+  }
 
-  // Read header
-  w55_readn(rxrd, rx_block, (uint8_t *) header, header_size);
-  rxrd += header_size;
+  return 0;
+}
 
-  // Swap endianess of port and size
-  header->port = swap16(header->port);
-  header->size = swap16(header->size);
 
-  w55_readn(rxrd, rx_block, dst, MIN(header->size, size));
-  rxrd += header->size;
+// Frees everything w55_udp_rx_next() consumed with a single RECV; returns
+// the bytes counted by w55_udp_rx_begin() that are left for the next one
+uint16_t w55_udp_rx_end(uint8_t socket)
+{
+  if (socket >= W5500_NUM_SOCKETS)
+    return 0;
 
-  w55_write16(W5500_RX_RD_OFFSET, block, rxrd);
+  uint16_t left = rx_left[socket];
+  rx_left[socket] = 0;
+
+  if (!rx_consumed[socket])
+    return left;
+
+  w55_write16(W5500_RX_RD_OFFSET, W5500_BLB_SKT_REG(socket), rxrd[socket]);
   w55_command(socket, W5500_SKT_CR_RECV);
+  rx_consumed[socket] = 0;
 
-  return header->size;
+  return left;
 }
 
 
-static uint16_t get_free_size[W5500_NUM_SOCKETS] = {
+uint16_t w55_udp_read(uint16_t socket, struct w5500_udp_header *header,
+                      uint8_t *dst, uint16_t size)
+{
+  if (!w55_udp_rx_begin(socket))
+    return 0;
+
+  uint16_t nbytes = w55_udp_rx_next(socket, header, dst, size);
+
+  // Leave later datagrams for the next call
+  w55_udp_rx_end(socket);
+
+  return nbytes;
+}
+
+
+uint32_t w55_udp_dropped(void)
+{
+  return rx_dropped;
+}
+
+
+// SEND issued by w55_udp_end() and not yet completed
+static uint8_t send_pending[W5500_NUM_SOCKETS] = {
     0,
 };
-static uint16_t txwr[W5500_NUM_SOCKETS] = {
+static uint32_t send_started[W5500_NUM_SOCKETS];
+static uint32_t failed_sends = 0;
+static uint32_t socket_failed_sends[W5500_NUM_SOCKETS] = {
     0,
 };
 
 
+enum w5500_send_state w55_udp_poll(uint8_t socket)
+{
+  if (socket >= W5500_NUM_SOCKETS || !send_pending[socket])
+    return W55_SEND_IDLE;
+
+  uint8_t block = W5500_BLB_SKT_REG(socket);
+  uint8_t ir = w55_read(W5500_IR_OFFSET, block);
+
+  if (ir & (W5500_IR_SEND_OK | W5500_IR_TIMEOUT)) {
+    w55_write(W5500_IR_OFFSET, block, W5500_IR_SEND_OK | W5500_IR_TIMEOUT);
+    send_pending[socket] = 0;
+
+    if (ir & W5500_IR_SEND_OK)
+      return W55_SEND_OK;
+
+    tx_synced[socket] = 0;
+    failed_sends++;
+    socket_failed_sends[socket]++;
+    return W55_SEND_FAILED;
+  }
+
+  // The W5500 should have timed out by now (see W55_RTR); don't wait forever
+  if (micros() - send_started[socket] > W55_SEND_TIMEOUT_US) {
+    send_pending[socket] = 0;
+    tx_synced[socket] = 0;
+    failed_sends++;
+    socket_failed_sends[socket]++;
+    return W55_SEND_FAILED;
+  }
+
+  return W55_SEND_PENDING;
+}
+
+
+uint32_t w55_udp_failed_sends(void)
+{
+  return failed_sends;
+}
+
+
+uint32_t w55_udp_socket_failed_sends(uint8_t socket)
+{
+  return socket < W5500_NUM_SOCKETS ? socket_failed_sends[socket] : 0;
+}
+
+
 uint8_t w55_udp_begin(uint8_t socket, struct w5500_udp_header *header)
 {
   if (socket >= W5500_NUM_SOCKETS)
     return 1;
 
+  // DIPR and DPORT must not change under a pending SEND
+  while (w55_udp_poll(socket) == W55_SEND_PENDING)
+    ;
+
   uint8_t block = W5500_BLB_SKT_REG(socket);
 
-  // Write destination IP and port
-  header->port = swap16(header->port);
-  w55_writen(W5500_DIPR_OFFSET, block, (uint8_t *) header, 6);
+  // Write destination IP and port, unless the last datagram went there too
+  if (!tx_peer_valid[socket] || tx_peer_port[socket] != header->port ||
+      memcmp(tx_peer_ip[socket], header->ip_address, 4)) {
+    uint8_t dest[6];
+    memcpy(dest, header->ip_address, 4);
+    dest[4] = header->port >> 8;
+    dest[5] = header->port;
+    w55_writen(W5500_DIPR_OFFSET, block, dest, sizeof(dest));
+
+    memcpy(tx_peer_ip[socket], header->ip_address, 4);
+    tx_peer_port[socket] = header->port;
+    tx_peer_valid[socket] = 1;
+  }
 
-  // Restore endianess if client wants to reuse port afterwards
-  header->port = swap16(header->port);
+  get_free_size[socket] = tx_size[socket];
 
-  get_free_size[socket] = w55_read16(W5500_TX_FSR_OFFSET, block);
-  txwr[socket] = w55_read16(W5500_TX_WR_OFFSET, block);
+  // tx_size stays the buffer size; a SEND given up on may still hold part of it
+  if (!tx_synced[socket]) {
+    get_free_size[socket] = w55_read16(W5500_TX_FSR_OFFSET, block);
+    txwr[socket] = w55_read16(W5500_TX_WR_OFFSET, block);
+    tx_synced[socket] = get_free_size[socket] == tx_size[socket];
+  }
 
   return 0;
 }
@@ -298,21 +608,103 @@ uint8_t w55_udp_end(uint8_t socket)
   // Set to safe value in case user calls w55_udp_end() several times
   get_free_size[socket] = 0;
 
-  // TODO: Add timeout
-  while (1) {
-    uint8_t ir = w55_read(W5500_IR_OFFSET, block);
-
-    if (ir & W5500_IR_SEND_OK) {
-      w55_write(W5500_IR_OFFSET, block, W5500_IR_SEND_OK | W5500_IR_TIMEOUT);
-      return 0;
-    } else if (ir & W5500_IR_TIMEOUT) {
-      w55_write(W5500_IR_OFFSET, block, W5500_IR_SEND_OK | W5500_IR_TIMEOUT);
-      return 1;
-    }
-  }
+  // Completion is picked up by w55_udp_poll() (next tick or next begin)
+  send_pending[socket] = 1;
+  send_started[socket] = micros();
 
-  // Timed out
+  return 0;
+}
+
+
+#if W55_RECV_IRQ
+// Set by the INTn interrupt; starts set so the first tick polls once
+static volatile uint8_t irq_pending = 1;
+static uint8_t irq_sockets = 0;  // Sockets routed to INTn
+
+
+static void w55_isr(void)
+{
+  irq_pending = 1;
+}
+#endif
+
+
+// Routes received packets of a socket to INTn; returns 1 (and the stack
+// keeps polling) if W55_INT_PIN is not set or cannot interrupt
+uint8_t w55_irq_enable(uint8_t socket)
+{
+#if W55_RECV_IRQ
+  if (socket >= W5500_NUM_SOCKETS ||
+      digitalPinToInterrupt(W55_INT_PIN) == NOT_AN_INTERRUPT)
+    return 1;
+
+  // Only RECV: INTn stays low while any unmasked flag is set, and SEND
+  // completion is collected by w55_udp_poll()
+  w55_write(W5500_IMR_OFFSET, W5500_BLB_SKT_REG(socket), W5500_IR_RECV);
+  w55_write(W5500_SIMR, W5500_BLB_COM,
+            w55_read(W5500_SIMR, W5500_BLB_COM) | (1 << socket));
+
+  pinMode(W55_INT_PIN, INPUT_PULLUP);
+  attachInterrupt(W55_INT_PIN, w55_isr, FALLING);
+  irq_sockets |= 1 << socket;
+
+  return 0;
+#else
+  (void) socket;
   return 1;
+#endif
+}
+
+
+// Returns the mask of sockets that may have received data since the last
+// call (all of them if polling). The RECV flags of all of them are cleared:
+// INTn stays low while any is set, so one left set would hide the packets
+// arriving on the others.
+uint8_t w55_irq_take(void)
+{
+#if W55_RECV_IRQ
+  if (!irq_sockets)
+    return 0xff;
+
+  if (!irq_pending)
+    return 0;
+
+  // A packet may arrive on another socket between reading SIR and clearing
+  // the flags it showed; read again until none is left, so that INTn is
+  // high and falls for the next one
+  irq_pending = 0;
+  uint8_t sockets = 0;
+  uint8_t flags;
+  while ((flags = w55_read(W5500_SIR, W5500_BLB_COM) & irq_sockets)) {
+    sockets |= flags;
+    for (uint8_t socket = 0; socket < W5500_NUM_SOCKETS; socket++)
+      if (flags & (1 << socket))
+        w55_write(W5500_IR_OFFSET, W5500_BLB_SKT_REG(socket), W5500_IR_RECV);
+  }
+
+  return sockets;
+#else
+  return 0xff;
+#endif
+}
+
+
+// Sleeps until the next interrupt unless a packet is already pending. Other
+// interrupts (SysTick, USB) wake the CPU as well; the caller just ticks again.
+void w55_irq_sleep(void)
+{
+#if W55_RECV_IRQ
+  if (!irq_sockets)
+    return;
+
+  // WFI also returns for an interrupt that became pending while masked
+  __disable_irq();
+  if (!irq_pending) {
+    __DSB();
+    __WFI();
+  }
+  __enable_irq();
+#endif
 }
 
 
@@ -332,15 +724,83 @@ void w55_transmit(uint8_t x)
 
 void w55_enable(void)
 {
-//  W55_CS_PORT &= ~(1 << W55_CS_BIT);
-  digitalWrite(SS,LOW);
+  gpio<W55_CS_PIN>::low();
   //SPI_2.beginTransaction(SPISettings(8000000, MSBFIRST, SPI_MODE0));
 }
 
 
 void w55_disable(void)
 {
-//  W55_CS_PORT |= (1 << W55_CS_BIT);
-  digitalWrite(SS,HIGH);
+  gpio<W55_CS_PIN>::high();
   //SPI_2.endTransaction();
 }
+
+
+#if W55_SPI_DMA
+// DMAC channels for SERCOM4 (SPI_2), see dmac.h
+#define W55_DMA_CH_TX DMAC_CH_W55_TX
+#define W55_DMA_CH_RX DMAC_CH_W55_RX
+
+static DmacDescriptor dma_payload[2] __attribute__((aligned(16)));
+static const uint8_t dma_tx_dummy = 0x00;
+static uint8_t dma_rx_sink;
+
+
+static void w55_dma_descriptor(DmacDescriptor *desc, const volatile void *src,
+                               uint8_t src_inc, volatile void *dst,
+                               uint8_t dst_inc, uint16_t count,
+                               DmacDescriptor *next)
+{
+  desc->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE |
+                     (src_inc ? DMAC_BTCTRL_SRCINC : 0) |
+                     (dst_inc ? DMAC_BTCTRL_DSTINC : 0);
+  desc->BTCNT.reg = count;
+
+  // Incrementing addresses point one past the end of the block
+  desc->SRCADDR.reg = (uintptr_t) src + (src_inc ? count : 0);
+  desc->DSTADDR.reg = (uintptr_t) dst + (dst_inc ? count : 0);
+  desc->DESCADDR.reg = (uintptr_t) next;
+}
+
+
+void w55_dma_init(void)
+{
+  dmac_init();
+
+  // Lowest priority: pulse train edges must not wait for a burst
+  dmac_channel_init(W55_DMA_CH_TX, SERCOM4_DMAC_ID_TX, 0);
+  dmac_channel_init(W55_DMA_CH_RX, SERCOM4_DMAC_ID_RX, 0);
+}
+
+
+void w55_dma_burst(uint8_t *header, uint8_t *src, uint8_t *dest, uint16_t size)
+{
+  volatile void *data = &SERCOM4->SPI.DATA.reg;
+
+  // TX: header, then the payload (write) or dummy bytes (read)
+  w55_dma_descriptor(&dma_payload[0], src ? src : &dma_tx_dummy, src != NULL,
+                     data, 0, size, NULL);
+  w55_dma_descriptor(&dmac_base[W55_DMA_CH_TX], header, 1, data, 0, 3,
+                     &dma_payload[0]);
+
+  // RX: drain every byte so no stale data is left for the next polled transfer
+  w55_dma_descriptor(&dma_payload[1], data, 0, dest ? dest : &dma_rx_sink,
+                     dest != NULL, size, NULL);
+  dma_payload[1].BTCTRL.reg |= DMAC_BTCTRL_BLOCKACT_INT;  // TCMPL when done
+  w55_dma_descriptor(&dmac_base[W55_DMA_CH_RX], data, 0, &dma_rx_sink, 0, 3,
+                     &dma_payload[1]);
+
+  // Arm RX before TX so that the first received byte is not missed
+  DMAC->CHID.reg = DMAC_CHID_ID(W55_DMA_CH_RX);
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+  DMAC->CHID.reg = DMAC_CHID_ID(W55_DMA_CH_TX);
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+
+  // The last RX beat arrives after the last bit was clocked out
+  DMAC->CHID.reg = DMAC_CHID_ID(W55_DMA_CH_RX);
+  while (!(DMAC->CHINTFLAG.reg & (DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR)))
+    ;
+}
+#endif
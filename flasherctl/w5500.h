@@ -13,9 +13,54 @@
 // Chip select configuration
 #define W55_CS_PIN SS
 
+// Bulk transfers (w55_readn/w55_writen) through the DMAC: 0 = always polled
+#ifndef W55_SPI_DMA
+#if defined(ARDUINO_ARCH_SAMD) || defined(FLASHERCTL_HOST)
+#define W55_SPI_DMA 1
+#else
+#define W55_SPI_DMA 0
+#endif
+#endif
+
+// Payloads shorter than this are sent polled; DMA setup costs more than it saves
+#ifndef W55_SPI_DMA_MIN_SIZE
+#define W55_SPI_DMA_MIN_SIZE 8
+#endif
+
+// Byte and time accounting of bulk transfers (costs two micros() per transfer)
+#ifndef W55_SPI_STATS
+#define W55_SPI_STATS 0
+#endif
+
+// Retransmission time (units of 100 us) and retry count of the W5500; a SEND
+// to an unresolved address ends in TIMEOUT after W55_RTR * (W55_RCR + 1)
+#ifndef W55_RTR
+#define W55_RTR 1000
+#endif
+
+#ifndef W55_RCR
+#define W55_RCR 3
+#endif
+
+// Give up on a SEND the W5500 has not completed after this long
+#define W55_SEND_TIMEOUT_US (100ul * W55_RTR * (W55_RCR + 1) + 100000ul)
+
+// Board pin wired to the W5500 INTn output. When defined, received packets
+// raise an EIC interrupt and the sketch sleeps (WFI) until one arrives instead
+// of polling RX_RSR in every tick; leave undefined where INTn is not wired.
+// #define W55_INT_PIN 12
+#ifdef W55_INT_PIN
+#define W55_RECV_IRQ 1
+#else
+#define W55_RECV_IRQ 0
+#endif
+
 // Max. number of sockets
 #define W5500_NUM_SOCKETS 8
 
+// Buffer memory shared by the sockets, per direction (KB)
+#define W5500_BUF_MEMORY_KB 16
+
 // Read/write bit
 #define W5500_RWB (1 << 2)
 
@@ -31,6 +76,10 @@
 #define  W5500_SUBR 0x0005  // Subnet mask address (4 bytes)
 #define  W5500_SHAR 0x0009  // Source hardware address (MAC, 6 bytes)
 #define  W5500_SIPR 0x000f  // Source IP address (4 bytes)
+#define  W5500_RTR  0x0019  // Retry time (2 bytes)
+#define  W5500_RCR  0x001b  // Retry count
+#define  W5500_SIR  0x0017  // Socket interrupt
+#define  W5500_SIMR 0x0018  // Socket interrupt mask
 
 // Interrupt register bits
 #define W5500_IR_SEND_OK (1 << 4)
@@ -47,10 +96,13 @@
 #define  W5500_PORT_OFFSET   0x0004  // Socket port (2 bytes)
 #define  W5500_DIPR_OFFSET   0x000c  // Socket dest. IP address (4 bytes)
 #define  W5500_DPORT_OFFSET  0x0010  // Socket dest. port (2 bytes)
+#define  W5500_RXBUF_SIZE_OFFSET 0x001e  // Socket RX buffer size (KB)
+#define  W5500_TXBUF_SIZE_OFFSET 0x001f  // Socket TX buffer size (KB)
 #define  W5500_TX_FSR_OFFSET 0x0020  // Socket transmit free size (2 bytes)
 #define  W5500_TX_WR_OFFSET  0x0024  // Socket transmit write pointer (2 bytes)
 #define  W5500_RX_RSR_OFFSET 0x0026  // Socket receive received size (2 bytes)
 #define  W5500_RX_RD_OFFSET  0x0028  // Socket receive read pointer (2 bytes)
+#define  W5500_IMR_OFFSET    0x002c  // Socket interrupt mask
 
 // Chip mode register bits
 #define  W5500_MR_SOFTRST (1 << 7)  // Soft reset
@@ -81,6 +133,21 @@ struct __attribute__((packed)) w5500_config {
   uint8_t ip_address[4];
 };
 
+struct w5500_spi_stats {
+  uint32_t dma_bytes;     // Bytes moved by DMA bursts, including 3-byte headers
+  uint32_t dma_micros;
+  uint32_t polled_bytes;  // Bytes moved by polled bulk transfers
+  uint32_t polled_micros;
+};
+
+// Transmit state of a socket, see w55_udp_poll()
+enum w5500_send_state {
+  W55_SEND_IDLE = 0,  // Nothing in flight
+  W55_SEND_PENDING,   // SEND issued, no result yet
+  W55_SEND_OK,        // Previous SEND completed (returned once)
+  W55_SEND_FAILED,    // Previous SEND timed out (returned once)
+};
+
 struct __attribute__((packed)) w5500_udp_header {
   uint8_t ip_address[4];
   uint16_t port;
@@ -97,11 +164,25 @@ void w55_readn(uint16_t addr, uint8_t block, uint8_t dest[], uint16_t size);
 
 uint8_t w55_config(struct w5500_config *cfg);
 
-uint8_t w55_udp_open(uint16_t port);
+void w55_spi_stats(struct w5500_spi_stats *stats);
+
+uint8_t w55_udp_open(uint16_t port, uint8_t rx_kb, uint8_t tx_kb);
 uint16_t w55_udp_read(uint16_t socket, struct w5500_udp_header *header,
                       uint8_t *dst, uint16_t size);
+uint16_t w55_udp_rx_begin(uint8_t socket);
+uint16_t w55_udp_rx_next(uint8_t socket, struct w5500_udp_header *header,
+                         uint8_t *dst, uint16_t size);
+uint16_t w55_udp_rx_end(uint8_t socket);
+uint32_t w55_udp_dropped(void);
 uint8_t w55_udp_begin(uint8_t socket, struct w5500_udp_header *header);
 uint16_t w55_udp_write(uint8_t socket, uint8_t *src, uint16_t size);
 uint8_t w55_udp_end(uint8_t socket);
+enum w5500_send_state w55_udp_poll(uint8_t socket);
+uint32_t w55_udp_failed_sends(void);
+uint32_t w55_udp_socket_failed_sends(uint8_t socket);
+
+uint8_t w55_irq_enable(uint8_t socket);
+uint8_t w55_irq_take(void);
+void w55_irq_sleep(void);
 
 #endif
@@ -0,0 +1,227 @@
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+// Host shim for the parts of the Arduino (SAMD21) core used by the firmware.
+// All I/O is routed to the simulator in host/sim.cpp.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+// Interrupt modes (besides LOW and HIGH)
+#define CHANGE  2
+#define FALLING 3
+#define RISING  4
+
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) ((p) < NUM_DIGITAL_PINS ? (int) (p) : NOT_AN_INTERRUPT)
+
+#define DEC 10
+#define HEX 16
+
+#define F(string_literal) (string_literal)
+
+// Pin numbers as in the controller board variant
+#define LED_BUILTIN 13  // PA17
+#define PIN_LED2    25  // PB03, RX_LED / TEST_PULSE
+#define SS          10  // PA18, CS for the W5500
+
+#define NUM_DIGITAL_PINS 64
+
+#define F_CPU 48000000L
+
+typedef enum _EPortType {
+  NOT_A_PORT = -1,
+  PORTA = 0,
+  PORTB = 1,
+} EPortType;
+
+typedef struct _PinDescription {
+  EPortType ulPort;
+  uint32_t ulPin;
+} PinDescription;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern PinDescription g_APinDescription[NUM_DIGITAL_PINS];
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+
+typedef void (*voidFuncPtr)(void);
+void attachInterrupt(uint32_t pin, voidFuncPtr callback, uint32_t mode);
+void detachInterrupt(uint32_t pin);
+
+// CMSIS intrinsics; interrupts are delivered by the simulator between
+// statements, so masking them is a no-op
+void __WFI(void);
+static inline void __DSB(void) {}
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis(void);
+unsigned long micros(void);
+
+#ifdef __cplusplus
+}
+
+// PORT registers; accesses are forwarded to the simulated pins
+enum sim_port_reg_id {
+  SIM_PORT_DIR,
+  SIM_PORT_OUT,
+  SIM_PORT_OUTCLR,
+  SIM_PORT_OUTSET,
+  SIM_PORT_OUTTGL,
+  SIM_PORT_IN,
+};
+
+void sim_port_write(uint8_t group, uint8_t id, uint32_t value);
+uint32_t sim_port_read(uint8_t group, uint8_t id);
+
+template <uint8_t id>
+struct SimPortReg {
+  struct Reg {
+    uint8_t group;
+
+    Reg &operator=(uint32_t value) { sim_port_write(group, id, value); return *this; }
+    operator uint32_t() const { return sim_port_read(group, id); }
+  } reg;
+};
+
+struct SimPortGroup {
+  SimPortReg<SIM_PORT_DIR> DIR;
+  SimPortReg<SIM_PORT_OUT> OUT;
+  SimPortReg<SIM_PORT_OUTCLR> OUTCLR;
+  SimPortReg<SIM_PORT_OUTSET> OUTSET;
+  SimPortReg<SIM_PORT_OUTTGL> OUTTGL;
+  SimPortReg<SIM_PORT_IN> IN;
+};
+
+struct SimPort {
+  SimPortGroup Group[2];
+
+  SimPort()
+  {
+    for (uint8_t g = 0; g < 2; g++) {
+      Group[g].DIR.reg.group = g;
+      Group[g].OUT.reg.group = g;
+      Group[g].OUTCLR.reg.group = g;
+      Group[g].OUTSET.reg.group = g;
+      Group[g].OUTTGL.reg.group = g;
+      Group[g].IN.reg.group = g;
+    }
+  }
+};
+
+extern SimPort sim_port;
+#define PORT (&sim_port)
+
+// DMAC descriptors and channel registers; enabling a channel runs its
+// descriptor chain in the simulator. Addresses are host pointers.
+#define DMAC_BTCTRL_VALID         (1 << 0)
+#define DMAC_BTCTRL_BLOCKACT_Msk  (0x3 << 3)
+#define DMAC_BTCTRL_BLOCKACT_NOACT (0x0 << 3)
+#define DMAC_BTCTRL_BLOCKACT_INT  (0x1 << 3)
+#define DMAC_BTCTRL_BLOCKACT_SUSPEND (0x2 << 3)
+#define DMAC_BTCTRL_BLOCKACT_BOTH (0x3 << 3)
+#define DMAC_BTCTRL_BEATSIZE_BYTE (0x0 << 8)
+#define DMAC_BTCTRL_SRCINC        (1 << 10)
+#define DMAC_BTCTRL_DSTINC        (1 << 11)
+
+#define DMAC_CHID_ID(value)       (value)
+#define DMAC_CHCTRLA_ENABLE       (1 << 1)
+#define DMAC_CHINTFLAG_TERR       (1 << 0)
+#define DMAC_CHINTFLAG_TCMPL      (1 << 1)
+#define DMAC_CHINTFLAG_SUSP       (1 << 2)
+#define DMAC_CHINTFLAG_MASK       0x07
+
+#define SERCOM4_DMAC_ID_RX 0x09
+#define SERCOM4_DMAC_ID_TX 0x0a
+
+typedef struct {
+  struct { uint16_t reg; } BTCTRL;
+  struct { uint16_t reg; } BTCNT;
+  struct { uintptr_t reg; } SRCADDR;
+  struct { uintptr_t reg; } DSTADDR;
+  struct { uintptr_t reg; } DESCADDR;
+} DmacDescriptor;
+
+enum sim_dmac_reg_id {
+  SIM_DMAC_CHID,
+  SIM_DMAC_CHCTRLA,
+  SIM_DMAC_CHINTFLAG,
+};
+
+void sim_dmac_write(uint8_t id, uint32_t value);
+uint32_t sim_dmac_read(uint8_t id);
+
+template <uint8_t id>
+struct SimDmacReg {
+  struct Reg {
+    Reg &operator=(uint32_t value) { sim_dmac_write(id, value); return *this; }
+    operator uint32_t() const { return sim_dmac_read(id); }
+  } reg;
+};
+
+struct SimDmac {
+  SimDmacReg<SIM_DMAC_CHID> CHID;
+  SimDmacReg<SIM_DMAC_CHCTRLA> CHCTRLA;
+  SimDmacReg<SIM_DMAC_CHINTFLAG> CHINTFLAG;
+};
+
+extern SimDmac sim_dmac;
+#define DMAC (&sim_dmac)
+
+// SPI_2 DATA register, the DMAC's peripheral end of a W5500 burst
+struct SimSercom {
+  struct { struct { uint32_t reg; } DATA; } SPI;
+};
+
+extern SimSercom sim_sercom4;
+#define SERCOM4 (&sim_sercom4)
+
+class SimSerial {
+ public:
+  void begin(unsigned long baud) { (void) baud; }
+
+  int available(void);
+  int read(void);
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int availableForWrite(void);
+  size_t print(const char *s);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println(void);
+  template <typename T>
+  size_t println(T value) { size_t n = print(value); return n + println(); }
+  template <typename T>
+  size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+
+  operator bool() { return true; }
+};
+
+extern SimSerial Serial;
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __HOST_FASTCRC_H__
+#define __HOST_FASTCRC_H__
+
+// Host shim for FrankBoesing/FastCRC; only the CRC variants used by the
+// firmware are provided.
+
+#include <Arduino.h>
+
+class FastCRC16 {
+ public:
+  // CRC-16/X-25: reflected polynomial 0x1021, init 0xffff, xorout 0xffff
+  uint16_t x25(const uint8_t *data, uint16_t datalen)
+  {
+    uint16_t crc = 0xffff;
+    while (datalen--) {
+      crc ^= *data++;
+      for (uint8_t i = 0; i < 8; i++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+    }
+
+    return crc ^ 0xffff;
+  }
+};
+
+#endif
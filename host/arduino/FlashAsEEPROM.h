@@ -0,0 +1,27 @@
+#ifndef __HOST_FLASHASEEPROM_H__
+#define __HOST_FLASHASEEPROM_H__
+
+// Host shim for cmaglie/FlashStorage's EEPROM emulation.
+
+#include <Arduino.h>
+
+#ifndef EEPROM_EMULATION_SIZE
+#define EEPROM_EMULATION_SIZE 1024
+#endif
+
+class EEPROMClass {
+ public:
+  uint8_t read(int address) { return data[address % EEPROM_EMULATION_SIZE]; }
+  void write(int address, uint8_t value) { data[address % EEPROM_EMULATION_SIZE] = value; }
+  void update(int address, uint8_t value) { write(address, value); }
+  bool isValid(void) { return valid; }
+  void commit(void);
+
+  uint8_t data[EEPROM_EMULATION_SIZE];
+  bool valid;
+  uint32_t commits;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
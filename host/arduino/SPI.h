@@ -0,0 +1,78 @@
+#ifndef __HOST_SPI_H__
+#define __HOST_SPI_H__
+
+// Host shim for the SAMD21 SPIClass; transfers go to the simulated bus.
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+
+#define SPI_MODE0 0x02
+#define SPI_MODE1 0x00
+#define SPI_MODE2 0x03
+#define SPI_MODE3 0x01
+
+typedef enum { SPI_PAD_0_SCK_1 = 0, SPI_PAD_2_SCK_3, SPI_PAD_3_SCK_1, SPI_PAD_0_SCK_3 } SercomSpiTXPad;
+typedef enum { SERCOM_RX_PAD_0 = 0, SERCOM_RX_PAD_1, SERCOM_RX_PAD_2, SERCOM_RX_PAD_3 } SercomRXPad;
+
+struct SERCOM {
+  uint8_t index;
+};
+
+extern SERCOM sercom0, sercom1, sercom2, sercom3, sercom4, sercom5;
+
+// SERCOM assignment of the controller board variant
+#define PERIPH_SPI  sercom0
+#define PERIPH_SPI1 sercom1
+#define PERIPH_SPI2 sercom4
+
+#define PIN_SPI_MISO  2
+#define PIN_SPI_SCK   3
+#define PIN_SPI_MOSI  0
+#define PAD_SPI_TX    SPI_PAD_0_SCK_1
+#define PAD_SPI_RX    SERCOM_RX_PAD_2
+#define PIN_SPI1_MISO 17
+#define PIN_SPI1_SCK  18
+#define PIN_SPI1_MOSI 19
+#define PAD_SPI1_TX   SPI_PAD_2_SCK_3
+#define PAD_SPI1_RX   SERCOM_RX_PAD_0
+#define PIN_SPI2_MISO 28
+#define PIN_SPI2_SCK  29
+#define PIN_SPI2_MOSI 30
+#define PAD_SPI2_TX   SPI_PAD_2_SCK_3
+#define PAD_SPI2_RX   SERCOM_RX_PAD_0
+
+class SPISettings {
+ public:
+  SPISettings(uint32_t clock, uint8_t bit_order, uint8_t data_mode)
+      : clock(clock), bit_order(bit_order), data_mode(data_mode) {}
+  SPISettings() : clock(4000000), bit_order(MSBFIRST), data_mode(SPI_MODE0) {}
+
+  uint32_t clock;
+  uint8_t bit_order;
+  uint8_t data_mode;
+};
+
+class SPIClass {
+ public:
+  SPIClass(SERCOM *sercom, uint8_t miso, uint8_t sck, uint8_t mosi,
+           SercomSpiTXPad tx_pad, SercomRXPad rx_pad)
+      : sercom(sercom), clock(4000000)
+  {
+    (void) miso; (void) sck; (void) mosi; (void) tx_pad; (void) rx_pad;
+  }
+
+  void begin(void) {}
+  void end(void) {}
+  void beginTransaction(SPISettings settings) { clock = settings.clock; }
+  void endTransaction(void) {}
+
+  uint8_t transfer(uint8_t data);
+  void transfer(void *buf, size_t count);
+
+  SERCOM *sercom;
+  uint32_t clock;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __HOST_WIRE_H__
+#define __HOST_WIRE_H__
+
+// Host shim for the Arduino TwoWire (I2C) class; talks to the simulated
+// DS28CM00 serial number chip.
+
+#include <Arduino.h>
+
+class TwoWire {
+ public:
+  void begin(void) {}
+
+  void beginTransmission(uint8_t address);
+  size_t write(uint8_t data);
+  uint8_t endTransmission(bool stop_bit = true);
+
+  uint8_t requestFrom(uint8_t address, size_t quantity, bool stop_bit = true);
+  int available(void);
+  int read(void);
+
+ private:
+  uint8_t address;
+  uint8_t rx_buffer[32];
+  uint8_t rx_head;
+  uint8_t rx_tail;
+};
+
+extern TwoWire Wire;
+
+#endif
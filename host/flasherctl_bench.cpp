@@ -0,0 +1,1173 @@
+// Benchmark of the request hot path on the simulated controller board.
+//
+// Boots the unmodified sketch through setup(), then injects requests for each
+// command code into the simulated W5500 and reports the bus cost of serving
+// them through loop(): iostack_tick -> w55_udp_rx_next -> handler ->
+// iostack_response_* -> w55_udp_end.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "flasher.h"
+#include "log.h"
+#include "telemetry.h"
+#include "timesync.h"
+#include "w5500.h"
+
+#include "sim.h"
+#include "w5500_sim.h"
+
+void setup(void);
+void loop(void);
+
+struct bench_case {
+  const char *name;
+  uint8_t subsystem_id;
+  uint16_t request_code;
+  std::vector<uint8_t> payload;
+  void (*prepare)(void);   // Device state before each request, not measured
+  uint8_t (*check)(void);  // Device state after the request; 0 if correct
+  uint8_t burst;           // Copies injected back to back (0: one)
+};
+
+struct bench_result {
+  uint32_t requests;
+  uint32_t responses;
+  uint32_t ticks;
+  uint16_t response_code;
+  uint16_t response_size;
+  struct sim_counters cost;
+};
+
+static const uint8_t client_ip[4] = {192, 168, 0, 10};
+static const uint16_t client_port = 40000;
+static const uint16_t device_port = 512;
+static const uint32_t max_ticks = 16;
+
+static uint16_t request_id;
+static std::vector<uint8_t> last_response;  // Payload of the last response
+
+
+static uint8_t check_pulse_width(void)
+{
+  return ds1023sim.value != 0xa5;
+}
+
+
+// Starts each SET_LED_CURRENT from the complement of 0x0a, so that all four
+// current pins change
+static void prepare_led_current(void)
+{
+  flasher_SET_LED_CURRENT(0x05);
+}
+
+
+static uint8_t check_led_current(void)
+{
+  return sim_led_current() != 0x0a;
+}
+
+
+static void prepare_settings(void)
+{
+  flasher_SET_LED_CURRENT(0x0a);
+  flasher_SET_PULSE_WIDTH(0xa5);
+}
+
+
+// Staging must not change the outputs
+static uint8_t check_staged(void)
+{
+  return sim_led_current() != 0x0a || ds1023sim.value != 0xa5;
+}
+
+
+static void prepare_commit(void)
+{
+  prepare_settings();
+  flasher_STAGE_SETTINGS(0x05, 0x3c);
+}
+
+
+static uint8_t check_committed(void)
+{
+  return sim_led_current() != 0x05 || ds1023sim.value != 0x3c;
+}
+
+
+// The serial number read at boot, LSB first, ends the reply
+static uint8_t check_serial_no(void)
+{
+  return last_response.size() < 6 ||
+         memcmp(&last_response[last_response.size() - 6], &ds28cm00sim.memory[1], 6);
+}
+
+
+static uint8_t check_ethernet_configuration(void)
+{
+  return last_response.size() != sizeof(struct w5500_config) + IOSTACK_SERIAL_NO_SIZE ||
+         check_serial_no();
+}
+
+
+// Runs after the cases above, so every one of them has an entry; requests
+// with an unknown subsystem or command or an invalid size only count as
+// rejected
+static uint8_t check_cmd_stats(void)
+{
+  struct iostack_stats_header header;
+  if (last_response.size() < sizeof(header))
+    return 1;
+  memcpy(&header, &last_response[0], sizeof(header));
+
+  size_t n = (last_response.size() - sizeof(header)) / sizeof(struct iostack_cmd_stats);
+  if (header.first != 0 || header.nentries < 10 || n != IOSTACK_STATS_PER_PAGE ||
+      header.rejected < 3)
+    return 1;
+
+  for (size_t i = 0; i < n; i++) {
+    struct iostack_cmd_stats entry;
+    memcpy(&entry, &last_response[sizeof(header) + i * sizeof(entry)], sizeof(entry));
+
+    uint32_t histogram = 0;
+    for (uint8_t k = 0; k < IOSTACK_STATS_BUCKETS; k++)
+      histogram += entry.latency[k];
+    if (!entry.count || histogram != entry.count)
+      return 1;
+    if (entry.subsystem_id == 0x7f || entry.request_code == 0x7f)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+// Lets the background sampler complete a conversion
+static void prepare_temperature_sample(void)
+{
+  sim_advance_ns(TEMPERATURE_PERIOD_MS * 1000000ull);
+  loop();
+  sim_advance_ns(TEMPERATURE_CONVERSION_MS * 1000000ull);
+  loop();
+}
+
+
+static float response_float(size_t offset)
+{
+  float value = NAN;
+  if (last_response.size() >= offset + sizeof(value))
+    memcpy(&value, &last_response[offset], sizeof(value));
+  return value;
+}
+
+
+static uint8_t check_temperature(void)
+{
+  return response_float(0) != adt7310sim.temperature / TEMPERATURE_LSB_PER_C;
+}
+
+
+static uint8_t check_temperature_history(void)
+{
+  struct flasher_temperature_summary summary;
+  if (last_response.size() < sizeof(summary))
+    return 1;
+  memcpy(&summary, last_response.data(), sizeof(summary));
+
+  return summary.count == 0 ||
+         last_response.size() != sizeof(summary) +
+             summary.count * sizeof(struct flasher_temperature_sample) ||
+         summary.mean != adt7310sim.temperature / TEMPERATURE_LSB_PER_C;
+}
+
+
+static uint8_t check_telemetry(void)
+{
+  struct telemetry_frame frame;
+  if (last_response.size() != sizeof(frame))
+    return 1;
+  memcpy(&frame, last_response.data(), sizeof(frame));
+
+  return frame.version != TELEMETRY_VERSION || frame.temperature != adt7310sim.temperature;
+}
+
+
+// Lets the previous pulse train finish
+static void prepare_pulse_train(void)
+{
+  sim_advance_ns(200000000ull);
+  loop();
+}
+
+
+static uint8_t check_pulse_train(void)
+{
+  struct flasher_pulse_train train;
+  if (last_response.size() != sizeof(train))
+    return 1;
+  memcpy(&train, last_response.data(), sizeof(train));
+
+  return train.count != 100 || train.period_ns != 1000000 || train.width_ns != 1000;
+}
+
+
+static uint8_t check_pulse_train_done(void)
+{
+  struct flasher_pulse_train_status status;
+  if (last_response.size() != sizeof(status))
+    return 1;
+  memcpy(&status, last_response.data(), sizeof(status));
+
+  return status.running || status.count != 100 || status.emitted != 100;
+}
+
+
+static uint32_t failed_sends_expected;
+
+
+// Lets the response's SEND end in TIMEOUT
+static void prepare_failed_send(void)
+{
+  w55sim.fail_next_sends = 1;
+  failed_sends_expected++;
+}
+
+
+// The last failure is only seen by the next tick after the SEND ended
+static uint8_t check_failed_sends(void)
+{
+  sim_advance_ns(1000000);
+  loop();
+  return w55_udp_failed_sends() != failed_sends_expected;
+}
+
+
+// Appends an iostack_batch_request record to a CMD_BATCH payload
+static void batch_add(std::vector<uint8_t> *batch, uint8_t subsystem_id,
+                      uint16_t request_code, const std::vector<uint8_t> &payload)
+{
+  batch->push_back(subsystem_id);
+  batch->push_back(request_code);
+  batch->push_back(request_code >> 8);
+  batch->push_back(payload.size());
+  batch->insert(batch->end(), payload.begin(), payload.end());
+}
+
+
+// Expects one acknowledged record per request in the batch built in main()
+static uint8_t check_batch(void)
+{
+  static const uint16_t codes[] = {0x04, 0x05, 0x06};
+  size_t offset = 0;
+
+  for (size_t i = 0; i < sizeof(codes) / sizeof(*codes); i++) {
+    if (last_response.size() < offset + 6)
+      return 1;
+
+    const uint8_t *record = &last_response[offset];
+    if (record[0] != SYS_FLASHER || (record[1] | (record[2] << 8)) != codes[i] ||
+        (record[3] | (record[4] << 8)) != 0 || record[5] != 0)
+      return 1;
+    offset += 6;
+  }
+
+  return offset != last_response.size() || check_led_current() || check_pulse_width();
+}
+
+
+static void counters_add(struct sim_counters *sum, const struct sim_counters *a,
+                         const struct sim_counters *b)
+{
+  sum->spi_bytes += b->spi_bytes - a->spi_bytes;
+  sum->spi_calls += b->spi_calls - a->spi_calls;
+  sum->dma_bursts += b->dma_bursts - a->dma_bursts;
+  sum->w55_spi_bytes += b->w55_spi_bytes - a->w55_spi_bytes;
+  sum->w55_frames += b->w55_frames - a->w55_frames;
+  sum->cs_toggles += b->cs_toggles - a->cs_toggles;
+  sum->gpio_writes += b->gpio_writes - a->gpio_writes;
+  sum->port_writes += b->port_writes - a->port_writes;
+  sum->led_steps += b->led_steps - a->led_steps;
+  sum->i2c_bytes += b->i2c_bytes - a->i2c_bytes;
+  sum->bus_ns += b->bus_ns - a->bus_ns;
+}
+
+
+static void run_idle(struct bench_result *result, uint32_t reps)
+{
+  memset(result, 0, sizeof(*result));
+
+  for (uint32_t i = 0; i < reps; i++) {
+    struct sim_counters before = sim_counters;
+    loop();
+    result->ticks++;
+    counters_add(&result->cost, &before, &sim_counters);
+  }
+}
+
+
+static void run_case(const struct bench_case *c, struct bench_result *result,
+                     uint32_t reps)
+{
+  uint8_t burst = c->burst ? c->burst : 1;
+
+  memset(result, 0, sizeof(*result));
+
+  for (uint32_t i = 0; i < reps; i++) {
+    if (c->prepare)
+      c->prepare();
+
+    size_t sent = w55sim.outbox.size();
+    struct sim_counters before = sim_counters;
+    uint16_t first_id = request_id + 1;
+    uint8_t injected = 0;
+
+    for (uint8_t n = 0; n < burst; n++) {
+      std::vector<uint8_t> request;
+      request_id++;
+      request.push_back(request_id);
+      request.push_back(request_id >> 8);
+      request.push_back(c->subsystem_id);
+      request.push_back(c->request_code);
+      request.push_back(c->request_code >> 8);
+      request.insert(request.end(), c->payload.begin(), c->payload.end());
+
+      if (w55sim_inject(client_ip, client_port, device_port, request.data(),
+                        request.size()))
+        continue;
+      result->requests++;
+      injected++;
+    }
+
+    for (uint32_t tick = 0;
+         tick < max_ticks && w55sim.outbox.size() < sent + injected; tick++) {
+      loop();
+      result->ticks++;
+    }
+
+    counters_add(&result->cost, &before, &sim_counters);
+
+    // Check the response headers
+    for (size_t n = sent; n < w55sim.outbox.size(); n++) {
+      const struct w55sim_datagram *d = &w55sim.outbox[n];
+      uint16_t id = d->data.size() >= 2 ? d->data[0] | (d->data[1] << 8) : 0;
+      if (d->data.size() < 5 || d->dst_port != client_port ||
+          (uint16_t) (id - first_id) >= injected)
+        continue;
+
+      result->responses++;
+      result->response_code = d->data[3] | (d->data[4] << 8);
+      result->response_size = d->data.size() - 5;
+      last_response.assign(d->data.begin() + 5, d->data.end());
+    }
+    w55sim.outbox.clear();
+  }
+}
+
+
+// Expects the group IDs written by the WRITE_REG GROUPS case
+static uint8_t check_groups(void)
+{
+  static const uint8_t groups[IOSTACK_MAX_GROUPS] = {3, 0, 0, 0};
+  return last_response.size() != sizeof(groups) ||
+         memcmp(last_response.data(), groups, sizeof(groups));
+}
+
+
+// Members of the group execute a CMD_GROUP broadcast and reply only when
+// asked to; other devices ignore it
+static uint8_t run_group_check(void)
+{
+  static const struct {
+    uint8_t group, reply, led_builtin, current;
+    size_t replies;
+    uint8_t led_current;  // Expected afterwards
+  } steps[] = {
+    {3, IOSTACK_GROUP_REPLY_NONE, 0, 0x05, 0, 0x05},
+    {7, IOSTACK_GROUP_REPLY_ALL, 0, 0x0a, 0, 0x05},    // Not a member
+    {3, IOSTACK_GROUP_REPLY_ERRORS, 2, 0x0a, 1, 0x0a},  // LED_BUILTIN 2 fails
+    {IOSTACK_GROUP_ALL, IOSTACK_GROUP_REPLY_ERRORS, 0, 0x03, 0, 0x03},
+  };
+  uint8_t failed = 0;
+
+  w55sim.outbox.clear();
+  for (size_t i = 0; i < sizeof(steps) / sizeof(*steps); i++) {
+    std::vector<uint8_t> request = {0x37, 0x12, SYS_IOSTACK, 0x05, 0x00,
+                                    steps[i].group, steps[i].reply};
+    batch_add(&request, SYS_FLASHER, 0x00, {steps[i].led_builtin});
+    batch_add(&request, SYS_FLASHER, 0x04, {steps[i].current});
+
+    w55sim_inject(client_ip, client_port, device_port, request.data(), request.size());
+    loop();
+
+    failed |= w55sim.outbox.size() != steps[i].replies ||
+              sim_led_current() != steps[i].led_current;
+    w55sim.outbox.clear();
+  }
+
+  return failed;
+}
+
+
+// Datagrams the device cannot serve are dropped without blocking the ones
+// queued behind them
+static uint8_t run_drop_check(void)
+{
+  std::vector<uint8_t> oversized(300, 0);
+  uint8_t ping[5] = {0x34, 0x12, SYS_IOSTACK, 0x02, 0x00};
+  uint32_t dropped = w55_udp_dropped();
+
+  w55sim.outbox.clear();
+  w55sim_inject(client_ip, client_port, device_port, oversized.data(),
+                oversized.size());
+  w55sim_inject(client_ip, client_port, device_port, NULL, 0);
+  w55sim_inject(client_ip, client_port, device_port, ping, sizeof(ping));
+  loop();
+
+  uint8_t failed = w55_udp_dropped() != dropped + 2 || w55sim.outbox.size() != 1 ||
+                   w55sim.outbox[0].data.size() != 5 || w55sim.outbox[0].data[0] != 0x34;
+  w55sim.outbox.clear();
+
+  return failed;
+}
+
+
+// With bulk uploads queued on their channel, a command that arrives with
+// them is answered first, and the uploads are served one per tick
+static uint8_t run_channel_check(const std::vector<uint8_t> &upload)
+{
+  const uint16_t bulk_port = device_port + IOSTACK_CHANNEL_BULK;
+  const uint8_t uploads = 4;
+  uint8_t ping[5] = {0x3e, 0x12, SYS_IOSTACK, 0x02, 0x00};
+  uint8_t failed = 0;
+
+  w55sim.outbox.clear();
+  for (uint8_t i = 0; i < uploads; i++) {
+    std::vector<uint8_t> request = {(uint8_t) (0x40 + i), 0x12, SYS_FLASHER, 0x0d, 0x00};
+    request.insert(request.end(), upload.begin(), upload.end());
+    failed |= w55sim_inject(client_ip, client_port, bulk_port, request.data(), request.size());
+  }
+  w55sim_inject(client_ip, client_port, device_port, ping, sizeof(ping));
+
+  for (uint8_t tick = 0; tick < uploads; tick++) {
+    size_t sent = w55sim.outbox.size();
+    loop();
+    failed |= w55sim.outbox.size() != sent + (tick ? 1 : 2);
+  }
+  failed |= iostack_pending();
+
+  if (failed || w55sim.outbox[0].data[0] != 0x3e || w55sim.outbox[0].src_port != device_port)
+    return 1;
+  for (uint8_t i = 0; i < uploads; i++) {
+    const struct w55sim_datagram *d = &w55sim.outbox[i + 1];
+    failed |= d->data[0] != 0x40 + i || d->src_port != bulk_port || d->data.size() != 5;
+  }
+  w55sim.outbox.clear();
+
+  return failed;
+}
+
+
+// Finds the statistics entry of a command on the first REG_CMD_STATS page;
+// returns 1 if it has none
+static uint8_t read_cmd_stats(uint8_t subsystem_id, uint16_t request_code,
+                              struct iostack_cmd_stats *entry)
+{
+  uint8_t request[8] = {0x3d, 0x12, SYS_IOSTACK, 0x00, 0x00, 0x00, REG_CMD_STATS, 0};
+
+  w55sim.outbox.clear();
+  w55sim_inject(client_ip, client_port, device_port, request, sizeof(request));
+  loop();
+  if (w55sim.outbox.size() != 1)
+    return 1;
+
+  const std::vector<uint8_t> &data = w55sim.outbox[0].data;
+  uint8_t found = 0;
+  for (size_t offset = 5 + sizeof(struct iostack_stats_header);
+       offset + sizeof(*entry) <= data.size(); offset += sizeof(*entry)) {
+    memcpy(entry, &data[offset], sizeof(*entry));
+    if (entry->subsystem_id == subsystem_id && entry->request_code == request_code) {
+      found = 1;
+      break;
+    }
+  }
+  w55sim.outbox.clear();
+
+  return !found;
+}
+
+
+// A request that its handler fails counts as an error of its own command,
+// and not of the silent group request after it; a scan with more unknown
+// codes than there are slots leaves them free
+static uint8_t run_stats_check(void)
+{
+  std::vector<std::vector<uint8_t>> requests = {
+    {0x3a, 0x12, SYS_IOSTACK, CMD_RESET_STATS, 0x00},
+  };
+  for (uint8_t i = 0; i < 2 * IOSTACK_STATS_SLOTS; i++)
+    requests.push_back({0x3b, 0x12, SYS_FLASHER, (uint8_t) (0x80 + i), 0x00});
+  requests.push_back({0x3c, 0x12, SYS_FLASHER, CMD_LED_BUILTIN, 0x00, 2});  // Fails
+
+  // Not a member: no reply, and no error either
+  std::vector<uint8_t> group = {0x3d, 0x12, SYS_IOSTACK, CMD_GROUP, 0x00, 7,
+                                IOSTACK_GROUP_REPLY_ALL};
+  batch_add(&group, SYS_FLASHER, CMD_LED_BUILTIN, {1});
+  requests.push_back(group);
+
+  requests.push_back({0x3e, 0x12, SYS_FLASHER, CMD_LED_BUILTIN, 0x00, 1});
+
+  for (size_t i = 0; i < requests.size(); i++) {
+    w55sim_inject(client_ip, client_port, device_port, requests[i].data(),
+                  requests[i].size());
+    loop();
+  }
+  w55sim.outbox.clear();
+
+  struct iostack_cmd_stats entry;
+  if (read_cmd_stats(SYS_FLASHER, CMD_LED_BUILTIN, &entry) ||
+      entry.count != 2 || entry.errors != 1)
+    return 1;
+
+  if (read_cmd_stats(SYS_IOSTACK, CMD_GROUP, &entry) ||
+      entry.count != 1 || entry.errors != 0)
+    return 1;
+
+  return !read_cmd_stats(SYS_FLASHER, CMD_REPORT_FLASHERCTL_ERR, &entry);
+}
+
+
+#if W55_RECV_IRQ
+// A datagram that arrives on another channel while the stack takes the
+// interrupt flags of the first one must still be served
+static void inject_bulk_ping(void)
+{
+  uint8_t ping[5] = {0x3f, 0x12, SYS_IOSTACK, 0x02, 0x00};
+
+  w55sim.on_sir_read = NULL;
+  w55sim_inject(client_ip, client_port, device_port + IOSTACK_CHANNEL_BULK, ping,
+                sizeof(ping));
+}
+
+
+static uint8_t run_irq_race_check(void)
+{
+  uint8_t ping[5] = {0x3e, 0x12, SYS_IOSTACK, 0x02, 0x00};
+
+  w55sim.outbox.clear();
+  w55sim_inject(client_ip, client_port, device_port, ping, sizeof(ping));
+  w55sim.on_sir_read = inject_bulk_ping;
+
+  for (uint32_t tick = 0; tick < max_ticks && w55sim.outbox.size() < 2; tick++)
+    loop();
+
+  uint8_t failed = w55sim.on_sir_read != NULL || w55sim.outbox.size() != 2;
+  w55sim.on_sir_read = NULL;
+  w55sim.outbox.clear();
+
+  return failed;
+}
+#endif
+
+
+// Subscribes at a 10 ms period and measures the pushes; returns 1 if the
+// stream is not as expected
+static uint8_t run_telemetry_check(struct bench_result *result, uint32_t reps)
+{
+  uint8_t subscribe[7] = {0x35, 0x12, SYS_TELEMETRY, 0x00, 0x00, 10, 0};
+  uint8_t unsubscribe[5] = {0x36, 0x12, SYS_TELEMETRY, 0x01, 0x00};
+  uint8_t failed = 0;
+
+  memset(result, 0, sizeof(*result));
+
+  // Acknowledge, then the first push in the same tick
+  w55sim.outbox.clear();
+  w55sim_inject(client_ip, client_port, device_port, subscribe, sizeof(subscribe));
+  loop();
+  failed |= w55sim.outbox.size() != 2 || w55sim.outbox[0].data.size() != 5 ||
+            w55sim.outbox[0].data[0] != 0x35;
+  w55sim.outbox.clear();
+
+  for (uint32_t i = 0; i < reps; i++) {
+    sim_advance_ns(10000000ull);
+    struct sim_counters before = sim_counters;
+    loop();
+    result->ticks++;
+    counters_add(&result->cost, &before, &sim_counters);
+  }
+
+  for (size_t n = 0; n < w55sim.outbox.size(); n++) {
+    const struct w55sim_datagram *d = &w55sim.outbox[n];
+    struct telemetry_frame frame;
+    if (d->data.size() != 5 + sizeof(frame) || d->dst_port != client_port ||
+        d->src_port != device_port + IOSTACK_CHANNEL_TELEMETRY ||
+        d->data[0] != 0 || d->data[1] != 0 || d->data[2] != SYS_TELEMETRY) {
+      failed = 1;
+      continue;
+    }
+
+    memcpy(&frame, &d->data[5], sizeof(frame));
+    failed |= frame.version != TELEMETRY_VERSION || frame.sequence != n + 1 ||
+              frame.temperature != adt7310sim.temperature ||
+              frame.led_current != sim_led_current();
+    result->requests++;
+    result->responses++;
+  }
+  failed |= result->responses != reps;
+
+  // Nothing after unsubscribing
+  w55sim_inject(client_ip, client_port, device_port, unsubscribe, sizeof(unsubscribe));
+  loop();
+  w55sim.outbox.clear();
+  sim_advance_ns(100000000ull);
+  loop();
+  failed |= !w55sim.outbox.empty();
+  w55sim.outbox.clear();
+
+  return failed;
+}
+
+
+// While a push's SEND hangs because the subscriber's host is gone, commands
+// are still answered in the tick they arrive, and the subscriber is pushed
+// to again once the SEND has timed out
+static uint8_t run_telemetry_stall_check(void)
+{
+  static const uint8_t subscriber_ip[4] = {192, 168, 0, 11};
+  uint8_t subscribe[7] = {0x35, 0x12, SYS_TELEMETRY, 0x00, 0x00, 10, 0};
+  uint8_t unsubscribe[5] = {0x36, 0x12, SYS_TELEMETRY, 0x01, 0x00};
+  uint8_t ping[5] = {0x39, 0x12, SYS_IOSTACK, 0x02, 0x00};
+  uint8_t failed = 0;
+
+  w55sim.outbox.clear();
+  w55sim_inject(subscriber_ip, client_port, device_port, subscribe, sizeof(subscribe));
+  loop();
+  w55sim.outbox.clear();
+
+  memcpy(w55sim.unreachable_ip, subscriber_ip, 4);
+  uint64_t timeouts = w55sim.send_timeouts;
+  for (uint8_t i = 0; i < 50; i++) {
+    sim_advance_ns(10000000ull);
+    w55sim_inject(client_ip, client_port, device_port, ping, sizeof(ping));
+    uint64_t start_ns = sim_now_ns();
+    loop();
+    failed |= w55sim.outbox.size() != 1 || w55sim.outbox[0].data[0] != 0x39 ||
+              sim_now_ns() - start_ns > 2000000ull;
+    w55sim.outbox.clear();
+  }
+
+  // The first push, and one more once it timed out after 400 ms
+  failed |= w55sim.send_timeouts != timeouts + 2;
+
+  memset(w55sim.unreachable_ip, 0, 4);
+  w55sim_inject(subscriber_ip, client_port, device_port, unsubscribe, sizeof(unsubscribe));
+  loop();
+  sim_advance_ns(100000ull * W55_RTR * (W55_RCR + 1));
+  loop();
+  w55sim.outbox.clear();
+
+  return failed;
+}
+
+
+// Of two subscribers, one stops answering ARP: its pushes each time out and
+// hold up the other's, until it is dropped after TELEMETRY_MAX_FAILED_PUSHES.
+// The other is then pushed to every 10 ms again.
+static uint8_t run_telemetry_drop_check(void)
+{
+  static const uint8_t lost_ip[4] = {192, 168, 0, 11};
+  static const uint8_t kept_ip[4] = {192, 168, 0, 12};
+  uint8_t subscribe[7] = {0x37, 0x12, SYS_TELEMETRY, 0x00, 0x00, 10, 0};
+  uint8_t unsubscribe[5] = {0x38, 0x12, SYS_TELEMETRY, 0x01, 0x00};
+  uint32_t pushes = 0;
+  uint8_t failed = 0;
+
+  w55sim.outbox.clear();
+  w55sim_inject(lost_ip, client_port, device_port, subscribe, sizeof(subscribe));
+  w55sim_inject(kept_ip, client_port, device_port, subscribe, sizeof(subscribe));
+  loop();
+  w55sim.outbox.clear();
+
+  memcpy(w55sim.unreachable_ip, lost_ip, 4);
+  uint64_t timeouts = w55sim.send_timeouts;
+  for (uint8_t i = 0; i < 150; i++) {
+    sim_advance_ns(10000000ull);
+    loop();
+    for (const struct w55sim_datagram &d : w55sim.outbox)
+      pushes += i >= 130 && !memcmp(d.ip_address, kept_ip, 4);
+    w55sim.outbox.clear();
+  }
+
+  failed |= w55sim.send_timeouts != timeouts + TELEMETRY_MAX_FAILED_PUSHES;
+  failed |= pushes < 19;  // In the last 20 ticks
+
+  memset(w55sim.unreachable_ip, 0, 4);
+  w55sim_inject(kept_ip, client_port, device_port, unsubscribe, sizeof(unsubscribe));
+  loop();
+  sim_advance_ns(10000000ull);
+  loop();
+  w55sim.outbox.clear();
+
+  return failed;
+}
+
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+// With the USB port stalled, requests that log are still answered in the
+// same tick; records beyond the ring are counted as dropped and reported in
+// REG_LOG_DROPPED, the rest are printed once the port drains
+static uint8_t run_log_check(void)
+{
+  uint8_t unknown[5] = {0x39, 0x12, SYS_IOSTACK, 0x7f, 0x00};
+  uint8_t read_dropped[7] = {0x3a, 0x12, SYS_IOSTACK, 0x00, 0x00, 0x00, 0x04};
+  const uint8_t n = 2 * LOG_RING_SIZE;
+  uint32_t dropped = log_dropped();
+  uint8_t failed = 0;
+
+  w55sim.outbox.clear();
+  sim_serial_stall(1);
+  for (uint8_t i = 0; i < n; i++)
+    w55sim_inject(client_ip, client_port, device_port, unknown, sizeof(unknown));
+  loop();
+  failed |= w55sim.outbox.size() != n || log_dropped() - dropped != n - LOG_RING_SIZE;
+  w55sim.outbox.clear();
+
+  sim_serial_stall(0);
+  w55sim_inject(client_ip, client_port, device_port, read_dropped, sizeof(read_dropped));
+  loop();
+  uint32_t reported;
+  failed |= w55sim.outbox.size() != 1 || w55sim.outbox[0].data.size() != 5 + sizeof(reported);
+  if (!failed) {
+    memcpy(&reported, &w55sim.outbox[0].data[5], sizeof(reported));
+    failed |= reported != log_dropped();
+  }
+  w55sim.outbox.clear();
+
+  return failed;
+}
+#endif
+
+
+static void sequence_add(std::vector<uint8_t> *payload, uint8_t current, uint8_t width,
+                         uint16_t pulses, uint32_t period_ns, uint16_t dwell_ms)
+{
+  struct flasher_sequence_step step = {current, width, pulses, period_ns, dwell_ms};
+  uint8_t *p = (uint8_t *) &step;
+  payload->insert(payload->end(), p, p + sizeof(step));
+}
+
+
+// Runs a three-step sequence with progress pushes; returns 1 if the steps
+// or the pushes are not as expected
+static uint8_t run_sequence_check(struct bench_result *result)
+{
+  std::vector<uint8_t> load = {0x37, 0x12, SYS_FLASHER, 0x0d, 0x00, 0x00, 0x00};
+  sequence_add(&load, 0x05, 0x3c, 10, 1000000, 5);
+  sequence_add(&load, 0x0a, 0xa5, 0, 0, 2);
+  sequence_add(&load, 0x03, 0x10, 5, 200000, 0);
+  uint8_t start[6] = {0x38, 0x12, SYS_FLASHER, 0x0e, 0x00, 0x01};
+  uint8_t failed = 0;
+
+  memset(result, 0, sizeof(*result));
+
+  w55sim.outbox.clear();
+  w55sim_inject(client_ip, client_port, device_port, load.data(), load.size());
+  w55sim_inject(client_ip, client_port, device_port, start, sizeof(start));
+
+  // Both acknowledged, then pushes until the sequence is done
+  struct flasher_sequence_status status = {};
+  std::vector<uint16_t> steps;
+  for (uint32_t tick = 0; tick < 1000 && status.state != FLASHER_SEQ_DONE; tick++) {
+    struct sim_counters before = sim_counters;
+    loop();
+    result->ticks++;
+    counters_add(&result->cost, &before, &sim_counters);
+
+    for (size_t n = 0; n < w55sim.outbox.size(); n++) {
+      const struct w55sim_datagram *d = &w55sim.outbox[n];
+      if (d->data.size() == 5 + sizeof(status) && d->data[0] == 0 && d->data[1] == 0) {
+        memcpy(&status, &d->data[5], sizeof(status));
+        steps.push_back(status.step);
+        result->responses++;
+      } else if (d->data.size() != 5 || d->data[1] != 0x12) {
+        failed = 1;
+      }
+    }
+    w55sim.outbox.clear();
+    sim_advance_ns(1000000ull);
+  }
+
+  result->requests = 3;
+  failed |= steps != std::vector<uint16_t>({0, 1, 2, 3}) || status.nsteps != 3 ||
+            status.state != FLASHER_SEQ_DONE;
+  failed |= sim_led_current() != 0x03 || ds1023sim.value != 0x10;
+
+  return failed;
+}
+
+
+// Client clock of the time sync check: an epoch offset and a skew against
+// the simulated board clock
+static const uint64_t sync_epoch_us = 1700000000000000ull;
+static const int32_t sync_skew_ppm = 100;
+
+static uint64_t sync_client_us(uint64_t ns)
+{
+  uint64_t us = ns / 1000;
+  return sync_epoch_us + us + us * sync_skew_ppm / 1000000;
+}
+
+
+// Periods of about 3 s need the /16 prescaler (333 ns ticks): a 500 ns low
+// time that rounds to one tick is rejected, one that keeps 500 ns is not
+static uint8_t run_pulse_edge_check(void)
+{
+  struct flasher_pulse_train rounded_low = {1, 3000000670, 3000000170};
+  struct flasher_pulse_train kept_low = {1, 3000001000, 3000000000};
+  struct flasher_pulse_train stop = {0, 0, 0};
+  uint8_t failed = 0;
+
+  flasher_PULSE_TRAIN(&stop);
+  failed |= flasher_PULSE_TRAIN(&rounded_low) != FLASHER_EBVALUE;
+  failed |= flasher_PULSE_TRAIN(&kept_low) != 0 ||
+            kept_low.period_ns - kept_low.width_ns < PULSE_TRAIN_MIN_EDGE_NS;
+  flasher_PULSE_TRAIN(&stop);
+
+  return failed;
+}
+
+
+// Runs SYNC exchanges over a link with a jittery one-way latency, then
+// schedules a pulse 250 ms ahead; returns 1 if the disciplined clock or the
+// pulse is off by more than the jitter allows. loop() sleeps after serving a
+// request, so the replies are timed by their SEND.
+static uint8_t run_timesync_check(void)
+{
+  uint32_t seed = 1;
+  uint32_t prev_sequence = 0;
+  uint64_t prev_t4 = 0;
+  uint8_t failed = 0;
+
+  w55sim.outbox.clear();
+  for (uint32_t sequence = 1; sequence <= 200; sequence++) {
+    struct timesync_request sync = {sequence, sync_client_us(sim_now_ns()), prev_sequence, prev_t4};
+    std::vector<uint8_t> request = {0x3b, 0x12, SYS_TIMESYNC, 0x00, 0x00};
+    uint8_t *p = (uint8_t *) &sync;
+    request.insert(request.end(), p, p + sizeof(sync));
+
+    seed = seed * 1103515245 + 12345;
+    sim_advance_ns(1000ull * (150 + (seed >> 16) % 300));
+    w55sim_inject(client_ip, client_port, device_port, request.data(), request.size());
+    loop();
+
+    struct timesync_reply reply;
+    if (w55sim.outbox.size() != 1 || w55sim.outbox[0].data.size() != 5 + sizeof(reply))
+      return 1;
+    memcpy(&reply, &w55sim.outbox[0].data[5], sizeof(reply));
+    failed |= reply.sequence != sequence || reply.t1 != sync.t1 || reply.t3 < reply.t2;
+
+    seed = seed * 1103515245 + 12345;
+    prev_sequence = sequence;
+    prev_t4 = sync_client_us(w55sim.outbox[0].time_ns + 1000ull * (150 + (seed >> 16) % 300));
+    w55sim.outbox.clear();
+
+    sim_advance_ns(250000000ull);
+    loop();
+  }
+
+  uint8_t status_request[5] = {0x3c, 0x12, SYS_TIMESYNC, 0x01, 0x00};
+  w55sim_inject(client_ip, client_port, device_port, status_request, sizeof(status_request));
+  loop();
+  struct timesync_status status;
+  if (w55sim.outbox.size() != 1 || w55sim.outbox[0].data.size() != 5 + sizeof(status))
+    return 1;
+  memcpy(&status, &w55sim.outbox[0].data[5], sizeof(status));
+  int64_t clock_error = (int64_t) (status.now_us - sync_client_us(w55sim.outbox[0].time_ns));
+  w55sim.outbox.clear();
+
+  failed |= !status.synced || status.samples < 100 || llabs(clock_error) > 150 ||
+            abs(status.rate_ppb - sync_skew_ppm * 1000) > 3000;
+
+  // A pulse 250 ms ahead: armed by loop() within FIRE_ARM_WINDOW_US
+  uint64_t target_us = sync_client_us(sim_now_ns()) + 250000;
+  std::vector<uint8_t> fire = {0x3d, 0x12, SYS_FLASHER, 0x11, 0x00};
+  for (int i = 0; i < 8; i++)
+    fire.push_back(target_us >> (8 * i));
+  w55sim_inject(client_ip, client_port, device_port, fire.data(), fire.size());
+  loop();
+  failed |= w55sim.outbox.size() != 1 || w55sim.outbox[0].data.size() != 5 ||
+            w55sim.outbox[0].data[3] != 0x11;
+  w55sim.outbox.clear();
+
+  struct flasher_fire_status fire_status = {};
+  while (fire_status.state == FLASHER_FIRE_PENDING || fire_status.state == FLASHER_FIRE_ARMED ||
+         fire_status.state == FLASHER_FIRE_IDLE) {
+    sim_advance_ns(1000000ull);
+    loop();
+    flasher_FIRE_STATUS(&fire_status);
+    if (sync_client_us(sim_now_ns()) > target_us + 1000000)
+      break;
+  }
+
+  // Client time of the rising edge by the simulated timer
+  int64_t fire_error = (int64_t) (sync_client_us(pulsesim.start_ns) - target_us);
+  failed |= fire_status.state != FLASHER_FIRE_FIRED || llabs(fire_error) > 150 ||
+            llabs((int64_t) (fire_status.fired_us - target_us)) > 1;
+
+  printf("\ntime sync: %u exchanges (%u rejected), clock error %lld us, rate %d ppb "
+         "(skew %d ppm), pulse error %lld us\n",
+         status.samples, status.rejected, (long long) clock_error, status.rate_ppb,
+         sync_skew_ppm, (long long) fire_error);
+
+  return failed;
+}
+
+
+static void print_header(void)
+{
+  printf("%-28s %6s %6s %8s %8s %6s %6s %6s %6s %6s %6s %6s %6s %9s\n", "request",
+         "code", "ticks", "spi_B", "w55_B", "xfers", "dma", "frames", "cs",
+         "gpio", "port", "led", "i2c_B", "bus_us");
+}
+
+
+static void print_row(const char *name, int code, const struct bench_result *r,
+                      uint32_t n)
+{
+  if (n == 0)
+    n = 1;
+
+  char code_str[8] = "-";
+  if (code >= 0)
+    snprintf(code_str, sizeof(code_str), "0x%02x", code);
+
+  printf("%-28s %6s %6.1f %8.1f %8.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %9.2f\n",
+         name, code_str, (double) r->ticks / n, (double) r->cost.spi_bytes / n,
+         (double) r->cost.w55_spi_bytes / n, (double) r->cost.spi_calls / n,
+         (double) r->cost.dma_bursts / n, (double) r->cost.w55_frames / n,
+         (double) r->cost.cs_toggles / n, (double) r->cost.gpio_writes / n,
+         (double) r->cost.port_writes / n, (double) r->cost.led_steps / n,
+         (double) r->cost.i2c_bytes / n, (double) r->cost.bus_ns / n / 1000.0);
+}
+
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [-n repetitions] [-v]\n", argv0);
+  fprintf(stderr, "  -n  requests per command (default: 100)\n");
+  fprintf(stderr, "  -v  echo the sketch's serial output to stderr\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+  uint32_t reps = 100;
+  int opt;
+
+  sim_reset();
+
+  while ((opt = getopt(argc, argv, "n:vh")) != -1) {
+    switch (opt) {
+      case 'n':
+        reps = strtoul(optarg, NULL, 0);
+        break;
+      case 'v':
+        sim_serial_echo(1);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (reps == 0)
+    reps = 1;
+
+  // Boot with blank EEPROM: the sketch asks for a MAC address on the console
+  sim_serial_input("eece3107b0e4\r");
+  ds28cm00sim.corrupt_reads = 1;  // The first serial number read fails the CRC
+  setup();
+  fprintf(stderr, "booted in %.1f ms (simulated)\n", sim_now_ns() / 1e6);
+
+  std::vector<uint8_t> ping_payload(59);
+  for (size_t i = 0; i < ping_payload.size(); i++)
+    ping_payload[i] = i;
+
+  // The largest step table that fits a request
+  std::vector<uint8_t> sequence_payload = {0x00, 0x00};
+  for (uint8_t i = 0; i < 24; i++)
+    sequence_add(&sequence_payload, i & 0x0f, i, 100, 1000000, 10);
+
+  // One round trip for a full reconfiguration
+  std::vector<uint8_t> batch_payload;
+  batch_add(&batch_payload, SYS_FLASHER, 0x04, {0x0a});
+  batch_add(&batch_payload, SYS_FLASHER, 0x05, {0xa5});
+  batch_add(&batch_payload, SYS_FLASHER, 0x06, {0});
+
+  std::vector<uint8_t> group_payload = {3, IOSTACK_GROUP_REPLY_ALL};
+  batch_add(&group_payload, SYS_FLASHER, 0x04, {0x0a});
+  batch_add(&group_payload, SYS_FLASHER, 0x05, {0xa5});
+  batch_add(&group_payload, SYS_FLASHER, 0x06, {0});
+
+  const struct bench_case cases[] = {
+    {"iostack PING (0 B)", SYS_IOSTACK, 0x02, {}, NULL, NULL},
+    {"iostack PING (59 B)", SYS_IOSTACK, 0x02, ping_payload, NULL, NULL},
+    {"iostack PING (251 B)", SYS_IOSTACK, 0x02, std::vector<uint8_t>(251, 0xa5), NULL, NULL},
+    {"iostack READ_REG ETH_CFG", SYS_IOSTACK, 0x00, {0x00, 0x00}, NULL, check_ethernet_configuration},
+    {"iostack READ_REG FAILED_SENDS", SYS_IOSTACK, 0x00, {0x00, 0x01}, NULL, NULL},
+    {"iostack PING (failed SEND)", SYS_IOSTACK, 0x02, {}, prepare_failed_send, check_failed_sends},
+    {"iostack PING (0 B) burst of 4", SYS_IOSTACK, 0x02, {}, NULL, NULL, 4},
+    {"iostack BATCH (3 flasher)", SYS_IOSTACK, 0x03, batch_payload, prepare_led_current, check_batch},
+    {"iostack WRITE_REG GROUPS", SYS_IOSTACK, 0x01, {0x00, 0x06, 3, 0, 0, 0}, NULL, NULL},
+    {"iostack READ_REG GROUPS", SYS_IOSTACK, 0x00, {0x00, 0x06}, NULL, check_groups},
+    {"iostack GROUP (3 flasher)", SYS_IOSTACK, 0x05, group_payload, prepare_led_current, check_batch},
+    {"iostack unknown command", SYS_IOSTACK, 0x7f, {}, NULL, NULL},
+    {"unknown subsystem", 0x7f, 0x00, {}, NULL, NULL},
+    {"flasher invalid size", SYS_FLASHER, 0x04, {0x0a, 0x00}, NULL, NULL},
+    {"flasher LED_BUILTIN", SYS_FLASHER, 0x00, {1}, NULL, NULL},
+    {"flasher START_TEMPERATURE", SYS_FLASHER, 0x01, {}, NULL, NULL},
+    {"flasher READ_TEMPERATURE", SYS_FLASHER, 0x02, {}, prepare_temperature_sample, check_temperature},
+    {"flasher READ_SERIAL_NO", SYS_FLASHER, 0x03, {}, NULL, check_serial_no},
+    {"flasher SET_LED_CURRENT", SYS_FLASHER, 0x04, {0x0a}, prepare_led_current, check_led_current},
+    {"flasher SET_PULSE_WIDTH", SYS_FLASHER, 0x05, {0xa5}, NULL, check_pulse_width},
+    {"flasher TEST_PULSE", SYS_FLASHER, 0x06, {2}, NULL, NULL},
+    {"flasher STAGE_SETTINGS", SYS_FLASHER, 0x07, {0x05, 0x3c}, prepare_settings, check_staged},
+    {"flasher COMMIT_SETTINGS", SYS_FLASHER, 0x08, {}, prepare_commit, check_committed},
+    {"flasher READ_TEMP_HISTORY", SYS_FLASHER, 0x09, {}, prepare_temperature_sample, check_temperature_history},
+    {"flasher SET_TEMP_PERIOD", SYS_FLASHER, 0x0a, {0xe8, 0x03}, NULL, NULL},
+    {"flasher PULSE_TRAIN (1 kHz)", SYS_FLASHER, 0x0b,
+     {100, 0, 0x40, 0x42, 0x0f, 0x00, 0xe8, 0x03, 0x00, 0x00}, prepare_pulse_train, check_pulse_train},
+    {"flasher PULSE_TRAIN_STATUS", SYS_FLASHER, 0x0c, {}, prepare_pulse_train, check_pulse_train_done},
+    {"flasher SEQUENCE_LOAD (24)", SYS_FLASHER, 0x0d, sequence_payload, NULL, NULL},
+    {"flasher SEQUENCE_STATUS", SYS_FLASHER, 0x10, {}, NULL, NULL},
+    {"telemetry READ_TELEMETRY", SYS_TELEMETRY, 0x02, {}, NULL, check_telemetry},
+    {"timesync SYNC", SYS_TIMESYNC, 0x00, std::vector<uint8_t>(sizeof(struct timesync_request), 0), NULL, NULL},
+    {"timesync SYNC_STATUS", SYS_TIMESYNC, 0x01, {}, NULL, NULL},
+    {"flasher FIRE_STATUS", SYS_FLASHER, 0x12, {}, NULL, NULL},
+    {"iostack READ_REG CMD_STATS", SYS_IOSTACK, 0x00, {0x00, 0x05, 0}, NULL, check_cmd_stats},
+    {"iostack RESET_STATS", SYS_IOSTACK, 0x04, {}, NULL, NULL},
+  };
+
+  int failed = 0;
+  struct bench_result result;
+  struct w5500_spi_stats stats_before, stats_after;
+
+  w55_spi_stats(&stats_before);
+
+  print_header();
+
+  run_idle(&result, reps);
+  print_row("idle tick", -1, &result, result.ticks);
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+    run_case(&cases[i], &result, reps);
+    print_row(cases[i].name, cases[i].request_code, &result, result.requests);
+
+    uint32_t expected = reps * (cases[i].burst ? cases[i].burst : 1);
+    if (result.requests != expected || result.responses != result.requests) {
+      fprintf(stderr, "%s: %u of %u requests answered\n", cases[i].name,
+              result.responses, expected);
+      failed = 1;
+    }
+
+    // The photorelays must go straight to the new current
+    if (result.cost.led_steps > result.requests) {
+      fprintf(stderr, "%s: LED current passed through intermediate values\n",
+              cases[i].name);
+      failed = 1;
+    }
+
+    if (cases[i].check && cases[i].check()) {
+      fprintf(stderr, "%s: unexpected device state\n", cases[i].name);
+      failed = 1;
+    }
+  }
+
+  if (run_group_check()) {
+    fprintf(stderr, "group requests were not executed or answered as expected\n");
+    failed = 1;
+  }
+
+  if (run_drop_check()) {
+    fprintf(stderr, "oversized and empty datagrams were not dropped cleanly\n");
+    failed = 1;
+  }
+
+  if (run_channel_check(sequence_payload)) {
+    fprintf(stderr, "commands were not served ahead of bulk uploads\n");
+    failed = 1;
+  }
+
+  if (run_stats_check()) {
+    fprintf(stderr, "failed or rejected requests were not counted as expected\n");
+    failed = 1;
+  }
+
+#if W55_RECV_IRQ
+  if (run_irq_race_check()) {
+    fprintf(stderr, "a datagram arriving while INTn was being cleared was lost\n");
+    failed = 1;
+  }
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+  if (run_log_check()) {
+    fprintf(stderr, "log records were not deferred as expected\n");
+    failed = 1;
+  }
+#endif
+
+  if (run_telemetry_check(&result, reps)) {
+    fprintf(stderr, "telemetry push stream is not as expected\n");
+    failed = 1;
+  }
+  print_row("telemetry push (10 ms)", -1, &result, result.responses);
+
+  if (run_telemetry_stall_check()) {
+    fprintf(stderr, "a hanging telemetry push held up the loop\n");
+    failed = 1;
+  }
+
+  if (run_telemetry_drop_check()) {
+    fprintf(stderr, "an unreachable telemetry subscriber was not dropped\n");
+    failed = 1;
+  }
+
+  if (run_sequence_check(&result)) {
+    fprintf(stderr, "calibration sequence did not run as expected\n");
+    failed = 1;
+  }
+  print_row("flasher sequence (3 steps)", -1, &result, result.requests);
+
+  if (run_pulse_edge_check()) {
+    fprintf(stderr, "pulse train edges below the minimum after rounding to ticks\n");
+    failed = 1;
+  }
+
+  if (run_timesync_check()) {
+    fprintf(stderr, "time sync or scheduled pulse is off\n");
+    failed = 1;
+  }
+
+  if (w55sim.send_overlaps) {
+    fprintf(stderr, "%llu SENDs or destination writes while a SEND was pending\n",
+            (unsigned long long) w55sim.send_overlaps);
+    failed = 1;
+  }
+
+  // Effective W5500 throughput of w55_readn/w55_writen
+  w55_spi_stats(&stats_after);
+  uint32_t dma_bytes = stats_after.dma_bytes - stats_before.dma_bytes;
+  uint32_t dma_us = stats_after.dma_micros - stats_before.dma_micros;
+  uint32_t polled_bytes = stats_after.polled_bytes - stats_before.polled_bytes;
+  uint32_t polled_us = stats_after.polled_micros - stats_before.polled_micros;
+  printf("\nbulk transfers: dma %u B in %u us (%.2f B/us), polled %u B in %u us (%.2f B/us)\n",
+         dma_bytes, dma_us, dma_us ? (double) dma_bytes / dma_us : 0.0,
+         polled_bytes, polled_us, polled_us ? (double) polled_bytes / polled_us : 0.0);
+
+  return failed;
+}
@@ -0,0 +1,691 @@
+// Fleet simulator: runs the unmodified sketch for each of N virtual flashers
+// and serves them on real UDP sockets, so that host software can be tried
+// against hundreds of devices without hardware.
+//
+// Every device is a process of its own running setup() and loop() against
+// the simulator in this directory, so all requests go through the firmware's
+// dispatch (iostack_tick -> handler -> iostack_response_*). The process moves
+// datagrams between its sockets and the simulated W5500, and keeps the
+// sketch's clock on the wall clock: it runs ahead while the sketch is busy,
+// so the service time of each request is that of the simulated board.
+//
+// Devices take consecutive loopback addresses with the channel ports of the
+// sketch (512..514), or share one address with consecutive channel ports.
+// Each also listens for broadcasts on the listen port and answers discovery
+// (READ_REG ETH_CFG) from its own address, like the hardware.
+//
+// With -g, the simulator drives its devices with the host client from
+// client/ for a while and reports requests per second and latency
+// percentiles instead of serving until interrupted.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+#include "iostack.h"
+#include "w5500.h"
+
+#include "flasherctl_client.h"
+#include "sim.h"
+#include "w5500_sim.h"
+
+void setup(void);
+void loop(void);
+
+// Listen port of the sketch (udp_listen_port); channel c is on this + c
+static const uint16_t sketch_port = 512;
+
+// Link between the host and one device; each direction loses datagrams
+// and takes the latency independently, and replies take the jitter on top
+struct fleet_link {
+  uint32_t latency_us;
+  uint32_t jitter_us;  // Uniform in [0, jitter_us]
+  double loss;
+};
+
+struct fleet_config {
+  unsigned devices;
+  struct in_addr address;  // Of the first device
+  uint8_t shared_address;  // All devices on address, channels on consecutive ports
+  uint16_t port;           // Listen port of the first device, and discovery port
+  uint32_t idle_ms;        // Longest time the sketch sleeps without a loop()
+  struct fleet_link link;
+  std::vector<std::pair<unsigned, struct fleet_link>> links;  // Per-device overrides
+
+  // Load generator
+  double load_s;
+  uint8_t window;
+  uint16_t ping_size;
+  uint32_t timeout_ms;
+};
+
+// A datagram on its way between a socket and the simulated W5500
+struct fleet_datagram {
+  uint64_t due_ns;  // Wall clock
+  uint8_t channel;
+  struct sockaddr_in peer;
+  uint16_t size;
+  uint8_t data[FLASHERCTL_MAX_DATAGRAM];
+
+  bool operator<(const struct fleet_datagram &other) const { return due_ns > other.due_ns; }
+};
+
+// The device run by this process
+static struct {
+  struct fleet_link link;
+  unsigned seed;
+  uint32_t idle_ms;
+  struct pollfd fds[IOSTACK_CHANNELS + 1];  // Channel sockets, then the discovery socket
+  int64_t offset_ns;                         // Wall clock minus the sketch's clock
+  std::priority_queue<struct fleet_datagram> requests;  // Towards the chip
+  std::priority_queue<struct fleet_datagram> replies;   // Towards the host
+} fleet;
+
+static volatile sig_atomic_t stop;
+
+
+static uint64_t wall_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void fleet_address(const struct fleet_config *config, unsigned index,
+                          uint8_t channel, struct sockaddr_in *addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  if (config->shared_address) {
+    addr->sin_addr = config->address;
+    addr->sin_port = htons(config->port + index * IOSTACK_CHANNELS + channel);
+  } else {
+    addr->sin_addr.s_addr = htonl(ntohl(config->address.s_addr) + index);
+    addr->sin_port = htons(config->port + channel);
+  }
+}
+
+
+static struct fleet_link fleet_link_of(const struct fleet_config *config, unsigned index)
+{
+  for (auto &link : config->links)
+    if (link.first == index)
+      return link.second;
+  return config->link;
+}
+
+
+static uint8_t fleet_lost(const struct fleet_link *link, unsigned *seed)
+{
+  return link->loss > 0 && rand_r(seed) < link->loss * RAND_MAX;
+}
+
+
+// Moves the sketch's clock forward to sim_ns; it never goes back
+static void fleet_sync(uint64_t sim_ns)
+{
+  if (sim_now_ns() < sim_ns)
+    sim_advance_ns(sim_ns - sim_now_ns());
+}
+
+
+// Boots the sketch as a device of its own: a blank board asks for its MAC
+// address on the console, and is then given the address it is served on
+// with WRITE_REG ETH_CFG, as flasherctl_discover.py would
+static void fleet_boot(const struct fleet_config *config, unsigned index)
+{
+  char mac_input[16];
+  snprintf(mac_input, sizeof(mac_input), "eece31%06x\r", index & 0xffffff);
+  uint8_t serial_no[6] = {0x5a, 0x3c, (uint8_t) index, (uint8_t) (index >> 8),
+                          (uint8_t) (index >> 16), 0x00};
+
+  sim_reset();
+  sim_serial_input(mac_input);
+  sim_set_serial_no(serial_no);
+  setup();
+
+  struct sockaddr_in addr;
+  fleet_address(config, index, IOSTACK_CHANNEL_CONTROL, &addr);
+
+  struct w5500_config eth = {.gateway_addr = {127, 0, 0, 1}, .subnet_mask = {255, 0, 0, 0},
+                             .mac_address = {0xee, 0xce, 0x31, (uint8_t) (index >> 16),
+                                             (uint8_t) (index >> 8), (uint8_t) index}};
+  memcpy(eth.ip_address, &addr.sin_addr, sizeof(eth.ip_address));
+
+  uint8_t request[FLASHERCTL_MAX_DATAGRAM];
+  uint8_t payload[2 + sizeof(eth)] = {0, REG_ETH_CFG};  // Register number big-endian
+  memcpy(&payload[2], &eth, sizeof(eth));
+  uint16_t size = flasherctl_pack(request, sizeof(request), 1, SYS_IOSTACK, CMD_WRITE_REG,
+                                  payload, sizeof(payload));
+
+  const uint8_t host[4] = {127, 0, 0, 1};
+  w55sim_inject(host, sketch_port, sketch_port, request, size);
+  loop();
+  w55sim.outbox.clear();
+}
+
+
+static int fleet_socket(const struct sockaddr_in *addr, uint8_t broadcast)
+{
+  int one = 1;
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  // Every device binds the discovery port on the wildcard address next to
+  // its own, and the kernel hands each of them the broadcasts
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (broadcast)
+    setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one));
+
+  if (bind(fd, (const struct sockaddr *) addr, sizeof(*addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+
+/* Reads the datagrams waiting on a socket into the queue towards the chip.
+   The discovery socket also gets unicasts for addresses no device has
+   taken; only broadcasts are passed on. */
+static void fleet_receive(int fd, uint8_t channel, uint8_t broadcast)
+{
+  for (;;) {
+    struct fleet_datagram d;
+    struct iovec iov = {d.data, sizeof(d.data)};
+    uint8_t control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    struct msghdr msg = {};
+    msg.msg_name = &d.peer;
+    msg.msg_namelen = sizeof(d.peer);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (n < 0)
+      return;
+
+    if (broadcast) {
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      if (!cmsg || cmsg->cmsg_level != IPPROTO_IP || cmsg->cmsg_type != IP_PKTINFO)
+        continue;
+      struct in_pktinfo info;
+      memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+      if ((ntohl(info.ipi_addr.s_addr) & 0xff) != 0xff)
+        continue;
+    }
+
+    if (msg.msg_flags & MSG_TRUNC || fleet_lost(&fleet.link, &fleet.seed))
+      continue;
+
+    d.due_ns = wall_ns() + fleet.link.latency_us * 1000ull;
+    d.channel = channel;
+    d.size = n;
+    fleet.requests.push(d);
+  }
+}
+
+
+/* Moves the responses the sketch has sent onto the link; each leaves when
+   the sketch sent it, plus the link delay */
+static void fleet_collect(void)
+{
+  for (auto &sent : w55sim.outbox) {
+    uint8_t channel = sent.src_port - sketch_port;
+    if (channel >= IOSTACK_CHANNELS || sent.data.size() > FLASHERCTL_MAX_DATAGRAM ||
+        fleet_lost(&fleet.link, &fleet.seed))
+      continue;
+
+    struct fleet_datagram d;
+    d.due_ns = sent.time_ns + fleet.offset_ns + fleet.link.latency_us * 1000ull;
+    if (fleet.link.jitter_us)
+      d.due_ns += (uint64_t) rand_r(&fleet.seed) % (fleet.link.jitter_us + 1) * 1000;
+    d.channel = channel;
+    memset(&d.peer, 0, sizeof(d.peer));
+    d.peer.sin_family = AF_INET;
+    memcpy(&d.peer.sin_addr, sent.ip_address, sizeof(sent.ip_address));
+    d.peer.sin_port = htons(sent.dst_port);
+    d.size = sent.data.size();
+    memcpy(d.data, sent.data.data(), d.size);
+    fleet.replies.push(d);
+  }
+  w55sim.outbox.clear();
+}
+
+
+/* Takes the place of the sketch's __WFI: sends the responses that are due
+   and waits for the wake-up time, or until a request crosses the link. That
+   one goes into the chip, which asserts INTn and so ends the sleep, as on
+   the board. An idle sketch is woken every idle_ms instead of every
+   SysTick; millis() catches up when it is. */
+static void fleet_wfi(uint64_t wake_ns)
+{
+  fleet_collect();
+
+  // Take the level of INTn before injecting, so that a request makes the
+  // falling edge the sketch waits for
+  sim_irq_update();
+
+  uint64_t event = w55sim_next_event_ns();
+  if (!(event > sim_now_ns() && event <= wake_ns))
+    wake_ns = std::max(wake_ns, sim_now_ns() + fleet.idle_ms * (uint64_t) 1000000);
+  uint64_t wake_wall_ns = wake_ns + fleet.offset_ns;
+
+  for (;;) {
+    uint64_t now = wall_ns();
+
+    while (!fleet.replies.empty() && fleet.replies.top().due_ns <= now) {
+      const struct fleet_datagram &d = fleet.replies.top();
+      sendto(fleet.fds[d.channel].fd, d.data, d.size, 0, (const struct sockaddr *) &d.peer,
+             sizeof(d.peer));
+      fleet.replies.pop();
+    }
+
+    // A request the sketch was too busy for waits in the chip's buffer, or
+    // is dropped if that is full, as on the board
+    uint8_t received = 0;
+    while (!fleet.requests.empty() && fleet.requests.top().due_ns <= now) {
+      const struct fleet_datagram &d = fleet.requests.top();
+      fleet_sync(d.due_ns - fleet.offset_ns);
+      w55sim_inject((const uint8_t *) &d.peer.sin_addr, ntohs(d.peer.sin_port),
+                    sketch_port + d.channel, d.data, d.size);
+      fleet.requests.pop();
+      received = 1;
+    }
+    if (received)
+      return;
+
+    if (now >= wake_wall_ns) {
+      fleet_sync(now - fleet.offset_ns);
+      return;
+    }
+
+    uint64_t until_ns = wake_wall_ns;
+    if (!fleet.requests.empty())
+      until_ns = std::min(until_ns, fleet.requests.top().due_ns);
+    if (!fleet.replies.empty())
+      until_ns = std::min(until_ns, fleet.replies.top().due_ns);
+    uint64_t wait_ns = until_ns > now ? until_ns - now : 0;
+    struct timespec timeout = {(time_t) (wait_ns / 1000000000), (long) (wait_ns % 1000000000)};
+
+    if (ppoll(fleet.fds, IOSTACK_CHANNELS + 1, &timeout, NULL) <= 0)
+      continue;
+    for (uint8_t channel = 0; channel <= IOSTACK_CHANNELS; channel++)
+      if (fleet.fds[channel].revents & POLLIN)
+        fleet_receive(fleet.fds[channel].fd,
+                      channel < IOSTACK_CHANNELS ? channel : IOSTACK_CHANNEL_CONTROL,
+                      channel == IOSTACK_CHANNELS);
+  }
+}
+
+
+// Unread datagrams in any socket of the chip
+static uint8_t fleet_chip_pending(void)
+{
+  for (uint8_t i = 0; i < W55SIM_NUM_SOCKETS; i++)
+    if (w55sim.sockets[i].rx_wr != w55sim.sockets[i].rx_rd)
+      return 1;
+  return 0;
+}
+
+
+static void fleet_device_run(const struct fleet_config *config, unsigned index, int ready_fd)
+{
+  fleet.link = fleet_link_of(config, index);
+  fleet.seed = index + 1;
+  fleet.idle_ms = config->idle_ms;
+
+  fleet_boot(config, index);
+
+  // One socket per channel, then the discovery socket
+  for (uint8_t channel = 0; channel <= IOSTACK_CHANNELS; channel++) {
+    struct sockaddr_in addr;
+    if (channel < IOSTACK_CHANNELS) {
+      fleet_address(config, index, channel, &addr);
+    } else {
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      addr.sin_port = htons(config->port);
+    }
+
+    fleet.fds[channel].fd = fleet_socket(&addr, channel == IOSTACK_CHANNELS);
+    fleet.fds[channel].events = POLLIN;
+    if (fleet.fds[channel].fd < 0) {
+      fprintf(stderr, "device %u: cannot bind %s:%u: %s\n", index, inet_ntoa(addr.sin_addr),
+              ntohs(addr.sin_port), strerror(errno));
+      exit(1);
+    }
+  }
+
+  if (write(ready_fd, "", 1) != 1)
+    exit(1);
+  close(ready_fd);
+
+  fleet.offset_ns = wall_ns() - sim_now_ns();
+  sim_wfi_hook = fleet_wfi;
+
+  for (;;) {
+    uint64_t sleeps = sim_counters.sleeps;
+    loop();
+
+    // A polling build never sleeps; let time pass once it has nothing to do
+    if (sim_counters.sleeps == sleeps && !iostack_pending() && !fleet_chip_pending())
+      fleet_wfi(sim_now_ns());
+  }
+}
+
+
+struct fleet_load {
+  struct flasherctl_client *client;
+  uint64_t end_ns;
+  std::vector<uint64_t> latency_ns;
+  uint32_t errors;  // Responses other than the echo
+};
+
+
+static void fleet_load_done(struct flasherctl_request *request, void *context)
+{
+  struct fleet_load *load = (struct fleet_load *) context;
+
+  if (request->status == FLASHERCTL_OK) {
+    if (request->response.code != CMD_PING || request->response_size != request->size)
+      load->errors++;
+    load->latency_ns.push_back(request->latency_ns);
+  }
+
+  if (wall_ns() < load->end_ns)
+    flasherctl_client_submit(load->client, request->device, request);
+}
+
+
+/* Keeps a window of PINGs in flight on the control channel of every device
+   for the configured time, then reads the datagrams each device dropped for
+   lack of buffer space; returns 1 if requests failed */
+static int fleet_load_run(const struct fleet_config *config)
+{
+  struct fleet_load load = {};
+  load.client = flasherctl_client_create(config->window, config->timeout_ms * 1000, 3);
+  if (!load.client) {
+    perror("flasherctl_client_create");
+    return 1;
+  }
+
+  for (unsigned i = 0; i < config->devices; i++) {
+    struct sockaddr_in addr;
+    fleet_address(config, i, IOSTACK_CHANNEL_CONTROL, &addr);
+    if (flasherctl_client_add_device(load.client, inet_ntoa(addr.sin_addr),
+                                     ntohs(addr.sin_port)) < 0) {
+      perror("flasherctl_client_add_device");
+      return 1;
+    }
+  }
+
+  std::vector<struct flasherctl_request> requests(config->devices * config->window);
+  load.latency_ns.reserve(1 << 20);
+  uint64_t start = wall_ns();
+  load.end_ns = start + (uint64_t) (config->load_s * 1e9);
+  for (size_t i = 0; i < requests.size(); i++) {
+    struct flasherctl_request *request = &requests[i];
+    request->subsystem_id = SYS_IOSTACK;
+    request->code = CMD_PING;
+    request->size = config->ping_size;
+    memset(request->payload, 0xa5, request->size);
+    request->max_retries = FLASHERCTL_DEFAULT_RETRIES;
+    request->done = fleet_load_done;
+    request->context = &load;
+    flasherctl_client_submit(load.client, i % config->devices, request);
+  }
+  if (flasherctl_client_run(load.client) < 0)
+    perror("flasherctl_client_run");
+  double elapsed = (wall_ns() - start) * 1e-9;
+
+  const struct flasherctl_client_stats *stats = flasherctl_client_stats(load.client);
+  uint64_t retries = stats->retries, timeouts = stats->timeouts;
+
+  // Datagrams the devices' W5500 buffers had no room for
+  std::vector<struct flasherctl_request> reads(config->devices);
+  for (unsigned i = 0; i < config->devices; i++) {
+    reads[i].subsystem_id = SYS_IOSTACK;
+    reads[i].code = CMD_READ_REG;
+    reads[i].payload[1] = REG_DROPPED_PACKETS;  // Big-endian
+    reads[i].size = 2;
+    reads[i].max_retries = FLASHERCTL_DEFAULT_RETRIES;
+    flasherctl_client_submit(load.client, i, &reads[i]);
+  }
+  flasherctl_client_run(load.client);
+
+  uint64_t dropped = 0;
+  unsigned unread = 0;
+  for (auto &read : reads) {
+    uint32_t value;
+    if (read.status != FLASHERCTL_OK || read.response_size != sizeof(value)) {
+      unread++;
+      continue;
+    }
+    memcpy(&value, read.response_payload, sizeof(value));
+    dropped += value;
+  }
+
+  std::vector<uint64_t> &latency = load.latency_ns;
+  std::sort(latency.begin(), latency.end());
+  auto percentile = [&](double p) {
+    return latency.empty() ? 0.0 : latency[(size_t) (p * (latency.size() - 1))] * 1e-3;
+  };
+
+  printf("%u devices, window %u, %u byte PINGs for %.1f s\n", config->devices,
+         config->window, config->ping_size, elapsed);
+  printf("  %zu responses, %.0f req/s, %lu retries, %lu timeouts, %u bad responses\n",
+         latency.size(), latency.size() / elapsed, (unsigned long) retries,
+         (unsigned long) timeouts, load.errors);
+  printf("  latency us: p50 %.0f, p90 %.0f, p99 %.0f, p99.9 %.0f, max %.0f\n",
+         percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+         percentile(1.0));
+  printf("  dropped by the devices: %lu", (unsigned long) dropped);
+  if (unread)
+    printf(" (%u devices did not answer)", unread);
+  printf("\n");
+
+  flasherctl_client_destroy(load.client);
+  return load.errors || latency.empty();
+}
+
+
+static void on_signal(int signum)
+{
+  stop = 1;
+}
+
+
+static int parse_link(const char *s, struct fleet_link *link)
+{
+  char *end;
+  link->latency_us = strtoul(s, &end, 0);
+  if (*end != ':')
+    return -1;
+  link->jitter_us = strtoul(end + 1, &end, 0);
+  if (*end != ':')
+    return -1;
+  link->loss = strtod(end + 1, &end);
+  return *end || link->loss < 0 || link->loss > 1 ? -1 : 0;
+}
+
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [options]\n", argv0);
+  fprintf(stderr, "  -n devices   number of devices (default: 16)\n");
+  fprintf(stderr, "  -a address   address of the first device; the others follow (default: 127.0.1.1)\n");
+  fprintf(stderr, "  -P           all devices on the address, channels on consecutive ports\n");
+  fprintf(stderr, "  -p port      listen port of the first device and discovery port (default: 512)\n");
+  fprintf(stderr, "  -l us        one-way latency (default: 0)\n");
+  fprintf(stderr, "  -j us        reply jitter (default: 0)\n");
+  fprintf(stderr, "  -L loss      probability that a datagram is lost, each way (default: 0)\n");
+  fprintf(stderr, "  -D i:us:us:loss  latency, jitter and loss of device i\n");
+  fprintf(stderr, "  -i ms        longest sleep of an idle sketch (default: 10)\n");
+  fprintf(stderr, "  -g seconds   generate load for this long, report and exit\n");
+  fprintf(stderr, "  -w window    requests in flight per device under load (default: 4)\n");
+  fprintf(stderr, "  -s bytes     PING payload under load (default: 0)\n");
+  fprintf(stderr, "  -t ms        timeout per attempt under load (default: 200)\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+  struct fleet_config config = {};
+  config.devices = 16;
+  inet_pton(AF_INET, "127.0.1.1", &config.address);
+  config.port = sketch_port;
+  config.idle_ms = 10;
+  config.window = 4;
+  config.timeout_ms = 200;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:a:Pp:l:j:L:D:i:g:w:s:t:h")) != -1) {
+    struct fleet_link link;
+    char *end;
+
+    switch (opt) {
+      case 'n':
+        config.devices = strtoul(optarg, NULL, 0);
+        break;
+      case 'a':
+        if (inet_pton(AF_INET, optarg, &config.address) != 1) {
+          fprintf(stderr, "invalid address %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'P':
+        config.shared_address = 1;
+        break;
+      case 'p':
+        config.port = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        config.link.latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'j':
+        config.link.jitter_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'L':
+        config.link.loss = strtod(optarg, NULL);
+        break;
+      case 'D':
+        if (parse_link(strchr(optarg, ':') ? strchr(optarg, ':') + 1 : "", &link) < 0) {
+          fprintf(stderr, "invalid device link %s\n", optarg);
+          return 2;
+        }
+        config.links.push_back({(unsigned) strtoul(optarg, &end, 0), link});
+        break;
+      case 'i':
+        config.idle_ms = strtoul(optarg, NULL, 0);
+        break;
+      case 'g':
+        config.load_s = strtod(optarg, NULL);
+        break;
+      case 'w':
+        config.window = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        config.ping_size = std::min(strtoul(optarg, NULL, 0), (unsigned long) iostack_max_payload_size);
+        break;
+      case 't':
+        config.timeout_ms = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (config.devices == 0 || config.idle_ms == 0 || config.window == 0 ||
+      config.timeout_ms == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  struct sigaction action = {};
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  // Each device reports on the pipe once its sockets are bound
+  int ready[2];
+  if (pipe(ready) < 0) {
+    perror("pipe");
+    return 1;
+  }
+
+  std::vector<pid_t> pids;
+  fflush(stdout);
+  for (unsigned i = 0; i < config.devices; i++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      break;
+    }
+    if (pid == 0) {
+      signal(SIGINT, SIG_IGN);
+      signal(SIGTERM, SIG_DFL);
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      close(ready[0]);
+      fleet_device_run(&config, i, ready[1]);
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+  close(ready[1]);
+
+  unsigned booted = 0;
+  char c;
+  while (booted < pids.size() && read(ready[0], &c, 1) == 1)
+    booted++;
+  close(ready[0]);
+
+  int status = 1;
+  if (booted == config.devices) {
+    struct sockaddr_in first, last;
+    fleet_address(&config, 0, IOSTACK_CHANNEL_CONTROL, &first);
+    fleet_address(&config, config.devices - 1, IOSTACK_CHANNELS - 1, &last);
+    char first_ip[INET_ADDRSTRLEN], last_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &first.sin_addr, first_ip, sizeof(first_ip));
+    inet_ntop(AF_INET, &last.sin_addr, last_ip, sizeof(last_ip));
+    fprintf(stderr, "%u devices on %s:%u to %s:%u, discovery on port %u\n", config.devices,
+            first_ip, ntohs(first.sin_port), last_ip, ntohs(last.sin_port), config.port);
+
+    if (config.load_s > 0) {
+      status = fleet_load_run(&config);
+    } else {
+      while (!stop)
+        pause();
+      status = 0;
+    }
+  } else {
+    fprintf(stderr, "%u of %u devices started\n", booted, config.devices);
+  }
+
+  for (pid_t pid : pids)
+    kill(pid, SIGTERM);
+  for (pid_t pid : pids)
+    waitpid(pid, NULL, 0);
+
+  return status;
+}
@@ -0,0 +1,853 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "dmac.h"
+#include "flasher.h"
+
+#include "sim.h"
+#include "w5500_sim.h"
+
+struct sim_counters sim_counters;
+struct sim_config sim_config;
+struct adt7310sim adt7310sim;
+struct pulsesim pulsesim;
+struct ds28cm00sim ds28cm00sim;
+struct ds1023sim ds1023sim;
+void (*sim_wfi_hook)(uint64_t wake_ns);
+
+SERCOM sercom0 = {0}, sercom1 = {1}, sercom2 = {2}, sercom3 = {3},
+       sercom4 = {4}, sercom5 = {5};
+
+extern SPIClass SPI_2;
+
+SimSerial Serial;
+SimPort sim_port;
+PinDescription g_APinDescription[NUM_DIGITAL_PINS];
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+static uint64_t now_ns;
+static uint8_t pin_state[NUM_DIGITAL_PINS];
+static voidFuncPtr irq_handler[NUM_DIGITAL_PINS];
+static uint32_t irq_mode[NUM_DIGITAL_PINS];
+static uint8_t pin_mode[NUM_DIGITAL_PINS];
+
+static std::string serial_input;
+static size_t serial_input_pos;
+static uint8_t serial_echo;
+static uint8_t serial_stalled;
+
+static const uint8_t ds28cm00_address = 0x50;
+static const uint32_t i2c_clock = 100000;
+
+
+// Dallas/Maxim CRC-8 (X^8 + X^5 + X^4 + 1), as computed by the DS28CM00
+static uint8_t crc8_maxim(const uint8_t *data, uint8_t size)
+{
+  uint8_t crc = 0;
+  while (size--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8c : crc >> 1;
+  }
+
+  return crc;
+}
+
+
+void sim_reset(void)
+{
+  now_ns = 0;
+  memset(&sim_counters, 0, sizeof(sim_counters));
+  sim_config.spi_call_ns = 500;
+  sim_config.dma_setup_ns = 1000;
+  memset(pin_state, 0, sizeof(pin_state));
+  memset(pin_mode, 0, sizeof(pin_mode));
+
+  // Controller board variant: Arduino pin, port, bit
+  static const uint8_t variant[][3] = {
+    {0, PORTA, 4}, {1, PORTA, 5}, {2, PORTA, 6}, {3, PORTA, 7},
+    {6, PORTA, 12}, {7, PORTA, 16}, {8, PORTA, 22}, {10, PORTA, 18},
+    {13, PORTA, 17}, {15, PORTA, 20}, {16, PORTA, 21}, {20, PORTA, 13},
+    {21, PORTA, 14}, {22, PORTA, 15}, {25, PORTB, 3}, {SIM_W55_INTN_PIN, PORTA, 19},
+  };
+  for (uint8_t i = 0; i < NUM_DIGITAL_PINS; i++)
+    g_APinDescription[i] = {NOT_A_PORT, 0};
+  for (size_t i = 0; i < sizeof(variant) / sizeof(*variant); i++)
+    g_APinDescription[variant[i][0]] = {(EPortType) variant[i][1], variant[i][2]};
+
+  w55sim_reset();
+  memset(irq_handler, 0, sizeof(irq_handler));
+  pin_state[SIM_W55_INTN_PIN] = HIGH;
+
+  memset(&adt7310sim, 0, sizeof(adt7310sim));
+  memset(&pulsesim, 0, sizeof(pulsesim));
+  adt7310sim.temperature = 25 * 128;
+  adt7310sim.value = adt7310sim.temperature;
+
+  static const uint8_t serial_no[6] = {0x5a, 0x3c, 0x01, 0x00, 0x00, 0x00};
+  memset(&ds28cm00sim, 0, sizeof(ds28cm00sim));
+  sim_set_serial_no(serial_no);
+
+  memset(&ds1023sim, 0, sizeof(ds1023sim));
+
+  memset(EEPROM.data, 0xff, sizeof(EEPROM.data));
+  EEPROM.valid = false;
+  EEPROM.commits = 0;
+
+  serial_input.clear();
+  serial_input_pos = 0;
+  serial_stalled = 0;
+}
+
+
+// Programs the DS28CM00 with a serial number, LSB first
+void sim_set_serial_no(const uint8_t serial_no[6])
+{
+  ds28cm00sim.memory[0] = 0x70;
+  memcpy(&ds28cm00sim.memory[1], serial_no, 6);
+  ds28cm00sim.memory[7] = crc8_maxim(ds28cm00sim.memory, 7);
+}
+
+
+uint64_t sim_now_ns(void)
+{
+  return now_ns;
+}
+
+
+void sim_advance_ns(uint64_t ns)
+{
+  now_ns += ns;
+}
+
+
+uint8_t sim_pin_state(uint32_t pin)
+{
+  return pin < NUM_DIGITAL_PINS ? pin_state[pin] : LOW;
+}
+
+
+void sim_serial_input(const char *s)
+{
+  serial_input += s;
+}
+
+
+void sim_serial_echo(uint8_t on)
+{
+  serial_echo = on;
+}
+
+
+// ADT7310: command byte, then data bytes MSB first
+static uint8_t adt7310_transfer(uint8_t data)
+{
+  struct adt7310sim *t = &adt7310sim;
+
+  if (t->ready_ns && now_ns >= t->ready_ns) {
+    t->value = t->temperature;
+    t->ready_ns = 0;
+  }
+
+  uint8_t phase = t->phase++;
+  if (phase == 0) {
+    t->cmd = data;
+    return 0xff;
+  }
+
+  uint8_t reg = (t->cmd >> 3) & 0x07;
+  uint8_t read = t->cmd & 0x40;
+
+  if (reg == 1 && !read && phase == 1) {
+    t->config = data;
+    if (((t->config >> 5) & 0x03) == 0x01)  // One-shot
+      t->ready_ns = now_ns + 240000000ULL;
+    return 0xff;
+  }
+
+  if (reg == 1 && read && phase == 1)
+    return t->config;
+
+  if (reg == 2 && read)
+    return phase == 1 ? (uint8_t) (t->value >> 8) : (uint8_t) t->value;
+
+  return 0xff;
+}
+
+
+// DS1023: one bit per rising CLK while LE is high, MS bit first
+static void ds1023_clock(uint8_t d)
+{
+  ds1023sim.shift = (ds1023sim.shift << 1) | d;
+  ds1023sim.bits++;
+}
+
+
+static uint8_t ds1023_transfer(uint8_t data)
+{
+  for (int i = 7; i >= 0; i--)
+    ds1023_clock((data >> i) & 0x01);
+
+  return 0xff;  // Not wired to MISO
+}
+
+
+uint8_t sim_spi_transfer(uint8_t sercom, uint32_t clock, uint8_t data)
+{
+  uint64_t ns = 8000000000ULL / (clock ? clock : 1);
+  now_ns += ns;
+  sim_counters.bus_ns += ns;
+  sim_counters.spi_bytes++;
+
+  if (sercom == PERIPH_SPI2.index && pin_state[SS] == LOW) {
+    sim_counters.w55_spi_bytes++;
+    return w55sim_transfer(data);
+  }
+
+  if (sercom == PERIPH_SPI1.index && pin_state[ADT7310_CS] == LOW)
+    return adt7310_transfer(data);
+
+  if (sercom == sercom5.index && pin_state[DS1023_LE])
+    return ds1023_transfer(data);
+
+  return 0xff;
+}
+
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+  now_ns += sim_config.spi_call_ns;
+  sim_counters.bus_ns += sim_config.spi_call_ns;
+  sim_counters.spi_calls++;
+
+  return sim_spi_transfer(sercom->index, clock, data);
+}
+
+
+void SPIClass::transfer(void *buf, size_t count)
+{
+  uint8_t *p = (uint8_t *) buf;
+  while (count--) {
+    *p = transfer(*p);
+    p++;
+  }
+}
+
+
+// DMAC (see dmac.h): a channel runs when it is enabled and its trigger fires.
+// SPI_2 raises the W5500 triggers: each TX beat written to DATA clocks a byte
+// out, whose reply is the RX channel's next beat. A burst costs one setup.
+DmacDescriptor dmac_base[DMAC_NUM_CHANNELS];
+DmacDescriptor dmac_writeback[DMAC_NUM_CHANNELS];
+SimDmac sim_dmac;
+SimSercom sim_sercom4;
+
+static struct {
+  uint8_t trigger;
+  uint8_t enabled;
+  uint8_t intflag;
+  uint16_t beat;
+} dmac_channel[DMAC_NUM_CHANNELS];
+static uint8_t dmac_chid;
+static uint8_t sercom4_rx;
+
+
+void dmac_init(void)
+{
+}
+
+
+void dmac_channel_init(uint8_t channel, uint8_t trigger, uint8_t level)
+{
+  (void) level;
+  dmac_channel[channel].trigger = trigger;
+}
+
+
+static uintptr_t dmac_beat_addr(uintptr_t addr, uint16_t count, uint16_t beat,
+                                uint16_t inc)
+{
+  return inc ? addr - count + beat : addr;
+}
+
+
+// One beat of a channel; the block action of each finished block applies
+static void dmac_beat(uint8_t channel)
+{
+  DmacDescriptor *desc = &dmac_writeback[channel];
+  uint16_t beat = dmac_channel[channel].beat;
+  uintptr_t src = dmac_beat_addr(desc->SRCADDR.reg, desc->BTCNT.reg, beat,
+                                 desc->BTCTRL.reg & DMAC_BTCTRL_SRCINC);
+  uintptr_t dst = dmac_beat_addr(desc->DSTADDR.reg, desc->BTCNT.reg, beat,
+                                 desc->BTCTRL.reg & DMAC_BTCTRL_DSTINC);
+  uintptr_t data = (uintptr_t) &SERCOM4->SPI.DATA.reg;
+  uint8_t value = src == data ? sercom4_rx : *(const uint8_t *) src;
+
+  if (dst == data)
+    sercom4_rx = sim_spi_transfer(PERIPH_SPI2.index, SPI_2.clock, value);
+  else
+    *(uint8_t *) dst = value;
+
+  if (++dmac_channel[channel].beat < desc->BTCNT.reg)
+    return;
+
+  uint16_t action = desc->BTCTRL.reg & DMAC_BTCTRL_BLOCKACT_Msk;
+  if (action == DMAC_BTCTRL_BLOCKACT_INT || action == DMAC_BTCTRL_BLOCKACT_BOTH)
+    dmac_channel[channel].intflag |= DMAC_CHINTFLAG_TCMPL;
+
+  dmac_channel[channel].beat = 0;
+  if (desc->DESCADDR.reg)
+    *desc = *(const DmacDescriptor *) desc->DESCADDR.reg;
+  else
+    dmac_channel[channel].enabled = 0;
+  if (dmac_channel[channel].enabled && !(desc->BTCTRL.reg & DMAC_BTCTRL_VALID)) {
+    dmac_channel[channel].intflag |= DMAC_CHINTFLAG_TERR;
+    dmac_channel[channel].enabled = 0;
+  }
+}
+
+
+static int dmac_find(uint8_t trigger)
+{
+  for (uint8_t ch = 0; ch < DMAC_NUM_CHANNELS; ch++)
+    if (dmac_channel[ch].enabled && dmac_channel[ch].trigger == trigger)
+      return ch;
+  return -1;
+}
+
+
+// SPI_2 keeps DATA empty while the TX channel has beats left
+static void dmac_sercom4_run(void)
+{
+  int tx, rx;
+
+  now_ns += sim_config.dma_setup_ns;
+  sim_counters.bus_ns += sim_config.dma_setup_ns;
+  sim_counters.dma_bursts++;
+
+  while ((tx = dmac_find(SERCOM4_DMAC_ID_TX)) >= 0) {
+    dmac_beat(tx);
+    if ((rx = dmac_find(SERCOM4_DMAC_ID_RX)) >= 0)
+      dmac_beat(rx);
+  }
+}
+
+
+uint32_t sim_dmac_read(uint8_t id)
+{
+  switch (id) {
+    case SIM_DMAC_CHID:
+      return dmac_chid;
+    case SIM_DMAC_CHCTRLA:
+      return dmac_channel[dmac_chid].enabled ? DMAC_CHCTRLA_ENABLE : 0;
+    case SIM_DMAC_CHINTFLAG:
+      // Nothing is left to raise a flag: a poll for one would spin forever
+      if (!dmac_channel[dmac_chid].enabled && !dmac_channel[dmac_chid].intflag) {
+        fprintf(stderr, "DMAC channel %u: flags polled after its transfer ended "
+                        "without raising any\n", dmac_chid);
+        exit(1);
+      }
+      return dmac_channel[dmac_chid].intflag;
+    default:
+      return 0;
+  }
+}
+
+
+void sim_dmac_write(uint8_t id, uint32_t value)
+{
+  switch (id) {
+    case SIM_DMAC_CHID:
+      dmac_chid = value % DMAC_NUM_CHANNELS;
+      break;
+    case SIM_DMAC_CHCTRLA:
+      if (!(value & DMAC_CHCTRLA_ENABLE)) {
+        dmac_channel[dmac_chid].enabled = 0;
+        break;
+      }
+      if (dmac_channel[dmac_chid].enabled)
+        break;
+      dmac_channel[dmac_chid].enabled = 1;
+      dmac_channel[dmac_chid].beat = 0;
+      dmac_writeback[dmac_chid] = dmac_base[dmac_chid];
+      if (!(dmac_writeback[dmac_chid].BTCTRL.reg & DMAC_BTCTRL_VALID)) {
+        dmac_channel[dmac_chid].intflag |= DMAC_CHINTFLAG_TERR;
+        dmac_channel[dmac_chid].enabled = 0;
+        break;
+      }
+      if (dmac_channel[dmac_chid].trigger == SERCOM4_DMAC_ID_TX)
+        dmac_sercom4_run();
+      break;
+    case SIM_DMAC_CHINTFLAG:
+      dmac_channel[dmac_chid].intflag &= ~value;
+      break;
+  }
+}
+
+
+// DS1023 on SERCOM5 (see flasher.cpp): 8 CLK cycles at the configured BAUD
+void ds1023_spi_init(void)
+{
+}
+
+
+void ds1023_spi_write(uint8_t data)
+{
+  sim_spi_transfer(sercom5.index, F_CPU / (2 * (DS1023_SPI_BAUD + 1)), data);
+}
+
+
+// Pulse train timer (see flasher.cpp): the edges follow from the clock
+void pulse_timer_start(uint16_t count, uint8_t prescaler, uint32_t period, uint32_t width,
+                       uint32_t delay)
+{
+  static const uint16_t dividers[] = {1, 2, 4, 8, 16, 64, 256, 1024};
+  double tick_ns = 1e9 * dividers[prescaler] / F_CPU;
+
+  pulsesim.running = 1;
+  pulsesim.count = count;
+  pulsesim.start_ns = now_ns + (uint64_t) (delay * tick_ns);
+  pulsesim.period_ns = period * tick_ns;
+  pulsesim.width_ns = width * tick_ns;
+  pulsesim.stamp = 0;
+}
+
+
+uint16_t pulse_timer_remaining(void)
+{
+  if (!pulsesim.running || now_ns < pulsesim.start_ns)
+    return pulsesim.running ? pulsesim.count : 0;
+
+  uint64_t started = (uint64_t) ((now_ns - pulsesim.start_ns) / pulsesim.period_ns) + 1;
+  return started >= pulsesim.count ? 0 : pulsesim.count - started;
+}
+
+
+uint8_t pulse_timer_busy(void)
+{
+  return pulsesim.running &&
+         now_ns < pulsesim.start_ns + (pulsesim.count - 1) * pulsesim.period_ns + pulsesim.width_ns;
+}
+
+
+void pulse_timer_stop(void)
+{
+  pulsesim.running = 0;
+}
+
+
+void pulse_timer_stamp_edge(void)
+{
+  pulsesim.stamp = 1;
+}
+
+
+// The TCC0 interrupt takes the latency out of its timestamp
+uint8_t pulse_timer_edge_us(uint32_t *us)
+{
+  if (!pulsesim.running || !pulsesim.stamp || now_ns < pulsesim.start_ns)
+    return 1;
+
+  *us = (uint32_t) (pulsesim.start_ns / 1000);
+  return 0;
+}
+
+
+void pinMode(uint32_t pin, uint32_t mode)
+{
+  if (pin < NUM_DIGITAL_PINS)
+    pin_mode[pin] = mode;
+}
+
+
+static void pin_set(uint32_t pin, uint8_t value)
+{
+  uint8_t old = pin_state[pin];
+  pin_state[pin] = value ? HIGH : LOW;
+  if (old == pin_state[pin])
+    return;
+
+  if (pin == SS) {
+    sim_counters.cs_toggles++;
+    if (pin_state[pin] == LOW) {
+      w55sim_select();
+    } else {
+      w55sim_deselect();
+      sim_counters.w55_frames = w55sim.frames;
+    }
+  } else if (pin == ADT7310_CS) {
+    sim_counters.cs_toggles++;
+    adt7310sim.phase = 0;
+  } else if (pin == DS1023_CLK && pin_state[pin] && pin_state[DS1023_LE]) {
+    ds1023_clock(pin_state[DS1023_D]);
+  } else if (pin == DS1023_LE && !pin_state[pin] && ds1023sim.bits) {
+    ds1023sim.value = ds1023sim.shift;
+    ds1023sim.bits = 0;
+    ds1023sim.latches++;
+  }
+}
+
+
+uint8_t sim_led_current(void)
+{
+  return pin_state[LED_A0] | (pin_state[LED_A1] << 1) |
+         (pin_state[LED_A2] << 2) | (pin_state[LED_A3] << 3);
+}
+
+
+// Counts every value the photorelays are driven with, including the
+// intermediate ones while the current pins are changed one at a time
+static void led_current_update(void)
+{
+  static uint8_t last;
+  uint8_t current = sim_led_current();
+
+  if (current != last)
+    sim_counters.led_steps++;
+  last = current;
+}
+
+
+void digitalWrite(uint32_t pin, uint32_t value)
+{
+  sim_counters.gpio_writes++;
+
+  if (pin < NUM_DIGITAL_PINS)
+    pin_set(pin, value);
+  led_current_update();
+}
+
+
+uint32_t sim_port_read(uint8_t group, uint8_t id)
+{
+  uint32_t value = 0;
+
+  if (id != SIM_PORT_OUT && id != SIM_PORT_IN)
+    return 0;
+
+  for (uint32_t pin = 0; pin < NUM_DIGITAL_PINS; pin++)
+    if (g_APinDescription[pin].ulPort == group && pin_state[pin])
+      value |= 1ul << g_APinDescription[pin].ulPin;
+
+  return value;
+}
+
+
+// All pins of a PORT write change in the same cycle
+void sim_port_write(uint8_t group, uint8_t id, uint32_t value)
+{
+  uint32_t out = sim_port_read(group, SIM_PORT_OUT);
+
+  switch (id) {
+    case SIM_PORT_OUT:
+      out = value;
+      break;
+    case SIM_PORT_OUTSET:
+      out |= value;
+      break;
+    case SIM_PORT_OUTCLR:
+      out &= ~value;
+      break;
+    case SIM_PORT_OUTTGL:
+      out ^= value;
+      break;
+    default:
+      return;
+  }
+  sim_counters.port_writes++;
+
+  for (uint32_t pin = 0; pin < NUM_DIGITAL_PINS; pin++)
+    if (g_APinDescription[pin].ulPort == group)
+      pin_set(pin, (out >> g_APinDescription[pin].ulPin) & 1);
+  led_current_update();
+}
+
+
+void attachInterrupt(uint32_t pin, voidFuncPtr callback, uint32_t mode)
+{
+  if (pin >= NUM_DIGITAL_PINS)
+    return;
+
+  irq_handler[pin] = callback;
+  irq_mode[pin] = mode;
+}
+
+
+void detachInterrupt(uint32_t pin)
+{
+  if (pin < NUM_DIGITAL_PINS)
+    irq_handler[pin] = NULL;
+}
+
+
+void sim_irq_update(void)
+{
+  // Input pins driven by peripherals
+  uint8_t old = pin_state[SIM_W55_INTN_PIN];
+  uint8_t level = w55sim_intn();
+  pin_state[SIM_W55_INTN_PIN] = level;
+
+  voidFuncPtr handler = irq_handler[SIM_W55_INTN_PIN];
+  if (!handler)
+    return;
+
+  uint32_t mode = irq_mode[SIM_W55_INTN_PIN];
+  if ((mode == FALLING && old && !level) || (mode == RISING && !old && level) ||
+      (mode == CHANGE && old != level) || (mode == LOW && !level) ||
+      (mode == HIGH && level)) {
+    sim_counters.irqs++;
+    handler();
+  }
+}
+
+
+// Sleeps until the next interrupt: SysTick (1 ms) or a W5500 event
+void __WFI(void)
+{
+  sim_counters.sleeps++;
+
+  uint64_t wake = (now_ns / 1000000 + 1) * 1000000;
+  uint64_t event = w55sim_next_event_ns();
+  if (event > now_ns && event < wake)
+    wake = event;
+
+  if (sim_wfi_hook)
+    sim_wfi_hook(wake);
+  else
+    now_ns = wake;
+  sim_irq_update();
+}
+
+
+int digitalRead(uint32_t pin)
+{
+  return sim_pin_state(pin);
+}
+
+
+void delay(unsigned long ms)
+{
+  now_ns += (uint64_t) ms * 1000000;
+}
+
+
+void delayMicroseconds(unsigned int us)
+{
+  now_ns += (uint64_t) us * 1000;
+}
+
+
+unsigned long millis(void)
+{
+  return (unsigned long) (uint32_t) (now_ns / 1000000);
+}
+
+
+unsigned long micros(void)
+{
+  return (unsigned long) (uint32_t) (now_ns / 1000);
+}
+
+
+// Serial
+int SimSerial::available(void)
+{
+  return (int) (serial_input.size() - serial_input_pos);
+}
+
+
+int SimSerial::read(void)
+{
+  if (serial_input_pos >= serial_input.size())
+    return -1;
+
+  return (uint8_t) serial_input[serial_input_pos++];
+}
+
+
+size_t SimSerial::write(uint8_t c)
+{
+  if (serial_echo)
+    fputc(c, stderr);
+
+  return 1;
+}
+
+
+size_t SimSerial::write(const uint8_t *buffer, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+    write(buffer[i]);
+
+  return size;
+}
+
+
+// A stalled port (host not reading) has no room
+int SimSerial::availableForWrite(void)
+{
+  return serial_stalled ? 0 : 63;
+}
+
+
+void sim_serial_stall(uint8_t on)
+{
+  serial_stalled = on;
+}
+
+
+size_t SimSerial::print(const char *s)
+{
+  size_t n = 0;
+  while (*s)
+    n += write(*s++);
+
+  return n;
+}
+
+
+size_t SimSerial::print(char c)
+{
+  return write(c);
+}
+
+
+size_t SimSerial::print(unsigned long n, int base)
+{
+  char buf[8 * sizeof(long) + 1];
+  snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", n);
+  return print(buf);
+}
+
+
+size_t SimSerial::print(long n, int base)
+{
+  if (base != DEC)
+    return print((unsigned long) n, base);
+
+  char buf[8 * sizeof(long) + 2];
+  snprintf(buf, sizeof(buf), "%ld", n);
+  return print(buf);
+}
+
+
+size_t SimSerial::print(unsigned char n, int base)
+{
+  return print((unsigned long) n, base);
+}
+
+
+size_t SimSerial::print(int n, int base)
+{
+  return print((long) n, base);
+}
+
+
+size_t SimSerial::print(unsigned int n, int base)
+{
+  return print((unsigned long) n, base);
+}
+
+
+size_t SimSerial::print(double n, int digits)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return print(buf);
+}
+
+
+size_t SimSerial::println(void)
+{
+  return print("\r\n");
+}
+
+
+// I2C: only the DS28CM00 is on the bus
+static void i2c_bytes(uint32_t n)
+{
+  uint64_t ns = (uint64_t) n * 9 * 1000000000ULL / i2c_clock;
+  now_ns += ns;
+  sim_counters.bus_ns += ns;
+  sim_counters.i2c_bytes += n;
+}
+
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  this->address = address;
+  rx_head = rx_tail = 0;
+  i2c_bytes(1);
+}
+
+
+size_t TwoWire::write(uint8_t data)
+{
+  i2c_bytes(1);
+  if (address == ds28cm00_address)
+    ds28cm00sim.pointer = data;
+
+  return 1;
+}
+
+
+uint8_t TwoWire::endTransmission(bool stop_bit)
+{
+  (void) stop_bit;
+  return address == ds28cm00_address ? 0 : 2;  // 2: NACK on address
+}
+
+
+uint8_t TwoWire::requestFrom(uint8_t address, size_t quantity, bool stop_bit)
+{
+  (void) stop_bit;
+  rx_head = rx_tail = 0;
+  i2c_bytes(1);
+
+  if (address != ds28cm00_address)
+    return 0;
+
+  if (quantity > sizeof(rx_buffer))
+    quantity = sizeof(rx_buffer);
+
+  uint8_t corrupt = 0;
+  if (ds28cm00sim.corrupt_reads) {
+    ds28cm00sim.corrupt_reads--;
+    corrupt = 1;
+  }
+
+  for (size_t i = 0; i < quantity; i++) {
+    uint8_t p = ds28cm00sim.pointer++;
+    rx_buffer[rx_tail++] = p < sizeof(ds28cm00sim.memory) ? ds28cm00sim.memory[p] : 0xff;
+  }
+  if (corrupt && quantity > 1)
+    rx_buffer[1] ^= 0x10;
+
+  i2c_bytes(quantity);
+  return quantity;
+}
+
+
+int TwoWire::available(void)
+{
+  return rx_tail - rx_head;
+}
+
+
+int TwoWire::read(void)
+{
+  if (rx_head >= rx_tail)
+    return -1;
+
+  return rx_buffer[rx_head++];
+}
+
+
+void EEPROMClass::commit(void)
+{
+  valid = true;
+  commits++;
+}
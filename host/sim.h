@@ -0,0 +1,108 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+// Host simulation of the flasher controller board: simulated clock, GPIO,
+// SPI/I2C buses and the peripherals attached to them. The firmware sources
+// are compiled unmodified against the shims in host/arduino.
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <Wire.h>
+#include <FlashAsEEPROM.h>
+
+// Cost counters; all monotonic, take differences around the code under test
+struct sim_counters {
+  uint64_t spi_bytes;       // Bytes clocked on any SPI port
+  uint64_t spi_calls;       // CPU-driven SPIClass::transfer() calls
+  uint64_t dma_bursts;      // W5500 DMA bursts
+  uint64_t w55_spi_bytes;   // Bytes clocked while the W5500 is selected
+  uint64_t w55_frames;      // W5500 SPI frames (address + control + data)
+  uint64_t cs_toggles;      // Edges on the W5500 and ADT7310 chip selects
+  uint64_t gpio_writes;     // Calls to digitalWrite
+  uint64_t port_writes;     // Direct PORT register writes
+  uint64_t led_steps;       // Distinct values seen on LED_A0..LED_A3
+  uint64_t i2c_bytes;       // Bytes on the I2C bus, including address bytes
+  uint64_t bus_ns;          // Time spent in SPI and I2C transfers
+  uint64_t sleeps;          // __WFI() calls
+  uint64_t irqs;            // Interrupt handler invocations
+};
+
+// Board pin wired to the W5500 INTn output
+#define SIM_W55_INTN_PIN 12
+
+// Timing model of the 48 MHz SAMD21; estimates, not measurements
+struct sim_config {
+  uint32_t spi_call_ns;   // CPU gap per SPIClass::transfer() call
+  uint32_t dma_setup_ns;  // Descriptor setup, channel enable and completion poll
+};
+
+extern struct sim_counters sim_counters;
+extern struct sim_config sim_config;
+
+// ADT7310 temperature sensor model
+struct adt7310sim {
+  uint8_t phase;
+  uint8_t cmd;
+  uint8_t config;
+  int16_t temperature;  // Current die temperature (1/128 C)
+  int16_t value;        // Temperature value register (1/128 C)
+  uint64_t ready_ns;    // End of the running one-shot conversion
+};
+
+// DS28CM00 serial number chip model
+struct ds28cm00sim {
+  uint8_t memory[9];    // Family code, 6 serial bytes, CRC, control register
+  uint8_t pointer;
+  uint8_t corrupt_reads;  // Number of upcoming reads with a flipped bit
+};
+
+// DS1023 delay line model: shifts D in on rising CLK (bit-banged or from
+// SERCOM5) while LE is high and latches the delay on falling LE
+struct ds1023sim {
+  uint8_t shift;
+  uint8_t bits;
+  uint8_t value;
+  uint32_t latches;
+};
+
+// Pulse train timer model (TCC0 pacing DMAC writes to PIN_LED2): pulse k
+// (from 0) rises at start_ns + k * period_ns
+struct pulsesim {
+  uint8_t running;
+  uint16_t count;
+  uint64_t start_ns;
+  double period_ns;
+  double width_ns;
+  uint8_t stamp;  // The first rising edge is timestamped
+};
+
+extern struct adt7310sim adt7310sim;
+extern struct ds28cm00sim ds28cm00sim;
+extern struct ds1023sim ds1023sim;
+extern struct pulsesim pulsesim;
+
+// When set, __WFI calls this instead of moving the clock to wake_ns (the
+// next SysTick or W5500 event); the hook moves the clock itself and may
+// inject datagrams to wake the sketch early. Used to run the sketch in real
+// time (flasherctl_fleet).
+extern void (*sim_wfi_hook)(uint64_t wake_ns);
+
+void sim_reset(void);
+void sim_set_serial_no(const uint8_t serial_no[6]);
+
+uint64_t sim_now_ns(void);
+void sim_advance_ns(uint64_t ns);
+
+uint8_t sim_pin_state(uint32_t pin);
+uint8_t sim_led_current(void);
+
+void sim_serial_input(const char *s);
+void sim_serial_echo(uint8_t on);
+void sim_serial_stall(uint8_t on);
+
+uint8_t sim_spi_transfer(uint8_t sercom, uint32_t clock, uint8_t data);
+
+// Samples interrupt lines and runs the handlers of triggered ones
+void sim_irq_update(void);
+
+#endif
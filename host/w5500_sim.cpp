@@ -0,0 +1,462 @@
+#include <string.h>
+
+#include "w5500.h"
+
+#include "sim.h"
+#include "w5500_sim.h"
+
+// Common register addresses not used by the firmware
+#define W55SIM_IR       0x0015
+#define W55SIM_IMR      0x0016
+#define W55SIM_SIR      0x0017
+#define W55SIM_SIMR     0x0018
+#define W55SIM_RTR      0x0019
+#define W55SIM_RCR      0x001b
+#define W55SIM_PHYCFGR  0x002e
+#define W55SIM_VERSIONR 0x0039
+
+// Socket register offsets not used by the firmware
+#define W55SIM_SKT_TTL         0x0016
+#define W55SIM_SKT_RXBUF_SIZE  0x001e
+#define W55SIM_SKT_TXBUF_SIZE  0x001f
+#define W55SIM_SKT_TX_RD       0x0022
+#define W55SIM_SKT_RX_WR       0x002a
+#define W55SIM_SKT_IMR         0x002c
+
+struct w55sim w55sim;
+
+
+static uint16_t get16(const uint8_t *regs, uint16_t offset)
+{
+  return (uint16_t) ((regs[offset] << 8) | regs[offset + 1]);
+}
+
+
+static void set16(uint8_t *regs, uint16_t offset, uint16_t value)
+{
+  regs[offset] = value >> 8;
+  regs[offset + 1] = value;
+}
+
+
+static uint16_t buf_size(const struct w55sim_socket *s, uint16_t size_offset)
+{
+  uint16_t kb = s->regs[size_offset];
+  if (kb != 1 && kb != 2 && kb != 4 && kb != 8 && kb != 16)
+    return 0;
+
+  return kb * 1024;
+}
+
+
+static uint16_t buf_mask(const struct w55sim_socket *s, uint16_t size_offset)
+{
+  uint16_t size = buf_size(s, size_offset);
+  return size ? size - 1 : 0;
+}
+
+
+static void socket_reset(struct w55sim_socket *s)
+{
+  memset(s->regs, 0, sizeof(s->regs));
+  s->regs[W5500_SR_OFFSET] = W5500_SKT_SR_CLOSED;
+  s->regs[W55SIM_SKT_TTL] = 0x80;
+  s->regs[W55SIM_SKT_RXBUF_SIZE] = 2;
+  s->regs[W55SIM_SKT_TXBUF_SIZE] = 2;
+  s->regs[W55SIM_SKT_IMR] = 0xff;
+
+  s->tx_rd = 0;
+  s->rx_rd = 0;
+  s->rx_wr = 0;
+  s->send_pending = 0;
+}
+
+
+static void chip_reset(void)
+{
+  memset(w55sim.com, 0, sizeof(w55sim.com));
+  set16(w55sim.com, W55SIM_RTR, 0x07d0);
+  w55sim.com[W55SIM_RCR] = 0x08;
+  w55sim.com[W55SIM_PHYCFGR] = 0xbf;  // 100 Mbit full duplex, link up
+  w55sim.com[W55SIM_VERSIONR] = 0x04;
+
+  for (uint8_t n = 0; n < W55SIM_NUM_SOCKETS; n++)
+    socket_reset(&w55sim.sockets[n]);
+}
+
+
+void w55sim_reset(void)
+{
+  chip_reset();
+
+  w55sim.selected = 0;
+  w55sim.phase = 0;
+  w55sim.addr = 0;
+  w55sim.control = 0;
+
+  w55sim.send_latency_ns = 10000;
+  w55sim.fail_next_sends = 0;
+  w55sim.on_sir_read = NULL;
+  memset(w55sim.unreachable_ip, 0, sizeof(w55sim.unreachable_ip));
+
+  w55sim.outbox.clear();
+
+  w55sim.frames = 0;
+  w55sim.sends = 0;
+  w55sim.send_timeouts = 0;
+  w55sim.send_overlaps = 0;
+  w55sim.recv_drops = 0;
+}
+
+
+// Completes SENDs whose wire time has passed
+void w55sim_update(void)
+{
+  uint64_t now = sim_now_ns();
+
+  for (uint8_t n = 0; n < W55SIM_NUM_SOCKETS; n++) {
+    struct w55sim_socket *s = &w55sim.sockets[n];
+    if (!s->send_pending || now < s->send_done_ns)
+      continue;
+
+    s->send_pending = 0;
+    s->regs[W5500_IR_OFFSET] |= s->send_fails ? W5500_IR_TIMEOUT : W5500_IR_SEND_OK;
+  }
+}
+
+
+// Time of the next SEND completion, UINT64_MAX if none is pending
+uint64_t w55sim_next_event_ns(void)
+{
+  uint64_t next = UINT64_MAX;
+
+  for (uint8_t n = 0; n < W55SIM_NUM_SOCKETS; n++) {
+    const struct w55sim_socket *s = &w55sim.sockets[n];
+    if (s->send_pending && s->send_done_ns < next)
+      next = s->send_done_ns;
+  }
+
+  return next;
+}
+
+
+static uint8_t sir(void)
+{
+  uint8_t value = 0;
+  for (uint8_t n = 0; n < W55SIM_NUM_SOCKETS; n++) {
+    const struct w55sim_socket *s = &w55sim.sockets[n];
+    if (s->regs[W5500_IR_OFFSET] & s->regs[W55SIM_SKT_IMR])
+      value |= 1 << n;
+  }
+
+  return value;
+}
+
+
+// Level of the (active low) INTn pin
+uint8_t w55sim_intn(void)
+{
+  w55sim_update();
+
+  if ((sir() & w55sim.com[W55SIM_SIMR]) ||
+      (w55sim.com[W55SIM_IR] & w55sim.com[W55SIM_IMR]))
+    return LOW;
+
+  return HIGH;
+}
+
+
+static void socket_command(uint8_t n, uint8_t cmd)
+{
+  struct w55sim_socket *s = &w55sim.sockets[n];
+  uint8_t udp = (s->regs[W5500_MR_OFFSET] & 0x0f) == W5500_SKT_MR_UDP;
+
+  switch (cmd) {
+    case W5500_SKT_CR_OPEN:
+      if (udp) {
+        s->regs[W5500_SR_OFFSET] = W5500_SKT_SR_UDP;
+      } else if (s->regs[W5500_MR_OFFSET] & 0x0f) {
+        s->regs[W5500_SR_OFFSET] = W5500_SKT_SR_INIT;
+      }
+      s->tx_rd = 0;
+      s->rx_rd = 0;
+      s->rx_wr = 0;
+      set16(s->regs, W5500_TX_WR_OFFSET, 0);
+      set16(s->regs, W5500_RX_RD_OFFSET, 0);
+      break;
+
+    case W5500_SKT_CR_CLOSE:
+      s->regs[W5500_SR_OFFSET] = W5500_SKT_SR_CLOSED;
+      s->send_pending = 0;
+      break;
+
+    case W5500_SKT_CR_SEND: {
+      if (s->regs[W5500_SR_OFFSET] != W5500_SKT_SR_UDP)
+        break;
+
+      // The datasheet requires SEND_OK or TIMEOUT before the next SEND
+      w55sim_update();
+      if (s->send_pending)
+        w55sim.send_overlaps++;
+
+      uint16_t mask = buf_mask(s, W55SIM_SKT_TXBUF_SIZE);
+      uint16_t tx_wr = get16(s->regs, W5500_TX_WR_OFFSET);
+      uint16_t size = tx_wr - s->tx_rd;
+
+      struct w55sim_datagram dgram;
+      dgram.socket = n;
+      memcpy(dgram.ip_address, &s->regs[W5500_DIPR_OFFSET], 4);
+      dgram.src_port = get16(s->regs, W5500_PORT_OFFSET);
+      dgram.dst_port = get16(s->regs, W5500_DPORT_OFFSET);
+      dgram.time_ns = sim_now_ns();
+      for (uint16_t i = 0; i < size; i++)
+        dgram.data.push_back(s->tx[(uint16_t) (s->tx_rd + i) & mask]);
+      w55sim.sends++;
+      s->tx_rd = tx_wr;
+
+      // ARP gets no answer: nothing goes out, and the chip gives up once
+      // the retries are spent
+      if (!memcmp(dgram.ip_address, w55sim.unreachable_ip, 4)) {
+        s->send_pending = 1;
+        s->send_fails = 1;
+        w55sim.send_timeouts++;
+        s->send_done_ns = sim_now_ns() + 100000ull * get16(w55sim.com, W55SIM_RTR) *
+                                             (w55sim.com[W55SIM_RCR] + 1);
+        break;
+      }
+      w55sim.outbox.push_back(dgram);
+
+      // 100 Mbit/s: 80 ns per byte including UDP/IP/Ethernet overhead
+      s->send_pending = 1;
+      s->send_fails = 0;
+      if (w55sim.fail_next_sends) {
+        w55sim.fail_next_sends--;
+        w55sim.send_timeouts++;
+        s->send_fails = 1;
+      }
+      s->send_done_ns = sim_now_ns() + w55sim.send_latency_ns + 80 * (size + 42);
+      break;
+    }
+
+    case W5500_SKT_CR_RECV:
+      s->rx_rd = get16(s->regs, W5500_RX_RD_OFFSET);
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+static uint8_t read_byte(uint8_t block, uint16_t addr)
+{
+  if (block == W5500_BLB_COM) {
+    if (addr == W55SIM_SIR) {
+      uint8_t value = sir();
+      if (w55sim.on_sir_read)
+        w55sim.on_sir_read();
+      return value;
+    }
+
+    return addr < W55SIM_COM_SIZE ? w55sim.com[addr] : 0;
+  }
+
+  uint8_t n = (block - 1) / 4;
+  struct w55sim_socket *s = &w55sim.sockets[n];
+
+  switch ((block - 1) % 4) {
+    case 0: {
+      uint16_t tx_size = buf_size(s, W55SIM_SKT_TXBUF_SIZE);
+      uint16_t value;
+
+      switch (addr & ~1) {
+        case W5500_TX_FSR_OFFSET:
+          value = tx_size - (uint16_t) (get16(s->regs, W5500_TX_WR_OFFSET) - s->tx_rd);
+          break;
+        case W55SIM_SKT_TX_RD:
+          value = s->tx_rd;
+          break;
+        case W5500_RX_RSR_OFFSET:
+          value = s->rx_wr - s->rx_rd;
+          break;
+        case W55SIM_SKT_RX_WR:
+          value = s->rx_wr;
+          break;
+        default:
+          return addr < W55SIM_SKT_SIZE ? s->regs[addr] : 0;
+      }
+
+      return (addr & 1) ? (uint8_t) value : (uint8_t) (value >> 8);
+    }
+
+    case 1:
+      return s->tx[addr & buf_mask(s, W55SIM_SKT_TXBUF_SIZE)];
+
+    case 2:
+      return s->rx[addr & buf_mask(s, W55SIM_SKT_RXBUF_SIZE)];
+
+    default:
+      return 0;
+  }
+}
+
+
+static void write_byte(uint8_t block, uint16_t addr, uint8_t value)
+{
+  if (block == W5500_BLB_COM) {
+    if (addr >= W55SIM_COM_SIZE)
+      return;
+
+    if (addr == W5500_MR && (value & W5500_MR_SOFTRST)) {
+      chip_reset();
+    } else if (addr == W55SIM_IR) {
+      w55sim.com[addr] &= ~value;
+    } else if (addr != W55SIM_SIR && addr != W55SIM_VERSIONR) {
+      w55sim.com[addr] = value;
+    }
+    return;
+  }
+
+  uint8_t n = (block - 1) / 4;
+  struct w55sim_socket *s = &w55sim.sockets[n];
+
+  switch ((block - 1) % 4) {
+    case 0:
+      switch (addr) {
+        case W5500_CR_OFFSET:
+          socket_command(n, value);
+          s->regs[W5500_CR_OFFSET] = 0;
+          break;
+        case W5500_IR_OFFSET:
+          s->regs[W5500_IR_OFFSET] &= ~value;
+          break;
+        case W5500_SR_OFFSET:
+        case W5500_TX_FSR_OFFSET:
+        case W5500_TX_FSR_OFFSET + 1:
+        case W55SIM_SKT_TX_RD:
+        case W55SIM_SKT_TX_RD + 1:
+        case W5500_RX_RSR_OFFSET:
+        case W5500_RX_RSR_OFFSET + 1:
+        case W55SIM_SKT_RX_WR:
+        case W55SIM_SKT_RX_WR + 1:
+          break;  // Read only
+        default:
+          if (addr < W55SIM_SKT_SIZE)
+            s->regs[addr] = value;
+
+          // The destination of a pending SEND must not change
+          if (addr >= W5500_DIPR_OFFSET && addr < W5500_DPORT_OFFSET + 2) {
+            w55sim_update();
+            if (s->send_pending)
+              w55sim.send_overlaps++;
+          }
+          break;
+      }
+      break;
+
+    case 1:
+      s->tx[addr & buf_mask(s, W55SIM_SKT_TXBUF_SIZE)] = value;
+      break;
+
+    case 2:
+      s->rx[addr & buf_mask(s, W55SIM_SKT_RXBUF_SIZE)] = value;
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+void w55sim_select(void)
+{
+  w55sim.selected = 1;
+  w55sim.phase = 0;
+}
+
+
+void w55sim_deselect(void)
+{
+  if (w55sim.phase >= 3)
+    w55sim.frames++;
+
+  w55sim.selected = 0;
+
+  // Register writes may have changed INTn
+  sim_irq_update();
+}
+
+
+uint8_t w55sim_transfer(uint8_t mosi)
+{
+  if (!w55sim.selected)
+    return 0xff;
+
+  w55sim_update();
+
+  switch (w55sim.phase) {
+    case 0:
+      w55sim.addr = (uint16_t) mosi << 8;
+      w55sim.phase++;
+      return 0x01;  // The W5500 shifts out 0x01, 0x02, 0x03 during the header
+
+    case 1:
+      w55sim.addr |= mosi;
+      w55sim.phase++;
+      return 0x02;
+
+    case 2:
+      w55sim.control = mosi;
+      w55sim.phase++;
+      return 0x03;
+
+    default: {
+      uint8_t block = w55sim.control >> 3;
+      uint8_t miso = 0;
+
+      if (w55sim.control & W5500_RWB)
+        write_byte(block, w55sim.addr, mosi);
+      else
+        miso = read_byte(block, w55sim.addr);
+
+      w55sim.addr++;
+      return miso;
+    }
+  }
+}
+
+
+uint8_t w55sim_inject(const uint8_t ip_address[4], uint16_t src_port,
+                      uint16_t dst_port, const uint8_t *data, uint16_t size)
+{
+  for (uint8_t n = 0; n < W55SIM_NUM_SOCKETS; n++) {
+    struct w55sim_socket *s = &w55sim.sockets[n];
+    if (s->regs[W5500_SR_OFFSET] != W5500_SKT_SR_UDP ||
+        get16(s->regs, W5500_PORT_OFFSET) != dst_port)
+      continue;
+
+    uint16_t rx_size = buf_size(s, W55SIM_SKT_RXBUF_SIZE);
+    uint16_t used = s->rx_wr - s->rx_rd;
+    if (rx_size - used < size + 8) {
+      w55sim.recv_drops++;
+      return 1;
+    }
+
+    uint8_t header[8] = {ip_address[0], ip_address[1], ip_address[2],
+                         ip_address[3], (uint8_t) (src_port >> 8),
+                         (uint8_t) src_port, (uint8_t) (size >> 8),
+                         (uint8_t) size};
+    uint16_t mask = buf_mask(s, W55SIM_SKT_RXBUF_SIZE);
+    for (uint16_t i = 0; i < 8; i++)
+      s->rx[s->rx_wr++ & mask] = header[i];
+    for (uint16_t i = 0; i < size; i++)
+      s->rx[s->rx_wr++ & mask] = data[i];
+
+    s->regs[W5500_IR_OFFSET] |= W5500_IR_RECV;
+    sim_irq_update();
+    return 0;
+  }
+
+  w55sim.recv_drops++;
+  return 1;
+}
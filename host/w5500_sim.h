@@ -0,0 +1,89 @@
+#ifndef __W5500_SIM_H__
+#define __W5500_SIM_H__
+
+// Register-level model of the WIZnet W5500 as seen over SPI.
+//
+// Models the common register block, the eight socket register blocks, the
+// socket TX/RX ring buffers (masked by Sn_TXBUF_SIZE/Sn_RXBUF_SIZE, like the
+// chip) and the socket interrupt bits. Only UDP mode is implemented; other
+// protocols are accepted but never move data.
+
+#include <stdint.h>
+
+#include <vector>
+
+#define W55SIM_NUM_SOCKETS 8
+#define W55SIM_MAX_BUF_SIZE 0x4000  // 16 KB: a single socket may own all memory
+#define W55SIM_COM_SIZE 0x40
+#define W55SIM_SKT_SIZE 0x30
+
+// A datagram on the simulated wire
+struct w55sim_datagram {
+  uint8_t socket;
+  uint8_t ip_address[4];
+  uint16_t src_port;
+  uint16_t dst_port;
+  std::vector<uint8_t> data;
+  uint64_t time_ns;
+};
+
+struct w55sim_socket {
+  uint8_t regs[W55SIM_SKT_SIZE];
+  uint8_t tx[W55SIM_MAX_BUF_SIZE];
+  uint8_t rx[W55SIM_MAX_BUF_SIZE];
+
+  // Internal pointers that only change on a socket command
+  uint16_t tx_rd;
+  uint16_t rx_rd;
+  uint16_t rx_wr;
+
+  // Pending SEND completion
+  uint8_t send_pending;
+  uint8_t send_fails;
+  uint64_t send_done_ns;
+};
+
+struct w55sim {
+  uint8_t com[W55SIM_COM_SIZE];
+  struct w55sim_socket sockets[W55SIM_NUM_SOCKETS];
+
+  // SPI frame decoder
+  uint8_t selected;
+  uint8_t phase;
+  uint16_t addr;
+  uint8_t control;
+
+  // Behaviour knobs
+  uint32_t send_latency_ns;  // SEND to SEND_OK/TIMEOUT
+  uint8_t fail_next_sends;   // Number of upcoming SENDs that end in TIMEOUT
+  void (*on_sir_read)(void); // Called once SIR has been read, e.g. to inject
+  uint8_t unreachable_ip[4]; // SENDs to it end in TIMEOUT after RTR x (RCR + 1)
+
+  // Datagrams transmitted by the chip, oldest first
+  std::vector<struct w55sim_datagram> outbox;
+
+  // Statistics
+  uint64_t frames;
+  uint64_t sends;
+  uint64_t send_timeouts;
+  uint64_t send_overlaps;  // SEND or DIPR/DPORT writes while a SEND is pending
+  uint64_t recv_drops;
+};
+
+extern struct w55sim w55sim;
+
+void w55sim_reset(void);
+
+// SPI side
+void w55sim_select(void);
+void w55sim_deselect(void);
+uint8_t w55sim_transfer(uint8_t mosi);
+
+// Network side
+uint8_t w55sim_inject(const uint8_t ip_address[4], uint16_t src_port,
+                      uint16_t dst_port, const uint8_t *data, uint16_t size);
+uint8_t w55sim_intn(void);
+uint64_t w55sim_next_event_ns(void);
+void w55sim_update(void);
+
+#endif
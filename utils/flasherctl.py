@@ -6,7 +6,12 @@ Access to CTA Flasher.
 Instantiate a FlasherCtl object and access flasher using its properties.
 """
 
+import collections
+import errno
 import iostack
+import random
+import select
+import socket
 import struct
 import time
 
@@ -21,6 +26,9 @@ class FlasherError:
     """Errors encountered during communication."""
     ERR_BVALUE = 1  # Binary / Boolean Value was not 1 (on) or 0 (off) (for LED_BUILTIN)
     ERR_SERIAL_NO = 2 # Error reading flasher serial number
+    ERR_NOT_STAGED = 4  # COMMIT_SETTINGS without STAGE_SETTINGS
+    ERR_BUSY = 8  # A pulse train is driving TEST_PULSE
+    ERR_NOT_SYNCED = 16  # FIRE_AT before the clock was synchronised
     ERR_TIMEDOUT = 128  # Communication with flasher timed out
     ERR_RX_CHECKSUM = 256  # Checksum error in flasher response
     ERR_MISMATCH = 512  # Received response from different flasher ID
@@ -37,9 +45,72 @@ class FlasherCommand:
     CMD_SET_LED_CURRENT = 4
     CMD_SET_PULSE_WIDTH = 5
     CMD_TEST_PULSE = 6
+    CMD_STAGE_SETTINGS = 7
+    CMD_COMMIT_SETTINGS = 8
+    CMD_READ_TEMPERATURE_HISTORY = 9
+    CMD_SET_TEMPERATURE_PERIOD = 10
+    CMD_PULSE_TRAIN = 11
+    CMD_PULSE_TRAIN_STATUS = 12
+    CMD_SEQUENCE_LOAD = 13
+    CMD_SEQUENCE_START = 14
+    CMD_SEQUENCE_ABORT = 15
+    CMD_SEQUENCE_STATUS = 16
+    CMD_FIRE_AT = 17
+    CMD_FIRE_STATUS = 18
     CMD_REPORT_ERR = 65535
 
 
+TemperatureHistory = collections.namedtuple("TemperatureHistory",
+                                            "millis period_ms min max mean "
+                                            "samples")
+
+# Header and samples of a CMD_READ_TEMPERATURE_HISTORY reply
+temperature_summary = struct.Struct("<IHBfff")
+temperature_sample = struct.Struct("<Ih")
+temperature_lsb_per_c = 128.0
+
+PulseTrain = collections.namedtuple("PulseTrain", "count period_ns width_ns")
+PulseTrainStatus = collections.namedtuple("PulseTrainStatus",
+                                          "running count emitted")
+
+pulse_train = struct.Struct("<HII")
+pulse_train_status = struct.Struct("<BHH")
+
+SequenceStep = collections.namedtuple("SequenceStep",
+                                      "current width pulses period_ns dwell_ms")
+SequenceStatus = collections.namedtuple("SequenceStatus",
+                                        "state step nsteps pulses")
+
+
+class SequenceState:
+    """Calibration sequence states."""
+    IDLE = 0
+    RUNNING = 1
+    DONE = 2
+    ABORTED = 3
+
+
+sequence_step = struct.Struct("<BBHIH")
+sequence_status = struct.Struct("<BHHH")
+sequence_max_steps = 256
+sequence_push_progress = 0x01
+
+FireStatus = collections.namedtuple("FireStatus", "state target_us fired_us")
+
+
+class FireState:
+    """States of a pulse scheduled with _FIRE_AT."""
+    IDLE = 0
+    PENDING = 1
+    ARMED = 2
+    FIRED = 3
+    MISSED = 4
+    CANCELLED = 5
+
+
+fire_status = struct.Struct("<BQQ")
+
+
 class FlasherCtl(iostack.IOStack):
     def __init__(self, ip, port=iostack.default_port,
                  timeout=iostack.default_timeout,
@@ -69,6 +140,19 @@ class FlasherCtl(iostack.IOStack):
                                  max_packet_size=max_packet_size,
                                  interface_ip=interface_ip)
 
+        # Uploads go to the bulk channel, see _bulk()
+        self.bulk_stack = None
+        self.bulk_args = dict(ip=ip, port=port + iostack.bulk_port_offset,
+                              timeout=timeout, max_retries=max_retries,
+                              verbosity=verbosity, max_packet_size=max_packet_size,
+                              interface_ip=interface_ip)
+
+    def _bulk(self):
+        """Returns the connection to the controller's bulk channel, where
+        uploads queue behind each other instead of delaying other commands."""
+        if self.bulk_stack is None:
+            self.bulk_stack = iostack.IOStack(**self.bulk_args)
+        return self.bulk_stack
 
     def _LED_BUILTIN(self, value):
         """Configure flasher controller LED_BUILTIN.
@@ -178,8 +262,299 @@ class FlasherCtl(iostack.IOStack):
 
         self._raise_error(response)
 
+    def _PULSE_TRAIN(self, count, period_ns, width_ns):
+        """Start a hardware-timed train of pulses on the test pulse line.
+
+        The controller's timer generates the pulses; the request returns
+        immediately. Poll _PULSE_TRAIN_STATUS for completion.
+
+        Parameters
+        ----------
+        count : int
+            Number of pulses (1 to 65535), or 0 to stop a running train.
+        period_ns : int
+            Time from one rising edge to the next in ns.
+        width_ns : int
+            Pulse width in ns; high and low times must be at least 500 ns,
+            also once rounded to the timer clock.
+
+        Returns
+        -------
+        PulseTrain
+            The count and the period and width actually used, rounded to
+            the timer clock.
+        """
+
+        payload = pulse_train.pack(count, period_ns, width_ns)
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_PULSE_TRAIN, payload)
+
+        if response.response_code == FlasherCommand.CMD_PULSE_TRAIN:
+            return PulseTrain(*pulse_train.unpack(response.payload))
+
+        self._raise_error(response)
+
+    def _PULSE_TRAIN_STATUS(self):
+        """Read the progress of the last pulse train.
+
+        Parameters
+        ----------
+        None.
+
+        Returns
+        -------
+        PulseTrainStatus
+            running is 0 once the last pulse has ended; emitted is the
+            number of pulses started, equal to count unless the train was
+            stopped early.
+        """
+
+        payload = b''
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_PULSE_TRAIN_STATUS, payload)
+
+        if response.response_code == FlasherCommand.CMD_PULSE_TRAIN_STATUS:
+            return PulseTrainStatus(*pulse_train_status.unpack(response.payload))
+
+        self._raise_error(response)
+
+    def _SEQUENCE_LOAD(self, steps):
+        """Upload a calibration sequence, replacing the previous one.
+
+        Parameters
+        ----------
+        steps : list of SequenceStep
+            At most 256 steps. Each applies current and width, produces
+            pulses pulses period_ns apart on the test pulse line, then waits
+            dwell_ms before the next step.
+        """
+
+        per_request = (self.max_packet_size - 5 - 2) // sequence_step.size
+        for offset in range(0, max(len(steps), 1), per_request):
+            payload = struct.pack("<H", offset) + b''.join(
+                sequence_step.pack(*step) for step in steps[offset:offset + per_request])
+            response = self._bulk().request(SYS_FLASHER, FlasherCommand.CMD_SEQUENCE_LOAD,
+                                            payload)
+
+            if response.response_code != FlasherCommand.CMD_SEQUENCE_LOAD:
+                self._raise_error(response)
+
+    def _SEQUENCE_START(self, push=False):
+        """Start the uploaded calibration sequence.
+
+        Parameters
+        ----------
+        push : bool, optional
+            If true, the controller sends the status whenever a step starts
+            and when the sequence ends; see _SEQUENCE_PROGRESS.
+        """
+
+        payload = struct.pack("<B", sequence_push_progress if push else 0)
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_SEQUENCE_START, payload)
+
+        if response.response_code == FlasherCommand.CMD_SEQUENCE_START:
+            return
+
+        self._raise_error(response)
+
+    def _SEQUENCE_ABORT(self):
+        """Stop a running calibration sequence.
+
+        Parameters
+        ----------
+        None.
+        """
+
+        payload = b''
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_SEQUENCE_ABORT, payload)
+
+        if response.response_code == FlasherCommand.CMD_SEQUENCE_ABORT:
+            return
+
+        self._raise_error(response)
+
+    def _SEQUENCE_STATUS(self):
+        """Read the progress of the calibration sequence.
+
+        Parameters
+        ----------
+        None.
+
+        Returns
+        -------
+        SequenceStatus
+            state (see SequenceState), the step being executed (nsteps once
+            done), the number of steps and the pulses started in the step.
+        """
+
+        payload = b''
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_SEQUENCE_STATUS, payload)
+
+        if response.response_code == FlasherCommand.CMD_SEQUENCE_STATUS:
+            return SequenceStatus(*sequence_status.unpack(response.payload))
+
+        self._raise_error(response)
+
+    def _FIRE_AT(self, time_us):
+        """Schedule one test pulse at an absolute time.
+
+        The controller must have been synchronised first (see
+        flasherctl_timesync.py); its timer produces the pulse.
+
+        Parameters
+        ----------
+        time_us : int
+            Time of the rising edge in the time base the controller was
+            synchronised to (us), or 0 to cancel a scheduled pulse.
+        """
+
+        payload = struct.pack("<Q", time_us)
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_FIRE_AT, payload)
+
+        if response.response_code == FlasherCommand.CMD_FIRE_AT:
+            return
+
+        self._raise_error(response)
+
+    def _FIRE_STATUS(self):
+        """Read the state of the pulse scheduled with _FIRE_AT.
+
+        Parameters
+        ----------
+        None.
+
+        Returns
+        -------
+        FireStatus
+            state (see FireState), the requested time and the time of the
+            rising edge, timestamped by the timer interrupt and read on the
+            controller's synchronised clock (0 until the pulse has fired).
+        """
+
+        payload = b''
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_FIRE_STATUS, payload)
+
+        if response.response_code == FlasherCommand.CMD_FIRE_STATUS:
+            return FireStatus(*fire_status.unpack(response.payload))
+
+        self._raise_error(response)
+
+    def _SEQUENCE_PROGRESS(self):
+        """Wait for the next status pushed after _SEQUENCE_START(push=True).
+
+        Returns
+        -------
+        SequenceStatus
+            As for _SEQUENCE_STATUS.
+
+        Raises
+        ------
+        iostack.TimeoutError
+            Nothing was pushed within the connection timeout.
+        """
+
+        while True:
+            try:
+                reply = self.cs.recv(self.max_packet_size)
+            except socket.timeout:
+                raise iostack.TimeoutError()
+
+            if len(reply) != 5 + sequence_status.size:
+                continue
+
+            request_id, subsystem_id, response_code = struct.unpack("<HBH", reply[:5])
+            if (request_id == 0 and subsystem_id == SYS_FLASHER and
+                    response_code == FlasherCommand.CMD_SEQUENCE_STATUS):
+                return SequenceStatus(*sequence_status.unpack(reply[5:]))
+
+    def _STAGE_SETTINGS(self, current, width):
+        """Preload the LED current and pulse width without applying them.
+
+        The outputs keep their present values until _COMMIT_SETTINGS.
+
+        Parameters
+        ----------
+        current : byte
+            LED current (0 to 15), as for _SET_LED_CURRENT.
+        width : byte
+            DS1023 delay (pulse width), as for _SET_PULSE_WIDTH.
+        """
+
+        payload = struct.pack("<BB", current, width)
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_STAGE_SETTINGS, payload)
+
+        if response.response_code == FlasherCommand.CMD_STAGE_SETTINGS:
+            return
+
+        self._raise_error(response)
+
+    def _COMMIT_SETTINGS(self):
+        """Apply the settings preloaded by _STAGE_SETTINGS.
+
+        Parameters
+        ----------
+        None.
+        """
+
+        payload = b''
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_COMMIT_SETTINGS, payload)
+
+        if response.response_code == FlasherCommand.CMD_COMMIT_SETTINGS:
+            return
+
+        self._raise_error(response)
+
+    def _READ_TEMPERATURE_HISTORY(self):
+        """Read the samples kept by the background temperature sampler.
+
+        Parameters
+        ----------
+        None.
+
+        Returns
+        -------
+        TemperatureHistory
+            millis and period_ms are the controller's millis() and sampling
+            period; min, max and mean summarise the samples (nan if there are
+            none); samples is a list of (millis, temperature) tuples, oldest
+            first.
+        """
+
+        payload = b''
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_READ_TEMPERATURE_HISTORY, payload)
+
+        if response.response_code == FlasherCommand.CMD_READ_TEMPERATURE_HISTORY:
+            millis, period_ms, count, t_min, t_max, t_mean = \
+                temperature_summary.unpack_from(response.payload)
+            samples = []
+            for i in range(count):
+                t, value = temperature_sample.unpack_from(
+                    response.payload,
+                    temperature_summary.size + i * temperature_sample.size)
+                samples.append((t, value / temperature_lsb_per_c))
+            return TemperatureHistory(millis, period_ms, t_min, t_max, t_mean,
+                                      samples)
+
+        self._raise_error(response)
+
+    def _SET_TEMPERATURE_PERIOD(self, period_ms):
+        """Set the time between background temperature conversions.
+
+        Parameters
+        ----------
+        period_ms : int
+            Milliseconds from the start of one conversion to the next; at
+            least 240 (the conversion time), or 0 to stop sampling.
+        """
+
+        payload = struct.pack("<H", period_ms)
+        response = self.request(SYS_FLASHER, FlasherCommand.CMD_SET_TEMPERATURE_PERIOD, payload)
+
+        if response.response_code == FlasherCommand.CMD_SET_TEMPERATURE_PERIOD:
+            return
+
+        self._raise_error(response)
+
     def _READ_SERIAL_NO(self):
-        """Read DS28CM00 serial number.
+        """Read DS28CM00 serial number, as read and CRC-checked at boot.
 
         Parameters
         ----------
@@ -201,20 +576,366 @@ class FlasherCtl(iostack.IOStack):
 
     def _raise_error(self, response):
         """Raises an appropriate exception."""
-        if response.response_code != FlasherCommand.CMD_REPORT_ERR:
-            raise iostack.ResponseError("unknown response code %i"
-                                        % response.response_code)
+        raise response_error(response)
 
-        if len(response.payload) != 2:
-            raise iostack.ResponseError("invalid error size %i"
-                                        % len(response.payload))
 
-        error_code, = struct.unpack("<H", response.payload)
-        if error_code not in FlasherError.lookup:
-            raise iostack.ResponseError("unknown error code %i"
-                                        % error_code)
+def response_error(response):
+    """Returns the exception for a response other than the expected one."""
+    if response.response_code != FlasherCommand.CMD_REPORT_ERR:
+        return iostack.ResponseError("unknown response code %i"
+                                     % response.response_code)
 
-        raise iostack.RequestError(FlasherError.lookup[error_code])
+    if len(response.payload) != 2:
+        return iostack.ResponseError("invalid error size %i"
+                                     % len(response.payload))
+
+    error_code, = struct.unpack("<H", response.payload)
+    if error_code not in FlasherError.lookup:
+        return iostack.ResponseError("unknown error code %i"
+                                     % error_code)
+
+    return iostack.RequestError(FlasherError.lookup[error_code])
+
+
+class ArrayError(iostack.Error):
+    """Some devices of a FlasherArray failed a request.
+
+    Attributes
+    ----------
+    results : dict
+        Result of each device that succeeded, by IP address.
+    errors : dict
+        Exception of each device that failed, by IP address.
+    """
+    def __init__(self, results, errors):
+        iostack.Error.__init__(self, "%i of %i devices failed" %
+                               (len(errors), len(errors) + len(results)))
+        self.results = results
+        self.errors = errors
+
+
+class FlasherArray(object):
+    def __init__(self, ips, port=iostack.default_port,
+                 timeout=iostack.default_timeout,
+                 max_retries=iostack.default_retries,
+                 max_in_flight=64, device_window=1,
+                 verbosity=iostack.default_verbosity,
+                 max_packet_size=iostack.default_max_packet_size,
+                 interface_ip=""):
+        """Drives many flasher controllers from one non-blocking socket.
+
+        Requests to different devices overlap, so a command sent to all
+        devices takes about one round trip plus the time to send the
+        requests, instead of one round trip per device.
+
+        Parameters
+        ----------
+        ips : list of string
+            Device addresses.
+        port : int, optional
+            Destination port (default: 512).
+        timeout : float, optional
+            Response timeout in seconds (default: 200 ms).
+        max_retries : int, optional
+            Maximum number of retries after a timeout (default: 3).
+        max_in_flight : int, optional
+            Maximum number of requests awaiting replies, over all devices
+            (default: 64).
+        device_window : int, optional
+            Maximum number of requests awaiting replies from one device
+            (default: 1). With 1, each device executes its requests in the
+            order given even if some are repeated.
+        verbosity : int, optional
+            Verbosity level (default: 0, silent)
+        max_packet_size : int, optional
+            Expected maximum size of replies (default: 256 Bytes).
+        interface_ip : str, optional
+            IP address of local interface (default: any).
+        """
+        self.ips = list(ips)
+        self.port = port
+        self.timeout = timeout
+        self.max_retries = max_retries
+        self.max_in_flight = max_in_flight
+        self.device_window = device_window
+        self.verbosity = verbosity
+        self.request_id = random.randint(1, 65535)
+        self.buffer = bytearray(max_packet_size)
+
+        self.cs = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.cs.bind((interface_ip, 0))
+        self.cs.setblocking(0)
+
+    def close(self):
+        self.cs.close()
+
+    def execute(self, requests):
+        """Sends requests to any of the devices and collects the replies.
+
+        Parameters
+        ----------
+        requests : list of (str, int, int, bytearray or str)
+            (ip, subsystem_id, request_code, payload) of each request.
+
+        Returns
+        -------
+        list of iostack.Response or iostack.Error
+            The response to each request, in order; requests that timed out
+            or were answered with an I/O stack error have the exception in
+            their place.
+        """
+        results = [None] * len(requests)
+        queued = collections.OrderedDict()  # ip: deque of indices
+        for i, (ip, subsystem_id, request_code, payload) in enumerate(requests):
+            queued.setdefault(ip, collections.deque()).append(i)
+
+        in_flight = {}  # (ip, request_id): [index, request, deadline, retries left]
+        device_in_flight = collections.Counter()
+        unsent = collections.deque()  # Requests the socket could not take yet
+
+        while queued or in_flight:
+            # Start requests on every device with room in its window
+            for ip in list(queued):
+                if len(in_flight) >= self.max_in_flight:
+                    break
+                if device_in_flight[ip] >= self.device_window:
+                    continue
+
+                i = queued[ip].popleft()
+                if not queued[ip]:
+                    del queued[ip]
+
+                # Pushes use ID 0
+                self.request_id = self.request_id % 65535 + 1
+                ip, subsystem_id, request_code, payload = requests[i]
+                request = bytearray(iostack.header.size + len(payload))
+                iostack.header.pack_into(request, 0, self.request_id,
+                                         subsystem_id, request_code)
+                request[iostack.header.size:] = payload
+
+                key = (ip, self.request_id)
+                in_flight[key] = [i, request, time.time() + self.timeout,
+                                  self.max_retries]
+                device_in_flight[ip] += 1
+                unsent.append(key)
+
+            unsent = self._send(unsent, in_flight)
+
+            if not in_flight:
+                continue
+
+            wait = min(slot[2] for slot in in_flight.values()) - time.time()
+            readable, writable, _ = select.select([self.cs],
+                                                  [self.cs] if unsent else [],
+                                                  [], max(wait, 0.0))
+
+            if readable:
+                self._receive(requests, results, in_flight, device_in_flight)
+
+            # Repeat or give up on the requests past their deadline
+            now = time.time()
+            for key, slot in list(in_flight.items()):
+                if slot[2] > now:
+                    continue
+                if slot[3] > 0:
+                    slot[3] -= 1
+                    slot[2] = now + self.timeout
+                    unsent.append(key)
+                else:
+                    results[slot[0]] = iostack.TimeoutError()
+                    del in_flight[key]
+                    device_in_flight[key[0]] -= 1
+
+        return results
+
+    def _send(self, unsent, in_flight):
+        # Returns the requests still to send once the socket buffer is full
+        while unsent:
+            key = unsent[0]
+            slot = in_flight.get(key)
+            if slot is not None:
+                try:
+                    self.cs.sendto(slot[1], (key[0], self.port))
+                except socket.error as e:
+                    if e.errno in (errno.EAGAIN, errno.EWOULDBLOCK, errno.ENOBUFS):
+                        break
+                    raise
+            unsent.popleft()
+
+        return unsent
+
+    def _receive(self, requests, results, in_flight, device_in_flight):
+        # Drains the socket
+        while True:
+            try:
+                size, (ip, port) = self.cs.recvfrom_into(self.buffer)
+            except socket.error as e:
+                if e.errno in (errno.EAGAIN, errno.EWOULDBLOCK):
+                    return
+                raise
+
+            if size < iostack.header.size:
+                continue
+
+            response = iostack.Response(*iostack.header.unpack_from(self.buffer),
+                                        payload=bytes(self.buffer[iostack.header.size:size]))
+            slot = in_flight.pop((ip, response.id), None)
+            if slot is None:
+                if self.verbosity:
+                    print("%s: skipping packet %s" % (ip, str(response)))
+                continue
+
+            device_in_flight[ip] -= 1
+            try:
+                iostack.check_response(response, requests[slot[0]][1])
+                results[slot[0]] = response
+            except iostack.Error as e:
+                results[slot[0]] = e
+
+    def group_request(self, group, requests, reply=iostack.GroupReply.ERRORS,
+                      broadcast_ip="255.255.255.255", wait=None):
+        """Broadcasts requests that every member of a group executes.
+
+        One datagram reaches all members, which execute the requests in
+        order as in a batch. It is sent once: a member that missed it cannot
+        be told from one that had nothing to report, so use reply=ALL and
+        compare with the expected members where that matters.
+
+        Parameters
+        ----------
+        group : int
+            Group ID (1 to 254), or iostack.GROUP_ALL.
+        requests : list of (int, int, bytearray or str)
+            (subsystem_id, request_code, payload) of each request.
+        reply : int, optional
+            Members that reply, see iostack.GroupReply (default: only those
+            where a request failed).
+        broadcast_ip : str, optional
+            Broadcast address of the devices' subnet (default: limited
+            broadcast).
+        wait : float, optional
+            Seconds to collect replies (default: the timeout).
+
+        Returns
+        -------
+        dict
+            The list of iostack.BatchResponse records of each member that
+            replied, or the iostack.Error it replied with, by IP address.
+        """
+        self.request_id = self.request_id % 65535 + 1
+        request = iostack.header.pack(self.request_id, iostack.SYS_IOSTACK,
+                                      iostack.Command.CMD_GROUP) + \
+            iostack.group_request_header.pack(group, reply) + iostack.pack_batch(requests)
+
+        self.cs.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+        self.cs.sendto(request, (broadcast_ip, self.port))
+
+        replies = {}
+        deadline = time.time() + (self.timeout if wait is None else wait)
+        while True:
+            wait = deadline - time.time()
+            if wait <= 0 or not select.select([self.cs], [], [], wait)[0]:
+                return replies
+
+            try:
+                size, (ip, port) = self.cs.recvfrom_into(self.buffer)
+            except socket.error as e:
+                if e.errno in (errno.EAGAIN, errno.EWOULDBLOCK):
+                    continue
+                raise
+
+            if size < iostack.header.size:
+                continue
+            response = iostack.Response(*iostack.header.unpack_from(self.buffer),
+                                        payload=bytes(self.buffer[iostack.header.size:size]))
+            if response.id != self.request_id:
+                continue
+
+            try:
+                iostack.check_response(response, iostack.SYS_IOSTACK)
+                replies[ip] = iostack.unpack_batch(response.payload)
+            except iostack.Error as e:
+                replies[ip] = e
+
+    def _map(self, request_code, payload, decode=None):
+        """Sends a flasher command to every device.
+
+        payload is sent to all devices, or is a dict of payloads by IP
+        address for the devices to address. Returns the results of decode
+        (applied to each response's payload) by IP address and raises
+        ArrayError if any device failed.
+        """
+        if isinstance(payload, dict):
+            ips = list(payload)
+            requests = [(ip, SYS_FLASHER, request_code, payload[ip]) for ip in ips]
+        else:
+            ips = self.ips
+            requests = [(ip, SYS_FLASHER, request_code, payload) for ip in ips]
+
+        results = {}
+        errors = {}
+        for ip, response in zip(ips, self.execute(requests)):
+            if isinstance(response, iostack.Error):
+                errors[ip] = response
+            elif response.response_code != request_code:
+                errors[ip] = response_error(response)
+            else:
+                try:
+                    results[ip] = decode(response.payload) if decode else None
+                except struct.error:
+                    errors[ip] = iostack.ResponseError("invalid size %i" %
+                                                       len(response.payload))
+
+        if errors:
+            raise ArrayError(results, errors)
+
+        return results
+
+    def _pack_each(self, fmt, value):
+        # A value for all devices, or a dict of values by IP address
+        if isinstance(value, dict):
+            return {ip: struct.pack(fmt, v) for ip, v in value.items()}
+        return struct.pack(fmt, value)
+
+    def _LED_BUILTIN(self, value):
+        """Set LED_BUILTIN of every controller to value (or {ip: value})."""
+        self._map(FlasherCommand.CMD_LED_BUILTIN, self._pack_each("<B", value))
+
+    def _SET_LED_CURRENT(self, current):
+        """Set the LED current of every flasher (current or {ip: current}),
+        see FlasherCtl._SET_LED_CURRENT."""
+        self._map(FlasherCommand.CMD_SET_LED_CURRENT, self._pack_each("<B", current))
+
+    def _SET_PULSE_WIDTH(self, width):
+        """Set the pulse width of every flasher (width or {ip: width})."""
+        self._map(FlasherCommand.CMD_SET_PULSE_WIDTH, self._pack_each("<B", width))
+
+    def _TEST_PULSE(self, on_off):
+        """Set the test pulse line of every controller high or low."""
+        self._map(FlasherCommand.CMD_TEST_PULSE, self._pack_each("<B", on_off))
+
+    def _STAGE_SETTINGS(self, current, width):
+        """Preload the same LED current and pulse width in every flasher."""
+        self._map(FlasherCommand.CMD_STAGE_SETTINGS, struct.pack("<BB", current, width))
+
+    def _COMMIT_SETTINGS(self):
+        """Apply the staged settings of every flasher.
+
+        The commits go out within the time to send one datagram per device,
+        so all flashers change within that spread rather than within one
+        round trip per device.
+        """
+        self._map(FlasherCommand.CMD_COMMIT_SETTINGS, b'')
+
+    def _READ_TEMPERATURE(self):
+        """Returns the temperature of every flasher by IP address."""
+        return self._map(FlasherCommand.CMD_READ_TEMPERATURE, b'',
+                         lambda payload: struct.unpack("<f", payload)[0])
+
+    def _READ_SERIAL_NO(self):
+        """Returns the serial number of every flasher by IP address."""
+        return self._map(FlasherCommand.CMD_READ_SERIAL_NO, b'',
+                         lambda payload: struct.unpack("6B", payload))
 
 
 # Generate lookup maps
@@ -0,0 +1,69 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+import argparse
+
+import iostack
+import flasherctl
+
+
+def parse_range(text):
+    """Parses '0-15' or '1,4,8' into a list of integers."""
+    values = []
+    for part in text.split(','):
+        if '-' in part:
+            first, last = part.split('-')
+            values.extend(range(int(first, 0), int(last, 0) + 1))
+        else:
+            values.append(int(part, 0))
+    return values
+
+
+if __name__ == '__main__':
+    # Parse command-line arguments
+    parser = argparse.ArgumentParser(
+        description='LED current x pulse width sweep executed by the flasher controller')
+    parser.add_argument('ip', type=str, help="IP address")
+    parser.add_argument('-c', metavar='currents', type=str, default='0-15',
+                        help='LED currents, e.g. 0-15 or 1,4,8 (default: 0-15)')
+    parser.add_argument('-w', metavar='widths', type=str, default='0-255',
+                        help='pulse widths (default: 0-255)')
+    parser.add_argument('-n', metavar='pulses', type=int, default=100,
+                        help='pulses per step (default: 100)')
+    parser.add_argument('-f', metavar='frequency', type=float, default=1000.0,
+                        help='pulse rate in Hz (default: 1000)')
+    parser.add_argument('-d', metavar='dwell', type=int, default=0,
+                        help='wait after each step in ms (default: 0)')
+    parser.add_argument('-p', metavar='port', type=int,
+                        default=iostack.default_port,
+                        help='port (default: %i)' % iostack.default_port)
+
+    args = parser.parse_args()
+
+    steps = [flasherctl.SequenceStep(current, width, args.n,
+                                     int(round(1e9 / args.f)), args.d)
+             for current in parse_range(args.c) for width in parse_range(args.w)]
+
+    # Time out only if a step takes much longer than planned
+    step_time = args.n / args.f + args.d / 1000.0
+    flasher = flasherctl.FlasherCtl(args.ip, args.p, timeout=2 * step_time + 1.0,
+                                    verbosity=0)
+
+    # The controller holds a limited table; longer sweeps run in parts
+    done = 0
+    for first in range(0, len(steps), flasherctl.sequence_max_steps):
+        part = steps[first:first + flasherctl.sequence_max_steps]
+        flasher._SEQUENCE_LOAD(part)
+        flasher._SEQUENCE_START(push=True)
+
+        status = flasher._SEQUENCE_PROGRESS()
+        while status.state == flasherctl.SequenceState.RUNNING:
+            step = part[status.step]
+            print("step %i of %i: current %i, width %i" %
+                  (done + status.step + 1, len(steps), step.current, step.width))
+            status = flasher._SEQUENCE_PROGRESS()
+
+        if status.state != flasherctl.SequenceState.DONE:
+            print("sequence stopped in step %i" % (done + status.step + 1))
+            break
+        done += len(part)
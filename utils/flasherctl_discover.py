@@ -25,8 +25,10 @@ def unpack_ethernet_configuration(reply):
     subnet = list(reply[4:8])
     mac = list(reply[8:14])
     ip = list(reply[14:18])
+    # Devices that read their serial number at boot append it, LSB first
+    serial_no = list(reply[18:24]) if len(reply) >= 24 else None
 
-    return gateway, subnet, mac, ip
+    return gateway, subnet, mac, ip, serial_no
 
 
 def pack_ethernet_configuration(gateway, subnet, mac, ip):
@@ -66,15 +68,17 @@ def query_interface(interface, interface_ip, port):
     devices = []
     while True:
         try:
-            gateway, subnet, mac, ip = unpack_ethernet_configuration(cs.recv(1024))
+            gateway, subnet, mac, ip, serial_no = unpack_ethernet_configuration(cs.recv(1024))
         except:
             break
 
         devices.append((gateway, subnet, mac, ip))
-        print("  mac %s, ip %s, subnet %s, gateway %s" % (":".join("%02x" % m for m in mac),
-                                                          ".".join(map(str, ip)),
-                                                          ".".join(map(str, subnet)),
-                                                          ".".join(map(str, gateway))))
+        print("  mac %s, ip %s, subnet %s, gateway %s, serial %s" % (
+            ":".join("%02x" % m for m in mac),
+            ".".join(map(str, ip)),
+            ".".join(map(str, subnet)),
+            ".".join(map(str, gateway)),
+            "".join("%02x" % b for b in reversed(serial_no)) if serial_no else "-"))
 
     return devices
 
@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+Assigns flasher controllers to groups and configures a whole group with one
+broadcast datagram.
+"""
+
+import argparse
+import struct
+
+import iostack
+import flasherctl
+
+
+def assign(args):
+    for ip in args.ip:
+        stack = iostack.IOStack(ip, args.p)
+        groups = [group for group in stack.groups() if group != args.group]
+        if not args.remove:
+            groups.append(args.group)
+        if len(groups) > iostack.max_groups:
+            print("%s: already in %i groups" % (ip, iostack.max_groups))
+            continue
+        stack.set_groups(groups)
+        print("%s: groups %s" % (ip, " ".join(str(group) for group in groups) or "-"))
+
+
+def configure(args):
+    requests = []
+    if args.c is not None:
+        requests.append((flasherctl.SYS_FLASHER, flasherctl.FlasherCommand.CMD_SET_LED_CURRENT,
+                         struct.pack("<B", args.c)))
+    if args.w is not None:
+        requests.append((flasherctl.SYS_FLASHER, flasherctl.FlasherCommand.CMD_SET_PULSE_WIDTH,
+                         struct.pack("<B", args.w)))
+    if not requests:
+        return
+
+    reply = iostack.GroupReply.ALL if args.all else iostack.GroupReply.ERRORS
+    array = flasherctl.FlasherArray([], args.p)
+    replies = array.group_request(args.group, requests, reply, args.b)
+
+    for ip, records in sorted(replies.items()):
+        if isinstance(records, iostack.Error):
+            print("%s: %s" % (ip, records.__class__.__name__))
+            continue
+
+        failed = [r for r in records if r.status != iostack.Status.ERR_OKAY or
+                  r.response_code == flasherctl.FlasherCommand.CMD_REPORT_ERR]
+        print("%s: %s" % (ip, "%i of %i requests failed" % (len(failed), len(requests))
+                          if failed else "ok"))
+
+    if args.all:
+        print("%i devices replied" % len(replies))
+
+
+if __name__ == '__main__':
+    # Parse command-line arguments
+    parser = argparse.ArgumentParser(
+        description='group addressing of flasher controllers')
+    parser.add_argument('-p', metavar='port', type=int,
+                        default=iostack.default_port,
+                        help='port (default: %i)' % iostack.default_port)
+    commands = parser.add_subparsers()
+
+    p = commands.add_parser('assign', help='add devices to a group')
+    p.add_argument('group', type=int, help='group ID (1-254)')
+    p.add_argument('ip', type=str, nargs='+', help='IP addresses')
+    p.add_argument('-r', dest='remove', action='store_true',
+                   help='remove the devices from the group instead')
+    p.set_defaults(run=assign)
+
+    p = commands.add_parser('set', help='configure every member of a group')
+    p.add_argument('group', type=int,
+                   help='group ID (1-254, %i: all devices)' % iostack.GROUP_ALL)
+    p.add_argument('-c', metavar='current', type=int, help='LED current (0:15)')
+    p.add_argument('-w', metavar='width', type=int,
+                   help='pulse width in 0.25nsec increments (0:255)')
+    p.add_argument('-b', metavar='broadcast', type=str, default='255.255.255.255',
+                   help='broadcast address (default: 255.255.255.255)')
+    p.add_argument('-a', dest='all', action='store_true',
+                   help='have every member reply, not only those that failed')
+    p.set_defaults(run=configure)
+
+    args = parser.parse_args()
+    args.run(args)
@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+Measures requests per second of stop-and-wait and pipelined IOStack requests
+against a local device simulator, or against a real device if an IP address
+is given.
+
+The simulator answers PING like a controller: one request at a time, each
+taking the service time, with the replies delayed by the one-way latency of
+the network in between.
+"""
+
+import argparse
+import heapq
+import multiprocessing
+import random
+import select
+import socket
+import time
+
+import iostack
+
+
+def serve(port, service_us, latency_us, loss, ready):
+    """Runs the simulated device until killed."""
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.bind(("127.0.0.1", port))
+    ready.set()
+
+    buffer = bytearray(iostack.default_max_packet_size)
+    pending = []  # (time to send, sequence, reply, address)
+    busy_until = 0.0
+    sequence = 0
+
+    while True:
+        wait = pending[0][0] - time.time() if pending else None
+        if wait is None or wait > 0:
+            readable, _, _ = select.select([s], [], [], wait)
+        else:
+            readable = []
+
+        if readable:
+            size, address = s.recvfrom_into(buffer)
+            now = time.time()
+            if size < iostack.header.size or random.random() < loss:
+                continue
+
+            request_id, subsystem_id, request_code = iostack.header.unpack_from(buffer)
+            if subsystem_id == iostack.SYS_IOSTACK and request_code == iostack.Command.CMD_PING:
+                reply = bytes(buffer[:size])
+            else:
+                reply = iostack.header.pack(request_id, iostack.SYS_IOSTACK,
+                                            iostack.Command.CMD_REPORT_ERR) + \
+                    iostack.error_code.pack(iostack.Status.ERR_UNKNOWN_COMMAND)
+
+            # Requests are served one after the other
+            busy_until = max(now + latency_us * 1e-6, busy_until) + service_us * 1e-6
+            sequence += 1
+            heapq.heappush(pending, (busy_until + latency_us * 1e-6, sequence,
+                                     reply, address))
+
+        now = time.time()
+        while pending and pending[0][0] <= now:
+            _, _, reply, address = heapq.heappop(pending)
+            s.sendto(reply, address)
+
+
+def run(stack, count, size, window):
+    """Returns requests per second; window 0 is stop-and-wait."""
+    payload = bytearray(random.randint(0, 255) for i in range(size))
+    t0 = time.time()
+
+    if window == 0:
+        for i in range(count):
+            stack.request(iostack.SYS_IOSTACK, iostack.Command.CMD_PING, payload)
+    else:
+        requests = [(iostack.SYS_IOSTACK, iostack.Command.CMD_PING, payload)] * count
+        for response in stack.pipeline(requests, window):
+            if isinstance(response, iostack.Error):
+                raise response
+            if response.payload != payload:
+                raise iostack.ResponseError("payload mismatch")
+
+    return count / (time.time() - t0)
+
+
+if __name__ == '__main__':
+    # Parse command-line arguments
+    parser = argparse.ArgumentParser(
+        description='compare stop-and-wait and pipelined request rates')
+    parser.add_argument('ip', type=str, nargs='?',
+                        help="IP address (default: run a local simulator)")
+    parser.add_argument('-p', metavar='port', type=int, default=None,
+                        help='port (default: %i, 5120 for the simulator)' %
+                        iostack.default_port)
+    parser.add_argument('-n', metavar='count', type=int, default=2000,
+                        help='requests per measurement (default: 2000)')
+    parser.add_argument('-s', metavar='size', type=int, default=16,
+                        help='PING payload size (default: 16)')
+    parser.add_argument('-w', metavar='windows', type=str, default='1,2,4,8',
+                        help='windows to measure (default: 1,2,4,8)')
+    parser.add_argument('--service', metavar='us', type=float, default=100.0,
+                        help='simulated time to serve a request (default: 100)')
+    parser.add_argument('--latency', metavar='us', type=float, default=250.0,
+                        help='simulated one-way latency (default: 250)')
+    parser.add_argument('--loss', metavar='fraction', type=float, default=0.0,
+                        help='simulated request loss (default: 0)')
+
+    args = parser.parse_args()
+
+    server = None
+    ip, port = args.ip, args.p
+    if ip is None:
+        ip, port = "127.0.0.1", port or 5120
+        ready = multiprocessing.Event()
+        server = multiprocessing.Process(target=serve, args=(port, args.service,
+                                                             args.latency, args.loss,
+                                                             ready))
+        server.daemon = True
+        server.start()
+        ready.wait()
+        print("simulator: %.0f us service, %.0f us latency, %.1f%% loss" %
+              (args.service, args.latency, 100 * args.loss))
+
+    stack = iostack.IOStack(ip, port or iostack.default_port, timeout=0.05)
+
+    try:
+        baseline = run(stack, args.n, args.s, 0)
+        print("%-16s %10.0f requests/s" % ("stop-and-wait", baseline))
+        for window in [int(w) for w in args.w.split(',')]:
+            rate = run(stack, args.n, args.s, window)
+            print("%-16s %10.0f requests/s  x%.2f" %
+                  ("window %i" % window, rate, rate / baseline))
+    finally:
+        if server is not None:
+            server.terminate()
@@ -0,0 +1,39 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+import argparse
+
+import iostack
+import flasherctl
+
+import time
+
+if __name__ == '__main__':
+    # Parse command-line arguments
+    parser = argparse.ArgumentParser(
+        description='hardware-timed pulse train on flasher TEST_PULSE')
+    parser.add_argument('ip', type=str, help="IP address")
+    parser.add_argument('count', type=int, help='number of pulses (0 stops a running train)')
+    parser.add_argument('-f', metavar='frequency', type=float, default=1000.0,
+                        help='pulse rate in Hz (default: 1000)')
+    parser.add_argument('-w', metavar='width', type=int, default=1000,
+                        help='pulse width in ns (default: 1000)')
+    parser.add_argument('-p', metavar='port', type=int,
+                        default=iostack.default_port,
+                        help='port (default: %i)' % iostack.default_port)
+
+    args = parser.parse_args()
+
+    # Create connection
+    flasher = flasherctl.FlasherCtl(args.ip, args.p, verbosity=0)
+
+    train = flasher._PULSE_TRAIN(args.count, int(round(1e9 / args.f)), args.w)
+    if args.count:
+        print("period %i ns, width %i ns" % (train.period_ns, train.width_ns))
+        time.sleep(args.count / args.f)
+
+    status = flasher._PULSE_TRAIN_STATUS()
+    while status.running:
+        time.sleep(0.01)
+        status = flasher._PULSE_TRAIN_STATUS()
+    print("%i of %i pulses" % (status.emitted, status.count))
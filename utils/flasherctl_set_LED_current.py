@@ -12,7 +12,7 @@ if __name__ == '__main__':
     # Parse command-line arguments
     parser = argparse.ArgumentParser(
         description='Configure the LED current')
-    parser.add_argument('ip', type=str, help="IP address")
+    parser.add_argument('ip', type=str, nargs='+', help="IP addresses")
     parser.add_argument('current', metavar='current', type=int,
                         help='current (0:15)')
     parser.add_argument('-p', metavar='port', type=int,
@@ -21,8 +21,12 @@ if __name__ == '__main__':
 
     args = parser.parse_args()
 
-    # Create connection
-    flasher = flasherctl.FlasherCtl(args.ip, args.p, verbosity=0)
+    # All devices are configured concurrently
+    flashers = flasherctl.FlasherArray(args.ip, args.p, verbosity=0)
 
     print("configuring LED current")
-    flasher._SET_LED_CURRENT(args.current)
+    try:
+        flashers._SET_LED_CURRENT(args.current)
+    except flasherctl.ArrayError as e:
+        for ip, error in sorted(e.errors.items()):
+            print("%s: %s" % (ip, error.__class__.__name__))
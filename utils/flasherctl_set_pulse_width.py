@@ -12,7 +12,7 @@ if __name__ == '__main__':
     # Parse command-line arguments
     parser = argparse.ArgumentParser(
         description='Configure the pulse width on the selected flasher timing board')
-    parser.add_argument('ip', type=str, help="IP address")
+    parser.add_argument('ip', type=str, nargs='+', help="IP addresses")
     parser.add_argument('width', metavar='width', type=int,
                         help='pulse width in 0.25nsec increments (0:255)')
     parser.add_argument('-p', metavar='port', type=int,
@@ -21,8 +21,12 @@ if __name__ == '__main__':
 
     args = parser.parse_args()
 
-    # Create connection
-    flasher = flasherctl.FlasherCtl(args.ip, args.p, verbosity=0)
+    # All devices are configured concurrently
+    flashers = flasherctl.FlasherArray(args.ip, args.p, verbosity=0)
 
     print("configuring pulse width")
-    flasher._SET_PULSE_WIDTH(args.width)
+    try:
+        flashers._SET_PULSE_WIDTH(args.width)
+    except flasherctl.ArrayError as e:
+        for ip, error in sorted(e.errors.items()):
+            print("%s: %s" % (ip, error.__class__.__name__))
@@ -0,0 +1,125 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+Scrapes the per-command request statistics of flasher controllers and prints
+the latency percentiles of every command, per device and for the whole fleet.
+"""
+
+import argparse
+import sys
+
+import iostack
+
+
+subsystem_names = {iostack.SYS_IOSTACK: "iostack", 2: "flasher", 3: "telemetry"}
+
+
+def command_name(subsystem_id, request_code):
+    name = subsystem_names.get(subsystem_id, "sys%i" % subsystem_id)
+    if subsystem_id == iostack.SYS_IOSTACK and request_code in iostack.Command.lookup:
+        return "%s %s" % (name, iostack.Command.lookup[request_code])
+    return "%s 0x%02x" % (name, request_code)
+
+
+def percentile(latency, fraction):
+    """Returns the upper edge (us) of the bucket holding the given fraction of
+    the histogram, or None if it is empty; the last bucket has no upper edge
+    and reports its lower one."""
+    total = sum(latency)
+    if not total:
+        return None
+
+    count = 0
+    for k, n in enumerate(latency):
+        count += n
+        if count >= fraction * total:
+            break
+
+    return 2 ** k if k == len(latency) - 1 else 2 ** (k + 1)
+
+
+def format_us(us, last):
+    if us is None:
+        return "-"
+    return (">=%i" if last else "<%i") % us
+
+
+def print_row(label, count, errors, handler_us, latency):
+    p50, p99 = percentile(latency, 0.5), percentile(latency, 0.99)
+    last = 2 ** (len(latency) - 1)
+    mean = "%.1f" % (float(handler_us) / count) if count else "-"
+    print("  %-24s %9i %7i %10s %8s %8s" %
+          (label, count, errors, mean, format_us(p50, p50 == last),
+           format_us(p99, p99 == last)))
+
+
+if __name__ == '__main__':
+    # Parse command-line arguments
+    parser = argparse.ArgumentParser(
+        description='print per-command latency percentiles of flasher controllers')
+    parser.add_argument('ip', type=str, nargs='*', help="IP addresses")
+    parser.add_argument('-f', metavar='file', type=str,
+                        help='file with one IP address per line')
+    parser.add_argument('-p', metavar='port', type=int,
+                        default=iostack.default_port,
+                        help='port (default: %i)' % iostack.default_port)
+    parser.add_argument('--reset', action='store_true',
+                        help='clear the statistics after reading them')
+    parser.add_argument('--slow', metavar='factor', type=float, default=4.0,
+                        help='flag devices whose p99 exceeds the fleet p99 by '
+                        'this factor (default: 4)')
+
+    args = parser.parse_args()
+
+    ips = list(args.ip)
+    if args.f:
+        with open(args.f) as hosts:
+            ips += [line.split('#')[0].strip() for line in hosts]
+        ips = [ip for ip in ips if ip]
+
+    if not ips:
+        parser.error("no devices given")
+
+    # Scrape every device; histograms add up across the fleet
+    devices = []
+    fleet = {}
+    for ip in ips:
+        try:
+            stack = iostack.IOStack(ip, args.p)
+            seconds, entries = stack.command_stats()
+            if args.reset:
+                stack.reset_stats()
+        except iostack.Error as e:
+            sys.stderr.write("%s: %s\n" % (ip, e.__class__.__name__))
+            continue
+
+        devices.append((ip, seconds, entries))
+        for e in entries:
+            key = (e.subsystem_id, e.request_code)
+            total = fleet.setdefault(key, [0, 0, 0, [0] * iostack.stats_buckets])
+            total[0] += e.count
+            total[1] += e.errors
+            total[2] += e.handler_us
+            total[3] = [a + b for a, b in zip(total[3], e.latency)]
+
+    header = "  %-24s %9s %7s %10s %8s %8s" % ("command", "count", "errors",
+                                               "handler us", "p50 us", "p99 us")
+
+    for ip, seconds, entries in devices:
+        print("%s (%.0f s)" % (ip, seconds))
+        print(header)
+        for e in sorted(entries, key=lambda e: (e.subsystem_id, e.request_code)):
+            label = command_name(e.subsystem_id, e.request_code)
+            p99 = percentile(e.latency, 0.99)
+            fleet_p99 = percentile(fleet[(e.subsystem_id, e.request_code)][3], 0.99)
+            if p99 and fleet_p99 and p99 > args.slow * fleet_p99:
+                label += " SLOW"
+            print_row(label, e.count, e.errors, e.handler_us, e.latency)
+        print("")
+
+    print("fleet (%i of %i devices)" % (len(devices), len(ips)))
+    print(header)
+    for key in sorted(fleet):
+        count, errors, handler_us, latency = fleet[key]
+        print_row(command_name(*key), count, errors, handler_us, latency)
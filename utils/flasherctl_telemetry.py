@@ -0,0 +1,243 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+Receiver for the telemetry pushed by CTA Flasher controllers.
+Subscribes to any number of controllers and decodes their streams on one
+socket.
+"""
+
+import argparse
+import collections
+import random
+import socket
+import struct
+import sys
+import time
+
+import iostack
+
+
+# Subsystem ID for telemetry
+SYS_TELEMETRY = 3
+
+
+class TelemetryCommand:
+    """Command codes."""
+    CMD_SUBSCRIBE = 0
+    CMD_UNSUBSCRIBE = 1
+    CMD_READ_TELEMETRY = 2
+    CMD_REPORT_ERR = 65535
+
+
+class TelemetryError:
+    """Errors reported in reply to CMD_SUBSCRIBE."""
+    ERR_BVALUE = 1  # Period below the minimum (10 ms)
+    ERR_FULL = 2  # All subscriber slots are in use
+
+
+# Must match TELEMETRY_VERSION and struct telemetry_frame in telemetry.h
+telemetry_version = 1
+telemetry_frame = struct.Struct("<BIIhBBIII")
+telemetry_lease = 60.0  # Seconds a subscription lasts without renewal
+
+header = struct.Struct("<HBH")
+
+Telemetry = collections.namedtuple("Telemetry",
+                                   "ip sequence uptime_ms temperature "
+                                   "led_current pulse_width failed_sends "
+                                   "dropped_packets request_errors lost")
+
+
+class _Device(object):
+    def __init__(self):
+        self.sequence = None  # Last sequence number received
+        self.lost = 0  # Pushes missing from the stream
+        self.renewed = 0.0  # time.time() of the last CMD_SUBSCRIBE
+
+
+class TelemetryReceiver(object):
+    def __init__(self, period_ms=1000, port=0, interface_ip="",
+                 device_port=iostack.default_port + iostack.telemetry_port_offset,
+                 verbosity=iostack.default_verbosity):
+        """Opens the socket that all subscribed streams are sent to.
+
+        Parameters
+        ----------
+        period_ms : int, optional
+            Time between pushes requested from each device (default: 1 s).
+        port : int, optional
+            Local port (default: let OS choose).
+        interface_ip : str, optional
+            IP address of local interface (default: any).
+        device_port : int, optional
+            Port subscriptions are sent to (default: 513, the telemetry
+            channel).
+        verbosity : int, optional
+            Verbosity level (default: 0, silent)
+        """
+        self.period_ms = period_ms
+        self.device_port = device_port
+        self.verbosity = verbosity
+        self.request_id = random.randint(1, 65535)
+        self.devices = {}
+
+        self.cs = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.cs.bind((interface_ip, port))
+
+    def _send(self, ip, request_code, payload):
+        # Pushes have ID 0, so replies never use it
+        self.request_id = self.request_id % 65535 + 1
+        request = header.pack(self.request_id, SYS_TELEMETRY,
+                              request_code) + payload
+        self.cs.sendto(request, (ip, self.device_port))
+
+    def subscribe(self, ip):
+        """Subscribes to the telemetry of a device, or renews the subscription.
+
+        Parameters
+        ----------
+        ip : string
+            Device address.
+        """
+        device = self.devices.setdefault(ip, _Device())
+        device.renewed = time.time()
+        self._send(ip, TelemetryCommand.CMD_SUBSCRIBE,
+                   struct.pack("<H", self.period_ms))
+
+    def unsubscribe(self, ip):
+        """Ends the subscription to a device.
+
+        Parameters
+        ----------
+        ip : string
+            Device address.
+        """
+        self.devices.pop(ip, None)
+        self._send(ip, TelemetryCommand.CMD_UNSUBSCRIBE, b'')
+
+    def close(self):
+        """Unsubscribes from all devices and closes the socket."""
+        for ip in list(self.devices):
+            self.unsubscribe(ip)
+        self.cs.close()
+
+    def _renew(self):
+        # Renew at half the lease so a lost request has time to be repeated;
+        # this also resubscribes devices that rebooted, or that dropped us
+        # after pushes failed
+        now = time.time()
+        for ip, device in self.devices.items():
+            if now - device.renewed > telemetry_lease / 2:
+                self.subscribe(ip)
+
+    def _decode(self, datagram, ip):
+        if len(datagram) < header.size:
+            return None
+
+        request_id, subsystem_id, response_code = header.unpack_from(datagram)
+        payload = datagram[header.size:]
+        device = self.devices.get(ip)
+
+        if subsystem_id != SYS_TELEMETRY or device is None:
+            return None
+
+        if response_code == TelemetryCommand.CMD_REPORT_ERR and len(payload) == 2:
+            error, = struct.unpack("<H", payload)
+            sys.stderr.write("%s: subscription refused (error %i)\n" % (ip, error))
+            return None
+
+        if request_id != 0 or response_code != TelemetryCommand.CMD_READ_TELEMETRY:
+            if self.verbosity:
+                sys.stderr.write("%s: skipping reply %i\n" % (ip, response_code))
+            return None
+
+        if len(payload) < telemetry_frame.size:
+            return None
+
+        fields = telemetry_frame.unpack_from(payload)
+        if fields[0] != telemetry_version:
+            return None
+
+        sequence = fields[1]
+        if device.sequence is not None and sequence > device.sequence:
+            device.lost += sequence - device.sequence - 1
+        device.sequence = sequence
+
+        temperature = fields[3] / 128.0 if fields[3] != -32768 else None
+        return Telemetry(ip, sequence, fields[2], temperature, fields[4],
+                         fields[5], fields[6], fields[7], fields[8],
+                         device.lost)
+
+    def receive(self, timeout=None):
+        """Waits for the next telemetry datagram from any subscribed device.
+
+        Parameters
+        ----------
+        timeout : float, optional
+            Seconds to wait (default: forever).
+
+        Returns
+        -------
+        Telemetry or None
+            The decoded datagram; temperature is in C (None before the first
+            sample) and lost counts the pushes missing from this device's
+            stream so far. None if the timeout expired.
+        """
+        deadline = None if timeout is None else time.time() + timeout
+
+        while True:
+            self._renew()
+
+            wait = telemetry_lease / 4
+            if deadline is not None:
+                wait = min(wait, deadline - time.time())
+                if wait <= 0:
+                    return None
+
+            self.cs.settimeout(wait)
+            try:
+                datagram, (ip, port) = self.cs.recvfrom(512)
+            except socket.timeout:
+                continue
+
+            telemetry = self._decode(datagram, ip)
+            if telemetry is not None:
+                return telemetry
+
+
+if __name__ == '__main__':
+    # Parse command-line arguments
+    parser = argparse.ArgumentParser(
+        description='receive telemetry from one or more flasher controllers')
+    parser.add_argument('ip', type=str, nargs='+', help="IP addresses")
+    parser.add_argument('-p', metavar='port', type=int,
+                        default=iostack.default_port,
+                        help='device listen port (default: %i; the telemetry '
+                        'channel is the next one)' % iostack.default_port)
+    parser.add_argument('-r', metavar='period', type=int, default=1000,
+                        help='time between pushes in ms (default: 1000)')
+    parser.add_argument('-n', metavar='count', type=int, default=0,
+                        help='stop after this many datagrams (default: run until Ctrl-C)')
+
+    args = parser.parse_args()
+
+    receiver = TelemetryReceiver(args.r, device_port=args.p + iostack.telemetry_port_offset)
+    for ip in args.ip:
+        receiver.subscribe(ip)
+
+    received = 0
+    try:
+        while args.n == 0 or received < args.n:
+            t = receiver.receive()
+            received += 1
+            temperature = "-" if t.temperature is None else "%.2f" % t.temperature
+            print("%-15s seq %8i up %10i ms %7s C current 0x%x width %3i "
+                  "failed %i dropped %i errors %i lost %i" %
+                  (t.ip, t.sequence, t.uptime_ms, temperature, t.led_current,
+                   t.pulse_width, t.failed_sends, t.dropped_packets,
+                   t.request_errors, t.lost))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        receiver.close()
@@ -0,0 +1,189 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+Synchronises the clocks of flasher controllers to this computer's clock and
+optionally fires all of them at the same time.
+
+Each SYNC exchange carries the client's send time (t1); the controller
+returns its receive and reply times (t2, t3), and the next exchange hands it
+the time the reply arrived here (t4). The controller disciplines its clock
+with the four timestamps, so the client keeps no state besides the last t4.
+"""
+
+import argparse
+import collections
+import socket
+import struct
+import sys
+import time
+
+import iostack
+import flasherctl
+
+
+# Subsystem ID for time sync
+SYS_TIMESYNC = 4
+
+
+class TimesyncCommand:
+    """Command codes."""
+    CMD_SYNC = 0
+    CMD_SYNC_STATUS = 1
+
+
+# Must match struct timesync_request, timesync_reply and timesync_status in
+# timesync.h
+timesync_request = struct.Struct("<IQIQ")
+timesync_reply = struct.Struct("<IQQQ")
+timesync_status = struct.Struct("<BiiIHHQ")
+
+Exchange = collections.namedtuple("Exchange", "t1 t2 t3 t4 offset_us delay_us")
+TimesyncStatus = collections.namedtuple("TimesyncStatus",
+                                        "synced offset_us rate_ppb delay_us "
+                                        "samples rejected now_us")
+
+
+def now_us():
+    """Returns the client's time base: microseconds since the epoch."""
+    return int(time.time() * 1e6)
+
+
+class Timesync(iostack.IOStack):
+    def __init__(self, ip, port=iostack.default_port,
+                 timeout=iostack.default_timeout, **kwargs):
+        """Connects to the time sync subsystem of the controller at the given
+        address; see iostack.IOStack for the parameters."""
+        iostack.IOStack.__init__(self, ip, port, timeout, **kwargs)
+        self.sequence = 0
+        self.prev_t4 = 0
+
+    def sync(self):
+        """Runs one exchange; the controller uses it with the next one.
+
+        Returns
+        -------
+        Exchange
+            The timestamps, and the offset of the controller's local clock
+            and the round trip measured from them.
+
+        Raises
+        ------
+        socket.timeout
+            If no reply arrived; the exchange is not used.
+        """
+        self.sequence += 1
+        self.request_id = (self.request_id + 1) & 0xffff
+
+        t1 = now_us()
+        self.cs.send(self._pack(self.request_id, SYS_TIMESYNC, TimesyncCommand.CMD_SYNC,
+                                timesync_request.pack(self.sequence, t1,
+                                                      self.sequence - 1, self.prev_t4)))
+        self.prev_t4 = 0
+
+        while True:
+            response = self._receive()
+            t4 = now_us()
+            if response.id == self.request_id:
+                break
+
+        iostack.check_response(response, SYS_TIMESYNC)
+        if response.response_code != TimesyncCommand.CMD_SYNC:
+            raise iostack.ResponseError("unknown response code %i" % response.response_code)
+
+        sequence, _, t2, t3 = timesync_reply.unpack(response.payload)
+        if sequence != self.sequence:
+            raise iostack.ResponseError("reply to exchange %i" % sequence)
+
+        self.prev_t4 = t4
+        return Exchange(t1, t2, t3, t4,
+                        ((t2 - t1) + (t3 - t4)) / 2.0, (t4 - t1) - (t3 - t2))
+
+    def status(self, max_retries=None):
+        """Reads the state of the controller's clock.
+
+        Returns
+        -------
+        TimesyncStatus
+            offset_us is the error of the clock found by the last accepted
+            exchange, rate_ppb the frequency correction of the local clock,
+            now_us the controller's time when it replied.
+        """
+        response = self.request(SYS_TIMESYNC, TimesyncCommand.CMD_SYNC_STATUS, b'',
+                                max_retries=max_retries)
+        iostack.check_response(response, SYS_TIMESYNC)
+        return TimesyncStatus(*timesync_status.unpack(response.payload))
+
+
+if __name__ == '__main__':
+    # Parse command-line arguments
+    parser = argparse.ArgumentParser(
+        description='synchronise flasher controllers to this computer and fire them together')
+    parser.add_argument('ip', type=str, nargs='+', help="IP addresses")
+    parser.add_argument('-p', metavar='port', type=int,
+                        default=iostack.default_port,
+                        help='port (default: %i)' % iostack.default_port)
+    parser.add_argument('-n', metavar='exchanges', type=int, default=32,
+                        help='exchanges per device (default: 32)')
+    parser.add_argument('-i', metavar='seconds', type=float, default=0.1,
+                        help='time between exchanges (default: 0.1)')
+    parser.add_argument('--fire', metavar='seconds', type=float,
+                        help='fire every device this long after syncing')
+
+    args = parser.parse_args()
+
+    clocks = [Timesync(ip, args.p) for ip in args.ip]
+
+    # Interleave the devices so that all of them see the same conditions
+    for n in range(args.n + 1):
+        for clock in clocks:
+            try:
+                clock.sync()
+            except (socket.timeout, iostack.Error):
+                pass
+        time.sleep(args.i)
+
+    print("%-16s %6s %10s %10s %9s %8s" % ("device", "synced", "offset us",
+                                           "drift ppm", "delay us", "samples"))
+    for clock, ip in zip(clocks, args.ip):
+        try:
+            t0 = now_us()
+            status = clock.status()
+            skew = status.now_us - (t0 + now_us()) / 2
+        except (socket.timeout, iostack.Error) as e:
+            print("%-16s %s" % (ip, e.__class__.__name__))
+            continue
+        print("%-16s %6s %10i %10.3f %9i %5i/%i   now %+.0f us" %
+              (ip, "yes" if status.synced else "no", status.offset_us,
+               status.rate_ppb / 1000.0, status.delay_us, status.samples,
+               status.samples + status.rejected, skew))
+
+    if args.fire is None:
+        sys.exit(0)
+
+    target_us = now_us() + int(args.fire * 1e6)
+    flashers = [flasherctl.FlasherCtl(ip, args.p) for ip in args.ip]
+    for flasher, ip in zip(flashers, args.ip):
+        try:
+            flasher._FIRE_AT(target_us)
+        except (socket.timeout, iostack.Error) as e:
+            print("%s: %s" % (ip, e))
+
+    time.sleep(max(0, (target_us - now_us()) * 1e-6) + 0.1)
+
+    print("")
+    fired = []
+    for flasher, ip in zip(flashers, args.ip):
+        try:
+            status = flasher._FIRE_STATUS()
+        except (socket.timeout, iostack.Error) as e:
+            print("%-16s %s" % (ip, e.__class__.__name__))
+            continue
+        if status.state != flasherctl.FireState.FIRED or status.target_us != target_us:
+            print("%-16s not fired (state %i)" % (ip, status.state))
+            continue
+        fired.append(status.fired_us)
+        print("%-16s fired at %+i us" % (ip, status.fired_us - target_us))
+
+    if len(fired) > 1:
+        print("spread %i us over %i devices" % (max(fired) - min(fired), len(fired)))
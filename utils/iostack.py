@@ -11,9 +11,15 @@ import random
 import socket
 import struct
 import sys
+import time
 
 
 default_port = 512
+
+# Channels on the ports following the device's listen port (see enum
+# iostack_channel). Any request is served on any channel, at its priority.
+telemetry_port_offset = 1
+bulk_port_offset = 2
 default_timeout = 0.2
 default_retries = 3
 default_verbosity = 0
@@ -26,12 +32,33 @@ class Command(object):
     CMD_READ_REG = 0
     CMD_WRITE_REG = 1
     CMD_PING = 2
+    CMD_BATCH = 3
+    CMD_RESET_STATS = 4
+    CMD_GROUP = 5
     CMD_REPORT_ERR = 255
 
 
 class Register(object):
     """I/O stack registers."""
     REG_ETHERNET_CFG = 0
+    REG_FAILED_SENDS = 1
+    REG_DROPPED_PACKETS = 2
+    REG_REQUEST_ERRORS = 3
+    REG_LOG_DROPPED = 4
+    REG_CMD_STATS = 5
+    REG_GROUPS = 6
+
+
+class GroupReply(object):
+    """Members that reply to CMD_GROUP."""
+    NONE = 0
+    ERRORS = 1  # Only those where a request failed
+    ALL = 2
+
+
+# Group IDs: 0 marks an unused slot, every device is a member of GROUP_ALL
+max_groups = 4
+GROUP_ALL = 255
 
 
 class Status(object):
@@ -43,6 +70,7 @@ class Status(object):
     ERR_INVALID_REGISTER = 4
     ERR_INVALID_MAC = 5
     ERR_UNHANDLED_ERROR = 6
+    ERR_BATCH_FULL = 7
 
 
 # Generate lookup maps
@@ -78,6 +106,47 @@ Response = collections.namedtuple("Response",
 SubsystemResponse = collections.namedtuple("SubsystemResponse",
                                            "response_code payload")
 
+BatchResponse = collections.namedtuple("BatchResponse",
+                                       "status subsystem_id response_code "
+                                       "payload")
+
+CommandStats = collections.namedtuple("CommandStats",
+                                      "subsystem_id request_code count errors "
+                                      "handler_us latency")
+
+header = struct.Struct("<HBH")
+error_code = struct.Struct("<H")
+
+group_request_header = struct.Struct("<BB")
+batch_request_header = struct.Struct("<BHB")
+batch_response_header = struct.Struct("<BHHB")
+
+# Must match struct iostack_stats_header and struct iostack_cmd_stats in
+# iostack.h; latency bucket k counts responses sent after [2^k, 2^(k+1)) us
+stats_header = struct.Struct("<IIIIBB")
+stats_buckets = 12
+stats_entry = struct.Struct("<BHIII%iH" % stats_buckets)
+
+
+def check_response(response, subsystem_id):
+    """Raises the I/O stack error reported by a response, if any."""
+    if response.subsystem_id == 0:
+        if response.response_code not in Command.lookup:
+            raise ResponseError("invalid response code %i" % response.response_code)
+
+        if response.response_code == Command.CMD_REPORT_ERR:
+            if len(response.payload) != 2:
+                raise ResponseError("invalid error size %i" % len(response.payload))
+
+            code, = error_code.unpack(response.payload)
+            if code not in Status.lookup:
+                raise ResponseError("invalid error code %i" % code)
+
+            raise RequestError(Status.lookup[code])
+
+    if response.subsystem_id != subsystem_id:
+        raise ResponseError("invalid subsystem id %i" % response.subsystem_id)
+
 
 class IOStack(object):
     def __init__(self, ip, port=default_port, timeout=default_timeout,
@@ -107,6 +176,10 @@ class IOStack(object):
         self.max_packet_size = max_packet_size
         self.request_id = random.randint(0, 65535)
         self.max_retries = max_retries
+        self.timeout = timeout
+
+        # Replies are received into this buffer, see _receive()
+        self.buffer = bytearray(max_packet_size)
 
         # Connect
         self.cs = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
@@ -159,8 +232,7 @@ class IOStack(object):
         """
         # Pack and transmit request
         self.request_id = (self.request_id + 1) % 65536
-        request = struct.pack("<HBH", self.request_id, subsystem_id,
-                              request_code) + payload
+        request = self._pack(self.request_id, subsystem_id, request_code, payload)
 
         self.cs.send(request)
 
@@ -168,7 +240,7 @@ class IOStack(object):
         trials_left = self.max_retries if max_retries is None else int(max_retries)
         while True:
             try:
-                reply = self.cs.recv(self.max_packet_size)
+                response = self._receive()
             except socket.timeout:
                 if trials_left > 0:  # Retry
                     trials_left -= 1
@@ -177,41 +249,126 @@ class IOStack(object):
 
                 raise TimeoutError()
 
-            if len(reply) < 5:
-                raise ResponseError("response too short")
-
-            header, payload = reply[:5], reply[5:]
-            response = Response(*struct.unpack("<HBH", header),
-                                payload=payload)
-
             if response.id != self.request_id:
                 if self.verbosity:
                     print >> sys.stderr, "skipping packet %s" % str(response)
 
                 continue
 
-            # Perform sanity checks
-            if response.subsystem_id == 0:
-                if response.response_code not in Command.lookup:
-                    raise ResponseError("invalid response code %i" % response.response_code)
+            check_response(response, subsystem_id)
 
-                if response.response_code == Command.CMD_REPORT_ERR:
-                    if len(response.payload) != 2:
-                        raise ResponseError("invalid error size %i" % len(response.payload))
+            yield response
 
-                    error_code, = struct.unpack("<H", response.payload)
-                    if error_code not in Status.lookup:
-                        raise ResponseError("invalid error code %i" % error_code)
+            if not broadcast:
+                break
 
-                    raise RequestError(Status.lookup[error_code])
+    def _pack(self, request_id, subsystem_id, request_code, payload):
+        request = bytearray(header.size + len(payload))
+        header.pack_into(request, 0, request_id, subsystem_id, request_code)
+        request[header.size:] = payload
+        return request
 
-            if response.subsystem_id != subsystem_id:
-                raise ResponseError("invalid subsystem id %i" % response.subsystem_id)
+    def _receive(self):
+        # Raises socket.timeout
+        size = self.cs.recv_into(self.buffer)
+        if size < header.size:
+            raise ResponseError("response too short")
 
-            yield response
+        return Response(*header.unpack_from(self.buffer),
+                        payload=bytes(self.buffer[header.size:size]))
 
-            if not broadcast:
-                break
+    def pipeline(self, requests, window=8, max_retries=None):
+        """Sends requests with up to window of them in flight at once.
+
+        Replies are matched to requests by their IDs, so the device may
+        answer in any order; each request is repeated on its own after the
+        timeout. The device serves requests in the order they arrive, so
+        requests that depend on each other must not share a window.
+
+        Parameters
+        ----------
+        requests : iterable of (int, int, bytearray or str)
+            (subsystem_id, request_code, payload) of each request.
+        window : int, optional
+            Maximum number of requests awaiting replies (default: 8). The
+            device's receive buffer holds 2 KB, so a window of full-size
+            requests beyond 8 gets dropped.
+        max_retries : int, optional
+            Maximum number of retries after a timeout (None: use default
+            value).
+
+        Returns
+        -------
+        list of Response or Error
+            The response to each request, in order; requests that timed out
+            or were answered with an error have the exception in their place.
+        """
+        retries = self.max_retries if max_retries is None else int(max_retries)
+        requests = iter(requests)
+        results = []
+        in_flight = {}  # request_id: [index, subsystem_id, request, deadline, retries left]
+
+        try:
+            while True:
+                # Fill the window
+                while len(in_flight) < window:
+                    try:
+                        subsystem_id, request_code, payload = next(requests)
+                    except StopIteration:
+                        break
+
+                    self.request_id = (self.request_id + 1) % 65536
+                    while self.request_id in in_flight:
+                        self.request_id = (self.request_id + 1) % 65536
+
+                    request = self._pack(self.request_id, subsystem_id,
+                                         request_code, payload)
+                    self.cs.send(request)
+                    in_flight[self.request_id] = [len(results), subsystem_id, request,
+                                                  time.time() + self.timeout, retries]
+                    results.append(None)
+
+                if not in_flight:
+                    break
+
+                # Wait for a reply until the earliest deadline
+                wait = min(slot[3] for slot in in_flight.values()) - time.time()
+                try:
+                    if wait <= 0:
+                        raise socket.timeout()
+                    self.cs.settimeout(wait)
+                    response = self._receive()
+                except socket.timeout:
+                    now = time.time()
+                    for request_id, slot in list(in_flight.items()):
+                        if slot[3] > now:
+                            continue
+                        if slot[4] > 0:  # Retry
+                            slot[4] -= 1
+                            slot[3] = now + self.timeout
+                            self.cs.send(slot[2])
+                        else:
+                            results[slot[0]] = TimeoutError()
+                            del in_flight[request_id]
+                    continue
+                except ResponseError:
+                    continue
+
+                slot = in_flight.pop(response.id, None)
+                if slot is None:
+                    if self.verbosity:
+                        print >> sys.stderr, "skipping packet %s" % str(response)
+                    continue
+
+                try:
+                    check_response(response, slot[1])
+                    results[slot[0]] = response
+                except Error as e:
+                    results[slot[0]] = e
+        finally:
+            self.cs.settimeout(self.timeout)
+
+        return results
 
     def request(self, subsystem_id, request_code, payload, max_retries=None):
         """Send a request and return the response.
@@ -255,7 +412,7 @@ class IOStack(object):
         SubsystemResponse
             Response with payload decoded according to the type_code parameter.
         """
-        payload = struct.pack("<H", register)
+        payload = struct.pack(">H", register)  # Big-endian on the device
 
         for response in self.multi_request(SYS_IOSTACK, Command.CMD_READ_REG,
                                            payload, broadcast=True,
@@ -282,7 +439,7 @@ class IOStack(object):
         SubsystemResponse
             Response with payload decoded according to the type_code parameter.
         """
-        payload = struct.pack("<H", register)
+        payload = struct.pack(">H", register)  # Big-endian on the device
 
         response = self.request(SYS_IOSTACK, Command.CMD_READ_REG, payload,
                                 max_retries=max_retries)
@@ -308,7 +465,7 @@ class IOStack(object):
             Maximum number of retries after a timeout (None: use default
             value).
         """
-        payload = struct.pack("<H", register)
+        payload = struct.pack(">H", register)  # Big-endian on the device
         if type_code:  # pack value according to type code
             payload += struct.pack(type_code, *value)
         else:  # transparently pass value
@@ -319,6 +476,96 @@ class IOStack(object):
 
         return response.response_code
 
+    def failed_sends(self, max_retries=None):
+        """Returns the number of responses the device failed to transmit.
+
+        Failed responses reach the client as timeouts; the count includes
+        W5500 transmit timeouts, e.g. after unanswered ARP requests.
+        """
+        return self.read_register(Register.REG_FAILED_SENDS, "<I",
+                                  max_retries=max_retries).payload[0]
+
+    def dropped_packets(self, max_retries=None):
+        """Returns the number of received datagrams the device discarded.
+
+        These are empty or oversized datagrams and corrupt receive buffer
+        contents; the requests in them were never executed.
+        """
+        return self.read_register(Register.REG_DROPPED_PACKETS, "<I",
+                                  max_retries=max_retries).payload[0]
+
+    def request_errors(self, max_retries=None):
+        """Returns the number of requests the device rejected.
+
+        These are requests that were too short to hold a header or that
+        were answered with an I/O stack error.
+        """
+        return self.read_register(Register.REG_REQUEST_ERRORS, "<I",
+                                  max_retries=max_retries).payload[0]
+
+    def log_dropped(self, max_retries=None):
+        """Returns the number of log records the device discarded.
+
+        Records are dropped when the device's log buffer is full because its
+        USB serial port is not being read; requests are never delayed.
+        """
+        return self.read_register(Register.REG_LOG_DROPPED, "<I",
+                                  max_retries=max_retries).payload[0]
+
+    def command_stats(self, max_retries=None):
+        """Reads the device's per-command request statistics.
+
+        Parameters
+        ----------
+        max_retries : int, optional
+            Maximum number of retries after a timeout (None: use default
+            value).
+
+        Returns
+        -------
+        (float, list of CommandStats)
+            Seconds since the statistics were last reset, and one entry per
+            (subsystem, command) dispatched since then; requests with an
+            unknown subsystem or command, or an invalid size, are only
+            counted as rejected. handler_us is the total
+            time spent in the handler; latency is the histogram of the time
+            from receiving a request to sending its response, see
+            stats_entry. Requests are counted in errors if they were answered
+            with an error report or not at all.
+        """
+        entries = []
+        page = 0
+        while True:
+            payload = struct.pack(">HB", Register.REG_CMD_STATS, page)
+            response = self.request(SYS_IOSTACK, Command.CMD_READ_REG, payload,
+                                    max_retries=max_retries)
+            if len(response.payload) < stats_header.size:
+                raise ResponseError("truncated statistics")
+
+            uptime_ms, reset_ms, untracked, rejected, nentries, first = \
+                stats_header.unpack_from(response.payload)
+            count = (len(response.payload) - stats_header.size) // stats_entry.size
+            for i in xrange(count):
+                fields = stats_entry.unpack_from(response.payload,
+                                                 stats_header.size + i * stats_entry.size)
+                entries.append(CommandStats(*fields[:5], latency=fields[5:]))
+
+            if count == 0 or first + count >= nentries:
+                break
+            page += 1
+
+        if untracked and self.verbosity:
+            print >> sys.stderr, "%i requests not tracked" % untracked
+        if rejected and self.verbosity:
+            print >> sys.stderr, "%i requests rejected before dispatch" % rejected
+
+        return ((uptime_ms - reset_ms) % 2**32 / 1000.0, entries)
+
+    def reset_stats(self, max_retries=None):
+        """Clears the device's per-command request statistics."""
+        self.request(SYS_IOSTACK, Command.CMD_RESET_STATS, b'',
+                     max_retries=max_retries)
+
     def ping(self, payload=None):
         """Probes the connection to the device by sending a random payload."""
         header_size = 5
@@ -331,3 +578,74 @@ class IOStack(object):
         response = self.request(SYS_IOSTACK, Command.CMD_PING, payload, max_retries=0)
         if response.payload != payload:
             raise ResponseError("payload mismatch")
+
+    def batch(self, requests, max_retries=None):
+        """Executes several requests in order with a single round trip.
+
+        Parameters
+        ----------
+        requests : list of (int, int, bytearray or str)
+            (subsystem_id, request_code, payload) of each request.
+        max_retries : int, optional
+            Maximum number of retries after a timeout (None: use default
+            value).
+
+        Returns
+        -------
+        list of BatchResponse
+            One response per executed request, in order. status is the I/O
+            stack error code of the request (see Status); the response code
+            and payload are those the request would have been answered with
+            on its own. Requests whose response no longer fit into the reply
+            were not executed and are missing from the list.
+        """
+        response = self.request(SYS_IOSTACK, Command.CMD_BATCH, pack_batch(requests),
+                                max_retries=max_retries)
+
+        return unpack_batch(response.payload)
+
+    def groups(self, max_retries=None):
+        """Returns the IDs of the groups the device is a member of."""
+        groups = self.read_register(Register.REG_GROUPS, "%iB" % max_groups,
+                                    max_retries=max_retries).payload
+        return [group for group in groups if group != 0]
+
+    def set_groups(self, groups, max_retries=None):
+        """Sets the groups the device is a member of (at most 4 IDs from 1 to
+        254); the device keeps them in its EEPROM."""
+        groups = list(groups) + [0] * (max_groups - len(groups))
+        self.write_register(Register.REG_GROUPS, groups, "%iB" % max_groups,
+                            max_retries=max_retries)
+
+
+def pack_batch(requests):
+    """Packs (subsystem_id, request_code, payload) requests for CMD_BATCH or
+    CMD_GROUP."""
+    payload = b''
+    for subsystem_id, request_code, request_payload in requests:
+        payload += batch_request_header.pack(subsystem_id, request_code,
+                                             len(request_payload))
+        payload += request_payload
+    return payload
+
+
+def unpack_batch(payload):
+    """Returns the BatchResponse records of a CMD_BATCH or CMD_GROUP reply."""
+    responses = []
+    offset = 0
+    while offset < len(payload):
+        if offset + batch_response_header.size > len(payload):
+            raise ResponseError("truncated batch record")
+
+        subsystem_id, response_code, status, size = \
+            batch_response_header.unpack_from(payload, offset)
+        offset += batch_response_header.size
+
+        if offset + size > len(payload):
+            raise ResponseError("truncated batch record")
+
+        responses.append(BatchResponse(status, subsystem_id, response_code,
+                                       payload[offset:offset + size]))
+        offset += size
+
+    return responses